@@ -9,6 +9,9 @@
  * Monitor: ps aux | grep process_states (in another terminal)
  */
 
+#define _GNU_SOURCE
+
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
@@ -17,6 +20,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 /* Helper: Print process state */
@@ -263,61 +267,517 @@ void example_state_transitions() {
   }
 }
 
-/* Example 7: Count processes in each state */
+/*
+ * State census engine
+ *
+ * Counts every task (thread) on the system by state in a single pass over
+ * /proc. /proc itself lists only thread-group leaders, so a worker thread
+ * stuck in D or spinning in R would be missed: each process's task/
+ * directory is walked instead. It is meant to be sampled often (every
+ * 100 ms is fine), so each sample:
+ *   - reuses one open handle on /proc (rewinddir instead of opendir)
+ *   - opens "<pid>/task" and then "<tid>/stat" relative to it with openat()
+ *   - reads only the first bytes of the file, up to the state field
+ */
+
+/*
+ * "pid (comm) S" - pid is at most 7 digits, and the kernel formats comm in
+ * a 64-byte buffer (workqueue workers show more than TASK_COMM_LEN, e.g.
+ * "kworker/u8:2-events_unbound"): 7 + 2 + 63 + 3 bytes always reach S
+ */
+#define CENSUS_STAT_PREFIX 128
+
+typedef struct {
+  int running;      /* R */
+  int sleeping;     /* S */
+  int disk_sleep;   /* D */
+  int zombie;       /* Z */
+  int stopped;      /* T */
+  int tracing_stop; /* t */
+  int idle;         /* I (idle kernel threads) */
+  int other;        /* X, P, W, ... */
+  int total;        /* Threads */
+  int processes;
+} state_census_t;
+
+typedef struct {
+  DIR *proc_dir;
+} census_ctx_t;
+
+int census_open(census_ctx_t *ctx) {
+  ctx->proc_dir = opendir("/proc");
+  if (!ctx->proc_dir) {
+    perror("opendir /proc");
+    return -1;
+  }
+  return 0;
+}
+
+void census_close(census_ctx_t *ctx) {
+  if (ctx->proc_dir)
+    closedir(ctx->proc_dir);
+  ctx->proc_dir = NULL;
+}
+
+/*
+ * Read just the state character from a stat file, relative to dir_fd.
+ * Optionally copies the comm (without parentheses). Returns 0 if the task
+ * vanished.
+ */
+static char read_stat_state(int dir_fd, const char *stat_path, char *comm,
+                            size_t comm_len) {
+  char buf[CENSUS_STAT_PREFIX];
+
+  int fd = openat(dir_fd, stat_path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return 0;
+
+  ssize_t n = read(fd, buf, sizeof(buf));
+  close(fd);
+  if (n <= 0)
+    return 0;
+
+  /* comm may contain spaces or ')', so search for the LAST ')' */
+  char *paren = memrchr(buf, ')', n);
+  if (!paren || paren + 2 >= buf + n)
+    return 0;
+
+  if (comm) {
+    char *open_paren = memchr(buf, '(', paren - buf);
+    size_t len = open_paren ? (size_t)(paren - open_paren - 1) : 0;
+    if (len >= comm_len)
+      len = comm_len - 1;
+    if (open_paren)
+      memcpy(comm, open_paren + 1, len);
+    comm[len] = '\0';
+  }
+  return paren[2];
+}
+
+static char census_read_state(int task_fd, const char *tid_name) {
+  char path[300];
+
+  snprintf(path, sizeof(path), "%s/stat", tid_name);
+  return read_stat_state(task_fd, path, NULL, 0);
+}
+
+static void census_count(state_census_t *c, char state) {
+  switch (state) {
+  case 'R':
+    c->running++;
+    break;
+  case 'S':
+    c->sleeping++;
+    break;
+  case 'D':
+    c->disk_sleep++;
+    break;
+  case 'Z':
+    c->zombie++;
+    break;
+  case 'T':
+    c->stopped++;
+    break;
+  case 't':
+    c->tracing_stop++;
+    break;
+  case 'I':
+    c->idle++;
+    break;
+  default:
+    c->other++;
+  }
+  c->total++;
+}
+
+/* Take one system-wide sample of every thread. Returns 0 on success. */
+int census_sample(census_ctx_t *ctx, state_census_t *c) {
+  memset(c, 0, sizeof(*c));
+  rewinddir(ctx->proc_dir);
+
+  int proc_fd = dirfd(ctx->proc_dir);
+  struct dirent *entry;
+
+  while ((entry = readdir(ctx->proc_dir)) != NULL) {
+    if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+      continue;
+
+    char path[300];
+    snprintf(path, sizeof(path), "%s/task", entry->d_name);
+    int task_fd = openat(proc_fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (task_fd == -1)
+      continue; /* Process exited between readdir() and open() */
+    DIR *task_dir = fdopendir(task_fd);
+    if (!task_dir) {
+      close(task_fd);
+      continue;
+    }
+    c->processes++;
+
+    struct dirent *task;
+    while ((task = readdir(task_dir)) != NULL) {
+      if (task->d_name[0] < '0' || task->d_name[0] > '9')
+        continue;
+      char state = census_read_state(task_fd, task->d_name);
+      if (state) /* Thread exited meanwhile */
+        census_count(c, state);
+    }
+    closedir(task_dir);
+  }
+
+  return 0;
+}
+
+static double elapsed_ms(const struct timespec *from,
+                         const struct timespec *to) {
+  return (to->tv_sec - from->tv_sec) * 1000.0 +
+         (to->tv_nsec - from->tv_nsec) / 1e6;
+}
+
+/* Example 7: Count threads in each state */
 void example_system_state_summary() {
   printf("\n=== Example 7: System-Wide State Summary ===\n");
-  printf("Scanning /proc for all process states...\n\n");
+  printf("Scanning /proc/<pid>/task for every thread's state...\n\n");
 
-  int count_R = 0, count_S = 0, count_D = 0, count_Z = 0, count_T = 0,
-      count_other = 0;
+  census_ctx_t ctx;
+  state_census_t c;
 
-  // Scan /proc for all PIDs
-  for (int pid = 1; pid < 65536; pid++) {
-    char path[256];
-    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  if (census_open(&ctx) != 0)
+    return;
+  census_sample(&ctx, &c);
+  census_close(&ctx);
+
+  printf("Thread State Summary:\n");
+  printf("  Running/Runnable (R): %d\n", c.running);
+  printf("  Sleeping (S):         %d\n", c.sleeping);
+  printf("  Disk Sleep (D):       %d\n", c.disk_sleep);
+  printf("  Zombie (Z):           %d\n", c.zombie);
+  printf("  Stopped (T):          %d\n", c.stopped);
+  printf("  Tracing stop (t):     %d\n", c.tracing_stop);
+  printf("  Idle kthread (I):     %d\n", c.idle);
+  printf("  Other:                %d\n", c.other);
+  printf("  Total threads:        %d (in %d processes)\n", c.total,
+         c.processes);
+
+  if (c.zombie > 0) {
+    printf("\n⚠️  Warning: %d zombie thread(s) detected!\n", c.zombie);
+  }
+}
 
-    FILE *fp = fopen(path, "r");
-    if (fp) {
-      char state;
-      fscanf(fp, "%*d %*s %c", &state);
-      fclose(fp);
+/* Example 8: State census as a time series */
+void example_state_census(int interval_ms, int samples) {
+  printf("\n=== Example 8: State Census Time Series ===\n");
+  printf("Threads per state, sampling every %d ms, %d samples (D spikes "
+         "flagged with '!')\n\n",
+         interval_ms, samples);
 
-      switch (state) {
-      case 'R':
-        count_R++;
-        break;
-      case 'S':
-        count_S++;
-        break;
-      case 'D':
-        count_D++;
-        break;
-      case 'Z':
-        count_Z++;
-        break;
-      case 'T':
-      case 't':
-        count_T++;
+  census_ctx_t ctx;
+  if (census_open(&ctx) != 0)
+    return;
+
+  printf("%9s %5s %5s %5s  %5s %5s %5s %5s %5s %6s %8s\n", "t(ms)", "R", "S",
+         "D", "Z", "T", "t", "I", "other", "total", "scan(ms)");
+
+  struct timespec start, next, before, after;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  next = start;
+
+  int prev_d = -1;
+  for (int i = 0; i < samples; i++) {
+    state_census_t c;
+
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    census_sample(&ctx, &c);
+    clock_gettime(CLOCK_MONOTONIC, &after);
+
+    /* Flag a spike when D at least doubles (and is more than a blip) */
+    int spike = prev_d >= 0 && c.disk_sleep >= 2 && c.disk_sleep >= 2 * prev_d;
+    prev_d = c.disk_sleep;
+
+    printf("%9.1f %5d %5d %5d%s %5d %5d %5d %5d %5d %6d %8.2f\n",
+           elapsed_ms(&start, &before), c.running, c.sleeping, c.disk_sleep,
+           spike ? "!" : " ", c.zombie, c.stopped, c.tracing_stop, c.idle,
+           c.other, c.total, elapsed_ms(&before, &after));
+    fflush(stdout);
+
+    /* Absolute deadlines so scan time does not make the series drift */
+    next.tv_nsec += (long)interval_ms * 1000000L;
+    while (next.tv_nsec >= 1000000000L) {
+      next.tv_nsec -= 1000000000L;
+      next.tv_sec++;
+    }
+    if (i + 1 < samples)
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+  }
+
+  census_close(&ctx);
+}
+
+/*
+ * D-state stall detector
+ *
+ * A task's stat file does not say how long it has been in D, so the
+ * detector samples every task (threads included) and remembers when each
+ * TID was first seen in D. Tasks that stay in D past a threshold are
+ * reported, grouped by wait channel (/proc/<pid>/task/<tid>/wchan), with
+ * the top kernel stack frames when /proc/.../stack is readable (root only).
+ */
+
+#define STALL_TABLE_SIZE 4096 /* power of two, keep load factor <= 0.5 */
+#define STALL_MAX_TRACKED (STALL_TABLE_SIZE / 2)
+#define STALL_MAX_GROUPS 32
+#define STALL_STACK_FRAMES 3
+
+typedef struct {
+  int tid; /* 0 = empty slot */
+  int tgid;
+  char comm[20];
+  struct timespec since; /* first sample that saw the task in D */
+} dstate_entry_t;
+
+typedef struct {
+  dstate_entry_t slots[STALL_TABLE_SIZE];
+  int count;
+} dstate_table_t;
+
+typedef struct {
+  char wchan[64];
+  char stack[192];
+  int tasks;
+  double max_ms;
+  int example_tid;
+  char example_comm[20];
+} stall_group_t;
+
+static dstate_entry_t *dstate_slot(dstate_table_t *t, int tid) {
+  unsigned i = ((unsigned)tid * 2654435761u) & (STALL_TABLE_SIZE - 1);
+  while (t->slots[i].tid != 0 && t->slots[i].tid != tid)
+    i = (i + 1) & (STALL_TABLE_SIZE - 1);
+  return &t->slots[i];
+}
+
+/* Read a small /proc text file relative to dir_fd into buf (NUL-terminated) */
+static ssize_t read_small_file(int dir_fd, const char *path, char *buf,
+                               size_t len) {
+  int fd = openat(dir_fd, path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return -1;
+  ssize_t n = read(fd, buf, len - 1);
+  close(fd);
+  if (n < 0)
+    return -1;
+  buf[n] = '\0';
+  return n;
+}
+
+/*
+ * Condense a kernel stack ("[<0>] io_schedule+0x12/0x40\n...") into
+ * "io_schedule <- folio_wait_bit <- ..." using the first few frames.
+ */
+static void condense_stack(char *raw, char *out, size_t out_len) {
+  size_t used = 0;
+  int frames = 0;
+  char *save = NULL;
+
+  out[0] = '\0';
+  for (char *line = strtok_r(raw, "\n", &save);
+       line && frames < STALL_STACK_FRAMES;
+       line = strtok_r(NULL, "\n", &save)) {
+    char *fn = strchr(line, ']');
+    fn = fn ? fn + 2 : line;
+    fn[strcspn(fn, "+")] = '\0';
+    int n = snprintf(out + used, out_len - used, "%s%s",
+                     frames ? " <- " : "", fn);
+    if (n < 0 || (size_t)n >= out_len - used)
+      break;
+    used += n;
+    frames++;
+  }
+}
+
+/* Wait channels that point at the block layer or a filesystem */
+static int wchan_is_storage(const char *wchan) {
+  static const char *const hints[] = {"io_schedule", "blk",   "bio",
+                                      "folio_wait",  "wait_on_page",
+                                      "jbd2",        "ext4",  "xfs",
+                                      "btrfs",       "nfs",   "fsync",
+                                      "writeback",   NULL};
+  for (int i = 0; hints[i]; i++) {
+    if (strstr(wchan, hints[i]))
+      return 1;
+  }
+  return 0;
+}
+
+/* Collect and print every task that has been in D for >= threshold_ms */
+static void stall_report(int proc_fd, const dstate_table_t *t,
+                         const struct timespec *now, double since_start_ms,
+                         int threshold_ms) {
+  stall_group_t groups[STALL_MAX_GROUPS];
+  int ngroups = 0, stalled = 0;
+
+  for (int i = 0; i < STALL_TABLE_SIZE; i++) {
+    const dstate_entry_t *e = &t->slots[i];
+    if (e->tid == 0)
+      continue;
+
+    double ms = elapsed_ms(&e->since, now);
+    if (ms < threshold_ms)
+      continue;
+    stalled++;
+
+    char path[64], wchan[64], raw[1024], stack[192] = "";
+    snprintf(path, sizeof(path), "%d/task/%d/wchan", e->tgid, e->tid);
+    if (read_small_file(proc_fd, path, wchan, sizeof(wchan)) <= 0 ||
+        strcmp(wchan, "0") == 0)
+      strcpy(wchan, "?");
+
+    snprintf(path, sizeof(path), "%d/task/%d/stack", e->tgid, e->tid);
+    if (read_small_file(proc_fd, path, raw, sizeof(raw)) > 0)
+      condense_stack(raw, stack, sizeof(stack));
+
+    int g;
+    for (g = 0; g < ngroups; g++) {
+      if (strcmp(groups[g].wchan, wchan) == 0)
         break;
-      default:
-        count_other++;
-      }
     }
+    if (g == ngroups && ngroups == STALL_MAX_GROUPS) {
+      g = ngroups - 1; /* Table full: the "(other)" bucket */
+    } else if (g == ngroups) {
+      /* The last slot is kept for everything that does not fit */
+      memset(&groups[g], 0, sizeof(groups[g]));
+      snprintf(groups[g].wchan, sizeof(groups[g].wchan), "%s",
+               ngroups == STALL_MAX_GROUPS - 1 ? "(other)" : wchan);
+      ngroups++;
+    }
+
+    stall_group_t *grp = &groups[g];
+    grp->tasks++;
+    if (ms > grp->max_ms) {
+      grp->max_ms = ms;
+      grp->example_tid = e->tid;
+      snprintf(grp->example_comm, sizeof(grp->example_comm), "%s", e->comm);
+      if (stack[0])
+        snprintf(grp->stack, sizeof(grp->stack), "%s", stack);
+    }
+  }
+
+  if (stalled == 0)
+    return;
+
+  int storage = 0;
+  for (int g = 0; g < ngroups; g++)
+    storage += wchan_is_storage(groups[g].wchan) ? groups[g].tasks : 0;
+
+  printf("[%9.1f ms] %d task(s) in D >= %d ms, %d wait channel(s)%s\n",
+         since_start_ms, stalled, threshold_ms, ngroups,
+         storage ? " -> STORAGE STALL likely" : "");
+  for (int g = 0; g < ngroups; g++) {
+    printf("  %-24s %4d task(s)  max %7.0f ms  e.g. %d (%s)%s\n",
+           groups[g].wchan, groups[g].tasks, groups[g].max_ms,
+           groups[g].example_tid, groups[g].example_comm,
+           wchan_is_storage(groups[g].wchan) ? " [storage]" : "");
+    if (groups[g].stack[0])
+      printf("  %-24s stack: %s\n", "", groups[g].stack);
+  }
+  fflush(stdout);
+}
+
+/* Take one pass over every task, carrying D-state start times forward */
+static void stall_scan(census_ctx_t *ctx, const dstate_table_t *prev,
+                       dstate_table_t *next, const struct timespec *now) {
+  memset(next, 0, sizeof(*next));
+  rewinddir(ctx->proc_dir);
+
+  int proc_fd = dirfd(ctx->proc_dir);
+  struct dirent *entry;
+
+  while ((entry = readdir(ctx->proc_dir)) != NULL) {
+    if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+      continue;
+
+    char path[300];
+    snprintf(path, sizeof(path), "%s/task", entry->d_name);
+    int task_fd = openat(proc_fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (task_fd == -1)
+      continue;
+    DIR *task_dir = fdopendir(task_fd);
+    if (!task_dir) {
+      close(task_fd);
+      continue;
+    }
+
+    struct dirent *task;
+    while ((task = readdir(task_dir)) != NULL) {
+      if (task->d_name[0] < '0' || task->d_name[0] > '9')
+        continue;
+
+      char comm[20];
+      snprintf(path, sizeof(path), "%s/stat", task->d_name);
+      if (read_stat_state(task_fd, path, comm, sizeof(comm)) != 'D')
+        continue;
+      if (next->count >= STALL_MAX_TRACKED)
+        continue;
+
+      int tid = atoi(task->d_name);
+      const dstate_entry_t *old = dstate_slot((dstate_table_t *)prev, tid);
+      dstate_entry_t *e = dstate_slot(next, tid);
+
+      e->tid = tid;
+      e->tgid = atoi(entry->d_name);
+      memcpy(e->comm, comm, sizeof(e->comm));
+      e->since = old->tid == tid ? old->since : *now;
+      next->count++;
+    }
+    closedir(task_dir);
   }
+}
+
+/* Example 9: D-state stall detector */
+void example_stall_detector(int threshold_ms, int duration_s,
+                            int interval_ms) {
+  printf("\n=== Example 9: D-State Stall Detector ===\n");
+  printf("Reporting tasks in D for >= %d ms (sampling every %d ms for %d s)\n",
+         threshold_ms, interval_ms, duration_s);
+  if (geteuid() != 0)
+    printf("(Not root: kernel stacks unavailable, wchan only)\n");
+  printf("\n");
+
+  census_ctx_t ctx;
+  if (census_open(&ctx) != 0)
+    return;
 
-  printf("Process State Summary:\n");
-  printf("  Running/Runnable (R): %d\n", count_R);
-  printf("  Sleeping (S):         %d\n", count_S);
-  printf("  Disk Sleep (D):       %d\n", count_D);
-  printf("  Zombie (Z):           %d\n", count_Z);
-  printf("  Stopped (T):          %d\n", count_T);
-  printf("  Other:                %d\n", count_other);
-  printf("  Total:                %d\n",
-         count_R + count_S + count_D + count_Z + count_T + count_other);
-
-  if (count_Z > 0) {
-    printf("\n⚠️  Warning: %d zombie process(es) detected!\n", count_Z);
+  /* Two tables, swapped each sample: too big for the stack */
+  dstate_table_t *tables = calloc(2, sizeof(dstate_table_t));
+  if (!tables) {
+    perror("calloc");
+    census_close(&ctx);
+    return;
   }
+
+  struct timespec start, now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  int cur = 0, reports = 0;
+  long samples = (long)duration_s * 1000 / interval_ms;
+  for (long i = 0; i < samples; i++) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    stall_scan(&ctx, &tables[cur], &tables[!cur], &now);
+    cur = !cur;
+
+    if (tables[cur].count > 0) {
+      stall_report(dirfd(ctx.proc_dir), &tables[cur], &now,
+                   elapsed_ms(&start, &now), threshold_ms);
+      reports++;
+    }
+    usleep(interval_ms * 1000);
+  }
+
+  if (reports == 0)
+    printf("No tasks entered D state during the run.\n");
+
+  free(tables);
+  census_close(&ctx);
 }
 
 int main(int argc, char *argv[]) {
@@ -351,8 +811,27 @@ int main(int argc, char *argv[]) {
     case 7:
       example_system_state_summary();
       break;
+    case 8: {
+      int interval_ms = argc > 2 ? atoi(argv[2]) : 100;
+      if (interval_ms <= 0) {
+        printf("interval_ms must be at least 1\n");
+        return 1;
+      }
+      example_state_census(interval_ms, argc > 3 ? atoi(argv[3]) : 50);
+      break;
+    }
+    case 9: {
+      int interval_ms = argc > 4 ? atoi(argv[4]) : 100;
+      if (interval_ms <= 0) {
+        printf("interval_ms must be at least 1\n");
+        return 1;
+      }
+      example_stall_detector(argc > 2 ? atoi(argv[2]) : 500,
+                             argc > 3 ? atoi(argv[3]) : 10, interval_ms);
+      break;
+    }
     default:
-      printf("Usage: %s [1-7]\n", argv[0]);
+      printf("Usage: %s [1-9]\n", argv[0]);
       printf("  1: Running/Runnable state\n");
       printf("  2: Sleeping state\n");
       printf("  3: Zombie state\n");
@@ -360,6 +839,9 @@ int main(int argc, char *argv[]) {
       printf("  5: Disk sleep state\n");
       printf("  6: State transitions\n");
       printf("  7: System-wide summary\n");
+      printf("  8: State census time series [interval_ms] [samples]\n");
+      printf("  9: D-state stall detector [threshold_ms] [seconds] "
+             "[interval_ms]\n");
     }
   } else {
     // Run all examples
@@ -392,11 +874,18 @@ int main(int argc, char *argv[]) {
  * 4. See all states:
  *    ps aux | awk '{print $8}' | sort | uniq -c
  *
+ * 5. Watch state counts every 100 ms for 10 seconds:
+ *    ./process_states 8 100 100
+ *
+ * 6. Report tasks stuck in D for 200 ms or more, for 30 seconds:
+ *    sudo ./process_states 9 200 30 50
+ *    (in another terminal: dd if=/dev/zero of=big bs=1M count=2000 oflag=sync)
+ *
  * EXERCISES:
  *
  * 1. Modify to create multiple zombies simultaneously
  * 2. Add example showing 'I' state (idle kernel thread)
  * 3. Create a process that cycles through all states repeatedly
- * 4. Write a monitor that tracks state changes over time
+ * 4. Extend example 8 to log which PIDs entered D state
  */
 
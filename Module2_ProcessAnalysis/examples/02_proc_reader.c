@@ -8,10 +8,14 @@
  * Run: ./proc_reader [pid]
  */
 
+#define _GNU_SOURCE
+
 #include <dirent.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 typedef struct {
@@ -24,29 +28,46 @@ typedef struct {
   unsigned long stime;
   long priority;
   long nice;
+  long num_threads;
   unsigned long vsize;
   long rss;
 } proc_stat_t;
 
 /* Read /proc/[pid]/stat */
 int read_proc_stat(int pid, proc_stat_t *stat) {
-  char path[256];
+  char path[256], line[1024];
   snprintf(path, sizeof(path), "/proc/%d/stat", pid);
 
   FILE *fp = fopen(path, "r");
   if (!fp)
     return -1;
 
-  int ret =
-      fscanf(fp,
-             "%d %s %c %d %d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d "
-             "%ld %ld %*d %*d %*u %lu %ld",
-             &stat->pid, stat->comm, &stat->state, &stat->ppid, &stat->pgrp,
-             &stat->utime, &stat->stime, &stat->priority, &stat->nice,
-             &stat->vsize, &stat->rss);
-
+  char *ok = fgets(line, sizeof(line), fp);
   fclose(fp);
-  return (ret >= 8) ? 0 : -1;
+  if (!ok)
+    return -1;
+
+  /* comm may contain spaces, so split on the first '(' and LAST ')' */
+  char *open_paren = strchr(line, '(');
+  char *close_paren = strrchr(line, ')');
+  if (!open_paren || !close_paren || close_paren < open_paren)
+    return -1;
+
+  stat->pid = atoi(line);
+  size_t len = close_paren - open_paren + 1;
+  if (len >= sizeof(stat->comm))
+    len = sizeof(stat->comm) - 1;
+  memcpy(stat->comm, open_paren, len);
+  stat->comm[len] = '\0';
+
+  int ret = sscanf(close_paren + 2,
+                   "%c %d %d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d "
+                   "%ld %ld %ld %*d %*u %lu %ld",
+                   &stat->state, &stat->ppid, &stat->pgrp, &stat->utime,
+                   &stat->stime, &stat->priority, &stat->nice,
+                   &stat->num_threads, &stat->vsize, &stat->rss);
+
+  return (ret >= 6) ? 0 : -1;
 }
 
 /* Read memory info from /proc/[pid]/status */
@@ -241,38 +262,571 @@ void find_zombies() {
   closedir(dir);
 }
 
-/* Process tree (simplified) */
-void print_process_tree(int pid, int level) {
-  proc_stat_t stat;
-  if (read_proc_stat(pid, &stat) != 0)
-    return;
+/*
+ * Process tree with resource rollup
+ *
+ * One scan of /proc builds an index of every process. Children are linked
+ * into sibling lists, and a single bottom-up pass over a parents-first
+ * ordering adds each node's totals into its parent, so every node ends up
+ * with the CPU, RSS, thread and fd totals of its whole subtree (much like
+ * a cgroup would account them).
+ */
 
-  // Print indentation
-  for (int i = 0; i < level; i++)
-    printf("  ");
+typedef struct {
+  unsigned long cpu_ticks; /* utime + stime */
+  long rss_pages;
+  long threads;
+  long fds;
+  long procs;
+} proc_usage_t;
 
-  printf("├─ [%d] %s (state: %c)\n", stat.pid, stat.comm, stat.state);
+typedef struct {
+  int pid;
+  int ppid;
+  char state;
+  char comm[64];
+  proc_usage_t self;
+  proc_usage_t total; /* self + all descendants */
+  int parent;         /* index, -1 for roots */
+  int first_child;    /* index, -1 if none */
+  int next_sibling;   /* index, -1 if none */
+} proc_node_t;
 
-  // Find children (scan all processes for this ppid)
-  DIR *dir = opendir("/proc");
+typedef struct {
+  proc_node_t *nodes;
+  int count;
+  int *slots; /* open-addressing pid -> node index */
+  int nslots; /* power of two */
+} proc_index_t;
+
+/* Count entries in /proc/[pid]/fd (0 if not permitted) */
+static long count_open_fds(int pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/fd", pid);
+
+  DIR *dir = opendir(path);
   if (!dir)
-    return;
+    return 0;
+
+  long count = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] != '.')
+      count++;
+  }
+  closedir(dir);
+  return count;
+}
+
+static int index_lookup(const proc_index_t *idx, int pid) {
+  unsigned i = ((unsigned)pid * 2654435761u) & (idx->nslots - 1);
+  while (idx->slots[i] != -1) {
+    if (idx->nodes[idx->slots[i]].pid == pid)
+      return idx->slots[i];
+    i = (i + 1) & (idx->nslots - 1);
+  }
+  return -1;
+}
+
+static void index_insert(proc_index_t *idx, int node) {
+  unsigned i = ((unsigned)idx->nodes[node].pid * 2654435761u) &
+               (idx->nslots - 1);
+  while (idx->slots[i] != -1)
+    i = (i + 1) & (idx->nslots - 1);
+  idx->slots[i] = node;
+}
+
+static void usage_add(proc_usage_t *into, const proc_usage_t *from) {
+  into->cpu_ticks += from->cpu_ticks;
+  into->rss_pages += from->rss_pages;
+  into->threads += from->threads;
+  into->fds += from->fds;
+  into->procs += from->procs;
+}
+
+void free_proc_index(proc_index_t *idx) {
+  free(idx->nodes);
+  free(idx->slots);
+  memset(idx, 0, sizeof(*idx));
+}
+
+/* Scan /proc once and build the linked, rolled-up process index */
+int build_proc_index(proc_index_t *idx) {
+  memset(idx, 0, sizeof(*idx));
+
+  DIR *dir = opendir("/proc");
+  if (!dir) {
+    perror("opendir /proc");
+    return -1;
+  }
+
+  int capacity = 1024;
+  idx->nodes = malloc(capacity * sizeof(proc_node_t));
+  if (!idx->nodes) {
+    closedir(dir);
+    return -1;
+  }
 
   struct dirent *entry;
   while ((entry = readdir(dir)) != NULL) {
     if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
       continue;
 
-    int child_pid = atoi(entry->d_name);
-    proc_stat_t child_stat;
+    proc_stat_t stat;
+    if (read_proc_stat(atoi(entry->d_name), &stat) != 0)
+      continue;
+
+    if (idx->count == capacity) {
+      capacity *= 2;
+      proc_node_t *grown = realloc(idx->nodes, capacity * sizeof(proc_node_t));
+      if (!grown) {
+        closedir(dir);
+        free_proc_index(idx);
+        return -1;
+      }
+      idx->nodes = grown;
+    }
+
+    proc_node_t *n = &idx->nodes[idx->count++];
+    memset(n, 0, sizeof(*n));
+    n->pid = stat.pid;
+    n->ppid = stat.ppid;
+    n->state = stat.state;
+    snprintf(n->comm, sizeof(n->comm), "%.63s", stat.comm);
+    n->self.cpu_ticks = stat.utime + stat.stime;
+    n->self.rss_pages = stat.rss;
+    n->self.threads = stat.num_threads;
+    n->self.fds = count_open_fds(stat.pid);
+    n->self.procs = 1;
+  }
+  closedir(dir);
 
-    if (read_proc_stat(child_pid, &child_stat) == 0 &&
-        child_stat.ppid == pid) {
-      print_process_tree(child_pid, level + 1);
+  /* Hash pids so parent lookup is O(1) instead of rescanning /proc */
+  idx->nslots = 1;
+  while (idx->nslots < idx->count * 2)
+    idx->nslots <<= 1;
+  idx->slots = malloc(idx->nslots * sizeof(int));
+  if (!idx->slots) {
+    free_proc_index(idx);
+    return -1;
+  }
+  memset(idx->slots, -1, idx->nslots * sizeof(int));
+  for (int i = 0; i < idx->count; i++)
+    index_insert(idx, i);
+
+  for (int i = 0; i < idx->count; i++)
+    idx->nodes[i].first_child = idx->nodes[i].next_sibling = -1;
+
+  for (int i = 0; i < idx->count; i++) {
+    proc_node_t *n = &idx->nodes[i];
+    n->parent = n->ppid != n->pid ? index_lookup(idx, n->ppid) : -1;
+    if (n->parent != -1) {
+      n->next_sibling = idx->nodes[n->parent].first_child;
+      idx->nodes[n->parent].first_child = i;
     }
   }
 
-  closedir(dir);
+  /*
+   * Breadth-first order puts every parent before its children, so walking
+   * it backwards visits children first: one post-order accumulation pass.
+   */
+  int *order = malloc(idx->count * sizeof(int));
+  if (!order) {
+    free_proc_index(idx);
+    return -1;
+  }
+  int head = 0, tail = 0;
+  for (int i = 0; i < idx->count; i++) {
+    if (idx->nodes[i].parent == -1)
+      order[tail++] = i;
+  }
+  while (head < tail) {
+    for (int c = idx->nodes[order[head++]].first_child; c != -1;
+         c = idx->nodes[c].next_sibling)
+      order[tail++] = c;
+  }
+
+  for (int i = tail - 1; i >= 0; i--) {
+    proc_node_t *n = &idx->nodes[order[i]];
+    usage_add(&n->total, &n->self);
+    if (n->parent != -1)
+      usage_add(&idx->nodes[n->parent].total, &n->total);
+  }
+
+  free(order);
+  return 0;
+}
+
+static void print_tree_node(const proc_index_t *idx, int node, int level,
+                            int max_depth) {
+  const proc_node_t *n = &idx->nodes[node];
+  static long page_kb = 0;
+  static long clk_tck = 0;
+  if (!page_kb) {
+    page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    clk_tck = sysconf(_SC_CLK_TCK);
+  }
+
+  printf("%6ld %7ld %6ld %10ld %9.2f  ", n->total.procs, n->total.threads,
+         n->total.fds, n->total.rss_pages * page_kb / 1024,
+         (double)n->total.cpu_ticks / clk_tck);
+  for (int i = 0; i < level; i++)
+    printf("  ");
+  printf("├─ [%d] %s (state: %c)\n", n->pid, n->comm, n->state);
+
+  if (level >= max_depth)
+    return;
+
+  /* Children, heaviest CPU subtree first */
+  int nchildren = 0;
+  for (int c = n->first_child; c != -1; c = idx->nodes[c].next_sibling)
+    nchildren++;
+  if (nchildren == 0)
+    return;
+
+  int *children = malloc(nchildren * sizeof(int));
+  if (!children)
+    return;
+  int k = 0;
+  for (int c = n->first_child; c != -1; c = idx->nodes[c].next_sibling)
+    children[k++] = c;
+  for (int i = 1; i < nchildren; i++) {
+    int c = children[i], j = i;
+    while (j > 0 && idx->nodes[children[j - 1]].total.cpu_ticks <
+                        idx->nodes[c].total.cpu_ticks) {
+      children[j] = children[j - 1];
+      j--;
+    }
+    children[j] = c;
+  }
+
+  for (int i = 0; i < nchildren; i++)
+    print_tree_node(idx, children[i], level + 1, max_depth);
+  free(children);
+}
+
+/* Process tree with subtree totals */
+void print_process_tree(int pid, int max_depth) {
+  proc_index_t idx;
+  if (build_proc_index(&idx) != 0)
+    return;
+
+  int node = index_lookup(&idx, pid);
+  if (node == -1) {
+    printf("Error: Cannot read process %d\n", pid);
+    free_proc_index(&idx);
+    return;
+  }
+
+  printf("Subtree totals (scanned %d processes):\n", idx.count);
+  printf("%6s %7s %6s %10s %9s  %s\n", "PROCS", "THREADS", "FDS", "RSS(MB)",
+         "CPU(s)", "TREE");
+  print_tree_node(&idx, node, 0, max_depth);
+  free_proc_index(&idx);
+}
+
+/*
+ * Pressure stall (PSI) and cgroup v2 collector
+ *
+ * Per-process views cannot tell host-wide contention from a slow process.
+ * /proc/pressure/{cpu,memory,io} can: "some" is the share of wall time in
+ * which at least one task was stalled on the resource, "full" the share in
+ * which all non-idle tasks were. The kernel's avg10 is too smooth for
+ * sub-second sampling, so stall percentages are computed from the delta of
+ * the cumulative total= counters (microseconds) between samples.
+ *
+ * Samples go into a fixed-size ring; when a threshold is crossed the ring
+ * is dumped, showing the lead-up to the event as well as the event itself.
+ */
+
+#define PSI_RING_SIZE 128
+
+enum { PSI_CPU, PSI_MEMORY, PSI_IO, PSI_NRES };
+
+static const char *const psi_names[PSI_NRES] = {"cpu", "memory", "io"};
+
+typedef struct {
+  unsigned long long some_total; /* usec */
+  unsigned long long full_total; /* usec */
+} psi_counters_t;
+
+typedef struct {
+  unsigned long long usage_usec;
+  unsigned long long throttled_usec;
+  unsigned long long memory_bytes;
+  unsigned long long read_bytes;
+  unsigned long long write_bytes;
+} cgroup_counters_t;
+
+typedef struct {
+  double t_ms;
+  double some_pct[PSI_NRES];
+  double full_pct[PSI_NRES];
+  double cg_cpu_pct;       /* cgroup CPU usage, % of one CPU */
+  double cg_throttled_pct; /* % of interval throttled */
+  unsigned long long cg_memory_bytes;
+  double cg_read_mbps;
+  double cg_write_mbps;
+} pressure_sample_t;
+
+typedef struct {
+  pressure_sample_t samples[PSI_RING_SIZE];
+  int head; /* next slot to write */
+  int count;
+} pressure_ring_t;
+
+typedef struct {
+  int psi_fd[PSI_NRES]; /* -1 if PSI is unavailable */
+  int cpu_stat_fd;      /* cgroup v2 files, -1 if unavailable */
+  int memory_current_fd;
+  int io_stat_fd;
+  char cgroup_dir[512];
+} pressure_src_t;
+
+/* Re-read a seq_file from the start through an fd kept open */
+static ssize_t pread_text(int fd, char *buf, size_t len) {
+  if (fd == -1)
+    return -1;
+  ssize_t n = pread(fd, buf, len - 1, 0);
+  if (n < 0)
+    return -1;
+  buf[n] = '\0';
+  return n;
+}
+
+static void read_psi(int fd, psi_counters_t *c) {
+  char buf[256];
+  memset(c, 0, sizeof(*c));
+  if (pread_text(fd, buf, sizeof(buf)) <= 0)
+    return;
+
+  char *some = strstr(buf, "some ");
+  char *full = strstr(buf, "full ");
+  char *total;
+  if (some && (total = strstr(some, "total=")))
+    c->some_total = strtoull(total + 6, NULL, 10);
+  if (full && (total = strstr(full, "total=")))
+    c->full_total = strtoull(total + 6, NULL, 10);
+}
+
+/* Find "key value" in a flat-keyed file such as cpu.stat */
+static unsigned long long flat_key(const char *buf, const char *key) {
+  size_t len = strlen(key);
+  for (const char *p = buf; (p = strstr(p, key)) != NULL; p += len) {
+    if ((p == buf || p[-1] == '\n') && p[len] == ' ')
+      return strtoull(p + len + 1, NULL, 10);
+  }
+  return 0;
+}
+
+static void read_cgroup(const pressure_src_t *src, cgroup_counters_t *c) {
+  char buf[4096];
+  memset(c, 0, sizeof(*c));
+
+  if (pread_text(src->cpu_stat_fd, buf, sizeof(buf)) > 0) {
+    c->usage_usec = flat_key(buf, "usage_usec");
+    c->throttled_usec = flat_key(buf, "throttled_usec");
+  }
+  if (pread_text(src->memory_current_fd, buf, sizeof(buf)) > 0)
+    c->memory_bytes = strtoull(buf, NULL, 10);
+
+  /* io.stat: one "MAJ:MIN rbytes=N wbytes=N ..." line per device */
+  if (pread_text(src->io_stat_fd, buf, sizeof(buf)) > 0) {
+    for (char *p = buf; (p = strstr(p, "rbytes=")) != NULL; p += 7)
+      c->read_bytes += strtoull(p + 7, NULL, 10);
+    for (char *p = buf; (p = strstr(p, "wbytes=")) != NULL; p += 7)
+      c->write_bytes += strtoull(p + 7, NULL, 10);
+  }
+}
+
+/* Locate our own cgroup v2 directory (pure v2 or hybrid "unified" mount) */
+static int find_cgroup_dir(char *out, size_t len) {
+  FILE *fp = fopen("/proc/self/cgroup", "r");
+  if (!fp)
+    return -1;
+
+  char line[512], rel[400] = "";
+  while (fgets(line, sizeof(line), fp)) {
+    if (strncmp(line, "0::", 3) == 0) {
+      line[strcspn(line, "\n")] = '\0';
+      snprintf(rel, sizeof(rel), "%s", line + 3);
+    }
+  }
+  fclose(fp);
+
+  const char *mounts[] = {"/sys/fs/cgroup", "/sys/fs/cgroup/unified"};
+  for (int i = 0; i < 2; i++) {
+    char probe[1024];
+    snprintf(probe, sizeof(probe), "%s/cgroup.controllers", mounts[i]);
+    if (access(probe, R_OK) == 0) {
+      snprintf(out, len, "%s%s", mounts[i], strcmp(rel, "/") ? rel : "");
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static int open_in(const char *dir, const char *name) {
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+int pressure_open(pressure_src_t *src, const char *cgroup_dir) {
+  memset(src, 0, sizeof(*src));
+  int available = 0;
+
+  for (int r = 0; r < PSI_NRES; r++) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/pressure/%s", psi_names[r]);
+    src->psi_fd[r] = open(path, O_RDONLY | O_CLOEXEC);
+    available += src->psi_fd[r] != -1;
+  }
+  if (available == 0)
+    printf("Note: /proc/pressure not available (kernel without PSI)\n");
+
+  if (cgroup_dir)
+    snprintf(src->cgroup_dir, sizeof(src->cgroup_dir), "%s", cgroup_dir);
+  else if (find_cgroup_dir(src->cgroup_dir, sizeof(src->cgroup_dir)) != 0)
+    src->cgroup_dir[0] = '\0';
+
+  src->cpu_stat_fd = src->memory_current_fd = src->io_stat_fd = -1;
+  if (src->cgroup_dir[0]) {
+    src->cpu_stat_fd = open_in(src->cgroup_dir, "cpu.stat");
+    src->memory_current_fd = open_in(src->cgroup_dir, "memory.current");
+    src->io_stat_fd = open_in(src->cgroup_dir, "io.stat");
+  }
+  if (src->cpu_stat_fd == -1 && src->memory_current_fd == -1 &&
+      src->io_stat_fd == -1)
+    printf("Note: no cgroup v2 metrics found%s%s\n",
+           src->cgroup_dir[0] ? " in " : "", src->cgroup_dir);
+  else
+    printf("cgroup v2: %s\n", src->cgroup_dir);
+
+  return 0;
+}
+
+void pressure_close(pressure_src_t *src) {
+  int fds[] = {src->psi_fd[0], src->psi_fd[1],        src->psi_fd[2],
+               src->cpu_stat_fd, src->memory_current_fd, src->io_stat_fd};
+  for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+    if (fds[i] != -1)
+      close(fds[i]);
+  }
+}
+
+static pressure_sample_t *ring_push(pressure_ring_t *ring) {
+  pressure_sample_t *slot = &ring->samples[ring->head];
+  ring->head = (ring->head + 1) % PSI_RING_SIZE;
+  if (ring->count < PSI_RING_SIZE)
+    ring->count++;
+  return slot;
+}
+
+static void print_pressure_header(void) {
+  printf("%9s  %-17s %-17s %-17s %7s %6s %9s %8s %8s\n", "t(ms)",
+         "cpu some/full%", "mem some/full%", "io some/full%", "cg cpu%",
+         "thr%", "cg mem MB", "rd MB/s", "wr MB/s");
+}
+
+static void print_pressure_sample(const pressure_sample_t *s) {
+  printf("%9.1f ", s->t_ms);
+  for (int r = 0; r < PSI_NRES; r++)
+    printf(" %7.2f/%-7.2f  ", s->some_pct[r], s->full_pct[r]);
+  printf("%7.1f %6.1f %9.1f %8.2f %8.2f\n", s->cg_cpu_pct,
+         s->cg_throttled_pct, s->cg_memory_bytes / (1024.0 * 1024.0),
+         s->cg_read_mbps, s->cg_write_mbps);
+}
+
+/* Print the ring oldest-first */
+static void ring_dump(const pressure_ring_t *ring) {
+  int first = (ring->head - ring->count + PSI_RING_SIZE) % PSI_RING_SIZE;
+  print_pressure_header();
+  for (int i = 0; i < ring->count; i++)
+    print_pressure_sample(&ring->samples[(first + i) % PSI_RING_SIZE]);
+}
+
+/*
+ * Sample PSI and cgroup counters every interval_ms for duration_s.
+ * If any "some" stall exceeds threshold_pct, dump the ring buffer.
+ */
+void collect_pressure(int interval_ms, int duration_s, double threshold_pct,
+                      const char *cgroup_dir) {
+  printf("\n=== Pressure Stall + cgroup v2 Collector ===\n");
+
+  pressure_src_t src;
+  pressure_open(&src, cgroup_dir);
+  printf("Sampling every %d ms for %d s, dump when some%% >= %.1f "
+         "(ring holds %d samples)\n\n",
+         interval_ms, duration_s, threshold_pct, PSI_RING_SIZE);
+
+  static pressure_ring_t ring;
+  psi_counters_t prev_psi[PSI_NRES], cur_psi[PSI_NRES];
+  cgroup_counters_t prev_cg, cur_cg;
+  struct timespec start, prev_t, now;
+
+  for (int r = 0; r < PSI_NRES; r++)
+    read_psi(src.psi_fd[r], &prev_psi[r]);
+  read_cgroup(&src, &prev_cg);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  prev_t = start;
+
+  long samples = (long)duration_s * 1000 / interval_ms;
+  int holdoff = 0, dumps = 0;
+  for (long i = 0; i < samples; i++) {
+    usleep(interval_ms * 1000);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double dt_us = (now.tv_sec - prev_t.tv_sec) * 1e6 +
+                   (now.tv_nsec - prev_t.tv_nsec) / 1e3;
+    for (int r = 0; r < PSI_NRES; r++)
+      read_psi(src.psi_fd[r], &cur_psi[r]);
+    read_cgroup(&src, &cur_cg);
+
+    pressure_sample_t *s = ring_push(&ring);
+    s->t_ms = (now.tv_sec - start.tv_sec) * 1e3 +
+              (now.tv_nsec - start.tv_nsec) / 1e6;
+
+    int triggered = 0;
+    for (int r = 0; r < PSI_NRES; r++) {
+      s->some_pct[r] =
+          100.0 * (cur_psi[r].some_total - prev_psi[r].some_total) / dt_us;
+      s->full_pct[r] =
+          100.0 * (cur_psi[r].full_total - prev_psi[r].full_total) / dt_us;
+      if (s->some_pct[r] >= threshold_pct)
+        triggered = 1;
+    }
+    s->cg_cpu_pct = 100.0 * (cur_cg.usage_usec - prev_cg.usage_usec) / dt_us;
+    s->cg_throttled_pct =
+        100.0 * (cur_cg.throttled_usec - prev_cg.throttled_usec) / dt_us;
+    s->cg_memory_bytes = cur_cg.memory_bytes;
+    /* bytes per usec == MB/s (decimal) */
+    s->cg_read_mbps = (cur_cg.read_bytes - prev_cg.read_bytes) / dt_us;
+    s->cg_write_mbps = (cur_cg.write_bytes - prev_cg.write_bytes) / dt_us;
+
+    memcpy(prev_psi, cur_psi, sizeof(prev_psi));
+    prev_cg = cur_cg;
+    prev_t = now;
+
+    if (holdoff > 0)
+      holdoff--;
+    if (triggered && holdoff == 0) {
+      printf("⚠️  Pressure threshold crossed at %.1f ms, last %d samples:\n",
+             s->t_ms, ring.count);
+      ring_dump(&ring);
+      printf("\n");
+      fflush(stdout);
+      dumps++;
+      holdoff = PSI_RING_SIZE; /* Next dump shows entirely new samples */
+    }
+  }
+
+  if (dumps == 0) {
+    printf("Threshold never crossed. Most recent samples:\n");
+    ring_dump(&ring);
+  }
+
+  pressure_close(&src);
 }
 
 int main(int argc, char *argv[]) {
@@ -284,8 +838,11 @@ int main(int argc, char *argv[]) {
     printf("  info <pid>    - Detailed info about process\n");
     printf("  list          - List all processes\n");
     printf("  zombies       - Find zombie processes\n");
-    printf("  tree <pid>    - Show process tree from pid\n");
+    printf("  tree <pid> [depth] - Process tree with subtree CPU/RSS/"
+           "thread/fd totals\n");
     printf("  self          - Show info about this process\n");
+    printf("  pressure [interval_ms] [seconds] [threshold%%] [cgroup_dir]\n");
+    printf("                - Sample PSI and cgroup v2 metrics\n");
     return 0;
   }
 
@@ -301,13 +858,21 @@ int main(int argc, char *argv[]) {
     find_zombies();
   } else if (strcmp(argv[1], "tree") == 0) {
     if (argc < 3) {
-      printf("Usage: %s tree <pid>\n", argv[0]);
+      printf("Usage: %s tree <pid> [depth]\n", argv[0]);
       return 1;
     }
     printf("\n=== Process Tree from PID %s ===\n", argv[2]);
-    print_process_tree(atoi(argv[2]), 0);
+    print_process_tree(atoi(argv[2]), argc > 3 ? atoi(argv[3]) : 64);
   } else if (strcmp(argv[1], "self") == 0) {
     print_process_info(getpid());
+  } else if (strcmp(argv[1], "pressure") == 0) {
+    int interval_ms = argc > 2 ? atoi(argv[2]) : 250;
+    if (interval_ms <= 0) {
+      printf("interval_ms must be at least 1\n");
+      return 1;
+    }
+    collect_pressure(interval_ms, argc > 3 ? atoi(argv[3]) : 10,
+                     argc > 4 ? atof(argv[4]) : 10.0, argc > 5 ? argv[5] : NULL);
   } else {
     printf("Unknown command: %s\n", argv[1]);
     return 1;
@@ -328,10 +893,16 @@ int main(int argc, char *argv[]) {
  * # Find zombies
  * ./proc_reader zombies
  *
- * # Show process tree
+ * # Show process tree with subtree totals
  * ./proc_reader tree 1
  *
+ * # Which top-level service tree is eating the host? (two levels deep)
+ * ./proc_reader tree 1 2
+ *
  * # Info about this program
  * ./proc_reader self
+ *
+ * # Sample PSI/cgroup every 100 ms for a minute, dump history on >= 20% stall
+ * ./proc_reader pressure 100 60 20
  */
 
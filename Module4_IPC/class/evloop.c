@@ -0,0 +1,831 @@
+#define _GNU_SOURCE
+
+#include "evloop.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Linux 6.7, newer than some installed uapi headers */
+#ifndef IORING_OP_READ_MULTISHOT
+#define IORING_OP_READ_MULTISHOT 49
+#endif
+
+#define URING_ENTRIES 256
+#define URING_CQ_ENTRIES 4096 /* Multishot readers post many completions */
+#define BUF_COUNT 64          /* Registered receive buffers, power of two */
+#define BUF_SIZE (16 * 1024)
+#define BUF_GROUP 0
+#define EPOLL_BUF_SIZE (64 * 1024)
+#define EPOLL_READS_PER_EVENT 16 /* Then let other descriptors run */
+#define MAX_EVENTS 256
+
+/* user_data of a reader (hangup watch) request is its ev_fd with this
+   bit set; untagged requests are writes */
+#define TAG_READ 1UL
+#define TAG_HUP 2UL
+#define TAG_MASK 3UL
+
+/* One queued write */
+typedef struct ev_op {
+  struct ev_op *next;
+  const char *buf;
+  size_t len;
+  size_t done;
+  ssize_t res;
+  evloop_write_cb cb;
+  void *arg;
+  int fd;
+} ev_op_t;
+
+/* Everything the loop knows about one descriptor */
+typedef struct ev_fd {
+  int fd;
+  int is_socket;
+  evloop_read_cb rcb;
+  void *rarg;
+  int reading;     /* Reader registered and not finished */
+  int read_armed;  /* io_uring: a read request is in flight */
+  int single_shot; /* io_uring: kernel lacks READ_MULTISHOT */
+  int write_armed; /* epoll: EPOLLOUT wanted; io_uring: write in flight */
+  evloop_hup_cb hcb; /* Hangup watch, until it fires */
+  void *harg;
+  int hup_armed;   /* io_uring: a poll request is in flight */
+  uint32_t events; /* epoll: interest currently registered */
+  int registered;  /* epoll: in the interest list (events may be 0) */
+  int closing;
+  unsigned inflight; /* io_uring requests that have not completed */
+  int stalled;       /* io_uring: a write is waiting for a free SQE */
+  ev_op_t *wq_head, *wq_tail;
+  struct ev_fd *next_zombie;
+  struct ev_fd *next_stalled;
+} ev_fd_t;
+
+struct evloop {
+  evloop_backend_t backend;
+  evloop_stats_t stats;
+  ev_fd_t **fds; /* Indexed by descriptor number */
+  int fds_cap;
+  ev_fd_t *zombies; /* Closed, freed once nothing refers to them */
+  ev_fd_t *stalled; /* io_uring: writes to submit once the SQ has room */
+  ev_op_t *done_head, *done_tail; /* Finished writes awaiting callbacks */
+  ev_op_t *free_ops;
+
+  /* epoll */
+  int epfd;
+  char *rbuf;
+
+  /* io_uring */
+  int ring_fd;
+  void *ring;
+  size_t ring_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array, sq_entries;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+  unsigned sq_local_tail; /* SQEs filled in, not all submitted */
+  unsigned to_submit;
+  struct io_uring_buf_ring *br;
+  size_t br_size;
+  char *bufs;
+  uint16_t br_tail;
+};
+
+/* ------------------------------------------------------------------ */
+/* Shared bookkeeping                                                   */
+/* ------------------------------------------------------------------ */
+
+static ev_op_t *op_alloc(evloop_t *loop) {
+  ev_op_t *op = loop->free_ops;
+  if (op)
+    loop->free_ops = op->next;
+  else
+    op = malloc(sizeof(*op));
+  return op;
+}
+
+static void op_finish(evloop_t *loop, ev_op_t *op, ssize_t res) {
+  op->res = res;
+  op->next = NULL;
+  if (loop->done_tail)
+    loop->done_tail->next = op;
+  else
+    loop->done_head = op;
+  loop->done_tail = op;
+}
+
+/* Take the head of e's write queue and queue its completion */
+static void write_done(evloop_t *loop, ev_fd_t *e, ssize_t res) {
+  ev_op_t *op = e->wq_head;
+  e->wq_head = op->next;
+  if (!e->wq_head)
+    e->wq_tail = NULL;
+  op_finish(loop, op, res);
+}
+
+static int deliver_done(evloop_t *loop) {
+  int n = 0;
+  while (loop->done_head) {
+    ev_op_t *op = loop->done_head;
+    loop->done_head = op->next;
+    if (!loop->done_head)
+      loop->done_tail = NULL;
+
+    evloop_write_cb cb = op->cb;
+    int fd = op->fd;
+    ssize_t res = op->res;
+    void *arg = op->arg;
+    op->next = loop->free_ops;
+    loop->free_ops = op;
+    if (cb)
+      cb(loop, fd, res, arg);
+    n++;
+  }
+  loop->stats.callbacks += n;
+  return n;
+}
+
+static void bury_zombies(evloop_t *loop) {
+  ev_fd_t **pp = &loop->zombies;
+  while (*pp) {
+    ev_fd_t *e = *pp;
+    if (e->inflight == 0) {
+      *pp = e->next_zombie;
+      free(e);
+    } else {
+      pp = &e->next_zombie;
+    }
+  }
+}
+
+static ev_fd_t *lookup(evloop_t *loop, int fd) {
+  return fd >= 0 && fd < loop->fds_cap ? loop->fds[fd] : NULL;
+}
+
+static ev_fd_t *get_fd(evloop_t *loop, int fd) {
+  ev_fd_t *e = lookup(loop, fd);
+  if (e)
+    return e;
+  if (fd < 0) {
+    errno = EBADF;
+    return NULL;
+  }
+
+  if (fd >= loop->fds_cap) {
+    int cap = loop->fds_cap ? loop->fds_cap : 64;
+    while (cap <= fd)
+      cap *= 2;
+    ev_fd_t **grown = realloc(loop->fds, cap * sizeof(*grown));
+    if (!grown)
+      return NULL;
+    memset(grown + loop->fds_cap, 0,
+           (cap - loop->fds_cap) * sizeof(*grown));
+    loop->fds = grown;
+    loop->fds_cap = cap;
+  }
+
+  struct stat sb;
+  if (fstat(fd, &sb) == -1 || !(e = calloc(1, sizeof(*e))))
+    return NULL;
+  e->fd = fd;
+  e->is_socket = S_ISSOCK(sb.st_mode);
+
+  /* epoll needs O_NONBLOCK; io_uring waits in the kernel without it */
+  int fl = fcntl(fd, F_GETFL);
+  if (fl != -1)
+    fcntl(fd, F_SETFL,
+          loop->backend == EVLOOP_EPOLL ? fl | O_NONBLOCK : fl & ~O_NONBLOCK);
+
+  loop->fds[fd] = e;
+  return e;
+}
+
+/* ------------------------------------------------------------------ */
+/* epoll backend                                                        */
+/* ------------------------------------------------------------------ */
+
+static void epoll_update(evloop_t *loop, ev_fd_t *e) {
+  uint32_t want =
+      (e->reading ? EPOLLIN : 0) | (e->write_armed ? EPOLLOUT : 0);
+  /* EPOLLERR and EPOLLHUP are always reported, even with no interest */
+  int keep = want != 0 || e->hcb != NULL;
+  if (want == e->events && keep == e->registered)
+    return;
+
+  struct epoll_event ev = {.events = want, .data.ptr = e};
+  int op = !e->registered ? EPOLL_CTL_ADD
+           : !keep        ? EPOLL_CTL_DEL
+                          : EPOLL_CTL_MOD;
+  epoll_ctl(loop->epfd, op, e->fd, &ev);
+  loop->stats.syscalls++;
+  e->events = want;
+  e->registered = keep;
+}
+
+/* Run the hangup watch, once: it is dropped before the callback */
+static void fire_hup(evloop_t *loop, ev_fd_t *e) {
+  evloop_hup_cb cb = e->hcb;
+  e->hcb = NULL;
+  if (loop->backend == EVLOOP_EPOLL)
+    epoll_update(loop, e); /* Or the level-triggered error fires forever */
+  cb(loop, e->fd, e->harg);
+  loop->stats.callbacks++;
+}
+
+static void epoll_read(evloop_t *loop, ev_fd_t *e) {
+  for (int i = 0; i < EPOLL_READS_PER_EVENT && e->reading && !e->closing;
+       i++) {
+    ssize_t n = read(e->fd, loop->rbuf, EPOLL_BUF_SIZE);
+    loop->stats.syscalls++;
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1 && errno == EAGAIN)
+      return;
+    if (n <= 0) {
+      n = n < 0 ? -errno : 0;
+      e->reading = 0;
+      epoll_update(loop, e);
+    }
+    e->rcb(loop, e->fd, loop->rbuf, n, e->rarg);
+    loop->stats.callbacks++;
+    /* A short read drained the pipe: skip the read that says EAGAIN */
+    if (n < EPOLL_BUF_SIZE)
+      return;
+  }
+}
+
+static void epoll_flush(evloop_t *loop, ev_fd_t *e) {
+  ev_op_t *op;
+  while ((op = e->wq_head) != NULL) {
+    if (op->done == op->len) {
+      write_done(loop, e, op->len); /* Zero-length write */
+      continue;
+    }
+    ssize_t n = write(e->fd, op->buf + op->done, op->len - op->done);
+    loop->stats.syscalls++;
+    if (n > 0) {
+      op->done += n;
+      if (op->done == op->len)
+        write_done(loop, e, op->len);
+    } else if (n == 0) {
+      write_done(loop, e, -EIO); /* No progress and no errno to report */
+    } else if (errno == EAGAIN) {
+      if (!e->write_armed) {
+        e->write_armed = 1;
+        epoll_update(loop, e);
+      }
+      return;
+    } else if (errno != EINTR) {
+      write_done(loop, e, -errno);
+    }
+  }
+  if (e->write_armed) {
+    e->write_armed = 0;
+    epoll_update(loop, e);
+  }
+}
+
+static int epoll_run_once(evloop_t *loop, int timeout_ms) {
+  struct epoll_event events[MAX_EVENTS];
+  int n = epoll_wait(loop->epfd, events, MAX_EVENTS,
+                     loop->done_head ? 0 : timeout_ms);
+  loop->stats.syscalls++;
+  loop->stats.iterations++;
+  if (n == -1)
+    return errno == EINTR ? 0 : -1;
+
+  for (int i = 0; i < n; i++) {
+    ev_fd_t *e = events[i].data.ptr;
+    if (e->closing)
+      continue; /* Closed earlier in this batch */
+    if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && e->reading)
+      epoll_read(loop, e);
+    if (!e->closing && e->wq_head &&
+        (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)))
+      epoll_flush(loop, e);
+    if (!e->closing && e->hcb && (events[i].events & (EPOLLHUP | EPOLLERR)))
+      fire_hup(loop, e);
+  }
+  return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* io_uring backend                                                     */
+/* ------------------------------------------------------------------ */
+
+static int uring_enter(evloop_t *loop, unsigned min_complete,
+                       int timeout_ms) {
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg = {0};
+  unsigned flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+
+  if (min_complete && timeout_ms >= 0) {
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    arg.ts = (uintptr_t)&ts;
+  }
+  /* GETEVENTS even when not waiting: it runs deferred completion work */
+  int ret = syscall(__NR_io_uring_enter, loop->ring_fd, loop->to_submit,
+                    min_complete, flags, &arg, sizeof(arg));
+  loop->stats.syscalls++;
+  if (ret >= 0) {
+    loop->to_submit -= ret;
+    return 0;
+  }
+  return errno == ETIME || errno == EINTR || errno == EBUSY ? 0 : -1;
+}
+
+static struct io_uring_sqe *uring_sqe(evloop_t *loop) {
+  unsigned head = __atomic_load_n(loop->sq_head, __ATOMIC_ACQUIRE);
+  if (loop->sq_local_tail - head >= loop->sq_entries) {
+    /* Ring full: submit what we have, without waiting for anything */
+    uring_enter(loop, 0, 0);
+    head = __atomic_load_n(loop->sq_head, __ATOMIC_ACQUIRE);
+    if (loop->sq_local_tail - head >= loop->sq_entries)
+      return NULL;
+  }
+
+  unsigned idx = loop->sq_local_tail & *loop->sq_mask;
+  struct io_uring_sqe *sqe = &loop->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  loop->sq_array[idx] = idx;
+  loop->sq_local_tail++;
+  loop->to_submit++;
+  /* Queued only: the next io_uring_enter() submits the whole batch */
+  __atomic_store_n(loop->sq_tail, loop->sq_local_tail, __ATOMIC_RELEASE);
+  return sqe;
+}
+
+static void uring_arm_read(evloop_t *loop, ev_fd_t *e) {
+  struct io_uring_sqe *sqe = uring_sqe(loop);
+  if (!sqe)
+    return;
+
+  sqe->fd = e->fd;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BUF_GROUP;
+  sqe->user_data = (uintptr_t)e | TAG_READ;
+  if (e->is_socket) {
+    sqe->opcode = IORING_OP_RECV;
+    if (!e->single_shot)
+      sqe->ioprio = IORING_RECV_MULTISHOT;
+    else
+      sqe->len = BUF_SIZE;
+  } else if (!e->single_shot) {
+    sqe->opcode = IORING_OP_READ_MULTISHOT;
+    sqe->off = -1;
+  } else {
+    sqe->opcode = IORING_OP_READ;
+    sqe->off = -1;
+    sqe->len = BUF_SIZE;
+  }
+  e->read_armed = 1;
+  e->inflight++;
+}
+
+static void uring_submit_write(evloop_t *loop, ev_fd_t *e) {
+  ev_op_t *op = e->wq_head;
+  struct io_uring_sqe *sqe = uring_sqe(loop);
+  if (!sqe) {
+    /*
+     * The SQ is still full after submitting: the kernel pushed back
+     * (EBUSY, completions to reap first). Park the descriptor; the next
+     * loop iteration queues the write again before it enters the kernel.
+     * The inflight count keeps it from being freed meanwhile.
+     */
+    if (!e->stalled) {
+      e->stalled = 1;
+      e->inflight++;
+      e->next_stalled = loop->stalled;
+      loop->stalled = e;
+    }
+    return;
+  }
+
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->fd = e->fd;
+  sqe->off = -1;
+  sqe->addr = (uintptr_t)(op->buf + op->done);
+  sqe->len = op->len - op->done;
+  sqe->user_data = (uintptr_t)e;
+  e->write_armed = 1;
+  e->inflight++;
+}
+
+static int uring_arm_hup(evloop_t *loop, ev_fd_t *e) {
+  struct io_uring_sqe *sqe = uring_sqe(loop);
+  if (!sqe) {
+    errno = EBUSY;
+    return -1;
+  }
+
+  /* The kernel adds POLLERR and POLLHUP to any mask; ask for nothing else */
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = e->fd;
+  sqe->poll32_events = POLLERR | POLLHUP;
+  sqe->user_data = (uintptr_t)e | TAG_HUP;
+  e->hup_armed = 1;
+  e->inflight++;
+  return 0;
+}
+
+static void uring_hup_cqe(evloop_t *loop, ev_fd_t *e, int res) {
+  e->hup_armed = 0;
+  e->inflight--;
+  if (res != -ECANCELED && e->hcb && !e->closing)
+    fire_hup(loop, e);
+}
+
+static void uring_cancel(evloop_t *loop, uint64_t user_data) {
+  struct io_uring_sqe *sqe = uring_sqe(loop);
+  if (!sqe)
+    return;
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = user_data;
+  sqe->user_data = 0; /* Its own completion is ignored */
+}
+
+/* Hand a provided buffer back to the kernel */
+static void uring_recycle(evloop_t *loop, unsigned bid) {
+  struct io_uring_buf *b = &loop->br->bufs[loop->br_tail & (BUF_COUNT - 1)];
+  b->addr = (uintptr_t)(loop->bufs + (size_t)bid * BUF_SIZE);
+  b->len = BUF_SIZE;
+  b->bid = bid;
+  loop->br_tail++;
+  __atomic_store_n(&loop->br->tail, loop->br_tail, __ATOMIC_RELEASE);
+}
+
+static void uring_read_cqe(evloop_t *loop, ev_fd_t *e,
+                           const struct io_uring_cqe *cqe) {
+  int more = cqe->flags & IORING_CQE_F_MORE;
+  if (!more) {
+    e->read_armed = 0;
+    e->inflight--;
+  }
+
+  if (cqe->flags & IORING_CQE_F_BUFFER) {
+    unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    if (cqe->res > 0 && e->reading && !e->closing) {
+      e->rcb(loop, e->fd, loop->bufs + (size_t)bid * BUF_SIZE, cqe->res,
+             e->rarg);
+      loop->stats.callbacks++;
+    }
+    uring_recycle(loop, bid);
+  } else if (cqe->res == -EINVAL && !e->single_shot) {
+    e->single_shot = 1; /* Older kernel: re-arm after every read */
+  } else if (cqe->res == -ENOBUFS) {
+    /* Every buffer was in use; they are back now, so just re-arm */
+  } else if (cqe->res <= 0 && cqe->res != -ECANCELED && e->reading &&
+             !e->closing) {
+    e->reading = 0; /* End of file or error */
+    e->rcb(loop, e->fd, NULL, cqe->res, e->rarg);
+    loop->stats.callbacks++;
+  }
+
+  if (!e->read_armed && e->reading && !e->closing)
+    uring_arm_read(loop, e);
+}
+
+static void uring_write_cqe(evloop_t *loop, ev_fd_t *e, int res) {
+  ev_op_t *op = e->wq_head;
+  e->write_armed = 0;
+  e->inflight--;
+
+  if (res > 0)
+    op->done += res;
+  if (res > 0 && op->done < op->len && !e->closing) {
+    uring_submit_write(loop, e); /* Short write: send the rest */
+    return;
+  }
+
+  if (op->done == op->len)
+    res = op->len;
+  else if (res >= 0)
+    res = e->closing ? -ECANCELED : -EIO;
+  write_done(loop, e, res);
+  if (e->wq_head && !e->closing)
+    uring_submit_write(loop, e);
+}
+
+/* Writes that found the SQ full last time: queue them for this enter */
+static void uring_retry_stalled(evloop_t *loop) {
+  ev_fd_t *e = loop->stalled;
+  loop->stalled = NULL;
+  while (e) {
+    ev_fd_t *next = e->next_stalled;
+    e->stalled = 0;
+    e->inflight--;
+    if (e->wq_head && !e->write_armed && !e->closing)
+      uring_submit_write(loop, e); /* May stall again */
+    e = next;
+  }
+}
+
+static int uring_run_once(evloop_t *loop, int timeout_ms) {
+  uring_retry_stalled(loop);
+  unsigned head = *loop->cq_head;
+  unsigned ready = __atomic_load_n(loop->cq_tail, __ATOMIC_ACQUIRE) - head;
+  int wait = ready == 0 && loop->done_head == NULL;
+
+  /* One syscall: submit everything queued, then wait for completions */
+  if ((wait || loop->to_submit) &&
+      uring_enter(loop, wait, timeout_ms) == -1)
+    return -1;
+  loop->stats.iterations++;
+
+  unsigned tail = __atomic_load_n(loop->cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    const struct io_uring_cqe *cqe = &loop->cqes[head & *loop->cq_mask];
+    uintptr_t ud = cqe->user_data;
+    if (ud == 0)
+      continue; /* Cancel request */
+    ev_fd_t *e = (ev_fd_t *)(ud & ~TAG_MASK);
+    if (ud & TAG_READ)
+      uring_read_cqe(loop, e, cqe);
+    else if (ud & TAG_HUP)
+      uring_hup_cqe(loop, e, cqe->res);
+    else
+      uring_write_cqe(loop, e, cqe->res);
+  }
+  /* The kernel never overwrites a slot before we release it here */
+  __atomic_store_n(loop->cq_head, head, __ATOMIC_RELEASE);
+  return 0;
+}
+
+static int uring_setup(evloop_t *loop) {
+  struct io_uring_params p;
+  int fd = -1;
+
+  /* Single issuer + deferred task work: completions are only processed
+     when we ask for them, in this thread, with no IPIs. Needs 6.1. */
+  unsigned flag_sets[] = {IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER |
+                              IORING_SETUP_DEFER_TASKRUN,
+                          IORING_SETUP_CQSIZE};
+  for (int i = 0; i < 2 && fd < 0; i++) {
+    memset(&p, 0, sizeof(p));
+    p.flags = flag_sets[i];
+    p.cq_entries = URING_CQ_ENTRIES;
+    fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (fd < 0 && errno != EINVAL)
+      break;
+  }
+  if (fd < 0)
+    return -1;
+  loop->ring_fd = fd;
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(p.features & IORING_FEAT_EXT_ARG)) {
+    errno = ENOSYS; /* Older than 5.11 */
+    return -1;
+  }
+
+  size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  loop->ring_size = sq_size > cq_size ? sq_size : cq_size;
+  loop->ring = mmap(NULL, loop->ring_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  loop->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  loop->sqes = mmap(NULL, loop->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (loop->ring == MAP_FAILED || loop->sqes == MAP_FAILED)
+    return -1;
+
+  char *r = loop->ring;
+  loop->sq_head = (unsigned *)(r + p.sq_off.head);
+  loop->sq_tail = (unsigned *)(r + p.sq_off.tail);
+  loop->sq_mask = (unsigned *)(r + p.sq_off.ring_mask);
+  loop->sq_array = (unsigned *)(r + p.sq_off.array);
+  loop->sq_entries = p.sq_entries;
+  loop->sq_local_tail = *loop->sq_tail;
+  loop->cq_head = (unsigned *)(r + p.cq_off.head);
+  loop->cq_tail = (unsigned *)(r + p.cq_off.tail);
+  loop->cq_mask = (unsigned *)(r + p.cq_off.ring_mask);
+  loop->cqes = (struct io_uring_cqe *)(r + p.cq_off.cqes);
+
+  /* Registered buffer ring that multishot reads pick buffers from (5.19) */
+  loop->br_size = BUF_COUNT * sizeof(struct io_uring_buf);
+  loop->br = mmap(NULL, loop->br_size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  loop->bufs = malloc((size_t)BUF_COUNT * BUF_SIZE);
+  if (loop->br == MAP_FAILED || !loop->bufs)
+    return -1;
+  struct io_uring_buf_reg reg = {.ring_addr = (uintptr_t)loop->br,
+                                 .ring_entries = BUF_COUNT,
+                                 .bgid = BUF_GROUP};
+  if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg,
+              1) == -1) {
+    errno = ENOSYS;
+    return -1;
+  }
+  for (unsigned bid = 0; bid < BUF_COUNT; bid++)
+    uring_recycle(loop, bid);
+  return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Public API                                                           */
+/* ------------------------------------------------------------------ */
+
+evloop_t *evloop_new(evloop_backend_t backend) {
+  evloop_t *loop = calloc(1, sizeof(*loop));
+  if (!loop)
+    return NULL;
+  loop->backend = backend;
+  loop->epfd = -1;
+  loop->ring_fd = -1;
+  loop->br = MAP_FAILED;
+  loop->ring = MAP_FAILED;
+  loop->sqes = MAP_FAILED;
+
+  int ok;
+  if (backend == EVLOOP_URING) {
+    ok = uring_setup(loop) == 0;
+  } else {
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    loop->rbuf = malloc(EPOLL_BUF_SIZE);
+    ok = loop->epfd >= 0 && loop->rbuf;
+  }
+  if (!ok) {
+    int saved = errno;
+    evloop_free(loop);
+    errno = saved;
+    return NULL;
+  }
+  return loop;
+}
+
+void evloop_free(evloop_t *loop) {
+  for (int fd = 0; fd < loop->fds_cap; fd++) {
+    if (loop->fds[fd])
+      evloop_close(loop, fd);
+  }
+  /* Let cancellations finish so no request still points into our memory */
+  for (int i = 0; i < 100 && loop->zombies; i++) {
+    if (loop->backend == EVLOOP_URING)
+      uring_run_once(loop, 10);
+    bury_zombies(loop);
+  }
+  /* Too late for write callbacks: the caller is tearing down */
+  if (loop->done_tail) {
+    loop->done_tail->next = loop->free_ops;
+    loop->free_ops = loop->done_head;
+  }
+  while (loop->free_ops) {
+    ev_op_t *op = loop->free_ops;
+    loop->free_ops = op->next;
+    free(op);
+  }
+
+  if (loop->ring_fd >= 0)
+    close(loop->ring_fd);
+  if (loop->ring != MAP_FAILED)
+    munmap(loop->ring, loop->ring_size);
+  if (loop->sqes != MAP_FAILED)
+    munmap(loop->sqes, loop->sqes_size);
+  if (loop->br != MAP_FAILED)
+    munmap(loop->br, loop->br_size);
+  free(loop->bufs);
+  if (loop->epfd >= 0)
+    close(loop->epfd);
+  free(loop->rbuf);
+  free(loop->fds);
+  free(loop);
+}
+
+const char *evloop_backend_name(const evloop_t *loop) {
+  return loop->backend == EVLOOP_URING ? "io_uring" : "epoll";
+}
+
+int evloop_add_reader(evloop_t *loop, int fd, evloop_read_cb cb, void *arg) {
+  ev_fd_t *e = get_fd(loop, fd);
+  if (!e)
+    return -1;
+  if (e->reading) {
+    errno = EEXIST;
+    return -1;
+  }
+  e->rcb = cb;
+  e->rarg = arg;
+  e->reading = 1;
+  if (loop->backend == EVLOOP_URING)
+    uring_arm_read(loop, e);
+  else
+    epoll_update(loop, e);
+  return 0;
+}
+
+int evloop_watch_hup(evloop_t *loop, int fd, evloop_hup_cb cb, void *arg) {
+  ev_fd_t *e = get_fd(loop, fd);
+  if (!e)
+    return -1;
+  if (e->hcb) {
+    errno = EEXIST;
+    return -1;
+  }
+  e->hcb = cb;
+  e->harg = arg;
+  if (loop->backend == EVLOOP_EPOLL) {
+    epoll_update(loop, e);
+  } else if (!e->hup_armed && uring_arm_hup(loop, e) == -1) {
+    e->hcb = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+int evloop_write(evloop_t *loop, int fd, const void *buf, size_t len,
+                 evloop_write_cb cb, void *arg) {
+  ev_fd_t *e = get_fd(loop, fd);
+  ev_op_t *op = e ? op_alloc(loop) : NULL;
+  if (!op)
+    return -1;
+
+  *op = (ev_op_t){.buf = buf, .len = len, .cb = cb, .arg = arg, .fd = fd};
+  if (e->wq_tail)
+    e->wq_tail->next = op;
+  else
+    e->wq_head = op;
+  e->wq_tail = op;
+
+  /* Only one write in flight per descriptor keeps them in order */
+  if (loop->backend == EVLOOP_URING) {
+    if (!e->write_armed)
+      uring_submit_write(loop, e);
+  } else if (!e->write_armed && e->wq_head == op) {
+    epoll_flush(loop, e); /* Usually completes right here */
+  }
+  return 0;
+}
+
+void evloop_close(evloop_t *loop, int fd) {
+  ev_fd_t *e = lookup(loop, fd);
+  if (!e) {
+    close(fd);
+    return;
+  }
+  loop->fds[fd] = NULL; /* The number may be reused as soon as we close */
+  e->closing = 1;
+  e->reading = 0;
+  e->hcb = NULL;
+
+  if (loop->backend == EVLOOP_URING) {
+    /* A write already in the kernel completes (or is cancelled) on its
+       own; the ones queued behind it never start */
+    ev_op_t *keep = e->write_armed ? e->wq_head : NULL;
+    ev_op_t *op = keep ? keep->next : e->wq_head;
+    if (keep) {
+      keep->next = NULL;
+      e->wq_tail = keep;
+      uring_cancel(loop, (uintptr_t)e);
+    } else {
+      e->wq_head = e->wq_tail = NULL;
+    }
+    while (op) {
+      ev_op_t *next = op->next;
+      op_finish(loop, op, -ECANCELED);
+      op = next;
+    }
+    if (e->read_armed)
+      uring_cancel(loop, (uintptr_t)e | TAG_READ);
+    if (e->hup_armed)
+      uring_cancel(loop, (uintptr_t)e | TAG_HUP);
+    /* Queued SQEs name the fd by number: submit them before it is gone */
+    if (loop->to_submit)
+      uring_enter(loop, 0, 0);
+  } else {
+    if (e->registered)
+      epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+    while (e->wq_head)
+      write_done(loop, e, -ECANCELED);
+  }
+
+  /* Requests still in flight hold their own reference to the file */
+  close(fd);
+  e->next_zombie = loop->zombies;
+  loop->zombies = e;
+}
+
+int evloop_run_once(evloop_t *loop, int timeout_ms) {
+  unsigned long before = loop->stats.callbacks;
+  deliver_done(loop);
+
+  int ret = loop->backend == EVLOOP_URING ? uring_run_once(loop, timeout_ms)
+                                          : epoll_run_once(loop, timeout_ms);
+  deliver_done(loop);
+  bury_zombies(loop);
+  return ret == -1 ? -1 : (int)(loop->stats.callbacks - before);
+}
+
+const evloop_stats_t *evloop_stats(const evloop_t *loop) {
+  return &loop->stats;
+}
@@ -0,0 +1,86 @@
+/*
+ * evloop.h - Completion-style event loop for pipes, FIFOs and UNIX sockets
+ *
+ * The caller never issues read() or write() itself: it registers a reader
+ * per descriptor and hands over buffers to write, and the loop calls back
+ * when data arrived or a write finished. Two backends sit behind the same
+ * API:
+ *
+ *   EVLOOP_EPOLL - readiness: epoll_wait, then one read()/write() per
+ *                  chunk. Descriptors are switched to O_NONBLOCK.
+ *   EVLOOP_URING - io_uring (raw syscalls, no liburing). Each reader is
+ *                  ONE multishot request (READ_MULTISHOT for pipes and
+ *                  FIFOs, RECV_MULTISHOT for sockets) that keeps posting
+ *                  completions into buffers the kernel picks from a
+ *                  registered buffer ring. New requests are only queued;
+ *                  a single io_uring_enter() per loop iteration submits
+ *                  the whole batch and reaps every completion.
+ *                  Descriptors are switched to blocking mode, so a write
+ *                  to a full pipe parks inside the kernel instead of
+ *                  failing with EAGAIN.
+ *
+ * Writes on one descriptor complete in order, each either in full or with
+ * an error. Callbacks only ever run from evloop_run_once(), never from
+ * inside evloop_write() or evloop_close().
+ */
+
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef struct evloop evloop_t;
+
+typedef enum { EVLOOP_EPOLL = 0, EVLOOP_URING = 1 } evloop_backend_t;
+
+/*
+ * Data arrived (len > 0), end of file (len == 0) or an error (-errno).
+ * data is only valid during the call. After len <= 0 the reader is gone.
+ */
+typedef void (*evloop_read_cb)(evloop_t *loop, int fd, const char *data,
+                               ssize_t len, void *arg);
+
+/* A write finished: res is the full length, or -errno (-ECANCELED when
+ * the descriptor was closed first). The buffer may be reused now. */
+typedef void (*evloop_write_cb)(evloop_t *loop, int fd, ssize_t res,
+                                void *arg);
+
+/* The other end of fd went away (error or hangup) */
+typedef void (*evloop_hup_cb)(evloop_t *loop, int fd, void *arg);
+
+typedef struct {
+  unsigned long iterations; /* evloop_run_once() calls that waited */
+  unsigned long syscalls;   /* Every syscall the loop made for I/O */
+  unsigned long callbacks;
+} evloop_stats_t;
+
+/* NULL with errno set on failure (ENOSYS: no io_uring in this kernel) */
+evloop_t *evloop_new(evloop_backend_t backend);
+/* Closes every descriptor still registered; pending callbacks never run */
+void evloop_free(evloop_t *loop);
+const char *evloop_backend_name(const evloop_t *loop);
+
+int evloop_add_reader(evloop_t *loop, int fd, evloop_read_cb cb, void *arg);
+
+/*
+ * Call cb once when fd reports an error or hangup, even while nothing is
+ * being read or written. Meant for write-only descriptors such as the
+ * write end of a FIFO, whose reader going away would otherwise only show
+ * up at the next write.
+ */
+int evloop_watch_hup(evloop_t *loop, int fd, evloop_hup_cb cb, void *arg);
+
+/* Queue len bytes of buf; buf must stay valid until the callback */
+int evloop_write(evloop_t *loop, int fd, const void *buf, size_t len,
+                 evloop_write_cb cb, void *arg);
+
+/* Cancel everything on fd and close it */
+void evloop_close(evloop_t *loop, int fd);
+
+/* Wait up to timeout_ms (-1 forever) and run callbacks; returns how many */
+int evloop_run_once(evloop_t *loop, int timeout_ms);
+
+const evloop_stats_t *evloop_stats(const evloop_t *loop);
+
+#endif /* EVLOOP_H */
@@ -0,0 +1,445 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "evloop.h"
+#include "fifo_proto.h"
+
+/*
+ * Echo benchmark for evloop.h: epoll vs io_uring at a fixed message rate.
+ *
+ * Clients send small timestamped frames open-loop (at the requested rate,
+ * whether or not replies keep up) and the server process echoes each one.
+ * What matters is what the server pays per message: CPU time, syscalls,
+ * and the latency the clients see.
+ *
+ *   ./evloop_bench                          # 100k msg/s, both backends
+ *   ./evloop_bench -e unix                  # socketpairs instead of pipes
+ *   ./evloop_bench -r 200000 -d 5 -c 8 -b uring
+ *
+ * Endpoints:
+ *   fifo - all clients write into ONE request pipe (like the bidir server),
+ *          each gets replies on its own pipe
+ *   unix - one socketpair per client, one multishot recv each on io_uring
+ */
+
+#define MAX_CLIENTS 64
+#define HIST_US 20000 /* Latency histogram: 1 us buckets, then overflow */
+#define DRAIN_TIMEOUT_MS 5000
+
+typedef struct {
+  frame_hdr_t hdr; /* pid = client index */
+  uint64_t sent_ns;
+} msg_t;
+
+/* Results the children leave in a MAP_SHARED region */
+typedef struct {
+  double server_cpu; /* Seconds, user + system */
+  evloop_stats_t stats;
+  long echoed;
+  long sent[MAX_CLIENTS];
+  long received[MAX_CLIENTS];
+  unsigned hist[MAX_CLIENTS][HIST_US + 1];
+} results_t;
+
+static results_t *res;
+static int use_unix = 0;
+static int nclients = 4;
+static long rate = 100000;
+static double duration = 3;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static double cpu_sec(void) {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec +
+         ru.ru_stime.tv_usec / 1e6;
+}
+
+/* Frames may be split across reads: carry the partial one over */
+typedef struct {
+  char part[sizeof(msg_t)];
+  size_t have;
+} reassembly_t;
+
+static void for_each_msg(reassembly_t *r, const char *data, size_t len,
+                         void (*fn)(const msg_t *m, void *arg), void *arg) {
+  msg_t m;
+  size_t off = 0;
+
+  if (r->have > 0) {
+    off = sizeof(msg_t) - r->have;
+    if (off > len)
+      off = len;
+    memcpy(r->part + r->have, data, off);
+    r->have += off;
+    if (r->have < sizeof(msg_t))
+      return;
+    memcpy(&m, r->part, sizeof(m));
+    fn(&m, arg);
+    r->have = 0;
+  }
+  for (; len - off >= sizeof(msg_t); off += sizeof(msg_t)) {
+    memcpy(&m, data + off, sizeof(m));
+    fn(&m, arg);
+  }
+  memcpy(r->part, data + off, len - off);
+  r->have = len - off;
+}
+
+/* ------------------------------------------------------------------ */
+/* Server                                                               */
+/* ------------------------------------------------------------------ */
+
+/* Same reply batching as fifo_bidir_server: one write in flight each */
+typedef struct {
+  int fd;
+  char *out, *sending;
+  size_t out_len, sending_len, cap;
+  int writing;
+  reassembly_t in; /* unix: each socket is its own stream */
+} peer_t;
+
+static peer_t peers[MAX_CLIENTS];
+static reassembly_t shared_in; /* fifo: the one request pipe */
+static int byes;
+
+static void on_written(evloop_t *loop, int fd, ssize_t n, void *arg);
+
+static void kick(evloop_t *loop, peer_t *p) {
+  if (p->writing || p->out_len == 0)
+    return;
+  char *swap = p->sending;
+  p->sending = p->out;
+  p->sending_len = p->out_len;
+  p->out = swap;
+  p->out_len = 0;
+  p->writing = 1;
+  if (evloop_write(loop, p->fd, p->sending, p->sending_len, on_written, p) ==
+      -1)
+    p->writing = 0;
+}
+
+static void on_written(evloop_t *loop, int fd, ssize_t n, void *arg) {
+  peer_t *p = arg;
+  (void)fd;
+  p->writing = 0;
+  if (n < 0)
+    fprintf(stderr, "[server] reply: %s\n", strerror(-n));
+  else
+    kick(loop, p);
+}
+
+static void echo_msg(const msg_t *m, void *arg) {
+  evloop_t *loop = arg;
+  if (m->hdr.pid < 0 || m->hdr.pid >= nclients)
+    return;
+  if (m->hdr.type == FRAME_BYE) {
+    byes++;
+    return;
+  }
+
+  peer_t *p = &peers[m->hdr.pid];
+  if (p->out_len + sizeof(*m) > p->cap)
+    return; /* Client far behind: shed the echo, it counts as lost */
+  msg_t reply = *m;
+  reply.hdr.type = FRAME_RESPONSE;
+  memcpy(p->out + p->out_len, &reply, sizeof(reply));
+  p->out_len += sizeof(reply);
+  res->echoed++;
+  kick(loop, p);
+}
+
+static void on_data(evloop_t *loop, int fd, const char *data, ssize_t len,
+                    void *arg) {
+  reassembly_t *r = arg;
+  (void)fd;
+  if (len <= 0) {
+    if (len < 0)
+      fprintf(stderr, "[server] read: %s\n", strerror(-len));
+    return;
+  }
+  for_each_msg(r, data, len, echo_msg, loop);
+}
+
+static int server_idle(void) {
+  for (int i = 0; i < nclients; i++) {
+    if (peers[i].writing || peers[i].out_len)
+      return 0;
+  }
+  return 1;
+}
+
+static void server(evloop_backend_t backend, int req_fd) {
+  evloop_t *loop = evloop_new(backend);
+  if (!loop) {
+    perror("evloop_new");
+    exit(1);
+  }
+
+  for (int i = 0; i < nclients; i++) {
+    peer_t *p = &peers[i];
+    p->cap = 1 << 20;
+    p->out = malloc(p->cap);
+    p->sending = malloc(p->cap);
+    if (use_unix && evloop_add_reader(loop, p->fd, on_data, &p->in) == -1)
+      perror("evloop_add_reader");
+  }
+  if (!use_unix && evloop_add_reader(loop, req_fd, on_data, &shared_in) == -1)
+    perror("evloop_add_reader");
+
+  double cpu0 = cpu_sec();
+  while (byes < nclients || !server_idle()) {
+    if (evloop_run_once(loop, DRAIN_TIMEOUT_MS) <= 0)
+      break; /* Error, or nothing happened for a long time */
+  }
+  res->server_cpu = cpu_sec() - cpu0;
+  res->stats = *evloop_stats(loop);
+  evloop_free(loop);
+}
+
+/* ------------------------------------------------------------------ */
+/* Clients                                                              */
+/* ------------------------------------------------------------------ */
+
+static void record_reply(const msg_t *m, void *arg) {
+  int id = *(int *)arg;
+  uint64_t us = (now_ns() - m->sent_ns) / 1000;
+  res->hist[id][us < HIST_US ? us : HIST_US]++;
+  res->received[id]++;
+}
+
+static void drain_replies(int id, int fd, reassembly_t *r) {
+  char buf[16384];
+  ssize_t n;
+  /* A socket is also written to, so it stays blocking: just don't wait */
+  while ((n = use_unix ? recv(fd, buf, sizeof(buf), MSG_DONTWAIT)
+                       : read(fd, buf, sizeof(buf))) > 0)
+    for_each_msg(r, buf, n, record_reply, &id);
+}
+
+static void client(int id, int wfd, int rfd) {
+  reassembly_t in = {0};
+  double per_sec = (double)rate / nclients;
+  uint64_t start = now_ns(), end = start + (uint64_t)(duration * 1e9);
+  long sent = 0;
+  msg_t m = {.hdr = {.len = sizeof(uint64_t), .type = FRAME_REQUEST,
+                     .pid = id}};
+
+  if (!use_unix)
+    fcntl(rfd, F_SETFL, fcntl(rfd, F_GETFL) | O_NONBLOCK);
+  for (uint64_t now = start; now < end; now = now_ns()) {
+    /* Open loop: send whatever is due by now, one write per message */
+    long due = (long)((now - start) / 1e9 * per_sec);
+    for (; sent < due; sent++) {
+      m.hdr.seq = sent;
+      m.sent_ns = now_ns();
+      if (write(wfd, &m, sizeof(m)) != sizeof(m)) {
+        perror("[client] write");
+        goto done;
+      }
+    }
+    drain_replies(id, rfd, &in);
+
+    /* Next 1 ms tick, or earlier if replies arrive */
+    uint64_t tick = now + 1000000 - (now - start) % 1000000;
+    struct timespec ts = {0, (long)(tick - now)};
+    struct pollfd pfd = {rfd, POLLIN, 0};
+    ppoll(&pfd, 1, &ts, NULL);
+  }
+
+done:
+  res->sent[id] = sent;
+  m.hdr.type = FRAME_BYE;
+  write(wfd, &m, sizeof(m));
+
+  uint64_t give_up = now_ns() + DRAIN_TIMEOUT_MS * 1000000ull;
+  while (res->received[id] < sent && now_ns() < give_up) {
+    struct pollfd pfd = {rfd, POLLIN, 0};
+    poll(&pfd, 1, 100);
+    drain_replies(id, rfd, &in);
+  }
+}
+
+/* ------------------------------------------------------------------ */
+/* Driver                                                               */
+/* ------------------------------------------------------------------ */
+
+static double percentile(double q) {
+  long total = 0, seen = 0;
+  for (int c = 0; c < nclients; c++)
+    for (int b = 0; b <= HIST_US; b++)
+      total += res->hist[c][b];
+  for (int b = 0; b <= HIST_US; b++) {
+    for (int c = 0; c < nclients; c++)
+      seen += res->hist[c][b];
+    if (total > 0 && seen >= q * total)
+      return b;
+  }
+  return HIST_US;
+}
+
+static int run(evloop_backend_t backend) {
+  int req[2] = {-1, -1};
+  int client_end[MAX_CLIENTS]; /* Where client i reads replies */
+  int client_wr[MAX_CLIENTS];  /* Where client i sends */
+
+  memset(res, 0, sizeof(*res));
+  memset(peers, 0, sizeof(peers));
+  if (!use_unix && pipe(req) == -1) {
+    perror("pipe");
+    return -1;
+  }
+  for (int i = 0; i < nclients; i++) {
+    int fds[2];
+    int ok = use_unix ? socketpair(AF_UNIX, SOCK_STREAM, 0, fds) : pipe(fds);
+    if (ok == -1) {
+      perror("socketpair/pipe");
+      return -1;
+    }
+    /* pipe: fds[0] read end (client), fds[1] write end (server) */
+    peers[i].fd = use_unix ? fds[0] : fds[1];
+    client_end[i] = use_unix ? fds[1] : fds[0];
+    client_wr[i] = use_unix ? fds[1] : req[1];
+  }
+
+  fflush(stdout);
+  pid_t srv = fork();
+  if (srv == 0) {
+    for (int i = 0; i < nclients; i++)
+      close(client_end[i]);
+    if (!use_unix)
+      close(req[1]); /* EOF once every client is gone */
+    server(backend, req[0]);
+    exit(0);
+  }
+
+  pid_t pids[MAX_CLIENTS];
+  for (int i = 0; i < nclients; i++) {
+    pids[i] = fork();
+    if (pids[i] == 0) {
+      client(i, client_wr[i], client_end[i]);
+      exit(0);
+    }
+  }
+
+  for (int i = 0; i < nclients; i++) {
+    close(peers[i].fd);
+    close(client_end[i]);
+  }
+  if (!use_unix) {
+    close(req[0]);
+    close(req[1]);
+  }
+  for (int i = 0; i < nclients; i++)
+    waitpid(pids[i], NULL, 0);
+  int status;
+  waitpid(srv, &status, 0);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+static void report(evloop_backend_t backend) {
+  long sent = 0, received = 0;
+  for (int i = 0; i < nclients; i++) {
+    sent += res->sent[i];
+    received += res->received[i];
+  }
+  double msgs = res->echoed ? res->echoed : 1;
+  printf("%-9s %10.0f %9ld %12.2f %13.2f %10.2f %8.0f %8.0f\n",
+         backend == EVLOOP_URING ? "io_uring" : "epoll", received / duration,
+         sent - received, res->server_cpu / msgs * 1e6,
+         res->stats.syscalls / msgs, res->stats.iterations / msgs,
+         percentile(0.50), percentile(0.99));
+}
+
+int main(int argc, char *argv[]) {
+  int opt;
+  int backends = 3; /* Bit 0: epoll, bit 1: io_uring */
+
+  while ((opt = getopt(argc, argv, "r:d:c:e:b:")) != -1) {
+    switch (opt) {
+    case 'r':
+      rate = atol(optarg);
+      break;
+    case 'd':
+      duration = atof(optarg);
+      break;
+    case 'c':
+      nclients = atoi(optarg);
+      break;
+    case 'e':
+      use_unix = strcmp(optarg, "unix") == 0;
+      break;
+    case 'b':
+      backends = strcmp(optarg, "epoll") == 0   ? 1
+                 : strcmp(optarg, "uring") == 0 ? 2
+                                                : 3;
+      break;
+    default:
+      fprintf(stderr,
+              "Usage: %s [-r msgs/s] [-d seconds] [-c clients] "
+              "[-e fifo|unix] [-b epoll|uring|both]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  if (nclients < 1 || nclients > MAX_CLIENTS || rate < 1 || duration <= 0) {
+    fprintf(stderr, "clients must be 1..%d, rate and duration positive\n",
+            MAX_CLIENTS);
+    return 1;
+  }
+
+  res = mmap(NULL, sizeof(*res), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (res == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  printf("=== evloop echo: %ld msg/s, %d clients, %.0f s, %s endpoints ===\n",
+         rate, nclients, duration, use_unix ? "socketpair" : "pipe");
+  printf("%-9s %10s %9s %12s %13s %10s %8s %8s\n", "backend", "msg/s", "lost",
+         "srv us/msg", "syscalls/msg", "loops/msg", "p50 us", "p99 us");
+
+  int failed = 0;
+  for (int b = 0; b < 2; b++) {
+    if (!(backends & (1 << b)))
+      continue;
+    evloop_backend_t backend = b ? EVLOOP_URING : EVLOOP_EPOLL;
+    if (run(backend) == -1) {
+      printf("%-9s FAILED\n", b ? "io_uring" : "epoll");
+      failed = 1;
+      continue;
+    }
+    report(backend);
+  }
+  return failed;
+}
+
+/*
+ * TRY THIS:
+ *
+ * Raise -r until "lost" goes up or p99 explodes: that is the backend's
+ * capacity on this machine. Which one gives up first?
+ *
+ * strace -c -f ./evloop_bench -b uring -d 1    # Count the syscalls yourself
+ */
@@ -1,41 +1,201 @@
-#include <fcntl.h>
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
-#define CLIENT_TO_SERVER "/tmp/client_to_server"
-#define SERVER_TO_CLIENT "/tmp/server_to_client"
+#include "fifo_rpc.h"
+
+/*
+ * Client for the epoll FIFO server, on the pipelined RPC layer
+ * (fifo_rpc.h).
+ *
+ * Interactive by default. With -n the client sends N requests on its own
+ * and reports latency; -d keeps up to D of them in flight at once, and
+ * -s makes every Sth one a "sleep 20" that the server answers late, so
+ * the replies come back out of order. With -c it forks C such clients at
+ * once to load the server:
+ *
+ *   ./fifo_bidir_client                   # Interactive
+ *   ./fifo_bidir_client -n 20000          # One request per round trip
+ *   ./fifo_bidir_client -n 20000 -d 64    # 64 in flight
+ *   ./fifo_bidir_client -n 2000 -d 64 -s 100
+ *   ./fifo_bidir_client -c 2000 -n 20     # 2000 clients x 20 requests
+ */
+
+static rpc_client_t rpc;
+
+/* Progress of one batch, updated by the reply callbacks */
+static struct {
+  double *sent, *lat;
+  int errors;
+  long completed, out_of_order, highest;
+} batch;
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void on_reply(rpc_client_t *c, uint32_t id, int err,
+                     const char *reply, size_t len, void *arg) {
+  long i = (intptr_t)arg;
+  (void)c;
+  (void)id;
+  if (err || len < 11 || memcmp(reply, "PROCESSED: ", 11) != 0) {
+    batch.errors++;
+    return;
+  }
+  batch.lat[i] = now_us() - batch.sent[i];
+  batch.completed++;
+  if (i < batch.highest)
+    batch.out_of_order++; /* A later request finished before this one */
+  else
+    batch.highest = i;
+}
+
+/* Send n requests, depth at a time; returns 0 if every reply matched */
+static int run_batch(int n, int depth, int slow_every, int quiet) {
+  char msg[64];
+  memset(&batch, 0, sizeof(batch));
+  batch.sent = malloc(n * sizeof(double));
+  batch.lat = malloc(n * sizeof(double));
+
+  if (rpc_connect(&rpc, depth) == -1) {
+    perror("connect");
+    free(batch.sent);
+    free(batch.lat);
+    return 1;
+  }
 
-int main(void) {
-  int fd_write, fd_read;
+  double start = now_us();
+  for (int i = 0; i < n; i++) {
+    int len = slow_every > 0 && i % slow_every == slow_every - 1
+                  ? snprintf(msg, sizeof(msg), "sleep 20")
+                  : snprintf(msg, sizeof(msg), "request %d from %d", i,
+                             getpid());
+    batch.sent[i] = now_us();
+    if (rpc_call_async(&rpc, msg, len, on_reply, (void *)(intptr_t)i,
+                       NULL) == -1) {
+      perror("request");
+      batch.errors++;
+      break;
+    }
+  }
+  if (rpc_wait(&rpc, 2 * RPC_TIMEOUT_MS) == -1) {
+    perror("waiting for replies");
+    batch.errors++;
+  }
+  double elapsed = now_us() - start;
+  rpc_stats_t st = rpc.st;
+  rpc_close(&rpc);
+
+  if (!quiet && batch.errors == 0) {
+    qsort(batch.lat, n, sizeof(double), cmp_double);
+    printf("%d requests, %d in flight, in %.1f ms: %.0f req/s, p50 %.1f us, "
+           "p99 %.1f us\n",
+           n, depth, elapsed / 1000, n / (elapsed / 1e6), batch.lat[n / 2],
+           batch.lat[(int)(n * 0.99)]);
+    printf("%.1f requests per write, %.1f replies per read, %ld completed "
+           "out of order\n",
+           (double)st.requests / st.writes, (double)st.replies / st.reads,
+           batch.out_of_order);
+  }
+  free(batch.sent);
+  free(batch.lat);
+  return batch.errors != 0;
+}
+
+/* Fork `clients` batch clients and wait for all of them */
+static int run_many(int clients, int n, int depth, int slow_every) {
+  printf("Starting %d clients x %d requests, %d in flight each...\n",
+         clients, n, depth);
+  fflush(stdout);
+
+  double start = now_us();
+  for (int c = 0; c < clients; c++) {
+    pid_t pid = fork();
+    if (pid == 0)
+      exit(run_batch(n, depth, slow_every, 1));
+    if (pid == -1) {
+      perror("fork");
+      clients = c;
+      break;
+    }
+  }
+
+  int failed = 0, status;
+  while (wait(&status) > 0)
+    failed += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+  double elapsed = now_us() - start;
+
+  printf("%d clients done in %.1f ms, %d failed, %.0f req/s overall\n",
+         clients, elapsed / 1000, failed,
+         (double)(clients - failed) * n / (elapsed / 1e6));
+  return failed != 0;
+}
+
+int main(int argc, char *argv[]) {
   char message[100];
-  char response[100];
-  ssize_t bytes_read;
+  char response[FRAME_MAX];
   int request_count = 0;
+  int clients = 0, requests = 0, depth = 1, slow_every = 0, opt;
+
+  while ((opt = getopt(argc, argv, "c:n:d:s:")) != -1) {
+    switch (opt) {
+    case 'c':
+      clients = atoi(optarg);
+      break;
+    case 'n':
+      requests = atoi(optarg);
+      break;
+    case 'd':
+      depth = atoi(optarg);
+      break;
+    case 's':
+      slow_every = atoi(optarg);
+      break;
+    default:
+      printf("Usage: %s [-c clients] [-n requests] [-d depth] "
+             "[-s slow every]\n",
+             argv[0]);
+      return 1;
+    }
+  }
+  if (depth < 1 || depth > RPC_DEPTH_MAX) {
+    printf("Depth must be 1-%d\n", RPC_DEPTH_MAX);
+    return 1;
+  }
+
+  if (clients > 0)
+    return run_many(clients, requests > 0 ? requests : 10, depth,
+                    slow_every);
+  if (requests > 0)
+    return run_batch(requests, depth, slow_every, 0);
 
   printf("===================================\n");
   printf("BIDIRECTIONAL FIFO CLIENT\n");
   printf("===================================\n");
   printf("Connecting to server...\n");
 
-  /* Open FIFOs */
-  fd_write = open(CLIENT_TO_SERVER, O_WRONLY);
-  if (fd_write == -1) {
-    perror("open CLIENT_TO_SERVER");
+  if (rpc_connect(&rpc, 1) == -1) {
     printf("\n❌ Error: Make sure the SERVER is running first!\n");
     printf("   Run: ./fifo_bidir_server\n");
     return 1;
   }
 
-  fd_read = open(SERVER_TO_CLIENT, O_RDONLY);
-  if (fd_read == -1) {
-    perror("open SERVER_TO_CLIENT");
-    close(fd_write);
-    return 1;
-  }
-
-  printf("✓ Connected to server!\n");
+  printf("✓ Connected to server! (replies on %s)\n", rpc.reply_path);
   printf("\nSend messages to server (it will process and respond)\n");
   printf("Type 'quit' to exit\n");
   printf("-----------------------------------\n");
@@ -43,7 +203,7 @@ int main(void) {
   while (1) {
     printf("\n[Client]> ");
     fflush(stdout);
-    
+
     if (fgets(message, sizeof(message), stdin) == NULL) {
       break;
     }
@@ -61,38 +221,23 @@ int main(void) {
       continue;
     }
 
-    /* Send request to server */
-    if (write(fd_write, message, strlen(message) + 1) == -1) {
-      perror("write");
+    /* Send the request and wait for its response (blocking RPC) */
+    printf("  📤 Request #%d, ⏳ waiting for server response...\n",
+           request_count + 1);
+    if (rpc_call(&rpc, message, strlen(message), response, sizeof(response),
+                 RPC_TIMEOUT_MS) == -1) {
+      printf("\n[ERROR] No response: %s\n", strerror(errno));
       break;
     }
     request_count++;
-    printf("  📤 Request sent (#%d)\n", request_count);
-
-    /* Wait for response from server */
-    printf("  ⏳ Waiting for server response...\n");
-    bytes_read = read(fd_read, response, sizeof(response) - 1);
-    
-    if (bytes_read == -1) {
-      perror("read");
-      break;
-    }
 
-    if (bytes_read == 0) {
-      printf("\n[ERROR] Server disconnected.\n");
-      break;
-    }
-
-    response[bytes_read] = '\0';
     printf("  📨 Server response: %s\n", response);
   }
 
-  close(fd_write);
-  close(fd_read);
-  
+  rpc_close(&rpc);
+
   printf("\n-----------------------------------\n");
   printf("Client exiting.\n");
   printf("Total requests sent: %d\n", request_count);
   return 0;
 }
-
@@ -1,104 +1,505 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
-#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "evloop.h"
+#include "fifo_proto.h"
+
+/*
+ * Event-driven server on evloop.h: epoll by default, io_uring with -u.
+ *
+ *  - Requests from all clients arrive framed on the shared request FIFO.
+ *  - Each client has its own reply FIFO, opened when its HELLO arrives.
+ *    The loop watches it for hangup the whole time, so a client that dies
+ *    without saying BYE is dropped (and its FIFO removed) right away, not
+ *    at the next reply that happens to fail.
+ *  - Replies are handed to the loop, one write per client at a time.
+ *    Replies produced meanwhile pile up and go out together in the next
+ *    write, so a slow client never blocks the others and a busy one gets
+ *    its replies batched.
+ *  - A request "sleep <ms>" is answered that much later, while the
+ *    requests behind it are answered right away: replies carry the
+ *    request's seq, so pipelining clients (fifo_rpc.h) match them up
+ *    whatever the order.
+ */
+
+#define CLIENT_BUCKETS 4096
+#define MAX_PENDING (1024 * 1024) /* Drop clients that stop reading */
+#define MAX_SLEEP_MS 10000
+
+typedef struct reply_buf {
+  char *data;
+  size_t len;
+  size_t cap;
+} reply_buf_t;
+
+typedef struct client {
+  int pid;
+  int fd;              /* Reply FIFO, write end */
+  reply_buf_t out;     /* Replies not yet handed to the loop */
+  reply_buf_t sending; /* Owned by the loop while `writing` */
+  int writing;
+  int dead;
+  long requests;
+  struct client *next; /* Hash chain, or graveyard once dropped */
+} client_t;
+
+/* A "sleep" request waiting for its time, in a list sorted by due time */
+typedef struct deferred {
+  long due_ms;
+  frame_hdr_t hdr;
+  struct deferred *next;
+  char payload[];
+} deferred_t;
+
+static client_t *clients[CLIENT_BUCKETS];
+/* Dropped clients are freed once the loop no longer writes from them */
+static client_t *graveyard;
+static evloop_t *loop;
+static char *pending;     /* Start of a frame split across reads */
+static size_t pending_len, pending_cap;
+static int verbose = 0;
+static volatile sig_atomic_t running = 1;
+static long total_requests = 0, connected = 0, peak_clients = 0;
+static deferred_t *deferred;
+static long total_deferred = 0;
+
+static long now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+static void on_signal(int sig) {
+  (void)sig;
+  running = 0;
+}
+
+static client_t **client_slot(int pid) {
+  client_t **pp = &clients[(unsigned)pid % CLIENT_BUCKETS];
+  while (*pp && (*pp)->pid != pid)
+    pp = &(*pp)->next;
+  return pp;
+}
+
+static void drop_client(int pid, const char *why) {
+  client_t **pp = client_slot(pid);
+  client_t *c = *pp;
+  if (!c)
+    return;
+
+  *pp = c->next;
+  evloop_close(loop, c->fd); /* Cancels the write in flight, if any */
+  c->fd = -1;
+  c->dead = 1;
+  connected--;
+  if (verbose)
+    printf("[INFO] Client %d left (%s) after %ld request(s)\n", pid, why,
+           c->requests);
+  c->next = graveyard;
+  graveyard = c;
+}
+
+static void free_client(client_t *c) {
+  free(c->out.data);
+  free(c->sending.data);
+  free(c);
+}
+
+static void bury_dropped_clients(void) {
+  client_t **pp = &graveyard;
+  while (*pp) {
+    client_t *c = *pp;
+    if (c->writing) {
+      pp = &c->next; /* Its cancelled write has not reported back yet */
+      continue;
+    }
+    *pp = c->next;
+    free_client(c);
+  }
+}
 
-#define CLIENT_TO_SERVER "/tmp/client_to_server"
-#define SERVER_TO_CLIENT "/tmp/server_to_client"
+/* The client closed its reply FIFO without a BYE: it was killed */
+static void on_hangup(evloop_t *l, int fd, void *arg) {
+  client_t *c = arg;
+  char path[64];
+  (void)l;
+  (void)fd;
+  snprintf(path, sizeof(path), REPLY_FIFO_FMT, c->pid);
+  unlink(path); /* Nobody else will */
+  drop_client(c->pid, "hung up");
+}
+
+static client_t *add_client(int pid) {
+  client_t **pp = client_slot(pid);
+  if (*pp)
+    return *pp;
+
+  char path[64];
+  snprintf(path, sizeof(path), REPLY_FIFO_FMT, pid);
+  int fd = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd == -1) {
+    fprintf(stderr, "open %s: %s\n", path, strerror(errno));
+    return NULL;
+  }
+
+  client_t *c = calloc(1, sizeof(*c));
+  if (!c) {
+    close(fd);
+    return NULL;
+  }
+  c->pid = pid;
+  c->fd = fd;
+  if (evloop_watch_hup(loop, fd, on_hangup, c) == -1) {
+    fprintf(stderr, "watch %s: %s\n", path, strerror(errno));
+    evloop_close(loop, fd);
+    free(c);
+    return NULL;
+  }
+  *pp = c;
+
+  if (++connected > peak_clients)
+    peak_clients = connected;
+  if (verbose)
+    printf("[INFO] Client %d connected (%ld online)\n", pid, connected);
+  return c;
+}
+
+static void on_written(evloop_t *l, int fd, ssize_t res, void *arg);
+
+/* Hand everything queued to the loop unless a write is still running */
+static void kick_client(client_t *c) {
+  if (c->writing || c->out.len == 0)
+    return;
+
+  reply_buf_t swap = c->sending;
+  c->sending = c->out;
+  c->out = swap;
+  c->out.len = 0;
+  c->writing = 1;
+  if (evloop_write(loop, c->fd, c->sending.data, c->sending.len, on_written,
+                   c) == -1) {
+    c->writing = 0;
+    drop_client(c->pid, "cannot queue reply");
+  }
+}
 
-int main(void) {
-  int fd_read, fd_write;
-  char buffer[100];
-  char response[100];
-  ssize_t bytes_read;
-  int request_count = 0;
+static void on_written(evloop_t *l, int fd, ssize_t res, void *arg) {
+  client_t *c = arg;
+  (void)l;
+  (void)fd;
+  c->writing = 0;
+  if (c->dead)
+    return;
+  if (res < 0)
+    drop_client(c->pid, "reply FIFO closed"); /* EPIPE */
+  else
+    kick_client(c);
+}
+
+static int queue_reply(client_t *c, const frame_hdr_t *hdr,
+                       const char *payload) {
+  reply_buf_t *out = &c->out;
+  size_t need = out->len + sizeof(*hdr) + hdr->len;
+  if (need + (c->writing ? c->sending.len : 0) > MAX_PENDING)
+    return -1;
+  if (need > out->cap) {
+    size_t cap = out->cap ? out->cap : FRAME_MAX;
+    while (cap < need)
+      cap *= 2;
+    char *grown = realloc(out->data, cap);
+    if (!grown)
+      return -1;
+    out->data = grown;
+    out->cap = cap;
+  }
+  memcpy(out->data + out->len, hdr, sizeof(*hdr));
+  memcpy(out->data + out->len + sizeof(*hdr), payload, hdr->len);
+  out->len = need;
+  return 0;
+}
+
+static void reply_to(client_t *c, const frame_hdr_t *req,
+                     const char *payload) {
+  char response[FRAME_PAYLOAD_MAX];
+
+  c->requests++;
+  total_requests++;
+  if (verbose)
+    printf("📨 Request #%u from client %d: %.*s\n", req->seq, c->pid,
+           (int)req->len, payload);
+
+  /* Process the request (convert to uppercase as example) */
+  size_t offset = snprintf(response, sizeof(response), "PROCESSED: ");
+  for (size_t i = 0; i < req->len && offset < sizeof(response); i++)
+    response[offset++] = toupper((unsigned char)payload[i]);
+
+  frame_hdr_t hdr = {.len = offset,
+                     .type = FRAME_RESPONSE,
+                     .pid = c->pid,
+                     .seq = req->seq};
+  if (queue_reply(c, &hdr, response) == -1)
+    drop_client(c->pid, "reply channel full");
+  else
+    kick_client(c);
+}
+
+/* "sleep <ms>": park the request; anything else is answered now */
+static void handle_request(client_t *c, const frame_hdr_t *req,
+                           const char *payload) {
+  char arg[16];
+  long ms = 0;
+  if (req->len > 6 && req->len - 6 < sizeof(arg) &&
+      memcmp(payload, "sleep ", 6) == 0) {
+    memcpy(arg, payload + 6, req->len - 6);
+    arg[req->len - 6] = '\0';
+    ms = atol(arg);
+  }
+  if (ms <= 0) {
+    reply_to(c, req, payload);
+    return;
+  }
+
+  deferred_t *d = malloc(sizeof(*d) + req->len);
+  if (!d) {
+    reply_to(c, req, payload);
+    return;
+  }
+  d->due_ms = now_ms() + (ms < MAX_SLEEP_MS ? ms : MAX_SLEEP_MS);
+  d->hdr = *req;
+  memcpy(d->payload, payload, req->len);
+  deferred_t **pp = &deferred;
+  while (*pp && (*pp)->due_ms <= d->due_ms)
+    pp = &(*pp)->next;
+  d->next = *pp;
+  *pp = d;
+  total_deferred++;
+}
+
+/* Answer the parked requests that are due; returns ms until the next */
+static int run_deferred(void) {
+  long now = now_ms();
+  while (deferred && deferred->due_ms <= now) {
+    deferred_t *d = deferred;
+    deferred = d->next;
+    client_t *c = *client_slot(d->hdr.pid); /* Gone meanwhile: drop it */
+    if (c)
+      reply_to(c, &d->hdr, d->payload);
+    free(d);
+  }
+  return deferred ? (int)(deferred->due_ms - now) : 1000;
+}
+
+static void handle_frame(const frame_hdr_t *hdr, const char *payload) {
+  client_t *c;
+
+  switch (hdr->type) {
+  case FRAME_HELLO:
+    add_client(hdr->pid);
+    break;
+  case FRAME_REQUEST:
+    c = *client_slot(hdr->pid);
+    if (!c)
+      c = add_client(hdr->pid); /* HELLO is optional */
+    if (c)
+      handle_request(c, hdr, payload);
+    break;
+  case FRAME_BYE:
+    drop_client(hdr->pid, "bye");
+    break;
+  default:
+    fprintf(stderr, "[WARN] Unknown frame type %u from %d\n", hdr->type,
+            hdr->pid);
+  }
+}
+
+/* Handle the whole frames in p; returns how many bytes they used */
+static size_t parse_frames(const char *p, size_t len) {
+  size_t pos = 0;
+  while (len - pos >= sizeof(frame_hdr_t)) {
+    frame_hdr_t hdr;
+    memcpy(&hdr, p + pos, sizeof(hdr));
+    if (hdr.len > FRAME_PAYLOAD_MAX) {
+      fprintf(stderr, "[WARN] Oversized frame, resynchronizing\n");
+      return len;
+    }
+    if (len - pos < sizeof(hdr) + hdr.len)
+      break;
+    handle_frame(&hdr, p + pos + sizeof(hdr));
+    pos += sizeof(hdr) + hdr.len;
+  }
+  return pos;
+}
+
+/*
+ * Data from the request FIFO. Frames are atomic, but one read may still
+ * end in the middle of a frame: the tail is kept for the next chunk, and
+ * only then are bytes copied. Everything else is parsed where the loop
+ * put it.
+ */
+static void on_requests(evloop_t *l, int fd, const char *data, ssize_t len,
+                        void *arg) {
+  (void)l;
+  (void)fd;
+  (void)arg;
+  if (len <= 0) {
+    /* Cannot happen while we hold the keepalive write end */
+    fprintf(stderr, "request FIFO: %s\n", len ? strerror(-len) : "EOF");
+    running = 0;
+    return;
+  }
+
+  if (pending_len > 0) {
+    if (pending_len + len > pending_cap) {
+      size_t cap = pending_len + len;
+      char *grown = realloc(pending, cap);
+      if (!grown) {
+        pending_len = 0; /* Lose the split frame, resynchronize */
+        return;
+      }
+      pending = grown;
+      pending_cap = cap;
+    }
+    memcpy(pending + pending_len, data, len);
+    data = pending;
+    len += pending_len;
+  }
+
+  size_t used = parse_frames(data, len);
+  pending_len = len - used; /* Less than one frame */
+  if (pending_len > 0) {
+    if (pending_cap < FRAME_MAX) {
+      char *grown = realloc(pending, FRAME_MAX);
+      if (!grown) {
+        pending_len = 0;
+        return;
+      }
+      pending = grown;
+      pending_cap = FRAME_MAX;
+    }
+    memmove(pending, data + used, pending_len);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int fd_read, fd_keepalive, opt;
+  evloop_backend_t backend = EVLOOP_EPOLL;
+
+  while ((opt = getopt(argc, argv, "vu")) != -1) {
+    switch (opt) {
+    case 'v':
+      verbose = 1;
+      break;
+    case 'u':
+      backend = EVLOOP_URING;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-v] [-u]\n", argv[0]);
+      fprintf(stderr, "  -v  log every request\n");
+      fprintf(stderr, "  -u  io_uring event loop instead of epoll\n");
+      return 1;
+    }
+  }
+
+  loop = evloop_new(backend);
+  if (!loop) {
+    perror(backend == EVLOOP_URING ? "io_uring" : "epoll");
+    return 1;
+  }
 
   printf("===================================\n");
-  printf("BIDIRECTIONAL FIFO SERVER\n");
+  printf("BIDIRECTIONAL FIFO SERVER (%s)\n", evloop_backend_name(loop));
   printf("===================================\n");
-  printf("Creating FIFOs...\n");
+  printf("Creating request FIFO...\n");
 
-  /* Create both FIFOs */
   if (mkfifo(CLIENT_TO_SERVER, 0666) == -1) {
     /* FIFO already exists, remove and recreate */
     unlink(CLIENT_TO_SERVER);
     mkfifo(CLIENT_TO_SERVER, 0666);
   }
-  if (mkfifo(SERVER_TO_CLIENT, 0666) == -1) {
-    unlink(SERVER_TO_CLIENT);
-    mkfifo(SERVER_TO_CLIENT, 0666);
-  }
-
   printf("  ✓ Created: %s\n", CLIENT_TO_SERVER);
-  printf("  ✓ Created: %s\n\n", SERVER_TO_CLIENT);
+  printf("  Replies go to per-client FIFOs: /tmp/fifo_reply_<pid>\n\n");
+
+  /* Each client costs one descriptor: allow as many as permitted */
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    printf("Descriptor limit: %lu clients max\n", (unsigned long)rl.rlim_cur);
+  }
 
-  printf("Waiting for client to connect...\n");
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
 
-  /* Open FIFOs */
-  fd_read = open(CLIENT_TO_SERVER, O_RDONLY);
+  /*
+   * Non-blocking open never waits for a client. The extra write end keeps
+   * the FIFO from reporting EOF every time the last client disconnects.
+   */
+  fd_read = open(CLIENT_TO_SERVER, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
   if (fd_read == -1) {
     perror("open CLIENT_TO_SERVER");
     return 1;
   }
+  fd_keepalive = open(CLIENT_TO_SERVER, O_WRONLY | O_CLOEXEC);
 
-  fd_write = open(SERVER_TO_CLIENT, O_WRONLY);
-  if (fd_write == -1) {
-    perror("open SERVER_TO_CLIENT");
-    close(fd_read);
+  if (evloop_add_reader(loop, fd_read, on_requests, NULL) == -1) {
+    perror("evloop_add_reader");
     return 1;
   }
 
-  printf("✓ Client connected!\n");
   printf("Server ready to process requests...\n");
-  printf("(Press Ctrl+C to exit)\n\n");
+  printf("(Run with -v to log every request, Ctrl+C to exit)\n\n");
   printf("-----------------------------------\n");
 
-  while (1) {
-    /* Read request from client */
-    bytes_read = read(fd_read, buffer, sizeof(buffer) - 1);
-
-    if (bytes_read == -1) {
-      perror("read");
-      break;
-    }
-
-    if (bytes_read == 0) {
-      printf("\n[INFO] Client disconnected.\n");
-      break;
-    }
-
-    buffer[bytes_read] = '\0';
-    request_count++;
-    
-    printf("📨 Request #%d from client: %s\n", request_count, buffer);
-
-    /* Process the request (convert to uppercase as example) */
-    snprintf(response, sizeof(response), "PROCESSED: ");
-    size_t offset = strlen(response);
-    for (size_t i = 0; buffer[i] && offset < sizeof(response) - 1; i++) {
-      response[offset++] = toupper(buffer[i]);
-    }
-    response[offset] = '\0';
-
-    /* Send response back to client */
-    if (write(fd_write, response, strlen(response) + 1) == -1) {
-      perror("write");
+  int timeout = 1000;
+  while (running) {
+    if (evloop_run_once(loop, timeout < 1000 ? timeout : 1000) == -1) {
+      perror("evloop_run_once");
       break;
     }
-    printf("📤 Response sent: %s\n\n", response);
+    timeout = run_deferred();
+    bury_dropped_clients();
   }
 
-  close(fd_read);
-  close(fd_write);
+  for (int b = 0; b < CLIENT_BUCKETS; b++) {
+    while (clients[b])
+      drop_client(clients[b]->pid, "server shutdown");
+  }
+  evloop_stats_t stats = *evloop_stats(loop);
+  evloop_free(loop); /* Closes fd_read too */
+  while (graveyard) {
+    client_t *c = graveyard;
+    graveyard = c->next;
+    free_client(c);
+  }
+  while (deferred) {
+    deferred_t *d = deferred;
+    deferred = d->next;
+    free(d);
+  }
+  free(pending);
+  close(fd_keepalive);
   unlink(CLIENT_TO_SERVER);
-  unlink(SERVER_TO_CLIENT);
-  
-  printf("-----------------------------------\n");
+
+  printf("\n-----------------------------------\n");
   printf("Server shutting down.\n");
-  printf("Total requests processed: %d\n", request_count);
+  printf("Total requests processed: %ld\n", total_requests);
+  printf("Peak simultaneous clients: %ld\n", peak_clients);
+  if (total_deferred > 0)
+    printf("Answered after a sleep: %ld\n", total_deferred);
+  if (total_requests > 0)
+    printf("Event loop: %lu iterations, %.2f syscalls per request\n",
+           stats.iterations, (double)stats.syscalls / total_requests);
   return 0;
 }
-
@@ -0,0 +1,385 @@
+#define _GNU_SOURCE
+
+#include "fifo_flow.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Queued messages are a singly linked FIFO. Spilled ones sit in the spill
+ * file as [u32 len][bytes] records between spill_rd and spill_wr, and are
+ * always newer than everything in memory: once a message spills, every
+ * later one goes to the file too until it has drained back.
+ */
+
+#define MAX_IOV 64
+
+struct flow_msg {
+  struct flow_msg *next;
+  uint32_t len;
+  char data[];
+};
+
+static const char *const policy_names[] = {
+    [FLOW_BLOCK] = "block",
+    [FLOW_DROP_OLDEST] = "drop-oldest",
+    [FLOW_DROP_NEWEST] = "drop-newest",
+    [FLOW_SPILL] = "spill",
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+const char *flow_policy_name(flow_policy_t policy) {
+  return policy <= FLOW_SPILL ? policy_names[policy] : "?";
+}
+
+int flow_policy_parse(const char *name) {
+  for (int i = 0; i <= FLOW_SPILL; i++)
+    if (strcmp(name, policy_names[i]) == 0)
+      return i;
+  return -1;
+}
+
+int flow_init(flow_writer_t *w, int fd, flow_policy_t policy,
+              size_t queue_max, const char *spill_dir) {
+  memset(w, 0, sizeof(*w));
+  w->fd = fd;
+  w->policy = policy;
+  w->queue_max = queue_max;
+  w->block_ms = -1;
+  w->spill_dir = spill_dir ? spill_dir : "/tmp";
+  w->spill_fd = -1;
+
+  int flags = fcntl(fd, F_GETFL);
+  if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+    return -1;
+  int size = fcntl(fd, F_GETPIPE_SZ);
+  w->st.pipe_size = size > 0 ? (size_t)size : 65536;
+  return 0;
+}
+
+void flow_destroy(flow_writer_t *w) {
+  while (w->head) {
+    struct flow_msg *m = w->head;
+    w->head = m->next;
+    free(m);
+  }
+  w->tail = NULL;
+  w->qbytes = w->qmsgs = 0;
+  if (w->spill_fd != -1)
+    close(w->spill_fd); /* Already unlinked */
+  w->spill_fd = -1;
+  w->spill_msgs = 0;
+}
+
+/* Free space in the pipe according to FIONREAD; also tracks the peak */
+static size_t pipe_room(flow_writer_t *w) {
+  int used = 0;
+  if (ioctl(w->fd, FIONREAD, &used) == -1)
+    used = 0;
+  w->st.pipe_used = used;
+  if (w->st.pipe_used > w->st.pipe_peak)
+    w->st.pipe_peak = w->st.pipe_used;
+  return w->st.pipe_size > w->st.pipe_used
+             ? w->st.pipe_size - w->st.pipe_used
+             : 0;
+}
+
+/* Wait for POLLOUT, counting the time as blocked */
+static int wait_writable(flow_writer_t *w, int timeout_ms) {
+  struct pollfd p = {.fd = w->fd, .events = POLLOUT};
+  uint64_t t0 = now_ns();
+  int n = poll(&p, 1, timeout_ms);
+  w->st.blocked_ns += now_ns() - t0;
+  if (n == -1)
+    return errno == EINTR ? 0 : -1;
+  if (n == 0) {
+    errno = ETIMEDOUT;
+    return -1;
+  }
+  if (p.revents & (POLLERR | POLLHUP)) {
+    errno = EPIPE; /* No reader any more */
+    return -1;
+  }
+  return 0;
+}
+
+/* 1 if written, 0 if the pipe is full, -1 on error */
+static int try_write(flow_writer_t *w, const struct iovec *iov, int iovcnt,
+                     size_t len) {
+  ssize_t n;
+  do {
+    n = writev(w->fd, iov, iovcnt);
+  } while (n == -1 && errno == EINTR);
+  if (n == -1) {
+    if (errno != EAGAIN)
+      return -1;
+    w->st.stalls++;
+    return 0;
+  }
+  /* Up to PIPE_BUF bytes go in whole or not at all */
+  w->st.msgs_sent++;
+  w->st.bytes_sent += len;
+  return 1;
+}
+
+static int enqueue(flow_writer_t *w, const struct iovec *iov, int iovcnt,
+                   size_t len) {
+  struct flow_msg *m = malloc(sizeof(*m) + len);
+  if (!m)
+    return -1;
+  m->next = NULL;
+  m->len = len;
+  size_t off = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    memcpy(m->data + off, iov[i].iov_base, iov[i].iov_len);
+    off += iov[i].iov_len;
+  }
+  if (w->tail)
+    w->tail->next = m;
+  else
+    w->head = m;
+  w->tail = m;
+  w->qbytes += len;
+  w->qmsgs++;
+  return 0;
+}
+
+static struct flow_msg *dequeue(flow_writer_t *w) {
+  struct flow_msg *m = w->head;
+  w->head = m->next;
+  if (!w->head)
+    w->tail = NULL;
+  w->qbytes -= m->len;
+  w->qmsgs--;
+  return m;
+}
+
+static void count_drop(flow_writer_t *w, size_t len) {
+  w->st.msgs_dropped++;
+  w->st.bytes_dropped += len;
+}
+
+/* ------------------------------------------------------------------ */
+/* Spill file                                                           */
+/* ------------------------------------------------------------------ */
+
+static int spill_open(flow_writer_t *w) {
+  if (w->spill_fd != -1)
+    return 0;
+  /* An unnamed file: it disappears with the writer, even on a crash */
+  w->spill_fd = open(w->spill_dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (w->spill_fd == -1 && errno == EOPNOTSUPP) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/fifo_spill_XXXXXX", w->spill_dir);
+    w->spill_fd = mkostemp(path, O_CLOEXEC);
+    if (w->spill_fd != -1)
+      unlink(path);
+  }
+  return w->spill_fd == -1 ? -1 : 0;
+}
+
+static int spill_append(flow_writer_t *w, const struct iovec *iov,
+                        int iovcnt, size_t len) {
+  if (spill_open(w) == -1)
+    return -1;
+  uint32_t hdr = len;
+  struct iovec v[1 + MAX_IOV];
+  v[0] = (struct iovec){&hdr, sizeof(hdr)};
+  memcpy(v + 1, iov, iovcnt * sizeof(*iov));
+  ssize_t n = pwritev(w->spill_fd, v, 1 + iovcnt, w->spill_wr);
+  if (n != (ssize_t)(sizeof(hdr) + len)) {
+    if (n >= 0)
+      errno = ENOSPC;
+    return -1;
+  }
+  w->spill_wr += n;
+  w->spill_msgs++;
+  w->st.msgs_spilled++;
+  w->st.bytes_spilled += len;
+  return 0;
+}
+
+/* Bring spilled messages back into memory while the queue has room */
+static int spill_refill(flow_writer_t *w) {
+  while (w->spill_msgs > 0 && (w->qmsgs == 0 || w->qbytes < w->queue_max)) {
+    uint32_t len;
+    if (pread(w->spill_fd, &len, sizeof(len), w->spill_rd) != sizeof(len))
+      goto bad;
+    struct flow_msg *m = malloc(sizeof(*m) + len);
+    if (!m)
+      return -1;
+    if (pread(w->spill_fd, m->data, len, w->spill_rd + sizeof(len)) !=
+        (ssize_t)len) {
+      free(m);
+      goto bad;
+    }
+    m->next = NULL;
+    m->len = len;
+    if (w->tail)
+      w->tail->next = m;
+    else
+      w->head = m;
+    w->tail = m;
+    w->qbytes += len;
+    w->qmsgs++;
+    w->spill_rd += sizeof(len) + len;
+    w->spill_msgs--;
+  }
+  if (w->spill_msgs == 0 && w->spill_wr > 0) {
+    /* Drained: start the file over so it never grows without bound */
+    if (ftruncate(w->spill_fd, 0) == -1)
+      return -1;
+    w->spill_rd = w->spill_wr = 0;
+  }
+  return 0;
+bad:
+  errno = EIO;
+  return -1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Sending                                                              */
+/* ------------------------------------------------------------------ */
+
+int flow_pump(flow_writer_t *w) {
+  for (;;) {
+    if (w->spill_msgs > 0 && spill_refill(w) == -1)
+      return -1;
+    if (!w->head)
+      return 0;
+
+    /* As many whole messages as fit in the pipe, in one atomic write. The
+     * first always goes: FIONREAD counts bytes, the kernel counts pages,
+     * and a pipe that polls writable takes one PIPE_BUF write. */
+    size_t room = pipe_room(w), bytes = 0;
+    if (room > PIPE_BUF)
+      room = PIPE_BUF;
+    struct iovec iov[MAX_IOV];
+    int n = 0;
+    for (struct flow_msg *m = w->head; m && n < MAX_IOV; m = m->next) {
+      if (n > 0 && bytes + m->len > room)
+        break;
+      iov[n++] = (struct iovec){m->data, m->len};
+      bytes += m->len;
+    }
+
+    ssize_t r;
+    do {
+      r = writev(w->fd, iov, n);
+    } while (r == -1 && errno == EINTR);
+    if (r == -1) {
+      if (errno != EAGAIN)
+        return -1;
+      w->st.stalls++;
+      return 0;
+    }
+    for (int i = 0; i < n; i++) {
+      struct flow_msg *m = dequeue(w);
+      w->st.msgs_sent++;
+      w->st.bytes_sent += m->len;
+      free(m);
+    }
+  }
+}
+
+int flow_sendv(flow_writer_t *w, const struct iovec *iov, int iovcnt,
+               int flags) {
+  size_t len = 0;
+  for (int i = 0; i < iovcnt; i++)
+    len += iov[i].iov_len;
+  if (len > PIPE_BUF || iovcnt > MAX_IOV) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  /* FLOW_MORE: collect messages until a PIPE_BUF batch is ready */
+  int more = flags & FLOW_MORE;
+  if (!more || w->qbytes + len > PIPE_BUF) {
+    if (flow_pump(w) == -1)
+      return -1;
+    if (!more && !flow_pending(w)) {
+      int r = try_write(w, iov, iovcnt, len);
+      if (r != 0)
+        return r == 1 ? 0 : -1;
+    }
+  }
+
+  if (w->spill_msgs > 0)
+    return spill_append(w, iov, iovcnt, len); /* Stay behind them */
+  while (w->qbytes + len > w->queue_max) {
+    /* The queue is full. Is the pipe too? */
+    if (!flow_pending(w)) {
+      int r = try_write(w, iov, iovcnt, len);
+      if (r != 0)
+        return r == 1 ? 0 : -1;
+    }
+    switch (w->policy) {
+    case FLOW_BLOCK:
+      if (wait_writable(w, w->block_ms) == -1 || flow_pump(w) == -1)
+        return -1;
+      break;
+    case FLOW_DROP_OLDEST:
+      if (w->head) {
+        struct flow_msg *m = dequeue(w);
+        count_drop(w, m->len);
+        free(m);
+        break;
+      }
+      /* Bigger than the whole queue: nothing older to drop */
+      /* fall through */
+    case FLOW_DROP_NEWEST:
+      count_drop(w, len);
+      return 0;
+    case FLOW_SPILL:
+      return spill_append(w, iov, iovcnt, len);
+    }
+  }
+  return enqueue(w, iov, iovcnt, len);
+}
+
+int flow_send(flow_writer_t *w, const void *msg, size_t len) {
+  struct iovec iov = {(void *)msg, len};
+  return flow_sendv(w, &iov, 1, 0);
+}
+
+int flow_flush(flow_writer_t *w, int timeout_ms) {
+  uint64_t deadline = now_ns() + (uint64_t)timeout_ms * 1000000;
+  for (;;) {
+    if (flow_pump(w) == -1)
+      return -1;
+    if (!flow_pending(w))
+      return 0;
+    int wait_ms = -1;
+    if (timeout_ms >= 0) {
+      uint64_t now = now_ns();
+      if (now >= deadline) {
+        errno = ETIMEDOUT;
+        return -1;
+      }
+      wait_ms = (deadline - now + 999999) / 1000000;
+    }
+    if (wait_writable(w, wait_ms) == -1)
+      return -1;
+  }
+}
+
+void flow_stats(flow_writer_t *w, flow_stats_t *st) {
+  pipe_room(w);
+  w->st.msgs_queued = w->qmsgs + w->spill_msgs;
+  w->st.bytes_queued = w->qbytes + (w->spill_wr - w->spill_rd) -
+                       w->spill_msgs * sizeof(uint32_t);
+  *st = w->st;
+}
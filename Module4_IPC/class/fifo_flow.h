@@ -0,0 +1,122 @@
+/*
+ * fifo_flow.h - Non-blocking FIFO writer with backpressure policies
+ *
+ * A plain write() to a FIFO whose reader stopped reading blocks as soon as
+ * the pipe (64 KiB by default) is full, and the writer cannot tell that it
+ * is stuck, let alone why. A flow writer switches the FIFO to O_NONBLOCK
+ * and keeps a bounded queue of messages of its own in front of it:
+ *
+ *   message -> [ writer queue, queue_max bytes ] -> [ pipe ] -> reader
+ *                       |
+ *                       +-- full: apply the policy
+ *
+ *   FLOW_BLOCK        wait in poll() for room (the old behaviour, but the
+ *                     time spent waiting is counted)
+ *   FLOW_DROP_OLDEST  discard queued messages, oldest first (latest data
+ *                     wins: metrics, status updates)
+ *   FLOW_DROP_NEWEST  discard the message being sent (the queue keeps a
+ *                     consistent prefix: logs that may lose a tail)
+ *   FLOW_SPILL        append to a temporary file and send from there, in
+ *                     order, once the reader catches up (nothing lost)
+ *
+ * Every message is written with one writev() of at most PIPE_BUF bytes,
+ * so it arrives whole even with other writers on the same FIFO. Queued
+ * messages are sent in batches as large as the room in the pipe, which
+ * FIONREAD reports (pipe size minus bytes unread).
+ */
+
+#ifndef FIFO_FLOW_H
+#define FIFO_FLOW_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+typedef enum {
+  FLOW_BLOCK = 0,
+  FLOW_DROP_OLDEST,
+  FLOW_DROP_NEWEST,
+  FLOW_SPILL,
+} flow_policy_t;
+
+typedef struct {
+  uint64_t msgs_sent, bytes_sent;
+  uint64_t msgs_queued, bytes_queued; /* Waiting now, in memory or spilled */
+  uint64_t msgs_dropped, bytes_dropped;
+  uint64_t msgs_spilled, bytes_spilled; /* Ever written to the spill file */
+  uint64_t stalls;     /* Times a write found the pipe full */
+  uint64_t blocked_ns; /* Time spent waiting in poll() for room */
+  size_t pipe_used;    /* Unread bytes in the pipe, at the last check */
+  size_t pipe_peak;
+  size_t pipe_size;
+} flow_stats_t;
+
+struct flow_msg; /* Queued message, see fifo_flow.c */
+
+typedef struct {
+  int fd;
+  flow_policy_t policy;
+  size_t queue_max; /* Bytes queued in memory before the policy applies */
+  int block_ms;     /* FLOW_BLOCK: fail with ETIMEDOUT after this long
+                       (-1, the default: wait forever) */
+  struct flow_msg *head, *tail;
+  size_t qbytes, qmsgs;
+  const char *spill_dir;
+  int spill_fd; /* -1 until the first spill */
+  off_t spill_rd, spill_wr;
+  uint64_t spill_msgs;
+  flow_stats_t st;
+} flow_writer_t;
+
+/*
+ * Take over `fd` (the write end of a FIFO or pipe) and make it
+ * non-blocking. queue_max 0 means no queue at all: the policy applies as
+ * soon as the pipe is full. Spill files go to `spill_dir` (NULL: /tmp).
+ * Returns 0, or -1 with errno set.
+ */
+int flow_init(flow_writer_t *w, int fd, flow_policy_t policy,
+              size_t queue_max, const char *spill_dir);
+
+/* Drop whatever is still queued and remove the spill file; fd stays open */
+void flow_destroy(flow_writer_t *w);
+
+/* flow_sendv() flags */
+#define FLOW_MORE 1 /* More messages follow: batch them (like MSG_MORE) */
+
+/*
+ * Send one message of at most PIPE_BUF bytes, gathered from iov: into the
+ * pipe if there is room and nothing is queued ahead of it, else into the
+ * queue according to the policy. With FLOW_MORE it is only queued until
+ * PIPE_BUF bytes are waiting, then they all go in one writev(); call
+ * flow_pump() or flow_flush() after the last one.
+ * Returns 0 (sent, queued, spilled or dropped: see the counters), or -1
+ * with errno set (EMSGSIZE, EPIPE when the reader is gone, ENOSPC/EIO
+ * from the spill file, ETIMEDOUT when FLOW_BLOCK waited block_ms).
+ */
+int flow_sendv(flow_writer_t *w, const struct iovec *iov, int iovcnt,
+               int flags);
+int flow_send(flow_writer_t *w, const void *msg, size_t len);
+
+/* Move queued messages into the pipe as far as it has room; never blocks */
+int flow_pump(flow_writer_t *w);
+
+/*
+ * Wait up to timeout_ms (-1: forever) until everything queued is in the
+ * pipe. Returns 0, or -1 with errno ETIMEDOUT or EPIPE.
+ */
+int flow_flush(flow_writer_t *w, int timeout_ms);
+
+/* Messages waiting in the queue or the spill file */
+static inline int flow_pending(const flow_writer_t *w) {
+  return w->qmsgs > 0 || w->spill_msgs > 0;
+}
+
+/* Counters, with pipe_used refreshed from FIONREAD */
+void flow_stats(flow_writer_t *w, flow_stats_t *st);
+
+const char *flow_policy_name(flow_policy_t policy);
+/* "block", "drop-oldest", "drop-newest" or "spill"; -1 if none matches */
+int flow_policy_parse(const char *name);
+
+#endif /* FIFO_FLOW_H */
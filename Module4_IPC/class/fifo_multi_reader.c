@@ -1,16 +1,95 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
-#include <sys/stat.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fifo_proto.h"
+
+/*
+ * Reads framed messages (see fifo_proto.h) from any number of writers.
+ *
+ * A single read() may return several frames, or end in the middle of one,
+ * so the reader fills one large buffer and parses whole frames out of it.
+ * Per-writer sequence numbers show that no frame was lost or torn.
+ *
+ *   ./fifo_multi_reader       # Print every message
+ *   ./fifo_multi_reader -q    # Only print msgs/s once per second
+ */
+
+#define READ_BUF_SIZE (64 * 1024)
+#define MAX_WRITERS 1024
+
+typedef struct {
+  int pid; /* 0 = free slot */
+  uint32_t next_seq;
+  long messages;
+  long gaps;
+} writer_t;
+
+static writer_t writers[MAX_WRITERS];
+static volatile sig_atomic_t running = 1;
 
-int main(void) {
-  const char *fifo_path = "/tmp/multi_writer_fifo";
+static void on_signal(int sig) {
+  (void)sig;
+  running = 0;
+}
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Open-addressed by PID; the last slot is shared if the table fills up */
+static writer_t *find_writer(int pid) {
+  unsigned h = (unsigned)pid % MAX_WRITERS;
+  for (int probe = 0; probe < MAX_WRITERS - 1; probe++) {
+    writer_t *w = &writers[(h + probe) % MAX_WRITERS];
+    if (w->pid == pid || w->pid == 0) {
+      w->pid = pid;
+      return w;
+    }
+  }
+  return &writers[MAX_WRITERS - 1];
+}
+
+/* Print and reset the per-writer stats of the session that just ended */
+static void session_report(long messages, long bytes, double elapsed) {
+  long gaps = 0;
+  int nwriters = 0;
+
+  for (int i = 0; i < MAX_WRITERS; i++) {
+    if (writers[i].pid == 0)
+      continue;
+    nwriters++;
+    gaps += writers[i].gaps;
+  }
+  if (elapsed <= 0)
+    elapsed = 1e-9;
+
+  printf("[STATS] %ld messages from %d writer(s) in %.3f s: %.0f msgs/s, "
+         "%.1f MB/s, %ld sequence gap(s)\n",
+         messages, nwriters, elapsed, messages / elapsed,
+         bytes / elapsed / 1e6, gaps);
+  memset(writers, 0, sizeof(writers));
+}
+
+int main(int argc, char *argv[]) {
   int fd;
-  char buffer[100];
+  char *buffer;
+  size_t have = 0;
   ssize_t bytes_read;
-  int message_count = 0;
+  int quiet = argc > 1 && strcmp(argv[1], "-q") == 0;
+  long message_count = 0;
+  long session_msgs = 0, session_bytes = 0, window_msgs = 0;
+  double session_start = 0, window_start = 0;
 
   printf("===================================\n");
   printf("MULTI-WRITER FIFO READER\n");
@@ -18,15 +97,20 @@ int main(void) {
   printf("This reader can receive messages from MULTIPLE writers!\n\n");
 
   /* Create the FIFO if it doesn't exist */
-  if (mkfifo(fifo_path, 0666) == -1) {
+  if (mkfifo(MULTI_WRITER_FIFO, 0666) == -1) {
     /* FIFO already exists, that's OK */
   }
 
-  printf("Opening FIFO for reading: %s\n", fifo_path);
+  /* No SA_RESTART: Ctrl+C interrupts a blocked open() or read() */
+  struct sigaction sa = {.sa_handler = on_signal};
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  printf("Opening FIFO for reading: %s\n", MULTI_WRITER_FIFO);
   printf("Waiting for writers to connect...\n\n");
 
   /* Open FIFO for reading */
-  fd = open(fifo_path, O_RDONLY);
+  fd = open(MULTI_WRITER_FIFO, O_RDONLY);
   if (fd == -1) {
     perror("open");
     return 1;
@@ -36,39 +120,99 @@ int main(void) {
   printf("Ready to receive messages from multiple writers...\n");
   printf("(Press Ctrl+C to exit)\n\n");
   printf("-----------------------------------\n");
+  fflush(stdout);
 
-  while (1) {
-    /* Read from FIFO */
-    bytes_read = read(fd, buffer, sizeof(buffer) - 1);
+  buffer = malloc(READ_BUF_SIZE);
+  session_start = window_start = now_sec();
+
+  while (running) {
+    /* One big read picks up as many frames as the pipe holds */
+    bytes_read = read(fd, buffer + have, READ_BUF_SIZE - have);
 
     if (bytes_read == -1) {
+      if (errno == EINTR)
+        continue;
       perror("read");
       break;
     }
 
     if (bytes_read == 0) {
       /* All writers closed - wait for new writers */
+      if (have > 0)
+        printf("[WARN] %zu trailing byte(s) of a partial frame dropped\n",
+               have);
+      have = 0;
+      session_report(session_msgs, session_bytes, now_sec() - session_start);
       printf("\n[INFO] All writers disconnected. Waiting for new connections...\n");
+      fflush(stdout);
       close(fd);
-      
+
       /* Reopen FIFO (will block until a writer connects) */
-      fd = open(fifo_path, O_RDONLY);
+      fd = open(MULTI_WRITER_FIFO, O_RDONLY);
       if (fd == -1) {
-        perror("reopen");
+        if (errno != EINTR)
+          perror("reopen");
         break;
       }
+      session_msgs = session_bytes = window_msgs = 0;
+      session_start = window_start = now_sec();
       continue;
     }
 
-    buffer[bytes_read] = '\0';
-    message_count++;
-    printf("📬 Message #%d: %s\n", message_count, buffer);
+    if (session_bytes == 0) /* Time the session from its first byte */
+      session_start = window_start = now_sec();
+    have += bytes_read;
+    session_bytes += bytes_read;
+
+    /* Parse every complete frame; keep a partial one for the next read */
+    size_t pos = 0;
+    while (have - pos >= sizeof(frame_hdr_t)) {
+      frame_hdr_t hdr;
+      memcpy(&hdr, buffer + pos, sizeof(hdr));
+      if (hdr.len > FRAME_PAYLOAD_MAX || hdr.type != FRAME_MESSAGE) {
+        fprintf(stderr, "[WARN] Corrupt frame header, discarding buffer\n");
+        pos = have;
+        break;
+      }
+      if (have - pos < sizeof(hdr) + hdr.len)
+        break;
+
+      writer_t *w = find_writer(hdr.pid);
+      if (hdr.seq != w->next_seq)
+        w->gaps++;
+      w->next_seq = hdr.seq + 1;
+      w->messages++;
+
+      message_count++;
+      session_msgs++;
+      window_msgs++;
+      if (!quiet)
+        printf("📬 Message #%ld: %.*s\n", message_count, (int)hdr.len,
+               buffer + pos + sizeof(hdr));
+      pos += sizeof(hdr) + hdr.len;
+    }
+    memmove(buffer, buffer + pos, have - pos);
+    have -= pos;
+
+    if (quiet) {
+      double now = now_sec();
+      if (now - window_start >= 1.0) {
+        printf("[RATE] %.0f msgs/s\n", window_msgs / (now - window_start));
+        fflush(stdout);
+        window_msgs = 0;
+        window_start = now;
+      }
+    }
   }
 
-  close(fd);
-  unlink(fifo_path);
+  if (fd != -1) {
+    if (session_msgs > 0)
+      session_report(session_msgs, session_bytes, now_sec() - session_start);
+    close(fd);
+  }
+  free(buffer);
+  unlink(MULTI_WRITER_FIFO);
   printf("\nReader exiting.\n");
-  printf("Total messages received: %d\n", message_count);
+  printf("Total messages received: %ld\n", message_count);
   return 0;
 }
-
@@ -1,32 +1,202 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "fifo_flow.h"
+#include "fifo_proto.h"
+
+/*
+ * Every message is a frame (see fifo_proto.h). A write of at most PIPE_BUF
+ * bytes is atomic, so several frames can be batched into one writev() as
+ * long as the whole batch still fits in PIPE_BUF.
+ *
+ * By default a stalled reader makes write() block forever. With -p the
+ * writer never blocks unexpectedly: it goes through a flow writer
+ * (fifo_flow.h) that queues up to -Q KiB and then applies the policy, and
+ * it reports pipe occupancy, queued bytes and time blocked.
+ *
+ *   ./fifo_multi_writer 1                  # Interactive, one frame per line
+ *   ./fifo_multi_writer 1 -n 100000        # Flood 100000 messages
+ *   ./fifo_multi_writer 1 -n 100000 -b 1   # Same, one write per message
+ *   ./fifo_multi_writer 1 -n 100000 -p drop-newest   # Never block
+ */
+
+#define MAX_BATCH 64
+
+static int fd = -1;
+static uint32_t seq = 0;
+static flow_writer_t *flow; /* NULL: plain blocking writes */
+static const char *flow_id;
+
+static void print_flow(const char *writer_id);
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Frames waiting to be written together */
+static struct {
+  frame_hdr_t hdr[MAX_BATCH];
+  char payload[MAX_BATCH][FRAME_PAYLOAD_MAX];
+  struct iovec iov[2 * MAX_BATCH];
+  int count;
+  size_t bytes;
+} batch;
+
+static int flush_batch(void) {
+  if (batch.count == 0)
+    return 0;
+  /* bytes <= PIPE_BUF: the reader sees all of it or none of it */
+  ssize_t n = writev(fd, batch.iov, 2 * batch.count);
+  batch.count = 0;
+  batch.bytes = 0;
+  return n == -1 ? -1 : 0;
+}
+
+/* Queue one frame, flushing first if it would push the batch past PIPE_BUF */
+static int queue_frame(const char *msg, size_t len, int max_batch) {
+  if (len > FRAME_PAYLOAD_MAX)
+    len = FRAME_PAYLOAD_MAX;
+  if (flow) {
+    /* The flow writer does its own batching */
+    frame_hdr_t hdr = {
+        .len = len, .type = FRAME_MESSAGE, .pid = getpid(), .seq = seq++};
+    struct iovec iov[2] = {{&hdr, sizeof(hdr)}, {(void *)msg, len}};
+    int ret;
+    /* Blocked a whole second: say so, then keep waiting */
+    while ((ret = flow_sendv(flow, iov, 2, max_batch > 1 ? FLOW_MORE : 0)) ==
+               -1 &&
+           errno == ETIMEDOUT)
+      print_flow(flow_id);
+    return ret;
+  }
+  if (batch.count == max_batch ||
+      batch.bytes + sizeof(frame_hdr_t) + len > PIPE_BUF) {
+    if (flush_batch() == -1)
+      return -1;
+  }
+
+  int i = batch.count++;
+  batch.hdr[i] = (frame_hdr_t){
+      .len = len, .type = FRAME_MESSAGE, .pid = getpid(), .seq = seq++};
+  memcpy(batch.payload[i], msg, len);
+  batch.iov[2 * i] = (struct iovec){&batch.hdr[i], sizeof(frame_hdr_t)};
+  batch.iov[2 * i + 1] = (struct iovec){batch.payload[i], len};
+  batch.bytes += sizeof(frame_hdr_t) + len;
+  return 0;
+}
+
+static void print_flow(const char *writer_id) {
+  flow_stats_t st;
+  flow_stats(flow, &st);
+  printf("[FLOW] %s: pipe %zu/%zu KiB (peak %zu), queued %lu msgs "
+         "(%.1f KiB), sent %lu, dropped %lu, spilled %lu, blocked %.3f s "
+         "over %lu stalls\n",
+         writer_id, st.pipe_used / 1024, st.pipe_size / 1024,
+         st.pipe_peak / 1024, (unsigned long)st.msgs_queued,
+         st.bytes_queued / 1024.0, (unsigned long)st.msgs_sent,
+         (unsigned long)st.msgs_dropped, (unsigned long)st.msgs_spilled,
+         st.blocked_ns / 1e9, (unsigned long)st.stalls);
+  fflush(stdout);
+}
+
+static int flood(const char *writer_id, long count, int size, int max_batch) {
+  char msg[FRAME_PAYLOAD_MAX];
+
+  double start = now_sec(), last_report = start;
+  for (long i = 0; i < count; i++) {
+    int len = snprintf(msg, sizeof(msg), "[%s]: message %ld", writer_id, i);
+    if (len < size) {
+      memset(msg + len, '.', size - len);
+      len = size;
+    }
+    if (queue_frame(msg, len, max_batch) == -1) {
+      perror("writev");
+      return 1;
+    }
+    /* Once a second, show whether the reader keeps up */
+    if (flow && (i & 1023) == 0 && now_sec() - last_report >= 1.0) {
+      print_flow(writer_id);
+      last_report = now_sec();
+    }
+  }
+  if (flow) {
+    /* Give a stalled reader a few seconds, then give up on the rest */
+    if (flow_flush(flow, 5000) == -1)
+      perror("flow_flush");
+  } else if (flush_batch() == -1) {
+    perror("writev");
+    return 1;
+  }
+  double elapsed = now_sec() - start;
+
+  printf("%s: %ld messages in %.3f s = %.0f msgs/s (batch %d)\n", writer_id,
+         count, elapsed, count / elapsed, max_batch);
+  if (flow)
+    print_flow(writer_id);
+  return 0;
+}
+
 int main(int argc, char *argv[]) {
-  const char *fifo_path = "/tmp/multi_writer_fifo";
-  int fd;
-  char message[100];
+  char message[FRAME_PAYLOAD_MAX];
   char writer_id[20];
   int msg_count = 0;
+  long flood_count = 0;
+  int size = 0, max_batch = MAX_BATCH, opt;
+  int policy = -1;
+  size_t queue_kib = 256;
+
+  while ((opt = getopt(argc, argv, "n:s:b:p:Q:")) != -1) {
+    switch (opt) {
+    case 'n':
+      flood_count = atol(optarg);
+      break;
+    case 's':
+      size = atoi(optarg);
+      break;
+    case 'b':
+      max_batch = atoi(optarg);
+      break;
+    case 'p':
+      policy = flow_policy_parse(optarg);
+      if (policy == -1) {
+        printf("Policies: block, drop-oldest, drop-newest, spill\n");
+        return 1;
+      }
+      break;
+    case 'Q':
+      queue_kib = atol(optarg);
+      break;
+    default:
+      printf("Usage: %s [id] [-n messages] [-s size] [-b batch] "
+             "[-p policy] [-Q queue KiB]\n",
+             argv[0]);
+      return 1;
+    }
+  }
+  if (max_batch < 1 || max_batch > MAX_BATCH)
+    max_batch = MAX_BATCH;
+  if (size < 0 || size > (int)FRAME_PAYLOAD_MAX)
+    size = FRAME_PAYLOAD_MAX;
 
   /* Get writer ID from command line or use default */
-  if (argc > 1) {
-    snprintf(writer_id, sizeof(writer_id), "Writer %s", argv[1]);
+  if (optind < argc) {
+    snprintf(writer_id, sizeof(writer_id), "Writer %.12s", argv[optind]);
   } else {
     snprintf(writer_id, sizeof(writer_id), "Writer %d", getpid());
   }
 
-  printf("===================================\n");
-  printf("MULTI-WRITER FIFO: %s\n", writer_id);
-  printf("===================================\n");
-  printf("PID: %d\n", getpid());
-  printf("Connecting to FIFO: %s\n\n", fifo_path);
-
   /* Open FIFO for writing */
-  printf("Opening FIFO for writing...\n");
-  fd = open(fifo_path, O_WRONLY);
+  fd = open(MULTI_WRITER_FIFO, O_WRONLY);
   if (fd == -1) {
     perror("open");
     printf("\n❌ Error: Make sure the READER is running first!\n");
@@ -34,14 +204,41 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  printf("✓ Connected to reader!\n");
+  flow_writer_t fw;
+  if (policy != -1) {
+    if (flow_init(&fw, fd, policy, queue_kib * 1024, NULL) == -1) {
+      perror("flow_init");
+      return 1;
+    }
+    fw.block_ms = 1000;
+    flow = &fw;
+    flow_id = writer_id;
+  }
+
+  if (flood_count > 0) {
+    int ret = flood(writer_id, flood_count, size, max_batch);
+    if (flow)
+      flow_destroy(flow);
+    close(fd);
+    return ret;
+  }
+
+  printf("===================================\n");
+  printf("MULTI-WRITER FIFO: %s\n", writer_id);
+  printf("===================================\n");
+  printf("PID: %d\n", getpid());
+  printf("✓ Connected to reader on %s\n", MULTI_WRITER_FIFO);
+  if (flow)
+    printf("Non-blocking, policy %s, queue %zu KiB ('stats' shows "
+           "counters)\n",
+           flow_policy_name(policy), queue_kib);
   printf("Enter messages (type 'quit' to exit):\n");
   printf("-----------------------------------\n");
 
   while (1) {
     printf("[%s]> ", writer_id);
     fflush(stdout);
-    
+
     if (fgets(message, sizeof(message), stdin) == NULL) {
       break;
     }
@@ -59,22 +256,41 @@ int main(int argc, char *argv[]) {
       continue;
     }
 
+    if (flow && strcmp(message, "stats") == 0) {
+      print_flow(writer_id);
+      continue;
+    }
+
     /* Prepend writer ID to message */
-    char full_message[150];
-    snprintf(full_message, sizeof(full_message), "[%s]: %s", writer_id, message);
+    char full_message[FRAME_PAYLOAD_MAX];
+    int len = snprintf(full_message, sizeof(full_message), "[%s]: %s",
+                       writer_id, message);
+    if (len >= (int)sizeof(full_message))
+      len = sizeof(full_message) - 1;
 
-    /* Write to FIFO */
-    if (write(fd, full_message, strlen(full_message) + 1) == -1) {
+    /* Interactive lines go out one frame per write */
+    uint64_t dropped = flow ? flow->st.msgs_dropped : 0;
+    if (queue_frame(full_message, len, 1) == -1 || flush_batch() == -1) {
       perror("write");
       break;
     }
     msg_count++;
-    printf("  ✓ Sent (message #%d)\n", msg_count);
+    if (flow && flow->st.msgs_dropped != dropped)
+      printf("  ✗ Dropped (message #%d, reader is behind)\n", msg_count);
+    else if (flow && flow_pending(flow))
+      printf("  ⏳ Queued (message #%d, reader is behind)\n", msg_count);
+    else
+      printf("  ✓ Sent (message #%d)\n", msg_count);
   }
 
+  if (flow) {
+    if (flow_flush(flow, 5000) == -1)
+      perror("flow_flush");
+    print_flow(writer_id);
+    flow_destroy(flow);
+  }
   close(fd);
   printf("\n%s exiting.\n", writer_id);
   printf("Total messages sent: %d\n", msg_count);
   return 0;
 }
-
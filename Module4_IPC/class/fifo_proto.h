@@ -0,0 +1,49 @@
+/*
+ * fifo_proto.h - Framing shared by the FIFO demos (bidir and multi-writer)
+ *
+ * All clients write requests into ONE well-known FIFO. Writes of at most
+ * PIPE_BUF bytes are atomic, so as long as every frame fits in PIPE_BUF the
+ * frames from different clients can never interleave.
+ *
+ * Each client creates its own reply FIFO (/tmp/fifo_reply_<pid>) and the
+ * server answers there, so replies can never go to the wrong client.
+ * A response carries the seq (request ID) of its request and may come
+ * back out of order, so a client can keep many requests in flight
+ * (fifo_rpc.h).
+ *
+ *   +--------+--------+--------+--------+-----------------+
+ *   |  len   |  type  |  pid   |  seq   |  payload (len)  |
+ *   +--------+--------+--------+--------+-----------------+
+ *     4 bytes  4 bytes  4 bytes  4 bytes
+ */
+
+#ifndef FIFO_PROTO_H
+#define FIFO_PROTO_H
+
+#include <limits.h>
+#include <stdint.h>
+
+#define CLIENT_TO_SERVER "/tmp/client_to_server"
+#define REPLY_FIFO_FMT "/tmp/fifo_reply_%d"
+#define MULTI_WRITER_FIFO "/tmp/multi_writer_fifo"
+
+enum frame_type {
+  FRAME_HELLO = 1, /* Client created its reply FIFO and opened it */
+  FRAME_REQUEST,   /* Client -> server */
+  FRAME_RESPONSE,  /* Server -> client, seq echoes the request */
+  FRAME_BYE,       /* Client is leaving */
+  FRAME_MESSAGE,   /* Multi-writer -> reader, seq counts per writer */
+};
+
+typedef struct {
+  uint32_t len; /* Payload bytes after this header */
+  uint32_t type;
+  int32_t pid; /* Sender's PID: names the reply FIFO */
+  uint32_t seq;
+} frame_hdr_t;
+
+/* Largest frame that is still written atomically */
+#define FRAME_MAX PIPE_BUF
+#define FRAME_PAYLOAD_MAX (FRAME_MAX - sizeof(frame_hdr_t))
+
+#endif /* FIFO_PROTO_H */
@@ -0,0 +1,380 @@
+/*
+ * fifo_rpc.c - Pipelined request/response client for the bidir FIFO server
+ *
+ * See fifo_rpc.h for the API.
+ *
+ * The request FIFO stays blocking: the server never stops reading it, so
+ * a write only ever waits for a moment. The reply FIFO is non-blocking and
+ * poll()ed, so a dead server shows up as a timeout or EOF, never a hang.
+ */
+
+#define _GNU_SOURCE
+
+#include "fifo_rpc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define READ_CHUNK 65536 /* A whole pipe's worth of replies per read() */
+
+struct rpc_slot {
+  rpc_done_cb cb;
+  void *arg;
+  uint32_t id; /* Slot number | generation << slot_bits */
+  int busy;
+};
+
+static long now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/* Milliseconds left until `deadline` (-1: none) */
+static int left_ms(long deadline) {
+  if (deadline < 0)
+    return -1;
+  long left = deadline - now_ms();
+  return left > 0 ? (int)left : 0;
+}
+
+static int write_frames(rpc_client_t *c, const char *buf, size_t len) {
+  for (;;) {
+    ssize_t n = write(c->fd_write, buf, len);
+    if (n == (ssize_t)len) {
+      c->st.writes++;
+      return 0;
+    }
+    if (n == -1 && errno == EINTR)
+      continue;
+    /* <= PIPE_BUF goes in whole or not at all, so this is an error */
+    c->broken = n == -1 ? errno : EIO;
+    errno = c->broken;
+    return -1;
+  }
+}
+
+static int append_frame(rpc_client_t *c, uint32_t type, uint32_t seq,
+                        const void *payload, size_t len) {
+  frame_hdr_t hdr = {.len = len, .type = type, .pid = getpid(), .seq = seq};
+  if (c->out_len + sizeof(hdr) + len > sizeof(c->out) && rpc_flush(c) == -1)
+    return -1;
+  memcpy(c->out + c->out_len, &hdr, sizeof(hdr));
+  if (len > 0)
+    memcpy(c->out + c->out_len + sizeof(hdr), payload, len);
+  c->out_len += sizeof(hdr) + len;
+  return 0;
+}
+
+int rpc_flush(rpc_client_t *c) {
+  if (c->broken) {
+    errno = c->broken;
+    return -1;
+  }
+  if (c->out_len == 0)
+    return 0;
+  size_t len = c->out_len;
+  c->out_len = 0;
+  return write_frames(c, c->out, len);
+}
+
+int rpc_connect(rpc_client_t *c, unsigned depth) {
+  memset(c, 0, sizeof(*c));
+  c->fd_write = c->fd_read = -1;
+  if (depth < 1 || depth > RPC_DEPTH_MAX) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  c->nslots = c->nfree = depth;
+  while ((1u << c->slot_bits) < depth)
+    c->slot_bits++;
+  c->slots = calloc(depth, sizeof(*c->slots));
+  c->free_slots = malloc(depth * sizeof(*c->free_slots));
+  if (!c->slots || !c->free_slots)
+    goto fail;
+  for (unsigned i = 0; i < depth; i++) {
+    c->slots[i].id = i;
+    c->free_slots[i] = depth - 1 - i; /* Slot 0 on top */
+  }
+
+  snprintf(c->reply_path, sizeof(c->reply_path), REPLY_FIFO_FMT, getpid());
+  unlink(c->reply_path);
+  if (mkfifo(c->reply_path, 0600) == -1)
+    goto fail;
+  /* Our read end first (non-blocking), so the server's open succeeds */
+  c->fd_read = open(c->reply_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (c->fd_read == -1)
+    goto fail;
+  /* ENXIO here: the FIFO exists but no server has it open */
+  c->fd_write = open(CLIENT_TO_SERVER, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+  if (c->fd_write == -1)
+    goto fail;
+  fcntl(c->fd_write, F_SETFL, 0);
+
+  if (append_frame(c, FRAME_HELLO, 0, NULL, 0) == -1)
+    goto fail;
+  return 0;
+
+fail:;
+  int saved = errno;
+  rpc_close(c);
+  errno = saved;
+  return -1;
+}
+
+void rpc_close(rpc_client_t *c) {
+  if (c->fd_write != -1) {
+    if (!c->broken && append_frame(c, FRAME_BYE, 0, NULL, 0) == 0)
+      rpc_flush(c);
+    close(c->fd_write);
+  }
+  if (c->fd_read != -1)
+    close(c->fd_read);
+  if (c->reply_path[0])
+    unlink(c->reply_path);
+  free(c->slots);
+  free(c->free_slots);
+  free(c->in);
+  memset(c, 0, sizeof(*c));
+  c->fd_write = c->fd_read = -1;
+}
+
+/* Free the slot first, so the callback can issue a request of its own */
+static void finish(rpc_client_t *c, struct rpc_slot *s, int err,
+                   const char *reply, size_t len) {
+  rpc_done_cb cb = s->cb;
+  void *arg = s->arg;
+  uint32_t id = s->id;
+  s->busy = 0;
+  s->id += 1u << c->slot_bits; /* Next generation */
+  c->free_slots[c->nfree++] = id & ((1u << c->slot_bits) - 1);
+  if (cb) {
+    c->in_callback++;
+    cb(c, id, err, reply, len, arg);
+    c->in_callback--;
+  }
+}
+
+/*
+ * Give up on a request (rpc_call() timed out): its slot is free again at
+ * once, and since the ID named the old generation, a reply that still
+ * comes later counts as stale instead of completing the slot's next user.
+ */
+static void abandon(rpc_client_t *c, uint32_t id) {
+  struct rpc_slot *s = &c->slots[id & ((1u << c->slot_bits) - 1)];
+  if (!s->busy || s->id != id)
+    return; /* Finished meanwhile */
+  s->cb = NULL;
+  finish(c, s, 0, NULL, 0);
+}
+
+/* rpc_poll() and rpc_wait() parse replies and walk the slots: a callback
+   calling them would do that again from the middle of the first pass */
+static int reentered(rpc_client_t *c) {
+  if (!c->in_callback)
+    return 0;
+  errno = EDEADLK;
+  return 1;
+}
+
+/* The connection is gone: every request in flight fails with err */
+static int fail_all(rpc_client_t *c, int err) {
+  int done = 0;
+  c->broken = err;
+  for (unsigned i = 0; i < c->nslots; i++) {
+    if (c->slots[i].busy) {
+      finish(c, &c->slots[i], err, NULL, 0);
+      done++;
+    }
+  }
+  return done;
+}
+
+static void complete(rpc_client_t *c, const frame_hdr_t *hdr,
+                     const char *payload) {
+  uint32_t slot = hdr->seq & ((1u << c->slot_bits) - 1);
+  struct rpc_slot *s = slot < c->nslots ? &c->slots[slot] : NULL;
+  if (hdr->type != FRAME_RESPONSE || !s || !s->busy || s->id != hdr->seq) {
+    c->st.stale++;
+    return;
+  }
+  c->st.replies++;
+  finish(c, s, 0, payload, hdr->len);
+}
+
+/* Read what the reply FIFO has and complete every whole frame in it */
+static int read_replies(rpc_client_t *c) {
+  if (c->in_cap - c->in_len < READ_CHUNK) {
+    char *grown = realloc(c->in, c->in_len + READ_CHUNK);
+    if (!grown)
+      return -1;
+    c->in = grown;
+    c->in_cap = c->in_len + READ_CHUNK;
+  }
+  ssize_t n = read(c->fd_read, c->in + c->in_len, c->in_cap - c->in_len);
+  if (n == 0)
+    return fail_all(c, EPIPE); /* Server closed our reply FIFO */
+  if (n == -1)
+    return errno == EAGAIN || errno == EINTR ? 0 : fail_all(c, errno);
+  c->st.reads++;
+  c->in_len += n;
+
+  int done = 0;
+  size_t pos = 0;
+  while (c->in_len - pos >= sizeof(frame_hdr_t)) {
+    frame_hdr_t hdr;
+    memcpy(&hdr, c->in + pos, sizeof(hdr));
+    if (hdr.len > FRAME_PAYLOAD_MAX)
+      return done + fail_all(c, EPROTO);
+    if (c->in_len - pos < sizeof(hdr) + hdr.len)
+      break;
+    uint64_t before = c->st.replies;
+    complete(c, &hdr, c->in + pos + sizeof(hdr));
+    done += c->st.replies != before;
+    pos += sizeof(hdr) + hdr.len;
+  }
+  memmove(c->in, c->in + pos, c->in_len - pos); /* Less than one frame */
+  c->in_len -= pos;
+  return done;
+}
+
+int rpc_poll(rpc_client_t *c, int timeout_ms) {
+  if (reentered(c))
+    return -1;
+  if (rpc_flush(c) == -1) {
+    /* No reply can come for what is in flight now */
+    int done = fail_all(c, errno);
+    return done ? done : -1;
+  }
+  if (!rpc_inflight(c))
+    return 0;
+
+  struct pollfd pfd = {.fd = c->fd_read, .events = POLLIN};
+  int r = poll(&pfd, 1, timeout_ms);
+  if (r == -1)
+    return errno == EINTR ? 0 : -1;
+  if (r == 0)
+    return 0;
+  /* POLLHUP alone means the server is gone: read() reports EOF */
+  return read_replies(c);
+}
+
+int rpc_wait(rpc_client_t *c, int timeout_ms) {
+  if (reentered(c))
+    return -1;
+  long deadline = timeout_ms < 0 ? -1 : now_ms() + timeout_ms;
+  while (rpc_inflight(c) > 0) {
+    if (rpc_poll(c, left_ms(deadline)) == -1)
+      return -1;
+    if (deadline >= 0 && now_ms() >= deadline && rpc_inflight(c) > 0) {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+  }
+  if (c->broken) {
+    errno = c->broken;
+    return -1;
+  }
+  return 0;
+}
+
+int rpc_call_async(rpc_client_t *c, const void *req, size_t len,
+                   rpc_done_cb cb, void *arg, uint32_t *id) {
+  if (len > FRAME_PAYLOAD_MAX) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  long deadline = now_ms() + RPC_TIMEOUT_MS;
+  while (c->nfree == 0) {
+    if (reentered(c))
+      return -1; /* Waiting for a slot would poll */
+    if (rpc_poll(c, left_ms(deadline)) == -1)
+      return -1;
+    if (c->nfree == 0 && now_ms() >= deadline) {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+  }
+  if (c->broken) {
+    errno = c->broken;
+    return -1;
+  }
+
+  struct rpc_slot *s = &c->slots[c->free_slots[c->nfree - 1]];
+  if (append_frame(c, FRAME_REQUEST, s->id, req, len) == -1)
+    return -1;
+  c->nfree--;
+  s->cb = cb;
+  s->arg = arg;
+  s->busy = 1;
+  c->st.requests++;
+  if (id)
+    *id = s->id;
+  return 0;
+}
+
+typedef struct {
+  char *buf;
+  size_t size;
+  ssize_t len;
+  int err;
+  int done;
+} sync_reply_t;
+
+static void on_sync_reply(rpc_client_t *c, uint32_t id, int err,
+                          const char *reply, size_t len, void *arg) {
+  sync_reply_t *r = arg;
+  (void)c;
+  (void)id;
+  r->done = 1;
+  r->err = err;
+  if (err)
+    return;
+  size_t n = len < r->size - 1 ? len : r->size - 1;
+  memcpy(r->buf, reply, n);
+  r->buf[n] = '\0';
+  r->len = len;
+}
+
+ssize_t rpc_call(rpc_client_t *c, const void *req, size_t len, char *reply,
+                 size_t size, int timeout_ms) {
+  sync_reply_t r = {.buf = reply, .size = size};
+  uint32_t id;
+  if (reentered(c))
+    return -1;
+  if (size == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (rpc_call_async(c, req, len, on_sync_reply, &r, &id) == -1)
+    return -1;
+
+  long deadline = timeout_ms < 0 ? -1 : now_ms() + timeout_ms;
+  while (!r.done) {
+    if (deadline >= 0 && now_ms() >= deadline) {
+      /* r is about to go out of scope: the reply must not land in it */
+      abandon(c, id);
+      errno = ETIMEDOUT;
+      return -1;
+    }
+    if (rpc_poll(c, left_ms(deadline)) == -1 && !r.done) {
+      int saved = errno;
+      abandon(c, id);
+      errno = saved;
+      return -1;
+    }
+  }
+  if (r.err) {
+    errno = r.err;
+    return -1;
+  }
+  return r.len;
+}
@@ -0,0 +1,129 @@
+/*
+ * fifo_rpc.h - Pipelined request/response client for the bidir FIFO server
+ *
+ * Sending one request and waiting for its reply caps a client at one
+ * request per round trip: two context switches and a trip through the
+ * server's event loop, however small the query. An RPC client keeps up to
+ * `depth` requests in flight on one connection instead:
+ *
+ *   client                                 server
+ *   id 0x000 --\                           (one read, many frames)
+ *   id 0x001 ---+-- one write <= PIPE_BUF -->
+ *   id 0x002 --/
+ *                <-- replies, batched -----  0x001, 0x000 (any order)
+ *   callback(0x001), callback(0x000) ...
+ *
+ * Every request carries an ID in the frame's seq field (fifo_proto.h),
+ * and the server echoes it, so replies may come back in any order: a slow
+ * request does not hold up the fast ones behind it. An ID is the request's
+ * slot in the in-flight table plus a generation count for that slot, so a
+ * reply that is late or duplicated can never complete the wrong request.
+ *
+ * Requests are batched: rpc_call_async() only appends the frame to a
+ * buffer, which goes out in ONE write when the next frame would not fit in
+ * PIPE_BUF (so it is still atomic next to other clients' writes), or when
+ * the client waits for replies. Replies are read in big chunks and parsed
+ * in place.
+ *
+ * Two ways to use it:
+ *   callbacks - rpc_call_async() per request, rpc_poll() to run the
+ *               callbacks of the replies that arrived, rpc_wait() at the
+ *               end. Pipelined.
+ *   blocking  - rpc_call() sends one request and returns its reply, still
+ *               running the callbacks of any other replies meanwhile.
+ */
+
+#ifndef FIFO_RPC_H
+#define FIFO_RPC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "fifo_proto.h"
+
+#define RPC_DEPTH_MAX 4096
+#define RPC_TIMEOUT_MS 5000 /* Waiting for a free slot gives up after this */
+
+typedef struct rpc_client rpc_client_t;
+
+/*
+ * A request finished: err 0 and the reply (valid only during the call),
+ * or err an errno value (EPIPE: the server went away) and no reply.
+ */
+typedef void (*rpc_done_cb)(rpc_client_t *c, uint32_t id, int err,
+                            const char *reply, size_t len, void *arg);
+
+typedef struct {
+  uint64_t requests, replies;
+  uint64_t writes, reads; /* Syscalls: compare with requests */
+  uint64_t stale;         /* Replies to cancelled or unknown IDs */
+} rpc_stats_t;
+
+struct rpc_slot; /* In-flight request, see fifo_rpc.c */
+
+struct rpc_client {
+  int fd_write, fd_read;
+  char reply_path[64];
+  struct rpc_slot *slots;
+  uint32_t *free_slots; /* Stack of free slot numbers */
+  unsigned nslots, nfree, slot_bits;
+  char out[FRAME_MAX]; /* Requests not yet written */
+  size_t out_len;
+  char *in; /* Reply bytes read but not yet parsed */
+  size_t in_len, in_cap;
+  int broken;      /* errno once the connection failed, else 0 */
+  int in_callback; /* Callbacks may send, but never poll or wait */
+  rpc_stats_t st;
+};
+
+/*
+ * Create the reply FIFO, connect to the server and say hello. Up to
+ * `depth` requests (1..RPC_DEPTH_MAX) may be in flight at once.
+ * Returns 0, or -1 with errno set (ENOENT/ENXIO: no server running).
+ */
+int rpc_connect(rpc_client_t *c, unsigned depth);
+
+/* Say goodbye and remove the reply FIFO; pending callbacks never run */
+void rpc_close(rpc_client_t *c);
+
+/*
+ * Queue one request of at most FRAME_PAYLOAD_MAX bytes; *id (if not NULL)
+ * receives its ID. cb runs from a later rpc_poll(), rpc_wait() or
+ * rpc_call() once the reply arrives. If `depth` requests are in flight
+ * already, this first waits for one to finish (not allowed inside a
+ * callback: EDEADLK there).
+ * Returns 0, or -1 with errno set (EMSGSIZE, EDEADLK, ETIMEDOUT, EPIPE).
+ */
+int rpc_call_async(rpc_client_t *c, const void *req, size_t len,
+                   rpc_done_cb cb, void *arg, uint32_t *id);
+
+/* Write out the requests queued so far */
+int rpc_flush(rpc_client_t *c);
+
+/*
+ * Flush, then wait up to timeout_ms (-1: forever, 0: not at all) for
+ * replies and run their callbacks. Returns how many requests finished, or
+ * -1 with errno set (EDEADLK when called from inside a callback: so are
+ * rpc_wait() and rpc_call()).
+ */
+int rpc_poll(rpc_client_t *c, int timeout_ms);
+
+/* rpc_poll() until nothing is in flight; -1/ETIMEDOUT after timeout_ms */
+int rpc_wait(rpc_client_t *c, int timeout_ms);
+
+/*
+ * Blocking call: send one request, wait up to timeout_ms for its reply
+ * and copy it, NUL-terminated, into reply[size]. Returns the reply length
+ * (before any truncation), or -1 with errno set. On ETIMEDOUT the request
+ * is abandoned: its slot is free again, and a late reply is dropped.
+ */
+ssize_t rpc_call(rpc_client_t *c, const void *req, size_t len, char *reply,
+                 size_t size, int timeout_ms);
+
+/* Requests sent or queued that have not finished yet */
+static inline unsigned rpc_inflight(const rpc_client_t *c) {
+  return c->nslots - c->nfree;
+}
+
+#endif /* FIFO_RPC_H */
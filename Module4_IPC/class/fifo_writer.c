@@ -4,10 +4,25 @@
 #include <string.h>
 #include <unistd.h>
 
-int main(void) {
+#include "fifo_flow.h"
+
+/*
+ *   ./fifo_writer          # write() blocks while the reader is not reading
+ *   ./fifo_writer spill    # Never blocks: queue, then block/drop-oldest/
+ *                          # drop-newest/spill (see fifo_flow.h)
+ */
+
+int main(int argc, char *argv[]) {
   const char *fifo_path = "/tmp/my_fifo";
   int fd;
   char message[100];
+  flow_writer_t flow;
+  int policy = -1;
+
+  if (argc > 1 && (policy = flow_policy_parse(argv[1])) == -1) {
+    printf("Usage: %s [block|drop-oldest|drop-newest|spill]\n", argv[0]);
+    return 1;
+  }
 
   printf("=== FIFO WRITER ===\n");
   printf("Opening FIFO for writing...\n");
@@ -21,6 +36,14 @@ int main(void) {
   }
 
   printf("FIFO opened successfully!\n");
+  if (policy != -1) {
+    /* Queue at most 4 KiB of our own once the pipe is full */
+    if (flow_init(&flow, fd, policy, 4096, NULL) == -1) {
+      perror("flow_init");
+      return 1;
+    }
+    printf("Non-blocking writer, policy: %s\n", flow_policy_name(policy));
+  }
   printf("Enter messages (type 'quit' to exit):\n");
 
   while (1) {
@@ -37,6 +60,22 @@ int main(void) {
       break;
     }
 
+    if (policy != -1) {
+      /* Returns at once; the counters say where the message went */
+      if (flow_send(&flow, message, strlen(message) + 1) == -1) {
+        perror("flow_send");
+        break;
+      }
+      flow_stats_t st;
+      flow_stats(&flow, &st);
+      printf("Sent %lu, queued %lu (%lu bytes), dropped %lu, spilled %lu; "
+             "pipe %zu of %zu bytes full\n",
+             (unsigned long)st.msgs_sent, (unsigned long)st.msgs_queued,
+             (unsigned long)st.bytes_queued, (unsigned long)st.msgs_dropped,
+             (unsigned long)st.msgs_spilled, st.pipe_used, st.pipe_size);
+      continue;
+    }
+
     /* Write to FIFO */
     if (write(fd, message, strlen(message) + 1) == -1) { // < --------
       perror("write");
@@ -45,6 +84,12 @@ int main(void) {
     printf("Sent: %s\n", message);
   }
 
+  if (policy != -1) {
+    if (flow_flush(&flow, 2000) == -1)
+      printf("Reader not keeping up; %lu message(s) left unsent\n",
+             (unsigned long)(flow.qmsgs + flow.spill_msgs));
+    flow_destroy(&flow);
+  }
   close(fd);
   printf("Writer exiting.\n");
   return 0;
@@ -0,0 +1,174 @@
+#define _GNU_SOURCE
+
+#include "job_queue.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Everything after mtype, which is what msgsnd/msgrcv count as the size */
+#define JQ_HDR_SIZE (offsetof(jq_job_t, data) - sizeof(long))
+#define JQ_BODY_MAX (sizeof(jq_job_t) - sizeof(long))
+
+/* Background jobs only get the first half of the queue */
+#define JQ_BACKGROUND_SHARE 2
+#define JQ_BACKOFF_US 1000
+
+uint64_t jq_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+const char *jq_class_name(jq_class_t cls) {
+  switch (cls) {
+  case JQ_INTERACTIVE:
+    return "interactive";
+  case JQ_NORMAL:
+    return "normal";
+  case JQ_BACKGROUND:
+    return "background";
+  }
+  return "?";
+}
+
+int jq_open(job_queue_t *q, key_t key, size_t max_bytes) {
+  struct msqid_ds ds;
+
+  memset(q, 0, sizeof(*q));
+  q->msqid = msgget(key, 0666 | IPC_CREAT);
+  if (q->msqid == -1 || msgctl(q->msqid, IPC_STAT, &ds) == -1)
+    return -1;
+
+  /* Raising the limit above kernel.msgmnb needs CAP_SYS_RESOURCE */
+  if (max_bytes > 0 && max_bytes != ds.msg_qbytes) {
+    ds.msg_qbytes = max_bytes;
+    if (msgctl(q->msqid, IPC_SET, &ds) == -1)
+      perror("jq_open: msg_qbytes");
+    msgctl(q->msqid, IPC_STAT, &ds);
+  }
+  q->qbytes = ds.msg_qbytes;
+  return 0;
+}
+
+int jq_depth(job_queue_t *q, unsigned long *jobs, unsigned long *bytes) {
+  struct msqid_ds ds;
+
+  if (msgctl(q->msqid, IPC_STAT, &ds) == -1)
+    return -1;
+  if (jobs)
+    *jobs = ds.msg_qnum;
+  if (bytes)
+    *bytes = ds.__msg_cbytes; /* Linux-specific */
+  return 0;
+}
+
+int jq_submit(job_queue_t *q, jq_class_t cls, uint32_t id, const char *data,
+              size_t len, int flags) {
+  jq_job_t job;
+
+  if (cls < JQ_INTERACTIVE || cls > JQ_BACKGROUND) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (len > JQ_PAYLOAD_MAX)
+    len = JQ_PAYLOAD_MAX;
+  size_t size = JQ_HDR_SIZE + len;
+
+  /* Hold background work back while the queue is more than half full */
+  while (cls == JQ_BACKGROUND) {
+    unsigned long used;
+    if (jq_depth(q, NULL, &used) == -1)
+      return -1;
+    if (used + size <= q->qbytes / JQ_BACKGROUND_SHARE)
+      break;
+    if (flags & JQ_NOWAIT) {
+      errno = EAGAIN;
+      return -1;
+    }
+    usleep(JQ_BACKOFF_US);
+  }
+
+  job.mtype = cls;
+  job.magic = JQ_MAGIC;
+  job.id = id;
+  job.len = len;
+  memcpy(job.data, data, len);
+  job.enqueued_ns = jq_now_ns();
+
+  while (msgsnd(q->msqid, &job, size, (flags & JQ_NOWAIT) ? IPC_NOWAIT : 0) ==
+         -1) {
+    if (errno != EINTR)
+      return -1;
+  }
+  return 0;
+}
+
+/*
+ * Anti-starvation: out of every 8 takes, one prefers background work and
+ * two prefer normal work. Under full load from all classes this still gives
+ * interactive 5/8 of the workers, but nobody waits forever.
+ */
+static long preferred_type(unsigned taken) {
+  if (taken % 8 == 7)
+    return JQ_BACKGROUND;
+  if (taken % 4 == 3)
+    return JQ_NORMAL;
+  return 0;
+}
+
+/* Plain text messages (e.g. from ./queue) become jobs of their type */
+static void normalize(jq_job_t *job, ssize_t n) {
+  if ((size_t)n >= JQ_HDR_SIZE && job->magic == JQ_MAGIC &&
+      job->len <= JQ_PAYLOAD_MAX && JQ_HDR_SIZE + job->len == (size_t)n) {
+    job->data[job->len] = '\0';
+    return;
+  }
+
+  size_t len = (size_t)n < JQ_PAYLOAD_MAX ? (size_t)n : JQ_PAYLOAD_MAX;
+  memmove(job->data, &job->magic, len);
+  job->data[len] = '\0';
+  job->len = strlen(job->data);
+  job->magic = 0;
+  job->id = 0;
+  job->enqueued_ns = 0;
+}
+
+static ssize_t take_one(job_queue_t *q, jq_job_t *job, int block) {
+  long pref = preferred_type(q->taken);
+  ssize_t n = -1;
+
+  if (pref)
+    n = msgrcv(q->msqid, job, JQ_BODY_MAX, pref, IPC_NOWAIT | MSG_NOERROR);
+  if (n == -1)
+    n = msgrcv(q->msqid, job, JQ_BODY_MAX, -JQ_NCLASSES,
+               (block ? 0 : IPC_NOWAIT) | MSG_NOERROR);
+  if (n >= 0) {
+    normalize(job, n);
+    q->taken++;
+  }
+  return n;
+}
+
+int jq_take(job_queue_t *q, jq_job_t *jobs, int max) {
+  int count = 0;
+
+  if (max < 1) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (take_one(q, &jobs[0], 1) == -1)
+    return -1;
+  count = 1;
+
+  /* The rest of the batch only takes what is already there */
+  while (count < max && take_one(q, &jobs[count], 0) != -1)
+    count++;
+  return count;
+}
+
+int jq_destroy(job_queue_t *q) { return msgctl(q->msqid, IPC_RMID, NULL); }
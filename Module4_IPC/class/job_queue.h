@@ -0,0 +1,79 @@
+/*
+ * job_queue.h - Priority job queue on top of a System V message queue
+ *
+ * Priority classes map directly onto message types, so the kernel does the
+ * ordering: msgrcv() with a NEGATIVE type returns the lowest type first.
+ *
+ *   type 1  JQ_INTERACTIVE   user-facing requests
+ *   type 2  JQ_NORMAL        regular work
+ *   type 3  JQ_BACKGROUND    backups, scrubs, anything that can wait
+ *
+ * Strict priority would starve background jobs under a steady interactive
+ * load, so every few takes a worker looks at the lower classes first.
+ *
+ * Backpressure: the queue's byte limit (msg_qbytes) bounds memory. When it
+ * is full, jq_submit() blocks (or fails with EAGAIN under JQ_NOWAIT).
+ * Background jobs are held back earlier, once the queue is half full, so
+ * there is always room left for interactive requests.
+ */
+
+#ifndef JOB_QUEUE_H
+#define JOB_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define JQ_PAYLOAD_MAX 240
+#define JQ_MAGIC 0x4a4f4253 /* "JOBS" */
+
+typedef enum {
+  JQ_INTERACTIVE = 1,
+  JQ_NORMAL = 2,
+  JQ_BACKGROUND = 3,
+} jq_class_t;
+
+#define JQ_NCLASSES 3
+
+/* Submit flags */
+#define JQ_NOWAIT 1 /* Fail with EAGAIN instead of blocking when full */
+
+typedef struct {
+  long mtype; /* jq_class_t */
+  uint32_t magic;
+  uint32_t id;
+  uint64_t enqueued_ns; /* CLOCK_MONOTONIC, for queueing delay */
+  uint32_t len;
+  char data[JQ_PAYLOAD_MAX + 1]; /* Always NUL-terminated on receive */
+} jq_job_t;
+
+typedef struct {
+  int msqid;
+  size_t qbytes;   /* Queue byte limit */
+  unsigned taken;  /* Jobs taken by this process, drives anti-starvation */
+} job_queue_t;
+
+/* Open (creating if needed) the queue for `key`; max_bytes 0 keeps the limit */
+int jq_open(job_queue_t *q, key_t key, size_t max_bytes);
+
+/* Enqueue one job; 0 on success, -1 with errno (EAGAIN when full) */
+int jq_submit(job_queue_t *q, jq_class_t cls, uint32_t id, const char *data,
+              size_t len, int flags);
+
+/*
+ * Take up to `max` jobs. Blocks for the first one, then grabs whatever else
+ * is already queued without blocking. Returns the count, or -1 with errno.
+ */
+int jq_take(job_queue_t *q, jq_job_t *jobs, int max);
+
+/* Jobs and bytes currently queued */
+int jq_depth(job_queue_t *q, unsigned long *jobs, unsigned long *bytes);
+
+/* Remove the queue from the system */
+int jq_destroy(job_queue_t *q);
+
+uint64_t jq_now_ns(void);
+
+const char *jq_class_name(jq_class_t cls);
+
+#endif /* JOB_QUEUE_H */
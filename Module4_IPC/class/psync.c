@@ -0,0 +1,293 @@
+#define _GNU_SOURCE
+
+#include "psync.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+ * Shared (not FUTEX_PRIVATE_FLAG) futexes: waiters are keyed by the
+ * physical page, so processes may map the object at different addresses.
+ */
+static void futex_wait(_Atomic uint32_t *addr, uint32_t expected) {
+  syscall(SYS_futex, addr, FUTEX_WAIT, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t *addr, int count) {
+  syscall(SYS_futex, addr, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+/* ------------------------------------------------------------------ */
+/* Robust list                                                          */
+/* ------------------------------------------------------------------ */
+
+/*
+ * Every mutex a thread holds is linked into this list. When the thread
+ * dies the kernel walks it, sets FUTEX_OWNER_DIED in each futex word that
+ * still carries the thread's TID, and wakes one waiter. list_op_pending
+ * covers a death in the middle of a lock or unlock.
+ */
+static __thread struct robust_list_head robust_head;
+static __thread uint32_t robust_tid; /* 0 = not registered in this thread */
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+/* A fork child has no robust list and holds none of the parent's locks */
+static void robust_forget(void) { robust_tid = 0; }
+
+static void robust_install_atfork(void) {
+  pthread_atfork(NULL, NULL, robust_forget);
+}
+
+/* Register on first use; the cached TID keeps gettid() off the fast path */
+static uint32_t robust_self(void) {
+  if (robust_tid == 0) {
+    pthread_once(&atfork_once, robust_install_atfork);
+    robust_head.list.next = &robust_head.list;
+    robust_head.futex_offset =
+        offsetof(psync_mutex_t, word) - offsetof(psync_mutex_t, node);
+    robust_head.list_op_pending = NULL;
+    syscall(SYS_set_robust_list, &robust_head, sizeof(robust_head));
+    robust_tid = gettid();
+  }
+  return robust_tid;
+}
+
+static void robust_add(psync_mutex_t *m) {
+  m->node.next = robust_head.list.next;
+  robust_head.list.next = &m->node;
+}
+
+/* Held-lock lists are short, a walk is cheaper than keeping back links */
+static void robust_remove(psync_mutex_t *m) {
+  for (struct robust_list *p = &robust_head.list; p->next != &robust_head.list;
+       p = p->next) {
+    if (p->next == &m->node) {
+      p->next = m->node.next;
+      return;
+    }
+  }
+}
+
+/* ------------------------------------------------------------------ */
+/* Mutex                                                                */
+/* ------------------------------------------------------------------ */
+
+void psync_mutex_init(psync_mutex_t *m) {
+  atomic_init(&m->word, 0);
+  m->node.next = NULL;
+}
+
+/* Try to take the lock given its current word; 0, EOWNERDEAD or EBUSY */
+static int mutex_take(psync_mutex_t *m, uint32_t tid, uint32_t *v,
+                      uint32_t extra) {
+  if (*v & FUTEX_OWNER_DIED) {
+    /* The kernel cleared the dead owner's TID; keep the waiters bit */
+    uint32_t next = tid | (*v & FUTEX_WAITERS) | extra;
+    return atomic_compare_exchange_strong(&m->word, v, next) ? EOWNERDEAD
+                                                             : EAGAIN;
+  }
+  if ((*v & FUTEX_TID_MASK) == 0)
+    return atomic_compare_exchange_strong(&m->word, v, tid | extra) ? 0
+                                                                    : EAGAIN;
+  return EBUSY;
+}
+
+int psync_mutex_lock(psync_mutex_t *m) {
+  uint32_t tid = robust_self();
+  uint32_t v = 0;
+  int ret = 0;
+
+  robust_head.list_op_pending = &m->node;
+
+  /* Fast path: 0 -> TID, no syscall */
+  if (!atomic_compare_exchange_strong(&m->word, &v, tid)) {
+    for (;;) {
+      /* Someone may be asleep behind us, so claim it with the waiters bit */
+      ret = mutex_take(m, tid, &v, FUTEX_WAITERS);
+      if (ret == 0 || ret == EOWNERDEAD)
+        break;
+      if (ret == EAGAIN)
+        continue; /* Lost a race, v was reloaded */
+
+      /* Held: announce ourselves and sleep until the word changes */
+      if (!(v & FUTEX_WAITERS)) {
+        if (!atomic_compare_exchange_strong(&m->word, &v, v | FUTEX_WAITERS))
+          continue;
+        v |= FUTEX_WAITERS;
+      }
+      futex_wait(&m->word, v);
+      v = atomic_load(&m->word);
+    }
+  }
+
+  robust_add(m);
+  robust_head.list_op_pending = NULL;
+  return ret;
+}
+
+int psync_mutex_trylock(psync_mutex_t *m) {
+  uint32_t tid = robust_self();
+  uint32_t v = atomic_load(&m->word);
+  int ret;
+
+  robust_head.list_op_pending = &m->node;
+  do {
+    ret = mutex_take(m, tid, &v, 0);
+  } while (ret == EAGAIN);
+  if (ret != EBUSY)
+    robust_add(m);
+  robust_head.list_op_pending = NULL;
+  return ret;
+}
+
+void psync_mutex_unlock(psync_mutex_t *m) {
+  robust_head.list_op_pending = &m->node;
+  robust_remove(m);
+  if (atomic_exchange(&m->word, 0) & FUTEX_WAITERS)
+    futex_wake(&m->word, 1);
+  robust_head.list_op_pending = NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/* Condition variable                                                   */
+/* ------------------------------------------------------------------ */
+
+void psync_cond_init(psync_cond_t *c) {
+  atomic_init(&c->seq, 0);
+  atomic_init(&c->waiters, 0);
+}
+
+/*
+ * Reading seq before dropping the mutex closes the lost-wakeup window: a
+ * signal sent after that point changes seq and FUTEX_WAIT returns at once.
+ * Wakeups may be spurious, so callers re-check their predicate in a loop.
+ */
+int psync_cond_wait(psync_cond_t *c, psync_mutex_t *m) {
+  atomic_fetch_add(&c->waiters, 1);
+  uint32_t seq = atomic_load(&c->seq);
+  psync_mutex_unlock(m);
+  futex_wait(&c->seq, seq);
+  atomic_fetch_sub(&c->waiters, 1);
+  return psync_mutex_lock(m);
+}
+
+void psync_cond_signal(psync_cond_t *c) {
+  atomic_fetch_add(&c->seq, 1);
+  if (atomic_load(&c->waiters) > 0)
+    futex_wake(&c->seq, 1);
+}
+
+void psync_cond_broadcast(psync_cond_t *c) {
+  atomic_fetch_add(&c->seq, 1);
+  if (atomic_load(&c->waiters) > 0)
+    futex_wake(&c->seq, INT_MAX);
+}
+
+/* ------------------------------------------------------------------ */
+/* Semaphore                                                            */
+/* ------------------------------------------------------------------ */
+
+void psync_sem_init(psync_sem_t *s, uint32_t value) {
+  atomic_init(&s->value, value);
+  atomic_init(&s->waiters, 0);
+}
+
+int psync_sem_trywait(psync_sem_t *s) {
+  uint32_t v = atomic_load(&s->value);
+  while (v > 0) {
+    if (atomic_compare_exchange_weak(&s->value, &v, v - 1))
+      return 0;
+  }
+  return EAGAIN;
+}
+
+void psync_sem_wait(psync_sem_t *s) {
+  if (psync_sem_trywait(s) == 0)
+    return;
+
+  /* Count ourselves before the final check so post() knows to wake us */
+  atomic_fetch_add(&s->waiters, 1);
+  while (psync_sem_trywait(s) != 0)
+    futex_wait(&s->value, 0);
+  atomic_fetch_sub(&s->waiters, 1);
+}
+
+void psync_sem_post(psync_sem_t *s) {
+  atomic_fetch_add(&s->value, 1);
+  if (atomic_load(&s->waiters) > 0)
+    futex_wake(&s->value, 1);
+}
+
+/* ------------------------------------------------------------------ */
+/* Reader-writer lock                                                   */
+/* ------------------------------------------------------------------ */
+
+void psync_rwlock_init(psync_rwlock_t *rw) {
+  atomic_init(&rw->state, 0);
+  atomic_init(&rw->writers_waiting, 0);
+  atomic_init(&rw->seq, 0);
+  atomic_init(&rw->sleepers, 0);
+}
+
+/* Sleep until the next release, unless the lock has already become free */
+static void rwlock_sleep(psync_rwlock_t *rw, int reader) {
+  atomic_fetch_add(&rw->sleepers, 1);
+  uint32_t seq = atomic_load(&rw->seq);
+  uint32_t s = atomic_load(&rw->state);
+  int blocked = reader ? (s & PSYNC_RW_WRITER) ||
+                             atomic_load(&rw->writers_waiting) > 0
+                       : s != 0;
+  if (blocked)
+    futex_wait(&rw->seq, seq);
+  atomic_fetch_sub(&rw->sleepers, 1);
+}
+
+void psync_rwlock_rdlock(psync_rwlock_t *rw) {
+  for (;;) {
+    uint32_t s = atomic_load(&rw->state);
+    /* Waiting writers block new readers so writers cannot starve */
+    while (!(s & PSYNC_RW_WRITER) && atomic_load(&rw->writers_waiting) == 0) {
+      if (atomic_compare_exchange_weak(&rw->state, &s, s + 1))
+        return;
+    }
+    rwlock_sleep(rw, 1);
+  }
+}
+
+void psync_rwlock_wrlock(psync_rwlock_t *rw) {
+  uint32_t s = 0;
+  if (atomic_compare_exchange_strong(&rw->state, &s, PSYNC_RW_WRITER))
+    return;
+
+  atomic_fetch_add(&rw->writers_waiting, 1);
+  for (;;) {
+    s = 0;
+    if (atomic_compare_exchange_strong(&rw->state, &s, PSYNC_RW_WRITER))
+      break;
+    rwlock_sleep(rw, 0);
+  }
+  atomic_fetch_sub(&rw->writers_waiting, 1);
+}
+
+void psync_rwlock_unlock(psync_rwlock_t *rw) {
+  uint32_t s = atomic_load(&rw->state);
+  uint32_t left;
+
+  if (s == PSYNC_RW_WRITER) {
+    atomic_store(&rw->state, 0);
+    left = 0;
+  } else {
+    left = atomic_fetch_sub(&rw->state, 1) - 1;
+  }
+
+  /* Readers never block readers: only the last release can unblock anyone */
+  if (left == 0) {
+    atomic_fetch_add(&rw->seq, 1);
+    if (atomic_load(&rw->sleepers) > 0)
+      futex_wake(&rw->seq, INT_MAX);
+  }
+}
@@ -0,0 +1,75 @@
+/*
+ * psync.h - Process-shared synchronization built on futexes
+ *
+ * Every object here is a plain struct: put it in shared memory (mmap
+ * MAP_SHARED, shmat, ...), call the _init function once, and use it from
+ * any process that maps it. No syscall is made unless a process actually
+ * has to sleep or wake someone up.
+ *
+ *   psync_mutex_t   robust mutex: if the owner dies, the next locker gets
+ *                   the lock with EOWNERDEAD and must repair the data
+ *   psync_cond_t    condition variable used with psync_mutex_t
+ *   psync_sem_t     counting semaphore
+ *   psync_rwlock_t  reader-writer lock, waiting writers block new readers
+ *
+ * Robustness uses the kernel's per-thread robust futex list, so a thread
+ * that locks a psync_mutex_t must not also rely on glibc's robust pthread
+ * mutexes (both claim the same list head).
+ */
+
+#ifndef PSYNC_H
+#define PSYNC_H
+
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+typedef struct {
+  _Atomic uint32_t word; /* Owner TID | FUTEX_WAITERS | FUTEX_OWNER_DIED */
+  struct robust_list node; /* Links the mutex into its owner's robust list */
+} psync_mutex_t;
+
+typedef struct {
+  _Atomic uint32_t seq;     /* Bumped by signal/broadcast; the futex word */
+  _Atomic uint32_t waiters;
+} psync_cond_t;
+
+typedef struct {
+  _Atomic uint32_t value;
+  _Atomic uint32_t waiters;
+} psync_sem_t;
+
+#define PSYNC_RW_WRITER 0x80000000u
+
+typedef struct {
+  _Atomic uint32_t state; /* Reader count, or PSYNC_RW_WRITER */
+  _Atomic uint32_t writers_waiting;
+  _Atomic uint32_t seq; /* Bumped on every release; the futex word */
+  _Atomic uint32_t sleepers;
+} psync_rwlock_t;
+
+/* Mutex: lock returns 0, or EOWNERDEAD if the previous owner died */
+void psync_mutex_init(psync_mutex_t *m);
+int psync_mutex_lock(psync_mutex_t *m);
+int psync_mutex_trylock(psync_mutex_t *m); /* 0, EBUSY or EOWNERDEAD */
+void psync_mutex_unlock(psync_mutex_t *m);
+
+/* Condition variable: wait returns like psync_mutex_lock */
+void psync_cond_init(psync_cond_t *c);
+int psync_cond_wait(psync_cond_t *c, psync_mutex_t *m);
+void psync_cond_signal(psync_cond_t *c);
+void psync_cond_broadcast(psync_cond_t *c);
+
+/* Counting semaphore */
+void psync_sem_init(psync_sem_t *s, uint32_t value);
+void psync_sem_wait(psync_sem_t *s);
+int psync_sem_trywait(psync_sem_t *s); /* 0 or EAGAIN */
+void psync_sem_post(psync_sem_t *s);
+
+/* Reader-writer lock */
+void psync_rwlock_init(psync_rwlock_t *rw);
+void psync_rwlock_rdlock(psync_rwlock_t *rw);
+void psync_rwlock_wrlock(psync_rwlock_t *rw);
+void psync_rwlock_unlock(psync_rwlock_t *rw);
+
+#endif /* PSYNC_H */
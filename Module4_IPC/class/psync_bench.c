@@ -0,0 +1,297 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/sem.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "psync.h"
+
+/*
+ * Benchmarks and checks for the futex-based psync library.
+ *
+ *   ./psync_bench [procs] [iters]   # lock+unlock cost: psync vs sem_t vs semop
+ *   ./psync_bench check             # condvar, rwlock, semaphore correctness
+ *   ./psync_bench robust            # owner dies holding the mutex
+ */
+
+#if defined(__linux__)
+union semun {
+  int val;
+  struct semid_ds *buf;
+  unsigned short *array;
+};
+#endif
+
+/* Everything the processes share, in one MAP_SHARED region */
+typedef struct {
+  psync_mutex_t mutex;
+  psync_cond_t cond;
+  psync_sem_t sem;
+  psync_sem_t slots, items;
+  psync_rwlock_t rw;
+  sem_t posix_sem;
+  long counter;
+  long a, b, torn;
+  int turn;
+  long ring[16];
+  unsigned head, tail;
+  long consumed_sum;
+} shared_t;
+
+static shared_t *sh;
+static int sysv_id;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_children(int procs, void (*fn)(int id, long iters), long iters) {
+  fflush(stdout);
+  for (int i = 0; i < procs; i++) {
+    if (fork() == 0) {
+      fn(i, iters);
+      exit(0);
+    }
+  }
+  while (wait(NULL) > 0)
+    ;
+}
+
+/* ------------------------------------------------------------------ */
+/* Lock/unlock throughput                                               */
+/* ------------------------------------------------------------------ */
+
+static void loop_psync_mutex(int id, long iters) {
+  (void)id;
+  for (long i = 0; i < iters; i++) {
+    psync_mutex_lock(&sh->mutex);
+    sh->counter++;
+    psync_mutex_unlock(&sh->mutex);
+  }
+}
+
+static void loop_psync_sem(int id, long iters) {
+  (void)id;
+  for (long i = 0; i < iters; i++) {
+    psync_sem_wait(&sh->sem);
+    sh->counter++;
+    psync_sem_post(&sh->sem);
+  }
+}
+
+static void loop_posix_sem(int id, long iters) {
+  (void)id;
+  for (long i = 0; i < iters; i++) {
+    sem_wait(&sh->posix_sem);
+    sh->counter++;
+    sem_post(&sh->posix_sem);
+  }
+}
+
+static void loop_sysv_sem(int id, long iters) {
+  struct sembuf down = {0, -1, 0}, up = {0, 1, 0};
+  (void)id;
+  for (long i = 0; i < iters; i++) {
+    semop(sysv_id, &down, 1);
+    sh->counter++;
+    semop(sysv_id, &up, 1);
+  }
+}
+
+static void bench(int procs, long iters) {
+  struct {
+    const char *name;
+    void (*fn)(int, long);
+  } prims[] = {
+      {"psync mutex", loop_psync_mutex},
+      {"psync semaphore", loop_psync_sem},
+      {"POSIX sem_t", loop_posix_sem},
+      {"SysV semop", loop_sysv_sem},
+  };
+  int counts[2] = {1, procs};
+
+  printf("=== Lock + unlock cost, %ld iterations per process ===\n", iters);
+  char many[32];
+  snprintf(many, sizeof(many), "%d procs ns/op", procs);
+  printf("%-18s %14s %14s  %s\n", "primitive", "1 proc ns/op", many, "check");
+
+  for (size_t p = 0; p < sizeof(prims) / sizeof(prims[0]); p++) {
+    double ns[2];
+    int ok = 1;
+    for (int c = 0; c < 2; c++) {
+      psync_mutex_init(&sh->mutex);
+      psync_sem_init(&sh->sem, 1);
+      sem_init(&sh->posix_sem, 1, 1);
+      semctl(sysv_id, 0, SETVAL, (union semun){.val = 1});
+      sh->counter = 0;
+
+      double start = now_sec();
+      run_children(counts[c], prims[p].fn, iters);
+      ns[c] = (now_sec() - start) * 1e9 / (counts[c] * iters);
+      ok &= sh->counter == counts[c] * iters;
+      sem_destroy(&sh->posix_sem);
+    }
+    printf("%-18s %14.1f %14.1f  %s\n", prims[p].name, ns[0], ns[1],
+           ok ? "OK" : "LOST UPDATES");
+  }
+}
+
+/* ------------------------------------------------------------------ */
+/* Correctness checks                                                   */
+/* ------------------------------------------------------------------ */
+
+/* Two processes hand a turn back and forth through mutex + condvar */
+static void pingpong(int id, long rounds) {
+  for (long r = 0; r < rounds; r++) {
+    psync_mutex_lock(&sh->mutex);
+    while (sh->turn != id)
+      psync_cond_wait(&sh->cond, &sh->mutex);
+    sh->counter++;
+    sh->turn = !id;
+    psync_cond_broadcast(&sh->cond);
+    psync_mutex_unlock(&sh->mutex);
+  }
+}
+
+/* Writers keep a == b; readers must never see them differ */
+static void rw_worker(int id, long iters) {
+  for (long i = 0; i < iters; i++) {
+    if (id < 2) {
+      psync_rwlock_wrlock(&sh->rw);
+      sh->a++;
+      for (volatile int spin = 0; spin < 50; spin++)
+        ;
+      sh->b++;
+      psync_rwlock_unlock(&sh->rw);
+    } else {
+      psync_rwlock_rdlock(&sh->rw);
+      if (sh->a != sh->b)
+        __atomic_fetch_add(&sh->torn, 1, __ATOMIC_RELAXED);
+      psync_rwlock_unlock(&sh->rw);
+    }
+  }
+}
+
+/* Bounded buffer: producers 0-1 send 1..iters, consumers 2-3 sum them */
+static void bounded_buffer(int id, long iters) {
+  for (long i = 1; i <= iters; i++) {
+    if (id < 2) {
+      psync_sem_wait(&sh->slots);
+      psync_mutex_lock(&sh->mutex);
+      sh->ring[sh->head++ % 16] = i;
+      psync_mutex_unlock(&sh->mutex);
+      psync_sem_post(&sh->items);
+    } else {
+      psync_sem_wait(&sh->items);
+      psync_mutex_lock(&sh->mutex);
+      sh->consumed_sum += sh->ring[sh->tail++ % 16];
+      psync_mutex_unlock(&sh->mutex);
+      psync_sem_post(&sh->slots);
+    }
+  }
+}
+
+static int check(void) {
+  long n = 100000;
+  int failures = 0;
+
+  psync_mutex_init(&sh->mutex);
+  psync_cond_init(&sh->cond);
+  sh->counter = 0;
+  sh->turn = 0;
+  double start = now_sec();
+  run_children(2, pingpong, n);
+  double elapsed = now_sec() - start;
+  printf("condvar ping-pong: %ld hand-offs, %.2f us each  %s\n", sh->counter,
+         elapsed * 1e6 / sh->counter, sh->counter == 2 * n ? "OK" : "FAIL");
+  failures += sh->counter != 2 * n;
+
+  psync_rwlock_init(&sh->rw);
+  sh->a = sh->b = sh->torn = 0;
+  run_children(4, rw_worker, n);
+  printf("rwlock: a=%ld b=%ld, %ld torn read(s)  %s\n", sh->a, sh->b, sh->torn,
+         sh->a == 2 * n && sh->b == 2 * n && sh->torn == 0 ? "OK" : "FAIL");
+  failures += sh->a != 2 * n || sh->torn != 0;
+
+  psync_mutex_init(&sh->mutex);
+  psync_sem_init(&sh->slots, 16);
+  psync_sem_init(&sh->items, 0);
+  sh->head = sh->tail = 0;
+  sh->consumed_sum = 0;
+  run_children(4, bounded_buffer, n);
+  long expected = 2 * (n * (n + 1) / 2);
+  printf("semaphore bounded buffer: sum %ld (expected %ld)  %s\n",
+         sh->consumed_sum, expected,
+         sh->consumed_sum == expected ? "OK" : "FAIL");
+  failures += sh->consumed_sum != expected;
+
+  return failures != 0;
+}
+
+/* The owner is killed while holding the mutex; a waiter must recover it */
+static int robust(void) {
+  psync_mutex_init(&sh->mutex);
+  sh->counter = 0;
+  fflush(stdout);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    psync_mutex_lock(&sh->mutex);
+    printf("[child %d] Holding the mutex, now crashing...\n", getpid());
+    fflush(stdout);
+    usleep(200000);
+    raise(SIGKILL);
+  }
+
+  usleep(50000); /* Let the child take the lock first */
+  printf("[parent] Waiting for the mutex...\n");
+  int ret = psync_mutex_lock(&sh->mutex);
+  printf("[parent] Got it: %s\n", ret == EOWNERDEAD
+                                      ? "EOWNERDEAD (previous owner died)"
+                                      : strerror(ret));
+  psync_mutex_unlock(&sh->mutex);
+  waitpid(pid, NULL, 0);
+
+  int again = psync_mutex_lock(&sh->mutex);
+  psync_mutex_unlock(&sh->mutex);
+  printf("[parent] Relocking after recovery: %s\n",
+         again == 0 ? "OK" : strerror(again));
+  return !(ret == EOWNERDEAD && again == 0);
+}
+
+int main(int argc, char *argv[]) {
+  sh = mmap(NULL, sizeof(*sh), PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (sh == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+
+  if (argc > 1 && strcmp(argv[1], "check") == 0)
+    return check();
+  if (argc > 1 && strcmp(argv[1], "robust") == 0)
+    return robust();
+
+  int procs = argc > 1 ? atoi(argv[1]) : 4;
+  long iters = argc > 2 ? atol(argv[2]) : 200000;
+
+  sysv_id = semget(IPC_PRIVATE, 1, 0600 | IPC_CREAT);
+  if (sysv_id == -1) {
+    perror("semget");
+    return 1;
+  }
+  bench(procs < 1 ? 1 : procs, iters);
+  semctl(sysv_id, 0, IPC_RMID);
+  return 0;
+}
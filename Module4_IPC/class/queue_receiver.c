@@ -1,50 +1,212 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ipc.h>
-#include <sys/msg.h>
-#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "job_queue.h"
+
+/*
+ * Worker pool for the priority job queue (see job_queue.h).
+ *
+ * Each worker takes jobs in batches (one blocking msgrcv, then whatever is
+ * already queued) so a busy queue costs fewer wakeups per job. Per-class
+ * counts and queueing delays are kept in shared memory and printed at exit.
+ *
+ *   ./queue_receiver                      # One worker, prints every job
+ *   ./queue_receiver -w 4 -b 16 -q        # 4 workers, batches of 16
+ *   ./queue_receiver -w 4 -t 200 -i 1 -q  # 200 us per job, exit when idle 1s
+ */
+
+#define MAX_WORKERS 64
+#define MAX_BATCH 64
+
+typedef struct {
+  _Atomic long jobs;
+  _Atomic long wait_ns_total;
+  _Atomic long wait_ns_max;
+} class_stats_t;
+
+typedef struct {
+  class_stats_t cls[JQ_NCLASSES + 1];
+  _Atomic long batches;
+} pool_stats_t;
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+static void record(class_stats_t *s, const jq_job_t *job) {
+  atomic_fetch_add(&s->jobs, 1);
+  if (job->enqueued_ns == 0)
+    return; /* Plain message, no timestamp */
+  long wait = jq_now_ns() - job->enqueued_ns;
+  atomic_fetch_add(&s->wait_ns_total, wait);
+  long max = atomic_load(&s->wait_ns_max);
+  while (wait > max && !atomic_compare_exchange_weak(&s->wait_ns_max, &max, wait))
+    ;
+}
+
+static void worker(job_queue_t *q, pool_stats_t *stats, int batch, int work_us,
+                   int quiet) {
+  jq_job_t jobs[MAX_BATCH];
+
+  while (!stop) {
+    int n = jq_take(q, jobs, batch);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue; /* Signal: loop checks stop */
+      if (errno != EIDRM)
+        perror("msgrcv");
+      break;
+    }
+    atomic_fetch_add(&stats->batches, 1);
+
+    for (int i = 0; i < n; i++) {
+      jq_class_t cls = jobs[i].mtype;
+      record(&stats->cls[cls], &jobs[i]);
+      if (!quiet)
+        printf("📬 [worker %d] %-11s #%u: %s\n", getpid(), jq_class_name(cls),
+               jobs[i].id, jobs[i].data);
+      if (work_us > 0)
+        usleep(work_us); /* Simulated job cost */
+    }
+  }
+  exit(0);
+}
+
+static void print_stats(pool_stats_t *stats, double elapsed) {
+  long total = 0;
 
-#define MSG_SIZE 100
+  printf("\n%-12s %10s %14s %14s\n", "class", "jobs", "avg wait (ms)",
+         "max wait (ms)");
+  for (int c = JQ_INTERACTIVE; c <= JQ_BACKGROUND; c++) {
+    class_stats_t *s = &stats->cls[c];
+    long jobs = atomic_load(&s->jobs);
+    total += jobs;
+    printf("%-12s %10ld %14.3f %14.3f\n", jq_class_name(c), jobs,
+           jobs ? atomic_load(&s->wait_ns_total) / 1e6 / jobs : 0.0,
+           atomic_load(&s->wait_ns_max) / 1e6);
+  }
+  long batches = atomic_load(&stats->batches);
+  printf("Total: %ld jobs in %.3f s (%.0f jobs/s), %.1f jobs per batch\n",
+         total, elapsed, elapsed > 0 ? total / elapsed : 0.0,
+         batches ? (double)total / batches : 0.0);
+}
 
-struct message {
-  long msg_type;
-  char msg_text[MSG_SIZE];
-};
+int main(int argc, char *argv[]) {
+  job_queue_t q;
+  int workers = 1, batch = 1, work_us = 0, idle_s = 0, quiet = 0, opt;
+  pid_t pids[MAX_WORKERS];
 
-int main(void) {
-  key_t key;
-  int msgid;
-  struct message msg;
+  while ((opt = getopt(argc, argv, "w:b:t:i:q")) != -1) {
+    switch (opt) {
+    case 'w':
+      workers = atoi(optarg);
+      break;
+    case 'b':
+      batch = atoi(optarg);
+      break;
+    case 't':
+      work_us = atoi(optarg);
+      break;
+    case 'i':
+      idle_s = atoi(optarg);
+      break;
+    case 'q':
+      quiet = 1;
+      break;
+    default:
+      printf("Usage: %s [-w workers] [-b batch] [-t us_per_job] [-i idle_s] "
+             "[-q]\n",
+             argv[0]);
+      return 1;
+    }
+  }
+  if (workers < 1 || workers > MAX_WORKERS)
+    workers = workers < 1 ? 1 : MAX_WORKERS;
+  if (batch < 1 || batch > MAX_BATCH)
+    batch = batch < 1 ? 1 : MAX_BATCH;
 
-  printf("=== MESSAGE QUEUE RECEIVER ===\n");
+  printf("=== JOB QUEUE WORKER POOL ===\n");
 
   /* Generate same key as sender */
-  key = ftok("/tmp", 'A');
+  key_t key = ftok("/tmp", 'A');
   if (key == -1) {
     perror("ftok");
     exit(EXIT_FAILURE);
   }
 
   /* Access existing message queue */
-  msgid = msgget(key, 0666 | IPC_CREAT);
-  if (msgid == -1) {
+  if (jq_open(&q, key, 0) == -1) {
     perror("msgget");
     exit(EXIT_FAILURE);
   }
 
-  printf("Waiting for messages (Ctrl+C to exit)...\n\n");
+  pool_stats_t *stats = mmap(NULL, sizeof(*stats), PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (stats == MAP_FAILED) {
+    perror("mmap");
+    exit(EXIT_FAILURE);
+  }
+
+  /* No SA_RESTART: a blocked msgrcv() returns EINTR so workers can stop */
+  struct sigaction sa = {.sa_handler = on_signal};
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  printf("%d worker(s), batch %d, queue limit %zu bytes\n", workers, batch,
+         q.qbytes);
+  printf("Waiting for jobs (Ctrl+C to exit)...\n\n");
+  fflush(stdout);
 
-  while (1) {
-    /* Receive message of type 1 */
-    if (msgrcv(msgid, &msg, MSG_SIZE, 1, 0) == -1) {
-      perror("msgrcv");
-      exit(EXIT_FAILURE);
+  uint64_t start = jq_now_ns();
+  for (int i = 0; i < workers; i++) {
+    pids[i] = fork();
+    if (pids[i] == 0)
+      worker(&q, stats, batch, work_us, quiet);
+    if (pids[i] == -1) {
+      perror("fork");
+      workers = i;
+      break;
     }
+  }
 
-    printf("📬 Received: %s\n", msg.msg_text);
+  /* Supervise: with -i, stop once the queue has drained and stayed empty */
+  int idle_ticks = 0;
+  while (!stop) {
+    usleep(100000);
+    if (idle_s <= 0)
+      continue;
+    unsigned long depth;
+    long done = 0;
+    for (int c = JQ_INTERACTIVE; c <= JQ_BACKGROUND; c++)
+      done += atomic_load(&stats->cls[c].jobs);
+    if (jq_depth(&q, &depth, NULL) == 0 && depth == 0 && done > 0)
+      idle_ticks++;
+    else
+      idle_ticks = 0;
+    if (idle_ticks >= idle_s * 10)
+      break;
   }
 
+  for (int i = 0; i < workers; i++)
+    kill(pids[i], SIGTERM);
+  while (wait(NULL) > 0)
+    ;
+
+  /* Don't count the idle tail in the throughput */
+  print_stats(stats, (jq_now_ns() - start) / 1e9 - idle_ticks / 10.0);
+  munmap(stats, sizeof(*stats));
   return 0;
 }
-
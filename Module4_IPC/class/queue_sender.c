@@ -1,44 +1,128 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ipc.h>
-#include <sys/msg.h>
-#include <sys/types.h>
+#include <unistd.h>
+
+#include "job_queue.h"
+
+/*
+ * Job submitter for the priority job queue (see job_queue.h).
+ *
+ * Interactive: each line is one job. Prefix it with "!" for an interactive
+ * job or "bg " for a background job; anything else is a normal job.
+ *
+ * Load mode: -n submits N jobs mixed across the classes (-m weights).
+ *
+ *   ./queue_sender                        # Type jobs by hand
+ *   ./queue_sender -n 10000               # 10% / 30% / 60% mix
+ *   ./queue_sender -n 10000 -m 1:0:9 -N   # Never block, count rejections
+ *   ./queue_sender -n 10000 -l 8192       # Shrink the queue to 8 KB
+ */
+
+static int load(job_queue_t *q, long n, const int weights[JQ_NCLASSES],
+                int flags) {
+  long sent[JQ_NCLASSES + 1] = {0}, rejected[JQ_NCLASSES + 1] = {0};
+  int total_weight = weights[0] + weights[1] + weights[2];
+  char payload[64];
+
+  if (total_weight <= 0) {
+    fprintf(stderr, "Class weights must not all be zero\n");
+    return 1;
+  }
 
-#define MSG_SIZE 100
+  uint64_t start = jq_now_ns();
+  for (long i = 0; i < n; i++) {
+    /* Deterministic interleaving of the classes by weight */
+    int slot = i % total_weight;
+    jq_class_t cls = slot < weights[0]                ? JQ_INTERACTIVE
+                     : slot < weights[0] + weights[1] ? JQ_NORMAL
+                                                      : JQ_BACKGROUND;
+    int len = snprintf(payload, sizeof(payload), "%s job %ld",
+                       jq_class_name(cls), i);
 
-struct message {
-  long msg_type;
-  char msg_text[MSG_SIZE];
-};
+    if (jq_submit(q, cls, i, payload, len, flags) == 0) {
+      sent[cls]++;
+    } else if (errno == EAGAIN) {
+      rejected[cls]++; /* Backpressure: the caller decides what to do */
+    } else {
+      perror("jq_submit");
+      return 1;
+    }
+  }
+  double elapsed = (jq_now_ns() - start) / 1e9;
+
+  printf("Submitted %ld jobs in %.3f s (%.0f jobs/s), queue limit %zu bytes\n",
+         n, elapsed, n / elapsed, q->qbytes);
+  for (int c = JQ_INTERACTIVE; c <= JQ_BACKGROUND; c++)
+    printf("  %-12s sent %8ld  rejected %8ld\n", jq_class_name(c), sent[c],
+           rejected[c]);
+  return 0;
+}
 
-int main(void) {
-  key_t key;
-  int msgid;
-  struct message msg;
-  char input[MSG_SIZE];
+int main(int argc, char *argv[]) {
+  job_queue_t q;
+  char input[JQ_PAYLOAD_MAX];
+  long jobs = 0;
+  size_t limit = 0;
+  int weights[JQ_NCLASSES] = {1, 3, 6};
+  int flags = 0, opt;
+  uint32_t id = 0;
 
-  printf("=== MESSAGE QUEUE SENDER ===\n");
+  while ((opt = getopt(argc, argv, "n:m:l:N")) != -1) {
+    switch (opt) {
+    case 'n':
+      jobs = atol(optarg);
+      break;
+    case 'm':
+      if (sscanf(optarg, "%d:%d:%d", &weights[0], &weights[1], &weights[2]) !=
+          3) {
+        fprintf(stderr, "-m expects interactive:normal:background\n");
+        return 1;
+      }
+      break;
+    case 'l':
+      limit = atol(optarg);
+      break;
+    case 'N':
+      flags |= JQ_NOWAIT;
+      break;
+    default:
+      printf("Usage: %s [-n jobs] [-m I:N:B] [-l queue_bytes] [-N]\n",
+             argv[0]);
+      return 1;
+    }
+  }
 
   /* Generate unique key using file path and project id */
-  key = ftok("/tmp", 'A');
+  key_t key = ftok("/tmp", 'A');
   if (key == -1) {
     perror("ftok");
     exit(EXIT_FAILURE);
   }
 
   /* Create or access message queue */
-  msgid = msgget(key, 0666 | IPC_CREAT);
-  if (msgid == -1) {
+  if (jq_open(&q, key, limit) == -1) {
     perror("msgget");
     exit(EXIT_FAILURE);
   }
 
-  printf("Enter messages to send (type 'quit' to exit):\n");
+  if (jobs > 0)
+    return load(&q, jobs, weights, flags);
+
+  printf("=== JOB QUEUE SENDER ===\n");
+  printf("Enter jobs to send (type 'quit' to exit)\n");
+  printf("  !text    interactive (served first)\n");
+  printf("  bg text  background (served last, never starved)\n");
+  printf("  text     normal\n");
 
   while (1) {
     printf("> ");
-    if (fgets(input, MSG_SIZE, stdin) == NULL) {
+    fflush(stdout);
+    if (fgets(input, sizeof(input), stdin) == NULL) {
       break;
     }
 
@@ -50,20 +134,26 @@ int main(void) {
       break;
     }
 
-    /* Prepare and send message */
-    msg.msg_type = 1;
-    strncpy(msg.msg_text, input, MSG_SIZE - 1);
-    msg.msg_text[MSG_SIZE - 1] = '\0';
+    jq_class_t cls = JQ_NORMAL;
+    char *text = input;
+    if (text[0] == '!') {
+      cls = JQ_INTERACTIVE;
+      text++;
+    } else if (strncmp(text, "bg ", 3) == 0) {
+      cls = JQ_BACKGROUND;
+      text += 3;
+    }
 
-    if (msgsnd(msgid, &msg, strlen(msg.msg_text) + 1, 0) == -1) {
+    if (jq_submit(&q, cls, id++, text, strlen(text), flags) == -1) {
       perror("msgsnd");
-      exit(EXIT_FAILURE);
+      if (errno != EAGAIN)
+        exit(EXIT_FAILURE);
+      continue;
     }
 
-    printf("✓ Message sent to queue\n");
+    printf("✓ %s job sent to queue\n", jq_class_name(cls));
   }
 
   printf("Sender exiting.\n");
   return 0;
 }
-
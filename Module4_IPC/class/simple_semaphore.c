@@ -6,39 +6,46 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
-/* Simple semaphore structure */
+#include "psync.h"
+
+/*
+ * Semaphore structure
+ *
+ * The count and the waiting queue live in one futex-based psync_sem_t:
+ * the count is changed with atomic instructions (no lost updates when two
+ * processes race), and blocked processes really sleep in the kernel's
+ * futex wait queue until sem_signal() wakes one of them.
+ */
 struct semaphore {
-  int count; // number of available resources
-  // In real implementation, would also have:
-  // queue q; // waiting processes queue
+  psync_sem_t sem; // count of available resources + kernel wait queue
 };
 
 /* Wait operation (P operation, down, acquire) */
 void sem_wait(struct semaphore *s) {
-  s->count--; // decrement
-
-  if (s->count < 0) {
-    printf("  [Process %d] count=%d, BLOCKED (added to queue)\n", getpid(),
-           s->count);
-    // In real OS: remove process from ready queue
-    // and put it in semaphore's waiting queue
-    sleep(2); // Simulate blocking
-  } else {
-    printf("  [Process %d] count=%d, proceeding\n", getpid(), s->count);
+  if (psync_sem_trywait(&s->sem) == 0) {
+    printf("  [Process %d] count=%u, proceeding\n", getpid(),
+           atomic_load(&s->sem.value));
+    return;
   }
+
+  printf("  [Process %d] count=0, BLOCKED (added to queue)\n", getpid());
+  fflush(stdout);
+  // Sleeps in the kernel until another process calls sem_signal()
+  psync_sem_wait(&s->sem);
+  printf("  [Process %d] woken up, proceeding\n", getpid());
 }
 
 /* Signal operation (V operation, up, release) */
 void sem_signal(struct semaphore *s) {
-  s->count++; // increment
+  int waiting = atomic_load(&s->sem.waiters) > 0;
+
+  psync_sem_post(&s->sem); // increment, and wake one waiter if any
 
-  if (s->count <= 0) {
-    printf("  [Process %d] count=%d, waking up one waiting process\n", getpid(),
-           s->count);
-    // In real OS: remove one process from waiting queue
-    // and add it to ready queue
+  if (waiting) {
+    printf("  [Process %d] waking up one waiting process\n", getpid());
   } else {
-    printf("  [Process %d] count=%d, no process waiting\n", getpid(), s->count);
+    printf("  [Process %d] count=%u, no process waiting\n", getpid(),
+           atomic_load(&s->sem.value));
   }
 }
 
@@ -94,15 +101,17 @@ int main(void) {
 
   // Initialize semaphore
   printf("Initializing semaphore with count = 1 (binary semaphore/mutex)\n");
-  sem->count = 1;
+  psync_sem_init(&sem->sem, 1);
 
   printf("\nSemaphore Structure:\n");
   printf("  struct semaphore {\n");
-  printf("    int count = %d;  // available resources\n", sem->count);
-  printf("    queue q;         // waiting processes (not shown)\n");
+  printf("    count = %u;   // available resources (atomic)\n",
+         atomic_load(&sem->sem.value));
+  printf("    queue q;     // waiting processes (kernel futex queue)\n");
   printf("  };\n\n");
 
   printf("Creating 3 worker processes...\n");
+  fflush(stdout); // Children must not inherit unflushed output
 
   // Create 3 child processes
   for (int i = 0; i < 3; i++) {
@@ -4,12 +4,19 @@
  *
  * Compile: gcc -o pipes 01_pipes.c
  * Run: ./pipes
+ *      ./pipes 4 [MB] [pipe_KB] [stages]   # copy vs zero-copy throughput
  */
 
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 /* Example 1: Basic pipe */
@@ -145,7 +152,252 @@ void example_pipeline() {
   wait(NULL);
 }
 
+/*
+ * Example 4: Pipeline throughput, copying vs zero-copy
+ *
+ *   generator | stage 1 (tap) | stage 2 | ... | consumer
+ *                    |
+ *                    +--> archiver
+ *
+ * Copy mode moves every byte through a userspace buffer at each hop, like
+ * example 3. Zero-copy mode never touches the data:
+ *   - the generator vmsplice()s its buffer pages into the pipe,
+ *   - stage 1 tee()s the stream to the archiver, then splice()s it on,
+ *   - the other stages splice() pipe to pipe,
+ *   - the consumer and archiver splice() into /dev/null.
+ * Only page references move between pipes, so throughput is bounded by
+ * pipe bookkeeping and context switches, not memcpy bandwidth.
+ */
+
+#define PIPE_KB_DEFAULT 1024
+#define MAX_STAGES 16
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* Fill a buffer with log-like lines so the stream looks like the real thing */
+static char *make_log_buffer(size_t size) {
+  char *buf = aligned_alloc(4096, size);
+  char line[128];
+  size_t pos = 0;
+
+  for (long n = 0; buf && pos < size; n++) {
+    int len = snprintf(line, sizeof(line),
+                       "2024-03-01T12:%02ld:%02ld INFO worker=%ld "
+                       "GET /api/items/%ld 200 %ldus\n",
+                       n / 60 % 60, n % 60, n % 16, n * 7919 % 100000,
+                       n * 37 % 10000);
+    size_t c = (size_t)len < size - pos ? (size_t)len : size - pos;
+    memcpy(buf + pos, line, c);
+    pos += c;
+  }
+  return buf;
+}
+
+/* Generator: push `total` bytes, reusing one buffer of `chunk` bytes */
+static void run_generator(int out, size_t total, size_t chunk, int zero_copy) {
+  char *buf = make_log_buffer(chunk);
+
+  for (size_t sent = 0; sent < total;) {
+    size_t len = total - sent < chunk ? total - sent : chunk;
+    if (!zero_copy) {
+      if (write_all(out, buf, len) == -1)
+        exit(1);
+      sent += len;
+      continue;
+    }
+    /* The pipe references our pages; the buffer is never modified */
+    struct iovec iov = {buf, len};
+    while (iov.iov_len > 0) {
+      ssize_t n = vmsplice(out, &iov, 1, 0);
+      if (n == -1) {
+        if (errno == EINTR)
+          continue;
+        exit(1);
+      }
+      iov.iov_base = (char *)iov.iov_base + n;
+      iov.iov_len -= n;
+      sent += n;
+    }
+  }
+  exit(0);
+}
+
+/* Pass-through stage; with tap != -1 every byte is also sent to the tap */
+static void run_stage(int in, int out, int tap, size_t chunk, int zero_copy) {
+  if (!zero_copy) {
+    char *buf = malloc(chunk);
+    ssize_t n;
+    while ((n = read(in, buf, chunk)) > 0) {
+      if (write_all(out, buf, n) == -1 ||
+          (tap != -1 && write_all(tap, buf, n) == -1))
+        exit(1);
+    }
+    exit(n == 0 ? 0 : 1);
+  }
+
+  for (;;) {
+    ssize_t n;
+    if (tap != -1) {
+      /* Duplicate without consuming, then move exactly that much on */
+      n = tee(in, tap, chunk, 0);
+      if (n <= 0)
+        exit(n == 0 ? 0 : 1);
+      for (ssize_t left = n; left > 0;) {
+        ssize_t m = splice(in, NULL, out, NULL, left, SPLICE_F_MOVE);
+        if (m <= 0)
+          exit(1);
+        left -= m;
+      }
+    } else {
+      n = splice(in, NULL, out, NULL, chunk, SPLICE_F_MOVE);
+      if (n <= 0)
+        exit(n == 0 ? 0 : 1);
+    }
+  }
+}
+
+/* Drain a pipe to the end; returns the number of bytes seen */
+static size_t run_sink(int in, size_t chunk, int zero_copy) {
+  size_t total = 0;
+  ssize_t n;
+
+  if (!zero_copy) {
+    char *buf = malloc(chunk);
+    while ((n = read(in, buf, chunk)) > 0)
+      total += n;
+    free(buf);
+    return total;
+  }
+  int devnull = open("/dev/null", O_WRONLY);
+  while ((n = splice(in, NULL, devnull, NULL, chunk, SPLICE_F_MOVE)) > 0)
+    total += n;
+  close(devnull);
+  return total;
+}
+
+/* Close every pipe end except the (up to) three this process uses */
+static void close_other_ends(int (*p)[2], int npipes, int keep1, int keep2,
+                             int keep3) {
+  for (int i = 0; i < npipes; i++) {
+    for (int e = 0; e < 2; e++) {
+      int fd = p[i][e];
+      if (fd != keep1 && fd != keep2 && fd != keep3)
+        close(fd);
+    }
+  }
+}
+
+/* Run one full pipeline; returns elapsed seconds, or -1 on a short stream */
+static double run_pipeline(size_t total, int pipe_size, int stages,
+                           int zero_copy, int *actual_size) {
+  /* p[0..stages] form the chain, p[stages + 1] feeds the archiver */
+  int p[MAX_STAGES + 2][2];
+  int npipes = stages + 2;
+  int chain_end = stages;
+  size_t chunk = pipe_size;
+
+  for (int i = 0; i < npipes; i++) {
+    if (pipe(p[i]) == -1) {
+      perror("pipe");
+      return -1;
+    }
+    /* Fails beyond /proc/sys/fs/pipe-max-size unless privileged */
+    if (fcntl(p[i][1], F_SETPIPE_SZ, pipe_size) == -1 && i == 0)
+      perror("F_SETPIPE_SZ");
+  }
+  *actual_size = fcntl(p[0][1], F_GETPIPE_SZ);
+  if (*actual_size > 0)
+    chunk = *actual_size;
+
+  fflush(stdout);
+  double start = now_sec();
+
+  if (fork() == 0) {
+    close_other_ends(p, npipes, p[0][1], -1, -1);
+    run_generator(p[0][1], total, chunk, zero_copy);
+  }
+  for (int s = 1; s <= stages; s++) {
+    if (fork() == 0) {
+      int tap = s == 1 ? p[stages + 1][1] : -1;
+      close_other_ends(p, npipes, p[s - 1][0], p[s][1], tap);
+      run_stage(p[s - 1][0], p[s][1], tap, chunk, zero_copy);
+    }
+  }
+  pid_t archiver = fork();
+  if (archiver == 0) {
+    close_other_ends(p, npipes, p[stages + 1][0], -1, -1);
+    exit(run_sink(p[stages + 1][0], chunk, zero_copy) == total ? 0 : 1);
+  }
+
+  close_other_ends(p, npipes, p[chain_end][0], -1, -1);
+  size_t received = run_sink(p[chain_end][0], chunk, zero_copy);
+  close(p[chain_end][0]);
+
+  int status, ok = received == total;
+  while (wait(&status) > 0)
+    ok &= WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  double elapsed = now_sec() - start;
+
+  if (!ok) {
+    fprintf(stderr, "  pipeline lost data (%zu of %zu bytes)\n", received,
+            total);
+    return -1;
+  }
+  return elapsed;
+}
+
+void example_pipeline_bench(long mb, int pipe_kb, int stages) {
+  printf("\n=== Example 4: Pipeline Throughput (copy vs zero-copy) ===\n");
+
+  if (stages < 1)
+    stages = 1;
+  if (stages > MAX_STAGES)
+    stages = MAX_STAGES;
+  size_t total = (size_t)mb << 20;
+  int actual = 0;
+
+  printf("Streaming %ld MB: generator | %d pass-through stage(s) | consumer\n",
+         mb, stages);
+  printf("Stage 1 also taps the stream to an archiver\n");
+  fflush(stdout);
+
+  const char *names[] = {"copy (read/write)", "zero-copy (vmsplice/tee/splice)"};
+  double secs[2];
+  for (int zc = 0; zc < 2; zc++) {
+    secs[zc] = run_pipeline(total, pipe_kb * 1024, stages, zc, &actual);
+    if (zc == 0)
+      printf("Pipe capacity: %d KB (requested %d KB)\n", actual / 1024,
+             pipe_kb);
+    if (secs[zc] < 0)
+      return;
+    printf("  %-32s %7.3f s  %6.2f GB/s\n", names[zc], secs[zc],
+           total / secs[zc] / 1e9);
+  }
+  printf("  Speedup: %.1fx\n", secs[0] / secs[1]);
+}
+
 int main(int argc, char *argv[]) {
+  /* Keep children from inheriting (and re-printing) unflushed output */
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
   if (argc > 1) {
     int ex = atoi(argv[1]);
     switch (ex) {
@@ -158,8 +410,13 @@ int main(int argc, char *argv[]) {
     case 3:
       example_pipeline();
       break;
+    case 4:
+      example_pipeline_bench(argc > 2 ? atol(argv[2]) : 1024,
+                             argc > 3 ? atoi(argv[3]) : PIPE_KB_DEFAULT,
+                             argc > 4 ? atoi(argv[4]) : 3);
+      break;
     default:
-      printf("Example 1-3\n");
+      printf("Example 1-4\n");
     }
   } else {
     example_basic_pipe();
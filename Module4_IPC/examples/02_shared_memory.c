@@ -2,11 +2,19 @@
  * 02_shared_memory.c - POSIX shared memory example
  * Demonstrates shared memory with semaphore synchronization
  *
- * Compile: gcc -o shm 02_shared_memory.c -lrt -lpthread
- * Run: ./shm writer  (in terminal 1)
- *      ./shm reader  (in terminal 2)
+ * Compile: gcc -o shm 02_shared_memory.c shm_seg.c -lrt -lpthread
+ * Run: ./shm writer [-T|-H] [-N node] [-P] [-s MiB]  (in terminal 1)
+ *      ./shm reader [-T|-H]                          (in terminal 2)
+ *
+ * Options (see shm_seg.h): -T transparent huge pages, -H hugetlb pages
+ * (needs a mounted hugetlbfs), -N bind the segment to a NUMA node,
+ * -P pre-fault the whole segment, -s segment size in MiB.
  */
 
+#define _GNU_SOURCE
+
+#include "shm_seg.h"
+
 #include <fcntl.h>
 #include <semaphore.h>
 #include <stdio.h>
@@ -25,16 +33,23 @@ typedef struct {
   char message[256];
 } shared_data_t;
 
-void writer_process() {
+void writer_process(const shm_seg_opts_t *opts, size_t size) {
   printf("=== Writer Process ===\n");
 
-  // Create shared memory
-  int fd = shm_open(SHM_NAME, O_CREAT | O_RDWR, 0666);
-  ftruncate(fd, SHM_SIZE);
+  // Create and map shared memory
+  shm_seg_t seg;
+  if (shm_seg_create(&seg, SHM_NAME, size, opts) == -1) {
+    perror("shm_seg_create");
+    return;
+  }
+  shared_data_t *data = seg.addr;
 
-  // Map shared memory
-  shared_data_t *data =
-      mmap(NULL, SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  shm_seg_stats_t st;
+  if (shm_seg_stats(&seg, &st) == 0)
+    printf("[Writer] %zu KiB segment, %s pages: %zu KiB resident, %zu KiB "
+           "huge, node %d\n",
+           seg.size / 1024, shm_pages_name(seg.pages), st.rss / 1024,
+           st.huge_bytes / 1024, st.node);
 
   // Create semaphore
   sem_t *sem = sem_open(SEM_NAME, O_CREAT, 0666, 1);
@@ -54,25 +69,22 @@ void writer_process() {
   }
 
   // Cleanup
-  munmap(data, SHM_SIZE);
-  close(fd);
+  shm_seg_close(&seg);
   sem_close(sem);
 
   printf("[Writer] Done\n");
 }
 
-void reader_process() {
+void reader_process(shm_pages_t pages) {
   printf("=== Reader Process ===\n");
 
-  // Open shared memory
-  int fd = shm_open(SHM_NAME, O_RDONLY, 0);
-  if (fd == -1) {
-    perror("shm_open");
+  // Open and map shared memory
+  shm_seg_t seg;
+  if (shm_seg_open(&seg, SHM_NAME, pages, 0) == -1) {
+    perror("shm_seg_open");
     return;
   }
-
-  // Map shared memory
-  shared_data_t *data = mmap(NULL, SHM_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+  shared_data_t *data = seg.addr;
 
   // Open semaphore
   sem_t *sem = sem_open(SEM_NAME, 0);
@@ -93,25 +105,53 @@ void reader_process() {
   }
 
   // Cleanup
-  munmap(data, SHM_SIZE);
-  close(fd);
+  shm_seg_close(&seg);
   sem_close(sem);
-  shm_unlink(SHM_NAME);
+  shm_seg_unlink(SHM_NAME, pages);
   sem_unlink(SEM_NAME);
 
   printf("[Reader] Done\n");
 }
 
 int main(int argc, char *argv[]) {
-  if (argc != 2) {
-    printf("Usage: %s [writer|reader]\n", argv[0]);
+  if (argc < 2) {
+    printf("Usage: %s [writer|reader] [-T|-H] [-N node] [-P] [-s MiB]\n",
+           argv[0]);
     return 1;
   }
 
+  shm_seg_opts_t opts = {SHM_PAGES_SMALL, -1, 0};
+  size_t size = SHM_SIZE;
+  int opt;
+  optind = 2;
+  while ((opt = getopt(argc, argv, "THN:Ps:")) != -1) {
+    switch (opt) {
+    case 'T':
+      opts.pages = SHM_PAGES_THP;
+      break;
+    case 'H':
+      opts.pages = SHM_PAGES_HUGETLB;
+      break;
+    case 'N':
+      opts.numa_node = atoi(optarg);
+      break;
+    case 'P':
+      opts.populate = 1;
+      break;
+    case 's':
+      size = strtoul(optarg, NULL, 10) << 20;
+      break;
+    default:
+      return 1;
+    }
+  }
+  if (size < sizeof(shared_data_t))
+    size = SHM_SIZE;
+
   if (strcmp(argv[1], "writer") == 0) {
-    writer_process();
+    writer_process(&opts, size);
   } else if (strcmp(argv[1], "reader") == 0) {
-    reader_process();
+    reader_process(opts.pages);
   } else {
     printf("Invalid argument. Use 'writer' or 'reader'\n");
     return 1;
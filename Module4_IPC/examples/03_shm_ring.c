@@ -0,0 +1,218 @@
+/*
+ * 03_shm_ring.c - Lock-free shared-memory ring buffer
+ * Same shm_open/mmap setup as 02_shared_memory.c, but messages go through
+ * a ring of variable-length records (see shm_ring.h) instead of one slot
+ * guarded by a semaphore. Nothing is lost between reads and the reader
+ * sleeps on a futex instead of polling with sleep(1).
+ *
+ * Compile: gcc -o shm_ring 03_shm_ring.c shm_ring.c
+ * Run: ./shm_ring consumer                (in terminal 1)
+ *      ./shm_ring producer [count]        (in terminal 2)
+ *      ./shm_ring bench [spsc|mpmc] [producers] [consumers] [size] [msgs]
+ */
+
+#define _GNU_SOURCE
+
+#include "shm_ring.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RING_NAME "/my_ring"
+#define RING_SIZE (1 << 20) /* 1 MiB of record space */
+#define MAX_PROCS 64
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void producer_process(int count) {
+  printf("=== Producer Process ===\n");
+
+  shm_ring_t ring;
+  if (shm_ring_open(&ring, RING_NAME) == -1) {
+    perror("shm_ring_open (start the consumer first)");
+    return;
+  }
+
+  char msg[128];
+  for (int i = 0; i < count; i++) {
+    int len = snprintf(msg, sizeof(msg), "Message #%d from producer", i + 1);
+    shm_ring_send(&ring, msg, len + 1);
+  }
+  printf("[Producer] Sent %d messages\n", count);
+
+  shm_ring_shutdown(&ring);
+  shm_ring_close(&ring);
+}
+
+void consumer_process() {
+  printf("=== Consumer Process ===\n");
+
+  shm_ring_t ring;
+  if (shm_ring_create(&ring, RING_NAME, RING_SIZE, SHM_RING_SPSC) == -1) {
+    perror("shm_ring_create");
+    return;
+  }
+  printf("[Consumer] Waiting for messages on %s...\n", RING_NAME);
+
+  char msg[256];
+  ssize_t n;
+  long received = 0;
+  while ((n = shm_ring_recv(&ring, msg, sizeof(msg))) > 0) {
+    if (received < 5 || received % 100000 == 0)
+      printf("[Consumer] Read: %s\n", msg);
+    received++;
+  }
+
+  printf("[Consumer] Done, %ld messages\n", received);
+  shm_ring_close(&ring);
+  shm_ring_unlink(RING_NAME);
+}
+
+/*
+ * Fork producers and consumers over one ring and measure throughput.
+ * Every payload starts with a sequence number; consumers sum them so the
+ * parent can check that nothing was lost or duplicated.
+ */
+void bench(shm_ring_mode_t mode, int producers, int consumers, size_t size,
+           long messages) {
+  struct totals {
+    _Atomic long received;
+    _Atomic unsigned long long checksum;
+  } *totals = mmap(NULL, sizeof(*totals), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (totals == MAP_FAILED) {
+    perror("mmap");
+    return;
+  }
+  atomic_init(&totals->received, 0);
+  atomic_init(&totals->checksum, 0);
+
+  shm_ring_t ring;
+  if (shm_ring_create(&ring, RING_NAME "_bench", RING_SIZE, mode) == -1) {
+    perror("shm_ring_create");
+    return;
+  }
+  if (size < sizeof(long))
+    size = sizeof(long);
+  if (size > shm_ring_max_msg(&ring)) {
+    printf("Message size too large (max %zu)\n", shm_ring_max_msg(&ring));
+    return;
+  }
+
+  printf("=== Ring Benchmark: %s, %d producer(s), %d consumer(s), "
+         "%zu-byte messages, %ld messages ===\n",
+         mode == SHM_RING_SPSC ? "SPSC" : "MPMC", producers, consumers, size,
+         messages);
+
+  fflush(stdout); /* Children must not inherit buffered output */
+  double start = now_sec();
+  pid_t cons[MAX_PROCS], prod[MAX_PROCS];
+
+  for (int c = 0; c < consumers; c++) {
+    if ((cons[c] = fork()) == 0) {
+      char *buf = malloc(size);
+      long got = 0;
+      unsigned long long sum = 0;
+      ssize_t n;
+      while ((n = shm_ring_recv(&ring, buf, size)) > 0) {
+        long seq;
+        memcpy(&seq, buf, sizeof(seq));
+        sum += seq;
+        got++;
+      }
+      atomic_fetch_add(&totals->received, got);
+      atomic_fetch_add(&totals->checksum, sum);
+      exit(0);
+    }
+  }
+
+  for (int p = 0; p < producers; p++) {
+    if ((prod[p] = fork()) == 0) {
+      char *buf = calloc(1, size);
+      for (long seq = p; seq < messages; seq += producers) {
+        memcpy(buf, &seq, sizeof(seq));
+        shm_ring_send(&ring, buf, size);
+      }
+      exit(0);
+    }
+  }
+
+  for (int p = 0; p < producers; p++)
+    waitpid(prod[p], NULL, 0);
+  shm_ring_shutdown(&ring);
+  for (int c = 0; c < consumers; c++)
+    waitpid(cons[c], NULL, 0);
+
+  double elapsed = now_sec() - start;
+  unsigned long long expected = (unsigned long long)messages * (messages - 1) / 2;
+  long received = atomic_load(&totals->received);
+
+  printf("Received:   %ld / %ld (%s)\n", received, messages,
+         received == messages && atomic_load(&totals->checksum) == expected
+             ? "checksum OK"
+             : "MISMATCH");
+  printf("Elapsed:    %.3f s\n", elapsed);
+  printf("Throughput: %.2f M msgs/s, %.1f MB/s\n", messages / elapsed / 1e6,
+         messages * size / elapsed / 1e6);
+
+  shm_ring_close(&ring);
+  shm_ring_unlink(RING_NAME "_bench");
+  munmap(totals, sizeof(*totals));
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("Usage: %s [consumer|producer [count]|bench [spsc|mpmc] "
+           "[producers] [consumers] [size] [msgs]]\n",
+           argv[0]);
+    return 1;
+  }
+
+  if (strcmp(argv[1], "producer") == 0) {
+    producer_process(argc > 2 ? atoi(argv[2]) : 1000000);
+  } else if (strcmp(argv[1], "consumer") == 0) {
+    consumer_process();
+  } else if (strcmp(argv[1], "bench") == 0) {
+    shm_ring_mode_t mode = argc > 2 && strcmp(argv[2], "mpmc") == 0
+                               ? SHM_RING_MPMC
+                               : SHM_RING_SPSC;
+    int producers = argc > 3 ? atoi(argv[3]) : 1;
+    int consumers = argc > 4 ? atoi(argv[4]) : 1;
+    if (mode == SHM_RING_SPSC)
+      producers = consumers = 1;
+    if (producers < 1 || producers > MAX_PROCS || consumers < 1 ||
+        consumers > MAX_PROCS) {
+      printf("Producers and consumers must be 1-%d\n", MAX_PROCS);
+      return 1;
+    }
+    bench(mode, producers, consumers, argc > 5 ? atoi(argv[5]) : 16,
+          argc > 6 ? atol(argv[6]) : 10000000);
+  } else {
+    printf("Invalid argument. Use 'producer', 'consumer' or 'bench'\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * TRY THIS:
+ *
+ * ./shm_ring bench spsc                # one producer, one consumer
+ * ./shm_ring bench mpmc 4 4 64         # 4 producers, 4 consumers, 64 B
+ * ./shm_ring bench spsc 1 1 4096 1000000
+ *
+ * Compare with 02_shared_memory: one message per second, and anything
+ * written between two reads is overwritten and lost.
+ */
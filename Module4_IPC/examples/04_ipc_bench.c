@@ -0,0 +1,692 @@
+/*
+ * 04_ipc_bench.c - IPC transport benchmark harness
+ * Sends fixed-size messages over each IPC mechanism and measures
+ * throughput, latency percentiles and CPU cost per message.
+ *
+ * Transports:
+ *   pipe    - anonymous pipe             (one lane per producer/consumer pair)
+ *   fifo    - named pipe from mkfifo()   (lanes)
+ *   unix    - AF_UNIX stream socketpair  (lanes)
+ *   sysv    - System V message queue     (one shared queue)
+ *   mq      - POSIX message queue        (one shared queue)
+ *   ring    - shm_ring.h ring buffer     (one shared ring, SPSC if 1:1)
+ *
+ * Byte streams have no message boundaries, so the stream transports use
+ * max(P, C) lanes, each with exactly one writer and one reader. Producers
+ * round-robin over their lanes and consumers poll() theirs. Message
+ * transports share one channel between everybody.
+ *
+ * Every message carries its send time (CLOCK_MONOTONIC) in its first
+ * 8 bytes, so latency includes queueing under full load. Consumers record
+ * every latency into a shared histogram (shm_hist.h) with no lock; -H
+ * names it, so `13_latency_hist watch NAME` can follow a run live.
+ *
+ * Compile: gcc -o ipc_bench 04_ipc_bench.c shm_ring.c shm_hist.c -lrt
+ * Run: ./ipc_bench [-t pipe,ring,...] [-s 8,4096,...] [-p producers]
+ *                  [-c consumers] [-n messages] [-C cpu,cpu,...] [-H name]
+ */
+
+#define _GNU_SOURCE
+
+#include "shm_hist.h"
+#include "shm_ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <mqueue.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/msg.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_PROCS 64
+#define BYTES_PER_RUN (256UL << 20)
+#define MIN_MSGS 500
+#define MAX_MSGS 200000
+#define MQ_NAME "/ipc_bench_mq"
+#define RING_NAME "/ipc_bench_ring"
+#define FIFO_FMT "/tmp/ipc_bench_fifo_%d_%d"
+
+typedef struct bench bench_t;
+
+typedef struct {
+  const char *name;
+  int shared; /* 1: one channel for all, 0: one lane per pair */
+  int (*setup)(bench_t *b);
+  int (*send)(bench_t *b, int lane, void *msg);
+  int (*recv)(bench_t *b, int lane, void *msg); /* 1 msg, 0 end, -1 error */
+  void (*finish)(bench_t *b); /* Parent, after all producers exited */
+  void (*teardown)(bench_t *b);
+} transport_t;
+
+struct bench {
+  const transport_t *t;
+  size_t size;
+  long messages;
+  int producers;
+  int consumers;
+  int lanes;
+  int rfd[MAX_PROCS];
+  int wfd[MAX_PROCS];
+  int sysv_id;
+  mqd_t mq;
+  shm_ring_t ring;
+  shm_hist_t *hist; /* Shared with the children, one shard per CPU */
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Loop until exactly len bytes moved (streams may return short counts) */
+static int write_full(int fd, const void *buf, size_t len) {
+  const char *p = buf;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int read_full(int fd, void *buf, size_t len) {
+  char *p = buf;
+  size_t got = 0;
+  while (got < len) {
+    ssize_t n = read(fd, p + got, len - got);
+    if (n == 0)
+      return got == 0 ? 0 : -1; /* EOF between messages is a clean end */
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    got += n;
+  }
+  return 1;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Stream transports: pipe, fifo, unix                                     */
+/* ---------------------------------------------------------------------- */
+
+static int pipe_setup(bench_t *b) {
+  for (int l = 0; l < b->lanes; l++) {
+    int fds[2];
+    if (pipe(fds) == -1)
+      return -1;
+    b->rfd[l] = fds[0];
+    b->wfd[l] = fds[1];
+  }
+  return 0;
+}
+
+static int fifo_setup(bench_t *b) {
+  for (int l = 0; l < b->lanes; l++) {
+    char path[64];
+    snprintf(path, sizeof(path), FIFO_FMT, getpid(), l);
+    unlink(path);
+    if (mkfifo(path, 0600) == -1)
+      return -1;
+    /* Open the read end non-blocking so opening the write end cannot hang */
+    b->rfd[l] = open(path, O_RDONLY | O_NONBLOCK);
+    b->wfd[l] = open(path, O_WRONLY);
+    if (b->rfd[l] == -1 || b->wfd[l] == -1)
+      return -1;
+    fcntl(b->rfd[l], F_SETFL, 0);
+  }
+  return 0;
+}
+
+static void fifo_teardown(bench_t *b) {
+  for (int l = 0; l < b->lanes; l++) {
+    char path[64];
+    snprintf(path, sizeof(path), FIFO_FMT, getpid(), l);
+    unlink(path);
+  }
+}
+
+static int unix_setup(bench_t *b) {
+  for (int l = 0; l < b->lanes; l++) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+      return -1;
+    shutdown(fds[0], SHUT_WR);
+    shutdown(fds[1], SHUT_RD);
+    b->rfd[l] = fds[0];
+    b->wfd[l] = fds[1];
+  }
+  return 0;
+}
+
+static int stream_send(bench_t *b, int lane, void *msg) {
+  return write_full(b->wfd[lane], msg, b->size);
+}
+
+static int stream_recv(bench_t *b, int lane, void *msg) {
+  return read_full(b->rfd[lane], msg, b->size);
+}
+
+/* ---------------------------------------------------------------------- */
+/* System V message queue                                                  */
+/* ---------------------------------------------------------------------- */
+
+static int sysv_setup(bench_t *b) {
+  /* msgsnd() rejects anything above MSGMAX with EINVAL: skip up front */
+  FILE *fp = fopen("/proc/sys/kernel/msgmax", "r");
+  long msgmax = 8192;
+  if (fp) {
+    if (fscanf(fp, "%ld", &msgmax) != 1)
+      msgmax = 8192;
+    fclose(fp);
+  }
+  if ((long)b->size > msgmax) {
+    b->sysv_id = -1;
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  b->sysv_id = msgget(IPC_PRIVATE, IPC_CREAT | 0600);
+  if (b->sysv_id == -1)
+    return -1;
+
+  /* Let the queue hold a decent backlog (root may raise it past MSGMNB) */
+  struct msqid_ds ds;
+  if (msgctl(b->sysv_id, IPC_STAT, &ds) == 0 && ds.msg_qbytes < 1 << 20) {
+    ds.msg_qbytes = 1 << 20;
+    msgctl(b->sysv_id, IPC_SET, &ds);
+  }
+  return 0;
+}
+
+/* msg points just past a long reserved for mtype (see run_producer) */
+static int sysv_send(bench_t *b, int lane, void *msg) {
+  (void)lane;
+  long *mtype = (long *)msg - 1;
+  *mtype = 1;
+  while (msgsnd(b->sysv_id, mtype, b->size, 0) == -1) {
+    if (errno != EINTR)
+      return -1;
+  }
+  return 0;
+}
+
+static int sysv_recv(bench_t *b, int lane, void *msg) {
+  (void)lane;
+  long *mtype = (long *)msg - 1;
+  while (msgrcv(b->sysv_id, mtype, b->size, 0, 0) == -1) {
+    if (errno != EINTR)
+      return -1;
+  }
+  return *(uint64_t *)msg != 0; /* Timestamp 0 = stop message */
+}
+
+static void sysv_finish(bench_t *b) {
+  long *stop = calloc(1, sizeof(long) + b->size);
+  for (int c = 0; c < b->consumers; c++)
+    sysv_send(b, 0, stop + 1);
+  free(stop);
+}
+
+static void sysv_teardown(bench_t *b) {
+  if (b->sysv_id != -1)
+    msgctl(b->sysv_id, IPC_RMID, NULL);
+}
+
+/* ---------------------------------------------------------------------- */
+/* POSIX message queue                                                     */
+/* ---------------------------------------------------------------------- */
+
+static int mq_setup(bench_t *b) {
+  struct mq_attr attr = {.mq_maxmsg = 10, .mq_msgsize = b->size};
+  mq_unlink(MQ_NAME);
+  b->mq = mq_open(MQ_NAME, O_CREAT | O_RDWR, 0600, &attr);
+  return b->mq == (mqd_t)-1 ? -1 : 0;
+}
+
+static int mq_send_msg(bench_t *b, int lane, void *msg) {
+  (void)lane;
+  while (mq_send(b->mq, msg, b->size, 0) == -1) {
+    if (errno != EINTR)
+      return -1;
+  }
+  return 0;
+}
+
+static int mq_recv_msg(bench_t *b, int lane, void *msg) {
+  (void)lane;
+  while (mq_receive(b->mq, msg, b->size, NULL) == -1) {
+    if (errno != EINTR)
+      return -1;
+  }
+  return *(uint64_t *)msg != 0;
+}
+
+static void mq_finish(bench_t *b) {
+  void *stop = calloc(1, b->size);
+  for (int c = 0; c < b->consumers; c++)
+    mq_send_msg(b, 0, stop);
+  free(stop);
+}
+
+static void mq_teardown(bench_t *b) {
+  mq_close(b->mq);
+  mq_unlink(MQ_NAME);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Shared-memory ring                                                      */
+/* ---------------------------------------------------------------------- */
+
+static int ring_setup(bench_t *b) {
+  size_t cap = 1 << 20;
+  while (cap / 4 < b->size + 16)
+    cap <<= 1;
+  shm_ring_mode_t mode = b->producers == 1 && b->consumers == 1
+                             ? SHM_RING_SPSC
+                             : SHM_RING_MPMC;
+  return shm_ring_create(&b->ring, RING_NAME, cap, mode);
+}
+
+static int ring_send(bench_t *b, int lane, void *msg) {
+  (void)lane;
+  return shm_ring_send(&b->ring, msg, b->size);
+}
+
+static int ring_recv(bench_t *b, int lane, void *msg) {
+  (void)lane;
+  ssize_t n = shm_ring_recv(&b->ring, msg, b->size);
+  return n > 0 ? 1 : (int)n;
+}
+
+static void ring_finish(bench_t *b) { shm_ring_shutdown(&b->ring); }
+
+static void ring_teardown(bench_t *b) {
+  shm_ring_close(&b->ring);
+  shm_ring_unlink(RING_NAME);
+}
+
+static const transport_t transports[] = {
+    {"pipe", 0, pipe_setup, stream_send, stream_recv, NULL, NULL},
+    {"fifo", 0, fifo_setup, stream_send, stream_recv, NULL, fifo_teardown},
+    {"unix", 0, unix_setup, stream_send, stream_recv, NULL, NULL},
+    {"sysv", 1, sysv_setup, sysv_send, sysv_recv, sysv_finish, sysv_teardown},
+    {"mq", 1, mq_setup, mq_send_msg, mq_recv_msg, mq_finish, mq_teardown},
+    {"ring", 1, ring_setup, ring_send, ring_recv, ring_finish, ring_teardown},
+};
+
+#define NTRANSPORTS (int)(sizeof(transports) / sizeof(transports[0]))
+
+/* ---------------------------------------------------------------------- */
+/* Harness                                                                 */
+/* ---------------------------------------------------------------------- */
+
+static void pin_to_cpu(const int *cpus, int ncpus, int slot) {
+  if (ncpus == 0)
+    return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpus[slot % ncpus], &set);
+  if (sched_setaffinity(0, sizeof(set), &set) == -1)
+    perror("sched_setaffinity");
+}
+
+/* In a child: keep only the lane ends this role uses */
+static void close_other_lanes(bench_t *b, int is_producer, int id) {
+  if (b->t->shared)
+    return;
+  for (int l = 0; l < b->lanes; l++) {
+    int mine = is_producer ? l % b->producers == id : l % b->consumers == id;
+    close(is_producer ? b->rfd[l] : b->wfd[l]);
+    if (!mine)
+      close(is_producer ? b->wfd[l] : b->rfd[l]);
+  }
+}
+
+static void run_producer(bench_t *b, int id) {
+  /* Room for a SysV mtype in front of the payload */
+  long *buf = calloc(1, sizeof(long) + b->size);
+  char *msg = (char *)(buf + 1);
+  int nlanes = 0, lanes[MAX_PROCS];
+
+  for (int l = 0; l < b->lanes; l++) {
+    if (b->t->shared || l % b->producers == id)
+      lanes[nlanes++] = b->t->shared ? 0 : l;
+    if (b->t->shared)
+      break;
+  }
+
+  long count = b->messages / b->producers +
+               (id < b->messages % b->producers ? 1 : 0);
+  for (long i = 0; i < count; i++) {
+    uint64_t ts = now_ns();
+    memcpy(msg, &ts, sizeof(ts));
+    if (b->t->send(b, lanes[i % nlanes], msg) == -1) {
+      perror("send");
+      exit(1);
+    }
+  }
+  exit(0);
+}
+
+static void run_consumer(bench_t *b, int id) {
+  long *buf = calloc(1, sizeof(long) + b->size);
+  char *msg = (char *)(buf + 1);
+  struct pollfd pfds[MAX_PROCS];
+  int lane_of[MAX_PROCS], nlanes = 0;
+
+  if (!b->t->shared) {
+    for (int l = 0; l < b->lanes; l++) {
+      if (l % b->consumers == id) {
+        pfds[nlanes].fd = b->rfd[l];
+        pfds[nlanes].events = POLLIN;
+        lane_of[nlanes++] = l;
+      }
+    }
+  }
+
+  for (;;) {
+    int lane = 0, r;
+
+    if (!b->t->shared) {
+      if (nlanes == 0)
+        break;
+      int idx = 0;
+      if (nlanes > 1) {
+        if (poll(pfds, nlanes, -1) == -1) {
+          if (errno == EINTR)
+            continue;
+          break;
+        }
+        while (idx < nlanes && !pfds[idx].revents)
+          idx++;
+        if (idx == nlanes)
+          continue;
+      }
+      lane = lane_of[idx];
+      r = b->t->recv(b, lane, msg);
+      if (r == 0) { /* Lane hit EOF: stop watching it */
+        pfds[idx] = pfds[nlanes - 1];
+        lane_of[idx] = lane_of[nlanes - 1];
+        nlanes--;
+        continue;
+      }
+    } else {
+      r = b->t->recv(b, 0, msg);
+      if (r == 0)
+        break;
+    }
+
+    if (r == -1) {
+      perror("recv");
+      exit(1);
+    }
+
+    uint64_t ts;
+    memcpy(&ts, msg, sizeof(ts));
+    shm_hist_record(b->hist, now_ns() - ts);
+  }
+  exit(0);
+}
+
+static double rusage_sec(const struct rusage *ru) {
+  return ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6 +
+         ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+}
+
+static void run_one(const transport_t *t, size_t size, long messages,
+                    int producers, int consumers, const int *cpus, int ncpus,
+                    shm_hist_t *hist) {
+  bench_t b = {.t = t,
+               .size = size,
+               .messages = messages,
+               .producers = producers,
+               .consumers = consumers,
+               .lanes = producers > consumers ? producers : consumers,
+               .hist = hist};
+
+  printf("%-5s %8zu %3d %3d %8ld ", t->name, size, producers, consumers,
+         messages);
+  fflush(stdout);
+
+  if (t->setup(&b) == -1) {
+    printf(" skipped: %s\n", strerror(errno));
+    if (t->teardown)
+      t->teardown(&b);
+    return;
+  }
+
+  /* Children block on this pipe until the parent closes it: one start */
+  int gate[2];
+  if (pipe(gate) == -1) {
+    perror("pipe");
+    return;
+  }
+
+  /* Counters only grow: this run's latencies are after minus before */
+  static shm_hist_snap_t hist_before, hist_after;
+  shm_hist_snapshot(b.hist, -1, &hist_before);
+
+  struct rusage before, after;
+  getrusage(RUSAGE_CHILDREN, &before);
+
+  pid_t pids[2 * MAX_PROCS];
+  int npids = 0;
+  for (int i = 0; i < consumers + producers; i++) {
+    int is_producer = i >= consumers;
+    int id = is_producer ? i - consumers : i;
+    pid_t pid = fork();
+    if (pid == 0) {
+      char c;
+      close(gate[1]);
+      pin_to_cpu(cpus, ncpus, i);
+      shm_hist_join(b.hist);
+      close_other_lanes(&b, is_producer, id);
+      read(gate[0], &c, 1);
+      close(gate[0]);
+      if (is_producer)
+        run_producer(&b, id);
+      run_consumer(&b, id);
+    }
+    pids[npids++] = pid;
+  }
+
+  /* Parent holds no write ends, or consumers would never see EOF */
+  if (!t->shared) {
+    for (int l = 0; l < b.lanes; l++) {
+      close(b.rfd[l]);
+      close(b.wfd[l]);
+    }
+  }
+
+  uint64_t start = now_ns();
+  close(gate[0]);
+  close(gate[1]);
+
+  int failed = 0;
+  for (int p = consumers; p < npids; p++) {
+    int status;
+    waitpid(pids[p], &status, 0);
+    failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+  }
+  if (failed) { /* Consumers would wait forever for the missing messages */
+    for (int c = 0; c < consumers; c++)
+      kill(pids[c], SIGKILL);
+  } else if (t->finish) {
+    t->finish(&b);
+  }
+  for (int c = 0; c < consumers; c++)
+    waitpid(pids[c], NULL, 0);
+
+  double elapsed = (now_ns() - start) / 1e9;
+  getrusage(RUSAGE_CHILDREN, &after);
+  double cpu = rusage_sec(&after) - rusage_sec(&before);
+
+  if (failed) {
+    printf(" failed\n");
+    if (t->teardown)
+      t->teardown(&b);
+    return;
+  }
+
+  shm_hist_snapshot(b.hist, -1, &hist_after);
+  shm_hist_sub(&hist_after, &hist_after, &hist_before);
+
+  printf("%8.3f %9.1f %9.1f %9.1f %9.1f %8.0f\n", messages / elapsed / 1e6,
+         messages * size / elapsed / 1e6,
+         shm_hist_percentile(&hist_after, 0.50) / 1000.0,
+         shm_hist_percentile(&hist_after, 0.99) / 1000.0,
+         shm_hist_percentile(&hist_after, 0.999) / 1000.0,
+         cpu * 1e9 / messages);
+
+  if (t->teardown)
+    t->teardown(&b);
+}
+
+/* Parse "a,b,c" into longs; returns the count */
+static int parse_list(const char *arg, long *out, int max) {
+  int n = 0;
+  char *copy = strdup(arg), *save = NULL;
+  for (char *tok = strtok_r(copy, ",", &save); tok && n < max;
+       tok = strtok_r(NULL, ",", &save))
+    out[n++] = strtol(tok, NULL, 0);
+  free(copy);
+  return n;
+}
+
+static void usage(const char *prog) {
+  printf("Usage: %s [-t transports] [-s sizes] [-p producers] "
+         "[-c consumers] [-n messages] [-C cpus]\n",
+         prog);
+  printf("  -t  comma list of: pipe,fifo,unix,sysv,mq,ring (default: all)\n");
+  printf("  -s  message sizes in bytes, >= 8 (default: 8,64,512,4096,"
+         "65536,1048576)\n");
+  printf("  -p  producer processes (default 1)\n");
+  printf("  -c  consumer processes (default 1)\n");
+  printf("  -n  messages per run (default: scaled to ~256 MB per run)\n");
+  printf("  -C  CPUs to pin processes to, round-robin: consumers first\n");
+  printf("  -H  record latencies in shm histogram NAME (default: private)\n");
+}
+
+int main(int argc, char *argv[]) {
+  long sizes[16] = {8, 64, 512, 4096, 65536, 1048576};
+  int nsizes = 6, producers = 1, consumers = 1, ncpus = 0;
+  long messages = 0, cpu_list[MAX_PROCS];
+  int cpus[MAX_PROCS];
+  const char *selected = NULL, *hist_name = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "t:s:p:c:n:C:H:h")) != -1) {
+    switch (opt) {
+    case 't':
+      selected = optarg;
+      break;
+    case 's':
+      nsizes = parse_list(optarg, sizes, 16);
+      break;
+    case 'p':
+      producers = atoi(optarg);
+      break;
+    case 'c':
+      consumers = atoi(optarg);
+      break;
+    case 'n':
+      messages = atol(optarg);
+      break;
+    case 'C':
+      ncpus = parse_list(optarg, cpu_list, MAX_PROCS);
+      for (int i = 0; i < ncpus; i++)
+        cpus[i] = cpu_list[i];
+      break;
+    case 'H':
+      hist_name = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (producers < 1 || producers > MAX_PROCS || consumers < 1 ||
+      consumers > MAX_PROCS) {
+    printf("Producers and consumers must be 1-%d\n", MAX_PROCS);
+    return 1;
+  }
+  for (int i = 0; i < nsizes; i++) {
+    if (sizes[i] < 8) {
+      printf("Message size must be at least 8 bytes (timestamp)\n");
+      return 1;
+    }
+  }
+
+  shm_hist_t hist;
+  if (shm_hist_create(&hist, hist_name, 0, SHM_HIST_PER_CPU) == -1) {
+    perror("shm_hist_create");
+    return 1;
+  }
+
+  printf("=== IPC Transport Benchmark ===\n");
+  printf("Latency = send to receive, including queueing at full load\n\n");
+  printf("%-5s %8s %3s %3s %8s %8s %9s %9s %9s %9s %8s\n", "xport", "size",
+         "P", "C", "msgs", "Mmsg/s", "MB/s", "p50(us)", "p99(us)", "p999(us)",
+         "cpu ns/m");
+
+  for (int s = 0; s < nsizes; s++) {
+    long n = messages;
+    if (n == 0) {
+      n = BYTES_PER_RUN / sizes[s];
+      n = n < MIN_MSGS ? MIN_MSGS : n > MAX_MSGS ? MAX_MSGS : n;
+    }
+    for (int i = 0; i < NTRANSPORTS; i++) {
+      if (selected) {
+        /* Match whole names in the comma list */
+        char key[16];
+        snprintf(key, sizeof(key), ",%s,", transports[i].name);
+        char list[256];
+        snprintf(list, sizeof(list), ",%s,", selected);
+        if (!strstr(list, key))
+          continue;
+      }
+      run_one(&transports[i], sizes[s], n, producers, consumers, cpus, ncpus,
+              &hist);
+    }
+  }
+
+  shm_hist_close(&hist);
+  if (hist_name)
+    shm_hist_unlink(hist_name);
+  return 0;
+}
+
+/*
+ * TRY THIS:
+ *
+ * ./ipc_bench                                  # Full matrix, 1:1
+ * ./ipc_bench -t pipe,ring -s 64 -p 4 -c 4     # Contended
+ * ./ipc_bench -s 4096 -C 2,3                   # Consumer on CPU 2,
+ *                                              # producer on CPU 3
+ * ./ipc_bench -t unix -H /bench &              # Then watch it live:
+ * ./latency_hist watch /bench                  # one line per second
+ *
+ * SysV queues refuse messages above MSGMAX (8 KiB by default) and POSIX
+ * queues above /proc/sys/fs/mqueue/msgsize_max; those runs are skipped.
+ */
@@ -0,0 +1,306 @@
+/*
+ * 05_status_page.c - Lock-free status page published with a seqlock
+ * In 02_shared_memory.c the reader takes the writer's semaphore, so every
+ * monitoring client slows the producer down. Here one writer publishes
+ * status snapshots under a seqlock (see seqlock.h) and any number of
+ * readers copy consistent snapshots without writing to shared memory.
+ *
+ * Compile: gcc -o status_page 05_status_page.c
+ * Run: ./status_page publish [updates_per_sec] [seconds]   (terminal 1)
+ *      ./status_page watch [interval_ms]                   (terminal 2, 3...)
+ *      ./status_page stress [readers] [seconds] [unsafe]
+ */
+
+#define _GNU_SOURCE
+
+#include "seqlock.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STATUS_NAME "/status_page"
+#define HIST_BUCKETS 32
+#define MAX_READERS 64
+
+/* What a storage daemon might publish; ~400 bytes, several cache lines */
+typedef struct {
+  uint64_t generation;
+  uint64_t ops_total;
+  uint64_t bytes_total;
+  uint32_t queue_depth;
+  uint32_t active_clients;
+  double latency_p50_us;
+  double latency_p99_us;
+  uint64_t latency_hist[HIST_BUCKETS];
+  char state[32];
+  uint64_t checksum; /* Over everything above: detects torn copies */
+} status_t;
+
+typedef struct {
+  seqlock_t lock;
+  _Alignas(64) status_t status;
+} status_page_t;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t status_checksum(const status_t *st) {
+  const unsigned char *p = (const unsigned char *)st;
+  uint64_t h = 1469598103934665603ull; /* FNV-1a */
+  for (size_t i = 0; i < offsetof(status_t, checksum); i++)
+    h = (h ^ p[i]) * 1099511628211ull;
+  return h;
+}
+
+/* Every field is derived from the generation, so a mix of two is visible */
+static void make_status(status_t *st, uint64_t gen) {
+  memset(st, 0, sizeof(*st));
+  st->generation = gen;
+  st->ops_total = gen * 3;
+  st->bytes_total = gen * 4096;
+  st->queue_depth = gen % 128;
+  st->active_clients = 10 + gen % 7;
+  st->latency_p50_us = 100 + gen % 50;
+  st->latency_p99_us = 900 + gen % 300;
+  for (int b = 0; b < HIST_BUCKETS; b++)
+    st->latency_hist[b] = gen + b;
+  snprintf(st->state, sizeof(st->state), "%s",
+           gen % 1000 < 10 ? "DEGRADED" : "OK");
+  st->checksum = status_checksum(st);
+}
+
+static status_page_t *map_page(int create) {
+  int fd = shm_open(STATUS_NAME, create ? O_CREAT | O_RDWR : O_RDONLY, 0666);
+  if (fd == -1) {
+    perror("shm_open");
+    return NULL;
+  }
+  if (create && ftruncate(fd, sizeof(status_page_t)) == -1) {
+    perror("ftruncate");
+    close(fd);
+    return NULL;
+  }
+  /* Readers map read-only: they physically cannot write to the page */
+  status_page_t *page =
+      mmap(NULL, sizeof(status_page_t),
+           create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  return page == MAP_FAILED ? NULL : page;
+}
+
+void publisher_process(int rate, int seconds) {
+  printf("=== Status Publisher ===\n");
+
+  status_page_t *page = map_page(1);
+  if (!page)
+    return;
+  seqlock_init(&page->lock);
+
+  status_t st;
+  struct timespec period = {0, 1000000000L / (rate > 0 ? rate : 1)};
+  long updates = (long)rate * seconds;
+  for (long gen = 1; gen <= updates; gen++) {
+    make_status(&st, gen);
+    seqlock_publish(&page->lock, &page->status, &st, sizeof(st));
+    nanosleep(&period, NULL);
+  }
+  printf("[Publisher] Published %ld snapshots\n", updates);
+
+  munmap(page, sizeof(*page));
+  shm_unlink(STATUS_NAME);
+}
+
+void watcher_process(int interval_ms) {
+  printf("=== Status Watcher ===\n");
+
+  status_page_t *page = map_page(0);
+  if (!page)
+    return;
+
+  status_t st;
+  struct timespec period = {interval_ms / 1000,
+                            (interval_ms % 1000) * 1000000L};
+  uint64_t last = 0;
+  for (;;) {
+    unsigned retries =
+        seqlock_snapshot(&page->lock, &st, &page->status, sizeof(st));
+    if (st.generation != last) {
+      printf("[Watcher] gen=%lu ops=%lu queue=%u clients=%u p99=%.0fus "
+             "state=%s%s (retries %u)\n",
+             st.generation, st.ops_total, st.queue_depth, st.active_clients,
+             st.latency_p99_us, st.state,
+             st.checksum == status_checksum(&st) ? "" : " TORN!", retries);
+      fflush(stdout);
+      last = st.generation;
+    } else if (last != 0) {
+      /* No change since the last poll: publisher probably exited */
+      struct stat sb;
+      if (stat("/dev/shm" STATUS_NAME, &sb) == -1)
+        break;
+    }
+    nanosleep(&period, NULL);
+  }
+
+  munmap(page, sizeof(*page));
+  printf("[Watcher] Publisher is gone\n");
+}
+
+/* ------------------------------------------------------------------ */
+/* Stress test                                                          */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+  long reads;
+  long retries;
+  long torn;
+  long backwards; /* Generation went down: snapshot older than a prior one */
+} reader_stats_t;
+
+static volatile sig_atomic_t stop = 0;
+static void on_alarm(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+static void stress_reader(status_page_t *page, reader_stats_t *out,
+                          int unsafe) {
+  status_t st;
+  reader_stats_t s = {0};
+  uint64_t last = 0;
+
+  while (!stop) {
+    if (unsafe)
+      memcpy(&st, &page->status, sizeof(st)); /* No seqlock: may tear */
+    else
+      s.retries +=
+          seqlock_snapshot(&page->lock, &st, &page->status, sizeof(st));
+    s.reads++;
+    if (st.checksum != status_checksum(&st))
+      s.torn++;
+    if (st.generation < last)
+      s.backwards++;
+    last = st.generation;
+  }
+  *out = s;
+}
+
+int stress_test(int readers, int seconds, int unsafe) {
+  printf("=== Seqlock Stress: 1 writer, %d reader(s), %d s%s ===\n", readers,
+         seconds, unsafe ? ", UNSAFE reads (no seqlock)" : "");
+
+  if (readers > MAX_READERS)
+    readers = MAX_READERS;
+
+  /* Anonymous shared mapping: same layout, nothing left in /dev/shm */
+  status_page_t *page = mmap(NULL, sizeof(*page), PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  reader_stats_t *stats =
+      mmap(NULL, sizeof(reader_stats_t) * (readers + 1),
+           PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (page == MAP_FAILED || stats == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+  seqlock_init(&page->lock);
+  status_t st;
+  make_status(&st, 0);
+  seqlock_publish(&page->lock, &page->status, &st, sizeof(st));
+
+  signal(SIGALRM, on_alarm);
+  fflush(stdout);
+  double start = now_sec();
+
+  for (int r = 0; r < readers; r++) {
+    if (fork() == 0) {
+      alarm(seconds);
+      stress_reader(page, &stats[r], unsafe);
+      exit(0);
+    }
+  }
+
+  /* The writer publishes as fast as it can */
+  alarm(seconds);
+  uint64_t gen = 0;
+  while (!stop) {
+    make_status(&st, ++gen);
+    seqlock_publish(&page->lock, &page->status, &st, sizeof(st));
+  }
+  while (wait(NULL) > 0)
+    ;
+  double elapsed = now_sec() - start;
+
+  reader_stats_t total = {0};
+  for (int r = 0; r < readers; r++) {
+    total.reads += stats[r].reads;
+    total.retries += stats[r].retries;
+    total.torn += stats[r].torn;
+    total.backwards += stats[r].backwards;
+  }
+
+  printf("Writer:  %lu snapshots (%.2f M/s)\n", gen, gen / elapsed / 1e6);
+  printf("Readers: %ld reads (%.2f M/s total), %.3f%% retried\n", total.reads,
+         total.reads / elapsed / 1e6,
+         total.reads ? 100.0 * total.retries / total.reads : 0.0);
+  printf("Torn snapshots: %ld, out-of-order snapshots: %ld  %s\n", total.torn,
+         total.backwards,
+         total.torn == 0 && total.backwards == 0 ? "OK" : "INCONSISTENT");
+
+  munmap(stats, sizeof(reader_stats_t) * (readers + 1));
+  munmap(page, sizeof(*page));
+  /* Torn reads are expected (and the point) in unsafe mode */
+  return unsafe ? 0 : total.torn != 0 || total.backwards != 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("Usage: %s publish [rate] [seconds] | watch [interval_ms] | "
+           "stress [readers] [seconds] [unsafe]\n",
+           argv[0]);
+    return 1;
+  }
+
+  if (strcmp(argv[1], "publish") == 0) {
+    publisher_process(argc > 2 ? atoi(argv[2]) : 10,
+                      argc > 3 ? atoi(argv[3]) : 30);
+  } else if (strcmp(argv[1], "watch") == 0) {
+    watcher_process(argc > 2 ? atoi(argv[2]) : 500);
+  } else if (strcmp(argv[1], "stress") == 0) {
+    int readers = argc > 2 ? atoi(argv[2]) : 4;
+    int seconds = argc > 3 ? atoi(argv[3]) : 2;
+    /* alarm(0) would arm nothing: the run would never end */
+    if (readers < 1 || seconds < 1) {
+      printf("readers and seconds must be at least 1\n");
+      return 1;
+    }
+    return stress_test(readers, seconds,
+                       argc > 4 && strcmp(argv[4], "unsafe") == 0);
+  } else {
+    printf("Invalid argument. Use 'publish', 'watch' or 'stress'\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * TRY THIS:
+ *
+ * ./status_page stress 4 2             # seqlock: 0 torn snapshots
+ * ./status_page stress 4 2 unsafe      # plain memcpy: watch torn count
+ *
+ * On a single CPU the unsafe reader only tears when it is preempted in
+ * the middle of its copy, so run it on a multi-core box to see it clearly.
+ * Note that a reader's cost does not depend on how many other readers
+ * there are: they share the cache lines read-only.
+ */
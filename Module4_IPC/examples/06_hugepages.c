@@ -0,0 +1,194 @@
+/*
+ * 06_hugepages.c - What huge pages buy a large shared segment
+ * 02_shared_memory.c maps 4 KiB of shared memory; a shared cache maps
+ * gigabytes. With 4 KiB pages a random lookup in such a segment almost
+ * always misses the TLB and walks the page tables first. This benchmark
+ * builds the same segment with small pages, transparent huge pages and
+ * hugetlb pages (see shm_seg.h), then chases pointers through it in a
+ * random page order, so every access lands on a different page.
+ *
+ * Compile: gcc -o hugepages 06_hugepages.c shm_seg.c
+ * Run: ./hugepages [MiB] [numa_node]
+ *
+ * hugetlb pages must be reserved first, e.g. for 256 MiB:
+ *   echo 128 | sudo tee /proc/sys/vm/nr_hugepages
+ * THP for shared memory needs
+ *   echo advise | sudo tee /sys/kernel/mm/transparent_hugepage/shmem_enabled
+ */
+
+#define _GNU_SOURCE
+
+#include "shm_seg.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CHASE_STRIDE 4096 /* One hop per small page */
+#define CACHELINE 64
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* dTLB load misses of this process, or -1 if the PMU is not available */
+static int tlb_counter_open(void) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+ * Link one cache line per page into a single random cycle (Sattolo's
+ * shuffle). Links are offsets from the segment base, not pointers, so the
+ * chain stays valid in a process that maps the segment elsewhere. The line
+ * inside each page varies so the hops do not all collide in one cache set.
+ */
+static size_t build_chain(unsigned char *base, size_t size) {
+  size_t n = size / CHASE_STRIDE;
+  uint32_t *order = malloc(n * sizeof(*order));
+  if (!order)
+    return (size_t)-1;
+
+  for (size_t i = 0; i < n; i++)
+    order[i] = i;
+  srand(42);
+  for (size_t i = n - 1; i > 0; i--) {
+    size_t j = ((size_t)rand() * RAND_MAX + rand()) % i;
+    uint32_t t = order[i];
+    order[i] = order[j];
+    order[j] = t;
+  }
+
+#define SLOT(p) ((size_t)(p) * CHASE_STRIDE + ((p) * 7 % 64) * CACHELINE)
+  for (size_t i = 0; i < n; i++)
+    *(size_t *)(base + SLOT(order[i])) = SLOT(order[(i + 1) % n]);
+  size_t first = SLOT(order[0]);
+#undef SLOT
+
+  free(order);
+  return first;
+}
+
+static size_t chase(const unsigned char *base, size_t off, long hops) {
+  for (long i = 0; i < hops; i++)
+    off = *(const size_t *)(base + off);
+  return off; /* Returned so the loop cannot be optimized away */
+}
+
+static void run(shm_pages_t pages, size_t size, int node, int tlb_fd) {
+  shm_seg_opts_t opts = {pages, node, 1};
+  shm_seg_t seg;
+
+  printf("%-9s", shm_pages_name(pages));
+  fflush(stdout);
+
+  double start = now_sec();
+  if (shm_seg_create(&seg, NULL, size, &opts) == -1) {
+    printf("unavailable: %s", strerror(errno));
+    if (pages == SHM_PAGES_HUGETLB && errno == ENOMEM)
+      printf(" (reserve %zu pages in /proc/sys/vm/nr_hugepages)",
+             size / (2 * 1024 * 1024));
+    if (errno == EINVAL && node >= 0)
+      printf(" (is node %d online?)", node);
+    printf("\n");
+    return;
+  }
+  double fault_ms = (now_sec() - start) * 1e3;
+
+  size_t first = build_chain(seg.addr, seg.size);
+  if (first == (size_t)-1) {
+    printf("out of memory building the chain\n");
+    shm_seg_close(&seg);
+    return;
+  }
+  long hops = (long)(seg.size / CHASE_STRIDE) * 4;
+  if (hops < 2000000)
+    hops = 2000000;
+  chase(seg.addr, first, hops / 4); /* Warm up caches and TLB */
+
+  uint64_t misses = 0;
+  if (tlb_fd >= 0) {
+    ioctl(tlb_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(tlb_fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  start = now_sec();
+  volatile size_t sink = chase(seg.addr, first, hops);
+  double elapsed = now_sec() - start;
+  (void)sink;
+  if (tlb_fd >= 0) {
+    ioctl(tlb_fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(tlb_fd, &misses, sizeof(misses)) != sizeof(misses))
+      misses = 0;
+  }
+
+  shm_seg_stats_t st;
+  shm_seg_stats(&seg, &st);
+  char tlb[32] = "n/a";
+  if (tlb_fd >= 0)
+    snprintf(tlb, sizeof(tlb), "%.3f", (double)misses / hops);
+  char where[16] = "?";
+  if (st.node >= 0)
+    snprintf(where, sizeof(where), "%d", st.node);
+
+  printf(" %7zu KiB %9zu %11.1f %10.1f %17s %5s\n", seg.page_size / 1024,
+         st.huge_bytes >> 20, fault_ms, elapsed * 1e9 / hops, tlb, where);
+  shm_seg_close(&seg);
+}
+
+int main(int argc, char *argv[]) {
+  size_t mib = argc > 1 ? strtoul(argv[1], NULL, 10) : 256;
+  int node = argc > 2 ? atoi(argv[2]) : -1;
+  if (mib < 4)
+    mib = 4;
+  size_t size = mib << 20;
+
+  int tlb_fd = tlb_counter_open();
+
+  printf("=== Shared-memory TLB benchmark: %zu MiB segment, random page "
+         "walk%s ===\n",
+         mib, node >= 0 ? ", bound to one node" : "");
+  if (tlb_fd < 0)
+    printf("(dTLB counter unavailable: %s; compare ns/access instead)\n",
+           strerror(errno));
+  printf("%-9s %11s %9s %11s %10s %17s %5s\n", "pages", "page size",
+         "huge MiB", "fault-in ms", "ns/access", "dTLB miss/access", "node");
+
+  run(SHM_PAGES_SMALL, size, node, tlb_fd);
+  run(SHM_PAGES_THP, size, node, tlb_fd);
+  run(SHM_PAGES_HUGETLB, size, node, tlb_fd);
+
+  if (tlb_fd >= 0)
+    close(tlb_fd);
+  return 0;
+}
+
+/*
+ * TRY THIS:
+ *
+ * ./hugepages 1024          # Bigger than the TLB reach of any page size?
+ * ./hugepages 16            # Small pages fit in the second-level TLB too
+ * ./hugepages 256 0         # Bind to node 0 (numactl -H lists nodes)
+ *
+ * "huge MiB" is what the kernel really did (from /proc/self/smaps): THP is
+ * best effort, so it can be 0 when shmem_enabled is "never" or memory is
+ * fragmented. Fault-in time drops with huge pages too: one fault and one
+ * zeroing pass per 2 MiB instead of 512 faults.
+ */
@@ -0,0 +1,447 @@
+/*
+ * 08_broadcast.c - One publisher, hundreds of subscribers, one copy
+ * The FIFO demos cover many writers and one reader. Going the other way
+ * with FIFOs means one FIFO per subscriber and writing every message into
+ * each of them. shm_log.h appends every message once to a shared-memory
+ * log instead, and each subscriber reads it in place at its own pace.
+ *
+ * The publisher never waits for slow subscribers. A subscriber that falls
+ * a whole log behind is told how many messages it missed (policy skip) or
+ * dropped (policy drop), and the publisher reports everyone's lag.
+ *
+ * Compile: gcc -o broadcast 08_broadcast.c shm_log.c -lrt
+ * Run: ./broadcast pub [msgs/s] [skip|drop]       (terminal 1)
+ *      ./broadcast sub [work_us]                  (terminals 2..N)
+ *      ./broadcast bench [subs] [msgs/s] [seconds]
+ */
+
+#define _GNU_SOURCE
+
+#include "shm_log.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_NAME "/broadcast_log"
+#define LOG_BYTES (1 << 20)
+#define MAX_SUBS 1024
+#define MSG_SIZE 64
+
+typedef struct {
+  uint64_t seq;
+  uint64_t sent_ns;
+  char text[MSG_SIZE - 2 * sizeof(uint64_t)];
+} msg_t;
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int sig) {
+  (void)sig;
+  running = 0;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleep_ns(uint64_t ns) {
+  struct timespec ts = {ns / 1000000000ull, ns % 1000000000ull};
+  nanosleep(&ts, NULL);
+}
+
+static void make_msg(msg_t *m, uint64_t seq) {
+  m->seq = seq;
+  m->sent_ns = now_ns();
+  snprintf(m->text, sizeof(m->text), "tick %llu", (unsigned long long)seq);
+}
+
+/* The text must match the sequence number, or the message is torn */
+static int msg_ok(const msg_t *m) {
+  char expect[sizeof(m->text)];
+  snprintf(expect, sizeof(expect), "tick %llu", (unsigned long long)m->seq);
+  return strcmp(expect, m->text) == 0;
+}
+
+void publisher_process(long rate, shm_log_policy_t policy) {
+  printf("=== Broadcast Publisher ===\n");
+
+  shm_log_t log;
+  if (shm_log_create(&log, LOG_NAME, LOG_BYTES, MAX_SUBS, policy) == -1) {
+    perror("shm_log_create");
+    return;
+  }
+  printf("[Publisher] %s: %d KiB log, %ld msg/s, policy %s\n", LOG_NAME,
+         LOG_BYTES >> 10, rate, policy == SHM_LOG_DROP ? "drop" : "skip");
+  if (policy == SHM_LOG_DROP)
+    printf("[Publisher] Subscribers lagging over half the log get dropped\n");
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  uint64_t start = now_ns(), seq = 0, next_report = start + 1000000000ull;
+  while (running) {
+    uint64_t now = now_ns();
+    uint64_t due = (now - start) * rate / 1000000000ull;
+    for (msg_t m; seq < due; seq++) {
+      make_msg(&m, seq);
+      shm_log_append(&log, &m, sizeof(m));
+    }
+    shm_log_wake(&log); /* Once per burst, not once per message */
+
+    if (now >= next_report) {
+      shm_log_sub_info_t info[MAX_SUBS];
+      int n = shm_log_scan(&log, policy == SHM_LOG_DROP ? LOG_BYTES / 2 : 0,
+                           info, MAX_SUBS);
+      printf("[Publisher] seq %llu, %d subscriber(s)\n",
+             (unsigned long long)seq, n);
+      for (int i = 0; i < n; i++)
+        printf("    pid %-7d lag %5llu KiB  missed %-8llu %s\n", info[i].pid,
+               (unsigned long long)(info[i].lag >> 10),
+               (unsigned long long)info[i].missed,
+               info[i].dropped ? "DROPPED" : "");
+      next_report += 1000000000ull;
+    }
+    sleep_ns(1000000);
+  }
+
+  shm_log_shutdown(&log);
+  printf("\n[Publisher] Published %llu messages\n", (unsigned long long)seq);
+  shm_log_close(&log);
+  shm_log_unlink(LOG_NAME);
+}
+
+void subscriber_process(int work_us) {
+  printf("=== Broadcast Subscriber ===\n");
+
+  shm_log_t log;
+  shm_log_sub_t sub;
+  if (shm_log_open(&log, LOG_NAME) == -1) {
+    perror("shm_log_open (is the publisher running?)");
+    return;
+  }
+  if (shm_log_subscribe(&log, &sub) == -1) {
+    perror("shm_log_subscribe");
+    shm_log_close(&log);
+    return;
+  }
+  printf("[Subscriber] Slot %d, %d us of work per message\n", sub.slot,
+         work_us);
+
+  long received = 0, torn = 0, laps = 0;
+  uint64_t next_report = now_ns() + 1000000000ull;
+  for (;;) {
+    const void *data;
+    ssize_t n = shm_log_next(&sub, &data);
+    if (n == 0)
+      break;
+    if (n == -1 && errno == EOVERFLOW) {
+      laps++; /* Lapped: the cursor skipped ahead to the oldest record */
+      continue;
+    }
+    if (n == -1) {
+      perror("[Subscriber] shm_log_next");
+      break;
+    }
+
+    /* Use the message where it is, then make sure it was not overwritten */
+    msg_t m;
+    memcpy(&m, data, sizeof(m));
+    if (!shm_log_intact(&sub) || !msg_ok(&m)) {
+      torn++;
+      continue;
+    }
+    received++;
+    if (work_us)
+      sleep_ns(work_us * 1000ull);
+
+    if (now_ns() >= next_report) {
+      printf("[Subscriber] \"%s\", latency %.1f us, received %ld, missed "
+             "%llu (lapped %ld times)\n",
+             m.text, (now_ns() - m.sent_ns) / 1e3, received,
+             (unsigned long long)sub.missed, laps);
+      next_report += 1000000000ull;
+    }
+  }
+
+  printf("[Subscriber] Done: received %ld, missed %llu, torn %ld\n", received,
+         (unsigned long long)sub.missed, torn);
+  shm_log_unsubscribe(&sub);
+  shm_log_close(&log);
+}
+
+/* ------------------------------------------------------------------ */
+/* Benchmark: one FIFO (pipe) per subscriber vs the shared log          */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+  long published;
+  long received[MAX_SUBS];
+  long missed[MAX_SUBS];
+  long bad[MAX_SUBS];
+} results_t;
+
+static results_t *res;
+
+static double cpu_sec(int who) {
+  struct rusage ru;
+  getrusage(who, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec +
+         ru.ru_stime.tv_usec / 1e6;
+}
+
+#define BURST_MAX 1024
+
+/*
+ * Paced publisher shared by both transports: one tick per millisecond,
+ * and each tick's messages handed over as one burst.
+ */
+static void publish_for(double seconds, long rate,
+                        int (*send)(const msg_t *m, int count, void *arg),
+                        void *arg) {
+  static msg_t burst[BURST_MAX];
+  uint64_t start = now_ns(), end = start + (uint64_t)(seconds * 1e9);
+  uint64_t seq = 0;
+
+  for (uint64_t now = start; now < end; now = now_ns()) {
+    uint64_t due = (now - start) * rate / 1000000000ull;
+    int count = 0;
+    for (; seq < due && count < BURST_MAX; seq++)
+      make_msg(&burst[count++], seq);
+    if (count > 0 && send(burst, count, arg) == -1)
+      break;
+    sleep_ns(1000000 - (now_ns() - start) % 1000000);
+  }
+  res->published = seq;
+}
+
+typedef struct {
+  int nsubs;
+  int *fds;
+} fanout_t;
+
+/* N FIFOs: the same bytes are copied into every subscriber's pipe */
+static int fanout_send(const msg_t *m, int count, void *arg) {
+  fanout_t *f = arg;
+  ssize_t len = count * sizeof(*m);
+  for (int i = 0; i < f->nsubs; i++) {
+    if (write(f->fds[i], m, len) != len)
+      return -1;
+  }
+  return 0;
+}
+
+static void fifo_subscriber(int id, int fd) {
+  msg_t buf[256];
+  size_t have = 0;
+  ssize_t n;
+  while ((n = read(fd, (char *)buf + have, sizeof(buf) - have)) > 0) {
+    have += n;
+    size_t whole = have / sizeof(msg_t);
+    for (size_t i = 0; i < whole; i++) {
+      res->received[id]++;
+      res->bad[id] += !msg_ok(&buf[i]);
+    }
+    have -= whole * sizeof(msg_t);
+    memmove(buf, (char *)buf + whole * sizeof(msg_t), have);
+  }
+}
+
+static int log_send(const msg_t *m, int count, void *arg) {
+  for (int i = 0; i < count; i++) {
+    if (shm_log_append(arg, &m[i], sizeof(*m)) == -1)
+      return -1;
+  }
+  shm_log_wake(arg);
+  return 0;
+}
+
+static void log_subscriber(int id, shm_log_sub_t *sub) {
+  const void *data;
+  ssize_t n;
+  long torn = 0;
+  while ((n = shm_log_next(sub, &data)) != 0) {
+    if (n == -1) {
+      if (errno == EOVERFLOW)
+        continue;
+      break;
+    }
+    /* Checked in place: no copy of the message */
+    int ok = msg_ok(data);
+    if (!shm_log_intact(sub))
+      torn++; /* Overwritten while we looked: as good as missed */
+    else if (ok)
+      res->received[id]++;
+    else
+      res->bad[id]++;
+  }
+  res->missed[id] = sub->missed + torn;
+}
+
+static int bench_one(int use_log, int nsubs, long rate, double seconds) {
+  int ready[2], fds[MAX_SUBS][2];
+  shm_log_t log;
+  pid_t pids[MAX_SUBS];
+
+  memset(res, 0, sizeof(*res));
+  if (pipe(ready) == -1)
+    return -1;
+  if (use_log) {
+    if (shm_log_create(&log, LOG_NAME, LOG_BYTES, nsubs, SHM_LOG_SKIP) == -1) {
+      perror("shm_log_create");
+      return -1;
+    }
+  } else {
+    for (int i = 0; i < nsubs; i++) {
+      if (pipe(fds[i]) == -1) {
+        perror("pipe");
+        return -1;
+      }
+    }
+  }
+
+  fflush(stdout);
+  for (int i = 0; i < nsubs; i++) {
+    pids[i] = fork();
+    if (pids[i] == 0) {
+      shm_log_sub_t sub;
+      close(ready[0]);
+      if (use_log) {
+        if (shm_log_subscribe(&log, &sub) == -1)
+          exit(1);
+      } else {
+        for (int j = 0; j < nsubs; j++) {
+          close(fds[j][1]);
+          if (j != i)
+            close(fds[j][0]);
+        }
+      }
+      close(ready[1]); /* Subscribed: the publisher may start */
+      if (use_log)
+        log_subscriber(i, &sub);
+      else
+        fifo_subscriber(i, fds[i][0]);
+      exit(0);
+    }
+  }
+
+  /* Every subscriber closed its copy of the write end: all are in */
+  close(ready[1]);
+  char c;
+  while (read(ready[0], &c, 1) > 0)
+    ;
+  close(ready[0]);
+
+  double cpu0 = cpu_sec(RUSAGE_CHILDREN);
+  double pub0 = cpu_sec(RUSAGE_SELF);
+  if (use_log) {
+    publish_for(seconds, rate, log_send, &log);
+    shm_log_shutdown(&log);
+  } else {
+    int wfds[MAX_SUBS];
+    for (int i = 0; i < nsubs; i++) {
+      close(fds[i][0]);
+      wfds[i] = fds[i][1];
+    }
+    fanout_t f = {nsubs, wfds};
+    publish_for(seconds, rate, fanout_send, &f);
+    for (int i = 0; i < nsubs; i++)
+      close(wfds[i]);
+  }
+  for (int i = 0; i < nsubs; i++)
+    waitpid(pids[i], NULL, 0);
+  double sub_cpu = cpu_sec(RUSAGE_CHILDREN) - cpu0;
+  double pub_cpu = cpu_sec(RUSAGE_SELF) - pub0;
+
+  long received = 0, missed = 0, bad = 0;
+  for (int i = 0; i < nsubs; i++) {
+    received += res->received[i];
+    missed += res->missed[i];
+    bad += res->bad[i];
+  }
+  printf("%-9s %12.0f %14.0f %8ld %6ld %12.2f %12.2f\n",
+         use_log ? "shm log" : "N FIFOs", res->published / seconds,
+         received / seconds, missed, bad,
+         res->published ? pub_cpu / res->published * 1e6 : 0,
+         received ? (pub_cpu + sub_cpu) / received * 1e6 : 0);
+
+  if (use_log) {
+    shm_log_close(&log);
+    shm_log_unlink(LOG_NAME);
+  }
+  return bad != 0 || received + missed != (long)res->published * nsubs;
+}
+
+int bench(int nsubs, long rate, double seconds) {
+  if (nsubs < 1 || nsubs > MAX_SUBS) {
+    fprintf(stderr, "subscribers must be 1..%d\n", MAX_SUBS);
+    return 1;
+  }
+  res = mmap(NULL, sizeof(*res), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (res == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+
+  printf("=== Fan-out of %d-byte messages: %d subscribers, %ld msg/s, "
+         "%.0f s ===\n",
+         MSG_SIZE, nsubs, rate, seconds);
+  printf("%-9s %12s %14s %8s %6s %12s %12s\n", "transport", "published/s",
+         "delivered/s", "missed", "bad", "pub us/msg", "us/delivery");
+  int failed = bench_one(0, nsubs, rate, seconds);
+  failed |= bench_one(1, nsubs, rate, seconds);
+  printf("(delivered counts every subscriber; us/delivery is the CPU of all "
+         "processes)\n");
+  return failed;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("Usage: %s pub [msgs/s] [skip|drop] | sub [work_us] |\n"
+           "       bench [subs] [msgs/s] [seconds]\n",
+           argv[0]);
+    return 1;
+  }
+
+  if (strcmp(argv[1], "pub") == 0) {
+    publisher_process(argc > 2 ? atol(argv[2]) : 1000,
+                      argc > 3 && strcmp(argv[3], "drop") == 0
+                          ? SHM_LOG_DROP
+                          : SHM_LOG_SKIP);
+  } else if (strcmp(argv[1], "sub") == 0) {
+    subscriber_process(argc > 2 ? atoi(argv[2]) : 0);
+  } else if (strcmp(argv[1], "bench") == 0) {
+    return bench(argc > 2 ? atoi(argv[2]) : 100,
+                 argc > 3 ? atol(argv[3]) : 10000,
+                 argc > 4 ? atof(argv[4]) : 2);
+  } else {
+    printf("Invalid argument. Use 'pub', 'sub' or 'bench'\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * TRY THIS:
+ *
+ * ./broadcast pub 100000              # and a few subscribers:
+ * ./broadcast sub                     # keeps up, missed stays 0
+ * ./broadcast sub 100                 # 10k msg/s at most: lapped, and the
+ *                                     # publisher drops it for lagging
+ * ./broadcast bench 500 10000         # Publisher cost per message vs N
+ *
+ * Restart the publisher with "drop": the slow subscriber now exits with
+ * ECONNRESET the first time it is lapped, instead of skipping ahead.
+ */
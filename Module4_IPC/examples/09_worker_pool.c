@@ -0,0 +1,313 @@
+/*
+ * 09_worker_pool.c - Preforked workers vs. a fork (or fork + exec) per task
+ * The pipe and process examples fork a fresh child for every job. That is
+ * fine once, but a batch tool doing it per request spends most of its CPU
+ * in fork, exec, the dynamic linker and page faults rather than the work.
+ * worker_pool.h forks the workers once and feeds them tasks over
+ * socketpairs; a worker that crashes is replaced and its tasks reported.
+ *
+ * Compile: gcc -o worker_pool 09_worker_pool.c worker_pool.c
+ * Run: ./worker_pool bench [tasks] [workers]
+ *      ./worker_pool crash
+ */
+
+#define _GNU_SOURCE
+
+#include "worker_pool.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HEAVY_EVERY 16 /* One task in 16 costs 50 times more */
+#define CRASH_TASK UINT32_MAX
+
+typedef struct {
+  uint32_t rounds; /* CRASH_TASK: the worker aborts */
+  uint32_t seed;
+} task_t;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The "work": a few thousand rounds of a 64-bit mix */
+static uint64_t compute(const task_t *t) {
+  uint64_t x = t->seed;
+  for (uint32_t i = 0; i < t->rounds; i++) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+  }
+  return x;
+}
+
+static task_t make_task(long i, int base_rounds) {
+  task_t t = {.rounds = base_rounds, .seed = (uint32_t)i};
+  if (i % HEAVY_EVERY == 0)
+    t.rounds *= 50;
+  return t;
+}
+
+static ssize_t handler(const void *task, size_t len, void *reply, void *arg) {
+  (void)arg;
+  const task_t *t = task;
+  if (len != sizeof(*t))
+    return -1;
+  if (t->rounds == CRASH_TASK)
+    abort();
+  uint64_t r = compute(t);
+  memcpy(reply, &r, sizeof(r));
+  return sizeof(r);
+}
+
+/* ------------------------------------------------------------------ */
+/* The old way: a child per task, up to `workers` at once               */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+  pid_t pid;
+  int fd;
+} child_t;
+
+static int start_child(child_t *c, const task_t *t, int do_exec) {
+  int p[2];
+  if (pipe(p) == -1)
+    return -1;
+  c->pid = fork();
+  if (c->pid == -1)
+    return -1;
+
+  if (c->pid == 0) {
+    close(p[0]);
+    if (do_exec) {
+      char rounds[16], seed[16];
+      snprintf(rounds, sizeof(rounds), "%u", t->rounds);
+      snprintf(seed, sizeof(seed), "%u", t->seed);
+      dup2(p[1], STDOUT_FILENO);
+      execl("/proc/self/exe", "worker_pool", "task", rounds, seed,
+            (char *)NULL);
+      _exit(127);
+    }
+    uint64_t r = compute(t);
+    write(p[1], &r, sizeof(r));
+    _exit(0);
+  }
+  close(p[1]);
+  c->fd = p[0];
+  return 0;
+}
+
+static int finish_child(child_t *c, uint64_t *sum) {
+  uint64_t r;
+  ssize_t n = read(c->fd, &r, sizeof(r));
+  close(c->fd);
+  int status;
+  waitpid(c->pid, &status, 0);
+  if (n != sizeof(r) || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    return -1;
+  *sum += r;
+  return 0;
+}
+
+static int run_forking(long tasks, int workers, int base_rounds, int do_exec,
+                       uint64_t *sum) {
+  child_t *kids = calloc(workers, sizeof(*kids));
+  long next = 0;
+  int running = 0, oldest = 0, failed = 0;
+
+  if (!kids)
+    return -1;
+  /* Children in a ring: start one whenever the oldest has finished */
+  while (next < tasks || running > 0) {
+    if (next < tasks && running < workers) {
+      task_t t = make_task(next++, base_rounds);
+      if (start_child(&kids[(oldest + running) % workers], &t, do_exec) == -1) {
+        perror("fork");
+        failed = 1;
+        break;
+      }
+      running++;
+      continue;
+    }
+    failed |= finish_child(&kids[oldest], sum) != 0;
+    oldest = (oldest + 1) % workers;
+    running--;
+  }
+  while (running-- > 0) {
+    finish_child(&kids[oldest], sum);
+    oldest = (oldest + 1) % workers;
+  }
+  free(kids);
+  return failed ? -1 : 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* The pool                                                             */
+/* ------------------------------------------------------------------ */
+
+static int run_pool(long tasks, int workers, int base_rounds,
+                    wp_policy_t policy, uint64_t *sum) {
+  wp_pool_t pool;
+  long next = 0, done = 0;
+  unsigned window = 64 * workers; /* Tasks in flight at most */
+  int failed = 0;
+
+  if (wp_start(&pool, workers, policy, handler, NULL) == -1) {
+    perror("wp_start");
+    return -1;
+  }
+  while (done < tasks) {
+    if (next < tasks && wp_inflight(&pool) < window) {
+      task_t t = make_task(next++, base_rounds);
+      if (wp_submit(&pool, &t, sizeof(t)) == -1) {
+        perror("wp_submit");
+        failed = 1;
+        break;
+      }
+      continue;
+    }
+    uint64_t id, r;
+    if (wp_wait(&pool, &id, &r, sizeof(r), -1) != sizeof(r)) {
+      perror("wp_wait");
+      failed = 1;
+      break;
+    }
+    *sum += r;
+    done++;
+  }
+  wp_stop(&pool);
+  return failed ? -1 : 0;
+}
+
+static int bench(long tasks, int workers) {
+  const int base_rounds = 2000;
+  const char *names[] = {"fork+exec/task", "fork/task", "pool round-robin",
+                         "pool least-load"};
+  uint64_t expect = 0;
+
+  if (tasks < 1 || workers < 1) {
+    fprintf(stderr, "tasks and workers must be positive\n");
+    return 1;
+  }
+  for (long i = 0; i < tasks; i++) {
+    task_t t = make_task(i, base_rounds);
+    expect += compute(&t);
+  }
+
+  printf("=== %ld tasks of ~%d rounds (1 in %d is 50x), %d workers ===\n",
+         tasks, base_rounds, HEAVY_EVERY, workers);
+  printf("%-17s %12s %12s %10s\n", "strategy", "tasks/s", "us/task", "results");
+  int failed = 0;
+  for (int mode = 0; mode < 4; mode++) {
+    uint64_t sum = 0;
+    double t0 = now_sec();
+    int rc = mode < 2 ? run_forking(tasks, workers, base_rounds, mode == 0,
+                                    &sum)
+                      : run_pool(tasks, workers, base_rounds,
+                                 mode == 2 ? WP_ROUND_ROBIN : WP_LEAST_LOADED,
+                                 &sum);
+    double el = now_sec() - t0;
+    int ok = rc == 0 && sum == expect;
+    printf("%-17s %12.0f %12.1f %10s\n", names[mode], tasks / el,
+           el * 1e6 / tasks, ok ? "ok" : "WRONG");
+    failed |= !ok;
+  }
+  return failed;
+}
+
+/* ------------------------------------------------------------------ */
+/* A worker crashing mid-batch                                          */
+/* ------------------------------------------------------------------ */
+
+static int crash_demo(void) {
+  wp_pool_t pool;
+  int lost = 0, good = 0;
+
+  if (wp_start(&pool, 2, WP_ROUND_ROBIN, handler, NULL) == -1) {
+    perror("wp_start");
+    return 1;
+  }
+  printf("2 workers; submitting 10 tasks, task 5 makes its worker abort()\n");
+  for (int i = 1; i <= 10; i++) {
+    task_t t = make_task(i, 200000);
+    if (i == 5)
+      t.rounds = CRASH_TASK;
+    wp_submit(&pool, &t, sizeof(t));
+  }
+
+  for (;;) {
+    uint64_t id, r;
+    ssize_t n = wp_wait(&pool, &id, &r, sizeof(r), 5000);
+    if (n == -1 && errno == ENOENT)
+      break;
+    if (n == -1 && errno == ECHILD) {
+      printf("  task %2llu: LOST, its worker died\n", (unsigned long long)id);
+      lost++;
+    } else if (n == -1) {
+      perror("wp_wait");
+      break;
+    } else {
+      printf("  task %2llu: %016llx\n", (unsigned long long)id,
+             (unsigned long long)r);
+      good++;
+    }
+  }
+  printf("%d done, %d lost, %lu worker(s) respawned\n", good, lost,
+         pool.respawns);
+
+  /* The replacement takes work like any other worker */
+  task_t t = make_task(11, 1000);
+  uint64_t id, r;
+  int64_t want = wp_submit(&pool, &t, sizeof(t));
+  int ok = wp_wait(&pool, &id, &r, sizeof(r), 5000) == sizeof(r) &&
+           (int64_t)id == want && r == compute(&t);
+  printf("after respawn: %s\n", ok ? "pool still answers" : "FAILED");
+  ok = ok && lost > 0 && pool.respawns > 0;
+  wp_stop(&pool);
+  return !ok;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("Usage: %s bench [tasks] [workers] | crash\n", argv[0]);
+    return 1;
+  }
+
+  if (strcmp(argv[1], "bench") == 0) {
+    return bench(argc > 2 ? atol(argv[2]) : 2000,
+                 argc > 3 ? atoi(argv[3]) : 4);
+  } else if (strcmp(argv[1], "crash") == 0) {
+    return crash_demo();
+  } else if (strcmp(argv[1], "task") == 0 && argc == 4) {
+    /* What fork+exec runs: one task, result on stdout */
+    task_t t = {.rounds = strtoul(argv[2], NULL, 10),
+                .seed = strtoul(argv[3], NULL, 10)};
+    uint64_t r = compute(&t);
+    return write(STDOUT_FILENO, &r, sizeof(r)) == sizeof(r) ? 0 : 1;
+  } else {
+    printf("Invalid argument. Use 'bench' or 'crash'\n");
+    return 1;
+  }
+}
+
+/*
+ * TRY THIS:
+ *
+ * ./worker_pool bench 5000 4        # Pool vs. a process per task
+ * ./worker_pool bench 5000 1        # One worker: the pool pipelines tasks
+ * ./worker_pool crash               # Lost tasks are reported, not dropped
+ *
+ * Under "pool round-robin" a worker that drew a heavy task keeps getting
+ * new ones queued behind it; least-loaded sends them to idle workers. The
+ * gap grows with more workers than CPUs and with fewer tasks in flight.
+ *
+ * While "./worker_pool bench 100000 4" runs, kill -9 one of its workers:
+ * the run aborts with ECHILD and the pool already has a replacement.
+ */
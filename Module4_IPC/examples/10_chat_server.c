@@ -0,0 +1,965 @@
+/*
+ * 10_chat_server.c - Reference HOMEWORK4 chat server for 10k clients
+ * One process, one edge-triggered epoll loop, UNIX domain stream sockets,
+ * the message protocol from HOMEWORK4_ChatSystem.md (see chat_proto.h).
+ *
+ * What keeps it fast with thousands of users in one room:
+ *   - A broadcast is encoded ONCE into a refcounted buffer; every
+ *     recipient's output queue holds a pointer to it, not a copy.
+ *   - Output is not written as it is produced. Clients with new output go
+ *     on a dirty list and are flushed once per loop iteration, with one
+ *     writev() of everything queued: ten messages in a burst cost one
+ *     system call per recipient, not ten.
+ *   - Edge-triggered epoll: every socket is registered once, for reading
+ *     and writing, and never modified again. The price is that every
+ *     read and write must go on until EAGAIN.
+ *   - A client that stops reading is disconnected once a megabyte is
+ *     queued for it, instead of growing the server without bound.
+ *
+ * Compile: gcc -o chat_server 10_chat_server.c
+ * Run: ./chat_server server [-q]           (server; type /help)
+ *      ./chat_server client <name>         (another terminal)
+ *      ./chat_server bench [clients] [messages]
+ */
+
+#define _GNU_SOURCE
+
+#include "chat_proto.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 256
+#define OUT_IOV 64             /* Frames per writev() */
+#define OUT_LIMIT (1 << 20)    /* Queued bytes before a client is cut off */
+#define NAME_BUCKETS 16384
+#define RX_SIZE (4 * CHAT_FRAME_MAX)
+
+/* One encoded frame, shared by every queue it sits in */
+typedef struct {
+  uint32_t refs;
+  uint32_t len;
+  unsigned char data[];
+} chat_buf_t;
+
+typedef struct client {
+  int fd;
+  uint32_t id;
+  int joined, dead, dirty;
+  char name[USERNAME_MAX];
+  unsigned char rx[RX_SIZE];
+  size_t rx_len;
+  chat_buf_t **outq; /* Ring of frames to send; out_off into the first */
+  unsigned out_head, out_count, out_cap;
+  size_t out_off, out_bytes;
+  struct client *prev, *next; /* Joined users */
+  struct client *hnext;       /* Name hash chain */
+  struct client *next_dirty, *next_dead;
+} client_t;
+
+static struct {
+  int epfd, lfd;
+  int quiet; /* No per-user log lines or join/leave notices */
+  client_t *users;
+  client_t *names[NAME_BUCKETS];
+  client_t *dirty, *dead, *graves;
+  unsigned nusers;
+  uint32_t next_id;
+  /* Statistics */
+  unsigned long msgs_in, frames_out, bytes_out, writevs, bufs, buf_bytes;
+  unsigned long connects, disconnects, slow_kicks;
+} srv;
+
+static volatile sig_atomic_t running = 1;
+
+/* Markers for epoll_event.data.ptr */
+static char listener_tag, stdin_tag;
+
+static void on_signal(int sig) {
+  (void)sig;
+  running = 0;
+}
+
+static void raise_fd_limit(void) {
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+}
+
+static void log_msg(const char *tag, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void log_msg(const char *tag, const char *fmt, ...) {
+  va_list ap;
+  printf("[%s] ", tag);
+  va_start(ap, fmt);
+  vprintf(fmt, ap);
+  va_end(ap);
+  putchar('\n');
+  fflush(stdout);
+}
+
+/* ------------------------------------------------------------------ */
+/* Shared buffers and output queues                                     */
+/* ------------------------------------------------------------------ */
+
+/* Encode m once; the caller holds the first reference */
+static chat_buf_t *buf_new(const message_t *m) {
+  chat_buf_t *b = malloc(sizeof(*b) + CHAT_FRAME_MAX);
+  if (!b)
+    return NULL;
+  b->refs = 1;
+  b->len = chat_encode(m, b->data);
+  srv.bufs++;
+  srv.buf_bytes += b->len;
+  return b;
+}
+
+static void buf_unref(chat_buf_t *b) {
+  if (--b->refs == 0)
+    free(b);
+}
+
+static void kill_client(client_t *c, const char *why);
+
+static void queue(client_t *c, chat_buf_t *b) {
+  if (c->dead)
+    return;
+  if (c->out_bytes + b->len > OUT_LIMIT) {
+    srv.slow_kicks++;
+    kill_client(c, "not reading, output queue full");
+    return;
+  }
+  if (c->out_count == c->out_cap) {
+    unsigned cap = c->out_cap ? 2 * c->out_cap : 16;
+    chat_buf_t **q = malloc(cap * sizeof(*q));
+    if (!q) {
+      kill_client(c, "out of memory");
+      return;
+    }
+    for (unsigned i = 0; i < c->out_count; i++)
+      q[i] = c->outq[(c->out_head + i) % c->out_cap];
+    free(c->outq);
+    c->outq = q;
+    c->out_cap = cap;
+    c->out_head = 0;
+  }
+  c->outq[(c->out_head + c->out_count) % c->out_cap] = b;
+  c->out_count++;
+  c->out_bytes += b->len;
+  b->refs++;
+  if (!c->dirty) {
+    c->dirty = 1;
+    c->next_dirty = srv.dirty;
+    srv.dirty = c;
+  }
+}
+
+static void send_to(client_t *c, const message_t *m) {
+  chat_buf_t *b = buf_new(m);
+  if (b) {
+    queue(c, b);
+    buf_unref(b);
+  }
+}
+
+/* The one-buffer fan-out: every recipient gets a reference */
+static void broadcast(const message_t *m, const client_t *except) {
+  chat_buf_t *b = buf_new(m);
+  if (!b)
+    return;
+  for (client_t *c = srv.users, *next; c; c = next) {
+    next = c->next; /* queue() may disconnect c */
+    if (c != except)
+      queue(c, b);
+  }
+  buf_unref(b);
+}
+
+/* Write as much of c's queue as the socket takes, OUT_IOV frames a call */
+static void flush(client_t *c) {
+  while (c->out_count > 0 && !c->dead) {
+    struct iovec iov[OUT_IOV];
+    int cnt = 0;
+    for (unsigned i = 0; i < c->out_count && cnt < OUT_IOV; i++, cnt++) {
+      chat_buf_t *b = c->outq[(c->out_head + i) % c->out_cap];
+      size_t off = i == 0 ? c->out_off : 0;
+      iov[cnt].iov_base = b->data + off;
+      iov[cnt].iov_len = b->len - off;
+    }
+
+    ssize_t n = writev(c->fd, iov, cnt);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN)
+        kill_client(c, strerror(errno));
+      return; /* EAGAIN: EPOLLOUT fires when there is room again */
+    }
+    srv.writevs++;
+    srv.bytes_out += n;
+    c->out_bytes -= n;
+
+    while (n > 0) {
+      chat_buf_t *b = c->outq[c->out_head];
+      size_t left = b->len - c->out_off;
+      if ((size_t)n < left) {
+        c->out_off += n;
+        break;
+      }
+      n -= left;
+      c->out_off = 0;
+      c->out_head = (c->out_head + 1) % c->out_cap;
+      c->out_count--;
+      srv.frames_out++;
+      buf_unref(b);
+    }
+  }
+}
+
+/* ------------------------------------------------------------------ */
+/* Users                                                                */
+/* ------------------------------------------------------------------ */
+
+static unsigned name_hash(const char *s) {
+  uint32_t h = 2166136261u;
+  while (*s)
+    h = (h ^ (unsigned char)*s++) * 16777619u;
+  return h % NAME_BUCKETS;
+}
+
+static client_t *find_user(const char *name) {
+  client_t *c = srv.names[name_hash(name)];
+  while (c && strcmp(c->name, name) != 0)
+    c = c->hnext;
+  return c;
+}
+
+static void add_user(client_t *c) {
+  unsigned h = name_hash(c->name);
+  c->hnext = srv.names[h];
+  srv.names[h] = c;
+  c->prev = NULL;
+  c->next = srv.users;
+  if (srv.users)
+    srv.users->prev = c;
+  srv.users = c;
+  c->joined = 1;
+  srv.nusers++;
+}
+
+static void remove_user(client_t *c) {
+  client_t **pp = &srv.names[name_hash(c->name)];
+  while (*pp != c)
+    pp = &(*pp)->hnext;
+  *pp = c->hnext;
+  if (c->prev)
+    c->prev->next = c->next;
+  else
+    srv.users = c->next;
+  if (c->next)
+    c->next->prev = c->prev;
+  srv.nusers--;
+}
+
+/*
+ * Close c now, but keep the struct until the end of the loop iteration:
+ * the current epoll batch may still hold events pointing at it. The leave
+ * notice goes out then too, so a cascade of slow clients being cut off
+ * cannot recurse.
+ */
+static void kill_client(client_t *c, const char *why) {
+  if (c->dead)
+    return;
+  c->dead = 1;
+  close(c->fd);
+  if (c->joined) {
+    remove_user(c);
+    if (!srv.quiet)
+      log_msg("INFO", "Client '%s' disconnected%s%s", c->name,
+              why ? ": " : "", why ? why : "");
+  }
+  while (c->out_count > 0) {
+    buf_unref(c->outq[c->out_head]);
+    c->out_head = (c->out_head + 1) % c->out_cap;
+    c->out_count--;
+  }
+  srv.disconnects++;
+  c->next_dead = srv.dead;
+  srv.dead = c;
+}
+
+/* Announce the departures, then keep the structs until the loop is idle */
+static void reap_dead(void) {
+  while (srv.dead) {
+    client_t *c = srv.dead;
+    srv.dead = c->next_dead;
+    if (c->joined && !srv.quiet) {
+      message_t m;
+      char text[MSG_MAX_SIZE];
+      snprintf(text, sizeof(text), "%s left", c->name);
+      chat_msg(&m, MSG_LEAVE, c->name, NULL, text);
+      broadcast(&m, NULL);
+    }
+    c->next_dead = srv.graves;
+    srv.graves = c;
+  }
+}
+
+static void free_graves(void) {
+  while (srv.graves) {
+    client_t *c = srv.graves;
+    srv.graves = c->next_dead;
+    free(c->outq);
+    free(c);
+  }
+}
+
+static void flush_dirty(void) {
+  while (srv.dirty) {
+    client_t *c = srv.dirty;
+    srv.dirty = c->next_dirty;
+    c->dirty = 0;
+    if (!c->dead)
+      flush(c);
+  }
+}
+
+static void send_error(client_t *c, const char *text) {
+  message_t m;
+  chat_msg(&m, MSG_ERROR, "server", c->name, text);
+  send_to(c, &m);
+}
+
+static void send_user_list(client_t *c) {
+  message_t m;
+  size_t used = 0;
+
+  /* Names split over as many frames as needed; client_id = user count */
+  chat_msg(&m, MSG_USER_LIST, "server", c->name, NULL);
+  m.client_id = srv.nusers;
+  for (client_t *u = srv.users; u; u = u->next) {
+    size_t len = strlen(u->name);
+    if (used + len + 2 >= MSG_MAX_SIZE) {
+      send_to(c, &m);
+      used = 0;
+    }
+    used += snprintf(m.text + used, MSG_MAX_SIZE - used, "%s%s",
+                     used ? ", " : "", u->name);
+  }
+  send_to(c, &m);
+}
+
+static void handle_join(client_t *c, message_t *m) {
+  if (c->joined) {
+    send_error(c, "already joined");
+    return;
+  }
+  if (m->from_user[0] == '\0' || strcmp(m->from_user, "server") == 0 ||
+      find_user(m->from_user)) {
+    send_error(c, "username taken or invalid");
+    return;
+  }
+  strcpy(c->name, m->from_user);
+  add_user(c);
+
+  message_t reply;
+  char text[MSG_MAX_SIZE];
+  snprintf(text, sizeof(text), "Welcome %s! %u users online", c->name,
+           srv.nusers);
+  chat_msg(&reply, MSG_JOIN, "server", c->name, text);
+  reply.client_id = c->id;
+  send_to(c, &reply);
+
+  if (!srv.quiet) {
+    log_msg("INFO", "Client '%s' connected (FD: %d)", c->name, c->fd);
+    snprintf(text, sizeof(text), "%s joined", c->name);
+    chat_msg(&reply, MSG_JOIN, c->name, NULL, text);
+    broadcast(&reply, c);
+  }
+}
+
+static void handle_message(client_t *c, message_t *m) {
+  srv.msgs_in++;
+  if (!c->joined && m->type != MSG_JOIN && m->type != MSG_PING) {
+    send_error(c, "join first");
+    return;
+  }
+
+  /* Never trust the sender's idea of who it is or what time it is */
+  if (m->type != MSG_JOIN)
+    strcpy(m->from_user, c->name);
+  m->client_id = c->id;
+  m->timestamp = time(NULL);
+
+  switch (m->type) {
+  case MSG_JOIN:
+    handle_join(c, m);
+    break;
+  case MSG_LEAVE:
+    kill_client(c, NULL);
+    break;
+  case MSG_BROADCAST:
+    if (!srv.quiet)
+      log_msg("MSG", "%s -> ALL: %s", c->name, m->text);
+    m->to_user[0] = '\0';
+    broadcast(m, c);
+    break;
+  case MSG_PRIVATE: {
+    client_t *to = find_user(m->to_user);
+    if (!to) {
+      send_error(c, "no such user");
+      break;
+    }
+    if (!srv.quiet)
+      log_msg("MSG", "%s -> %s: %s", c->name, to->name, m->text);
+    send_to(to, m);
+    break;
+  }
+  case MSG_LIST_USERS:
+    send_user_list(c);
+    break;
+  case MSG_PING:
+    m->type = MSG_PONG;
+    send_to(c, m);
+    break;
+  default:
+    send_error(c, "unexpected message type");
+  }
+}
+
+/* Edge-triggered: read until EAGAIN or the edge will not come again */
+static void on_readable(client_t *c) {
+  while (!c->dead) {
+    ssize_t n = read(c->fd, c->rx + c->rx_len, RX_SIZE - c->rx_len);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1 && errno == EAGAIN)
+      return;
+    if (n <= 0) {
+      kill_client(c, n == 0 ? NULL : strerror(errno));
+      return;
+    }
+    c->rx_len += n;
+
+    size_t pos = 0;
+    message_t m;
+    ssize_t len;
+    while (!c->dead &&
+           (len = chat_decode(c->rx + pos, c->rx_len - pos, &m)) != 0) {
+      if (len < 0) {
+        kill_client(c, "protocol error");
+        return;
+      }
+      pos += len;
+      handle_message(c, &m);
+    }
+    memmove(c->rx, c->rx + pos, c->rx_len - pos);
+    c->rx_len -= pos;
+  }
+}
+
+static void accept_clients(void) {
+  for (;;) {
+    int fd = accept4(srv.lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno != EAGAIN)
+        /* EMFILE: the rest wait in the backlog until a client leaves */
+        log_msg("WARN", "accept: %s", strerror(errno));
+      return;
+    }
+
+    client_t *c = calloc(1, sizeof(*c));
+    if (!c) {
+      close(fd);
+      continue;
+    }
+    c->fd = fd;
+    c->id = ++srv.next_id;
+    /* Registered once for both directions: edges, not levels */
+    struct epoll_event ev = {
+        .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = c};
+    if (epoll_ctl(srv.epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+      close(fd);
+      free(c);
+      continue;
+    }
+    srv.connects++;
+  }
+}
+
+static void print_stats(void) {
+  log_msg("INFO",
+          "Total messages: %lu, Active users: %u, connects %lu, "
+          "disconnects %lu (%lu too slow)",
+          srv.msgs_in, srv.nusers, srv.connects, srv.disconnects,
+          srv.slow_kicks);
+  log_msg("INFO",
+          "Frames out: %lu in %lu writev calls (%.1f per call), %.1f MB; "
+          "%lu shared buffers, %.2f MB encoded",
+          srv.frames_out, srv.writevs,
+          srv.writevs ? (double)srv.frames_out / srv.writevs : 0.0,
+          srv.bytes_out / 1e6, srv.bufs, srv.buf_bytes / 1e6);
+}
+
+static void server_command(char *line) {
+  line[strcspn(line, "\n")] = '\0';
+  if (strcmp(line, "/list") == 0) {
+    log_msg("INFO", "%u users online", srv.nusers);
+    int shown = 0;
+    for (client_t *u = srv.users; u && shown < 50; u = u->next, shown++)
+      printf("  %s (FD: %d)\n", u->name, u->fd);
+    if (srv.nusers > 50)
+      printf("  ...\n");
+  } else if (strcmp(line, "/stats") == 0) {
+    print_stats();
+  } else if (strncmp(line, "/kick ", 6) == 0) {
+    client_t *u = find_user(line + 6);
+    if (u)
+      kill_client(u, "kicked");
+    else
+      log_msg("WARN", "no user '%s'", line + 6);
+  } else if (strncmp(line, "/broadcast ", 11) == 0) {
+    message_t m;
+    chat_msg(&m, MSG_BROADCAST, "server", NULL, line + 11);
+    broadcast(&m, NULL);
+  } else if (strcmp(line, "/shutdown") == 0) {
+    running = 0;
+  } else if (line[0]) {
+    printf("Commands: /list /stats /kick <user> /broadcast <msg> "
+           "/shutdown\n");
+  }
+}
+
+static int server_main(int quiet) {
+  srv.quiet = quiet;
+  raise_fd_limit();
+
+  struct sigaction sa = {.sa_handler = on_signal};
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  strcpy(addr.sun_path, CHAT_SOCKET_PATH);
+  unlink(CHAT_SOCKET_PATH);
+  srv.lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (srv.lfd == -1 ||
+      bind(srv.lfd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      listen(srv.lfd, SOMAXCONN) == -1) {
+    perror("listen " CHAT_SOCKET_PATH);
+    return 1;
+  }
+
+  srv.epfd = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event ev = {.events = EPOLLIN | EPOLLET,
+                           .data.ptr = &listener_tag};
+  epoll_ctl(srv.epfd, EPOLL_CTL_ADD, srv.lfd, &ev);
+  /* stdin stays level-triggered and blocking: it belongs to the shell */
+  ev = (struct epoll_event){.events = EPOLLIN, .data.ptr = &stdin_tag};
+  epoll_ctl(srv.epfd, EPOLL_CTL_ADD, STDIN_FILENO, &ev);
+
+  log_msg("SERVER", "Chat server started on %s", CHAT_SOCKET_PATH);
+  log_msg("SERVER", "Using IPC method: UNIX_SOCKETS (epoll, edge-triggered)");
+
+  struct epoll_event events[MAX_EVENTS];
+  while (running) {
+    int n = epoll_wait(srv.epfd, events, MAX_EVENTS, -1);
+    for (int i = 0; i < n; i++) {
+      void *tag = events[i].data.ptr;
+      if (tag == &listener_tag) {
+        accept_clients();
+      } else if (tag == &stdin_tag) {
+        char line[MSG_MAX_SIZE + 16];
+        if (fgets(line, sizeof(line), stdin))
+          server_command(line);
+        else
+          epoll_ctl(srv.epfd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+      } else {
+        client_t *c = tag;
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+          on_readable(c);
+        if ((events[i].events & EPOLLOUT) && !c->dead)
+          flush(c);
+      }
+    }
+    /* Everything queued during this batch goes out now, coalesced */
+    while (srv.dirty || srv.dead) {
+      flush_dirty();
+      reap_dead();
+    }
+    free_graves(); /* Nothing points at them any more */
+  }
+
+  print_stats();
+  for (client_t *c = srv.users, *next; c; c = next) {
+    next = c->next;
+    kill_client(c, "server shutting down");
+  }
+  srv.quiet = 1;
+  reap_dead();
+  flush_dirty();
+  free_graves();
+  close(srv.epfd);
+  close(srv.lfd);
+  unlink(CHAT_SOCKET_PATH);
+  return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Interactive client                                                   */
+/* ------------------------------------------------------------------ */
+
+static int connect_server(void) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  strcpy(addr.sun_path, CHAT_SOCKET_PATH);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+  return fd;
+}
+
+static int send_msg(int fd, const message_t *m) {
+  unsigned char buf[CHAT_FRAME_MAX];
+  size_t len = chat_encode(m, buf);
+  return send(fd, buf, len, MSG_NOSIGNAL) == (ssize_t)len ? 0 : -1;
+}
+
+static void show(const message_t *m, const char *me) {
+  switch (m->type) {
+  case MSG_BROADCAST:
+    printf("[%s] %s\n", m->from_user, m->text);
+    break;
+  case MSG_PRIVATE:
+    printf("[%s -> you] %s\n", m->from_user, m->text);
+    break;
+  case MSG_USER_LIST:
+    printf("[SYSTEM] Users online (%d): %s\n", m->client_id, m->text);
+    break;
+  case MSG_ERROR:
+    printf("[ERROR] %s\n", m->text);
+    break;
+  default:
+    printf("[SYSTEM] %s\n", m->text);
+  }
+  printf("%s> ", me);
+  fflush(stdout);
+}
+
+static int client_main(const char *name) {
+  int fd = connect_server();
+  if (fd == -1) {
+    perror("connect " CHAT_SOCKET_PATH);
+    return 1;
+  }
+  message_t m;
+  chat_msg(&m, MSG_JOIN, name, NULL, NULL);
+  send_msg(fd, &m);
+  printf("=== Chat Client ===\nConnected to server!\n\n");
+
+  unsigned char rx[RX_SIZE];
+  size_t rx_len = 0;
+  struct pollfd pfd[2] = {{STDIN_FILENO, POLLIN, 0}, {fd, POLLIN, 0}};
+  for (;;) {
+    if (poll(pfd, 2, -1) == -1 && errno != EINTR)
+      break;
+
+    if (pfd[1].revents) {
+      ssize_t n = read(fd, rx + rx_len, sizeof(rx) - rx_len);
+      if (n <= 0) {
+        printf("\n[SYSTEM] Server closed the connection\n");
+        break;
+      }
+      rx_len += n;
+      size_t pos = 0;
+      ssize_t len;
+      while ((len = chat_decode(rx + pos, rx_len - pos, &m)) > 0) {
+        show(&m, name);
+        pos += len;
+      }
+      if (len < 0)
+        break;
+      memmove(rx, rx + pos, rx_len - pos);
+      rx_len -= pos;
+    }
+
+    if (pfd[0].revents) {
+      char line[MSG_MAX_SIZE + USERNAME_MAX + 8];
+      if (!fgets(line, sizeof(line), stdin) ||
+          strncmp(line, "/quit", 5) == 0) {
+        chat_msg(&m, MSG_LEAVE, name, NULL, NULL);
+        send_msg(fd, &m);
+        printf("[SYSTEM] Goodbye!\n");
+        break;
+      }
+      line[strcspn(line, "\n")] = '\0';
+      if (strcmp(line, "/help") == 0) {
+        printf("/users  /msg <user> <text>  /quit  (anything else: to all)\n");
+      } else if (strcmp(line, "/users") == 0) {
+        chat_msg(&m, MSG_LIST_USERS, name, NULL, NULL);
+        send_msg(fd, &m);
+      } else if (strncmp(line, "/msg ", 5) == 0) {
+        char *to = line + 5, *text = strchr(to, ' ');
+        if (text) {
+          *text++ = '\0';
+          chat_msg(&m, MSG_PRIVATE, name, to, text);
+          send_msg(fd, &m);
+          printf("[You -> %s] %s\n", to, text);
+        }
+      } else if (line[0]) {
+        chat_msg(&m, MSG_BROADCAST, name, NULL, line);
+        send_msg(fd, &m);
+      }
+      printf("%s> ", name);
+      fflush(stdout);
+    }
+  }
+  close(fd);
+  return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Load test: N connected users, bursts of broadcasts                   */
+/* ------------------------------------------------------------------ */
+
+typedef struct {
+  int fd;
+  unsigned char rx[CHAT_FRAME_MAX];
+  size_t rx_len;
+  int welcomed;        /* The server has processed our MSG_JOIN */
+  unsigned long got;   /* Broadcasts received */
+  unsigned listed;     /* Last user count seen in a MSG_USER_LIST */
+} bench_client_t;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_count(bench_client_t *bc, const message_t *m) {
+  if (m->type == MSG_BROADCAST)
+    bc->got++;
+  else if (m->type == MSG_JOIN)
+    bc->welcomed = 1;
+  else if (m->type == MSG_USER_LIST)
+    bc->listed = m->client_id;
+}
+
+/* Read whatever has arrived for every client, for up to timeout_ms */
+static void bench_drain(int epfd, int timeout_ms) {
+  static unsigned char chunk[64 * 1024];
+  struct epoll_event events[MAX_EVENTS];
+  int n = epoll_wait(epfd, events, MAX_EVENTS, timeout_ms);
+
+  for (int i = 0; i < n; i++) {
+    bench_client_t *bc = events[i].data.ptr;
+    ssize_t got;
+    while ((got = recv(bc->fd, chunk, sizeof(chunk), MSG_DONTWAIT)) > 0) {
+      /* Finish the frame left over from last time, then parse in place */
+      size_t pos = 0;
+      message_t m;
+      ssize_t len;
+      if (bc->rx_len > 0) {
+        size_t take = got < (ssize_t)(sizeof(bc->rx) - bc->rx_len)
+                          ? (size_t)got
+                          : sizeof(bc->rx) - bc->rx_len;
+        memcpy(bc->rx + bc->rx_len, chunk, take);
+        len = chat_decode(bc->rx, bc->rx_len + take, &m);
+        if (len <= 0) {
+          bc->rx_len += take;
+          continue;
+        }
+        pos = len - bc->rx_len;
+        bc->rx_len = 0;
+        bench_count(bc, &m);
+      }
+      while ((len = chat_decode(chunk + pos, got - pos, &m)) > 0) {
+        bench_count(bc, &m);
+        pos += len;
+      }
+      memcpy(bc->rx, chunk + pos, got - pos);
+      bc->rx_len = got - pos;
+    }
+  }
+}
+
+static int bench(int nclients, long messages) {
+  const int burst = 10;
+  if (nclients < 2 || messages < 1) {
+    fprintf(stderr, "need at least 2 clients and 1 message\n");
+    return 1;
+  }
+  raise_fd_limit();
+
+  fflush(stdout);
+  pid_t server = fork();
+  if (server == 0) {
+    int null = open("/dev/null", O_RDWR);
+    dup2(null, STDIN_FILENO);
+    _exit(server_main(1));
+  }
+
+  bench_client_t *cl = calloc(nclients, sizeof(*cl));
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  double t0 = now_sec();
+  int failed = 0;
+
+  printf("=== %d users in one room, %ld broadcasts in bursts of %d ===\n",
+         nclients, messages, burst);
+  for (int i = 0; i < nclients; i++) {
+    for (int tries = 0; (cl[i].fd = connect_server()) == -1; tries++) {
+      if (tries == 200 || (errno != ENOENT && errno != ECONNREFUSED)) {
+        fprintf(stderr, "client %d: connect: %s\n", i, strerror(errno));
+        kill(server, SIGTERM);
+        waitpid(server, NULL, 0);
+        return 1;
+      }
+      usleep(10000); /* Server still starting */
+    }
+    message_t m;
+    char name[USERNAME_MAX];
+    snprintf(name, sizeof(name), "user%d", i);
+    chat_msg(&m, MSG_JOIN, name, NULL, NULL);
+    send_msg(cl[i].fd, &m);
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &cl[i]};
+    epoll_ctl(epfd, EPOLL_CTL_ADD, cl[i].fd, &ev);
+    if (i % 256 == 255)
+      bench_drain(epfd, 0);
+  }
+  /* Broadcasts only reach users whose join the server has seen */
+  for (int i = 0; i < nclients && !failed; i++) {
+    while (!cl[i].welcomed && !failed) {
+      failed = now_sec() - t0 > 30;
+      bench_drain(epfd, 100);
+    }
+  }
+  printf("%d users connected and joined in %.2f s\n", nclients,
+         now_sec() - t0);
+
+  /* user0 sends; everyone else must see each message exactly once */
+  unsigned long expect = 0;
+  double worst = 0;
+  t0 = now_sec();
+  for (long sent = 0; sent < messages && !failed;) {
+    double b0 = now_sec();
+    for (int k = 0; k < burst && sent < messages; k++, sent++) {
+      message_t m;
+      char text[64];
+      snprintf(text, sizeof(text), "message %ld", sent);
+      chat_msg(&m, MSG_BROADCAST, "user0", NULL, text);
+      send_msg(cl[0].fd, &m);
+    }
+    expect = sent;
+    for (int i = 1; i < nclients; i++) {
+      while (cl[i].got < expect) {
+        if (now_sec() - b0 > 10) {
+          fprintf(stderr, "user%d: %lu of %lu messages after 10 s\n", i,
+                  cl[i].got, expect);
+          failed = 1;
+          break;
+        }
+        bench_drain(epfd, 100);
+      }
+      if (failed)
+        break;
+    }
+    if (now_sec() - b0 > worst)
+      worst = now_sec() - b0;
+  }
+  double el = now_sec() - t0;
+  double deliveries = (double)expect * (nclients - 1);
+  printf("%.0f deliveries in %.2f s: %.2f M/s, slowest burst %.1f ms\n",
+         deliveries, el, deliveries / el / 1e6, worst * 1e3);
+
+  /* Half the users vanish without a word; the server must notice */
+  int gone = nclients / 2;
+  for (int i = nclients - gone; i < nclients; i++)
+    close(cl[i].fd);
+  unsigned want = nclients - gone;
+  for (int tries = 0; !failed && cl[0].listed != want; tries++) {
+    if (tries == 50) {
+      fprintf(stderr, "server still lists %u users, expected %u\n",
+              cl[0].listed, want);
+      failed = 1;
+      break;
+    }
+    message_t m;
+    chat_msg(&m, MSG_LIST_USERS, "user0", NULL, NULL);
+    send_msg(cl[0].fd, &m);
+    bench_drain(epfd, 100);
+  }
+  if (!failed)
+    printf("%d abrupt disconnects detected, %u users left\n", gone, want);
+
+  for (int i = 0; i < nclients - gone; i++)
+    close(cl[i].fd);
+  close(epfd);
+  free(cl);
+  fflush(stdout);
+  kill(server, SIGTERM); /* Prints its statistics on the way out */
+  int status;
+  waitpid(server, &status, 0);
+  return failed || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("Usage: %s server [-q] | client <name> | bench [clients] "
+           "[messages]\n",
+           argv[0]);
+    return 1;
+  }
+
+  if (strcmp(argv[1], "server") == 0) {
+    return server_main(argc > 2 && strcmp(argv[2], "-q") == 0);
+  } else if (strcmp(argv[1], "client") == 0 && argc > 2) {
+    return client_main(argv[2]);
+  } else if (strcmp(argv[1], "bench") == 0) {
+    return bench(argc > 2 ? atoi(argv[2]) : 10000,
+                 argc > 3 ? atol(argv[3]) : 200);
+  } else {
+    printf("Invalid argument. Use 'server', 'client <name>' or 'bench'\n");
+    return 1;
+  }
+}
+
+/*
+ * TRY THIS:
+ *
+ * ./chat_server server              # Terminal 1, then /stats, /list
+ * ./chat_server client alice        # Terminals 2..N
+ * ./chat_server bench 10000 200     # 10k users, ~2M deliveries
+ *
+ * In the bench's server statistics, compare "frames out" with "writev
+ * calls": that ratio is the write coalescing. "MB encoded" against "MB"
+ * out is what sharing one buffer per broadcast saved in copies.
+ *
+ * Start a client, stop it with Ctrl-Z and send a flood from another one:
+ * once a megabyte is queued for it, the server cuts it off.
+ */
@@ -0,0 +1,335 @@
+/*
+ * 12_shm_map.c - One lookup table shared by many worker processes
+ *
+ * Workers that each load the same lookup table keep N copies of it. Here
+ * they all map one hash table in a shared heap (shm_map.h on top of
+ * shm_heap.h): lookups take no lock, writers lock only the groups they
+ * touch, and the table grows a few groups at a time while in use.
+ *
+ * Compile: gcc -O2 -o shm_map 12_shm_map.c shm_map.c shm_heap.c -lrt -lpthread
+ * Run: ./shm_map load [procs] [keys per proc]
+ *      ./shm_map read [readers] [seconds]
+ *      ./shm_map churn [procs] [ops per proc]
+ */
+
+#define _GNU_SOURCE
+
+#include "shm_map.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HEAP_NAME "/shm_map_demo"
+#define HEAP_SIZE (512u << 20)
+#define START_CAPACITY 1024 /* Small on purpose: watch it grow */
+
+/* Results the children report back */
+typedef struct {
+  _Atomic uint64_t worst_ns;
+  _Atomic uint64_t lookups;
+  _Atomic uint64_t wrong;
+} results_t;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* The value stored for key k says which key it belongs to */
+static uint64_t value_for(uint64_t key, uint64_t gen) {
+  return key << 24 | (gen & 0xffffff);
+}
+
+static void update_max(_Atomic uint64_t *max, uint64_t v) {
+  uint64_t cur = atomic_load(max);
+  while (v > cur && !atomic_compare_exchange_weak(max, &cur, v))
+    ;
+}
+
+static int wait_all(void) {
+  int failed = 0, status;
+  while (wait(&status) > 0)
+    failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+  return failed;
+}
+
+/* Create the heap and an empty map; the results live in the heap too */
+static int setup(shm_heap_t *h, shm_map_t *m, results_t **res) {
+  if (shm_heap_create(h, HEAP_NAME, HEAP_SIZE) == -1) {
+    perror("shm_heap_create");
+    return -1;
+  }
+  shm_off_t where, roff = shm_heap_alloc(h, sizeof(results_t));
+  if (!roff || shm_map_create(m, h, START_CAPACITY, &where) == -1) {
+    perror("shm_map_create");
+    return -1;
+  }
+  *res = shm_heap_ptr(h, roff);
+  memset(*res, 0, sizeof(results_t));
+  shm_heap_set_root(h, 0, where);
+  return 0;
+}
+
+/* A child's own mapping of the heap and its own map handle */
+static int open_child(shm_heap_t *h, shm_map_t *m) {
+  if (shm_heap_open(h, HEAP_NAME) == -1 ||
+      shm_map_attach(m, h, shm_heap_root(h)) == -1) {
+    perror("child attach");
+    return -1;
+  }
+  return 0;
+}
+
+static void close_child(shm_heap_t *h, shm_map_t *m) {
+  shm_map_detach(m);
+  shm_heap_close(h);
+}
+
+static void print_stats(shm_map_t *m) {
+  shm_map_stats_t st;
+  shm_map_stats(m, &st);
+  printf("map: %zu keys in %zu slots (%.0f%% full), %zu tombstones, "
+         "%lu resizes%s\n",
+         st.size, st.capacity, 100.0 * st.size / st.capacity, st.tombstones,
+         st.resizes, st.resizing ? ", still resizing" : "");
+}
+
+int load(int procs, long keys) {
+  shm_heap_t h;
+  shm_map_t m;
+  results_t *res;
+  if (setup(&h, &m, &res) == -1)
+    return 1;
+
+  printf("=== %d processes inserting %ld keys each, starting from %d "
+         "slots ===\n",
+         procs, keys, START_CAPACITY);
+  fflush(stdout);
+  double t0 = now_sec();
+  for (int p = 0; p < procs; p++) {
+    if (fork() == 0) {
+      shm_heap_t mine;
+      shm_map_t mm;
+      if (open_child(&mine, &mm) == -1)
+        _exit(1);
+      uint64_t worst = 0;
+      for (long i = 0; i < keys; i++) {
+        uint64_t key = (uint64_t)p * keys + i, t = now_ns();
+        if (shm_map_put(&mm, key, value_for(key, 0)) == -1) {
+          perror("shm_map_put");
+          _exit(1);
+        }
+        t = now_ns() - t;
+        if (t > worst)
+          worst = t;
+      }
+      update_max(&res->worst_ns, worst);
+      close_child(&mine, &mm);
+      _exit(0);
+    }
+  }
+  int failed = wait_all();
+  double el = now_sec() - t0;
+  long total = procs * keys;
+  printf("%ld inserts in %.3f s: %.0f ns each, slowest %.1f us "
+         "(growth is spread over later inserts)\n",
+         total, el, el * 1e9 / total, atomic_load(&res->worst_ns) / 1e3);
+  print_stats(&m);
+
+  long found = 0;
+  for (long k = 0; k < total; k++) {
+    uint64_t v;
+    found += shm_map_get(&m, k, &v) && v == value_for(k, 0);
+  }
+  uint64_t v;
+  printf("%ld of %ld keys found with the right value, key %ld %s\n", found,
+         total, total, shm_map_get(&m, total, &v) ? "FOUND" : "absent");
+  failed |= found != total;
+
+  shm_map_stats_t st;
+  shm_map_stats(&m, &st);
+  double mb = st.table_bytes / 1e6;
+  printf("table uses %.1f MB: %d private copies would be %.1f MB, shared "
+         "it stays %.1f MB (+%.1f MB reserved for the next resize)\n",
+         mb, procs, mb * procs, mb, st.spare_bytes / 1e6);
+
+  shm_map_detach(&m);
+  shm_heap_close(&h);
+  shm_heap_unlink(HEAP_NAME);
+  return failed;
+}
+
+int read_bench(int readers, double seconds) {
+  shm_heap_t h;
+  shm_map_t m;
+  results_t *res;
+  if (setup(&h, &m, &res) == -1)
+    return 1;
+
+  const long keys = 200000;
+  for (long k = 0; k < keys; k++)
+    shm_map_put(&m, k, value_for(k, 0));
+  print_stats(&m);
+
+  printf("=== %d readers looking up random keys for %.1f s while one "
+         "writer updates and inserts ===\n",
+         readers, seconds);
+  fflush(stdout);
+  for (int r = 0; r < readers; r++) {
+    if (fork() == 0) {
+      shm_heap_t mine;
+      shm_map_t mm;
+      if (open_child(&mine, &mm) == -1)
+        _exit(1);
+      unsigned seed = r + 1;
+      uint64_t n = 0, wrong = 0, v;
+      double end = now_sec() + seconds;
+      do {
+        for (int i = 0; i < 1024; i++, n++) {
+          uint64_t key = rand_r(&seed) % keys;
+          /* Preloaded keys are never removed, only updated */
+          wrong += !shm_map_get(&mm, key, &v) || v >> 24 != key;
+        }
+      } while (now_sec() < end);
+      atomic_fetch_add(&res->lookups, n);
+      atomic_fetch_add(&res->wrong, wrong);
+      close_child(&mine, &mm);
+      _exit(0);
+    }
+  }
+
+  /* The writer: new keys now and then, so the table resizes under them */
+  unsigned seed = 12345;
+  long updates = 0, next = keys;
+  double end = now_sec() + seconds;
+  while (now_sec() < end) {
+    for (int i = 0; i < 256; i++, updates++) {
+      uint64_t key = rand_r(&seed) % keys;
+      shm_map_put(&m, key, value_for(key, updates));
+      if (i % 4 == 0) {
+        shm_map_put(&m, next, value_for(next, 0));
+        next++;
+      }
+    }
+  }
+  int failed = wait_all();
+
+  uint64_t lookups = atomic_load(&res->lookups),
+           wrong = atomic_load(&res->wrong);
+  printf("%.1f M lookups/s across readers, %lu missing or wrong; writer "
+         "did %ld updates and %ld inserts\n",
+         lookups / seconds / 1e6, (unsigned long)wrong, updates,
+         next - keys);
+  print_stats(&m);
+  failed |= wrong != 0;
+
+  shm_map_detach(&m);
+  shm_heap_close(&h);
+  shm_heap_unlink(HEAP_NAME);
+  return failed;
+}
+
+int churn(int procs, long ops) {
+  shm_heap_t h;
+  shm_map_t m;
+  results_t *res;
+  if (setup(&h, &m, &res) == -1)
+    return 1;
+
+  /* Each process owns a range of keys and remembers which it stored */
+  const long range = 20000;
+  printf("=== %d processes, %ld random puts/deletes each over %ld keys "
+         "===\n",
+         procs, ops, range);
+  fflush(stdout);
+  double t0 = now_sec();
+  for (int p = 0; p < procs; p++) {
+    if (fork() == 0) {
+      shm_heap_t mine;
+      shm_map_t mm;
+      if (open_child(&mine, &mm) == -1)
+        _exit(1);
+      char *in = calloc(range, 1);
+      unsigned seed = p + 1;
+      long bad = 0;
+      for (long i = 0; i < ops; i++) {
+        long k = rand_r(&seed) % range;
+        uint64_t key = (uint64_t)p * range + k;
+        if (rand_r(&seed) % 2) {
+          if (shm_map_put(&mm, key, value_for(key, i)) == -1)
+            _exit(1);
+          in[k] = 1;
+        } else {
+          bad += shm_map_del(&mm, key) != in[k];
+          in[k] = 0;
+        }
+      }
+      /* Everything this process stored, and nothing else */
+      uint64_t v;
+      for (long k = 0; k < range; k++)
+        bad += shm_map_get(&mm, (uint64_t)p * range + k, &v) != in[k];
+      free(in);
+      close_child(&mine, &mm);
+      _exit(bad != 0);
+    }
+  }
+  int failed = wait_all();
+  double el = now_sec() - t0;
+  printf("%ld operations in %.3f s: %.0f ns each, contents %s\n",
+         procs * ops, el, el * 1e9 / (procs * ops),
+         failed ? "WRONG" : "as expected in every process");
+  print_stats(&m);
+
+  shm_map_detach(&m);
+  shm_heap_close(&h);
+  shm_heap_unlink(HEAP_NAME);
+  return failed;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("Usage: %s load [procs] [keys] | read [readers] [seconds] | "
+           "churn [procs] [ops]\n",
+           argv[0]);
+    return 1;
+  }
+
+  if (strcmp(argv[1], "load") == 0) {
+    return load(argc > 2 ? atoi(argv[2]) : 4,
+                argc > 3 ? atol(argv[3]) : 500000);
+  } else if (strcmp(argv[1], "read") == 0) {
+    return read_bench(argc > 2 ? atoi(argv[2]) : 4,
+                      argc > 3 ? atof(argv[3]) : 2.0);
+  } else if (strcmp(argv[1], "churn") == 0) {
+    return churn(argc > 2 ? atoi(argv[2]) : 4,
+                 argc > 3 ? atol(argv[3]) : 500000);
+  } else {
+    printf("Invalid argument. Use 'load', 'read' or 'churn'\n");
+    return 1;
+  }
+}
+
+/*
+ * TRY THIS:
+ *
+ * ./shm_map load 8 500000   # 4M keys, 8 writers, one copy in RAM
+ * ./shm_map read 8 5        # Lookups scale with readers: no shared writes
+ * ./shm_map churn 4         # Deletes leave tombstones; resizes purge them
+ *
+ * Set MIGRATE_STEP in shm_map.c to 1000000 so the first write after a
+ * resize starts moves the whole table, and compare the slowest insert in
+ * load: that pause is what incremental resizing avoids.
+ */
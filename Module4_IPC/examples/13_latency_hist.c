@@ -0,0 +1,410 @@
+/*
+ * 13_latency_hist.c - Round-trip latency percentiles from many processes
+ *
+ * Client processes ping their echo server over a pipe pair or a UNIX
+ * socket and record every round trip into one shared histogram
+ * (shm_hist.h). The parent never talks to them: it reads the histogram
+ * once a second and prints that second's percentiles, then the totals per
+ * client. Another terminal can watch the same histogram live.
+ *
+ * Also measures what recording costs: per-CPU shards vs one shard that
+ * every process adds to vs a histogram behind a process-shared mutex.
+ *
+ * Compile: gcc -O2 -o latency_hist 13_latency_hist.c shm_hist.c -lrt -lpthread
+ * Run: ./latency_hist rtt [pairs] [seconds] [pipe|unix]
+ *      ./latency_hist watch [name] [seconds]
+ *      ./latency_hist cost [procs] [records per proc]
+ */
+
+#define _GNU_SOURCE
+
+#include "shm_hist.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HIST_NAME "/latency_hist_demo"
+#define MAX_PAIRS 64
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int wait_all(void) {
+  int failed = 0, status;
+  while (wait(&status) > 0)
+    failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+  return failed;
+}
+
+static void print_header(const char *first) {
+  printf("%-8s %10s %9s %9s %9s %9s %9s\n", first, "count", "mean(us)",
+         "p50(us)", "p99(us)", "p999(us)", "max(us)");
+}
+
+static void print_snap(const char *label, const shm_hist_snap_t *s) {
+  printf("%-8s %10lu %9.2f %9.2f %9.2f %9.2f %9.2f\n", label,
+         (unsigned long)s->count, s->count ? s->sum / 1e3 / s->count : 0.0,
+         shm_hist_percentile(s, 0.50) / 1e3,
+         shm_hist_percentile(s, 0.99) / 1e3,
+         shm_hist_percentile(s, 0.999) / 1e3, s->max / 1e3);
+}
+
+/* One bar per power of two: where the time goes, tail included */
+static void print_shape(const shm_hist_snap_t *s) {
+  uint64_t per_pow[64] = {0}, most = 0;
+  int lo = 64, hi = 0;
+  for (int b = 0; b < SHM_HIST_BUCKETS; b++) {
+    if (!s->buckets[b])
+      continue;
+    uint64_t v = shm_hist_bucket_low(b);
+    int p = v ? 63 - __builtin_clzll(v) : 0;
+    per_pow[p] += s->buckets[b];
+    lo = p < lo ? p : lo;
+    hi = p > hi ? p : hi;
+  }
+  for (int p = lo; p <= hi; p++)
+    most = per_pow[p] > most ? per_pow[p] : most;
+  for (int p = lo; p <= hi; p++) {
+    int width = most ? (int)(50 * per_pow[p] / most) : 0;
+    printf("  >= %9.2f us %10lu %.*s%s\n", (1ull << p) / 1e3,
+           (unsigned long)per_pow[p], width,
+           "##################################################",
+           per_pow[p] && !width ? "." : "");
+  }
+}
+
+/* Print one line per interval until `seconds` pass or `done` returns 1 */
+static void watch_loop(shm_hist_t *h, double seconds, int (*done)(void)) {
+  shm_hist_snap_t *prev = malloc(sizeof(*prev)),
+                  *cur = malloc(sizeof(*cur)), *delta = malloc(sizeof(*delta));
+  shm_hist_snapshot(h, -1, prev);
+  print_header("second");
+  uint64_t end = now_ns() + (uint64_t)(seconds * 1e9);
+  for (int sec = 1; now_ns() < end && !(done && done()); sec++) {
+    sleep(1);
+    shm_hist_snapshot(h, -1, cur);
+    shm_hist_sub(delta, cur, prev);
+    char label[16];
+    snprintf(label, sizeof(label), "%d", sec);
+    print_snap(label, delta);
+    fflush(stdout);
+    shm_hist_snap_t *t = prev;
+    prev = cur;
+    cur = t;
+  }
+  free(prev);
+  free(cur);
+  free(delta);
+}
+
+/* ---------------------------------------------------------------------- */
+/* rtt: ping-pong pairs recording into one histogram                       */
+/* ---------------------------------------------------------------------- */
+
+static int transport_fds(int use_unix, int cfd[2], int sfd[2]) {
+  if (use_unix) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+      return -1;
+    cfd[0] = cfd[1] = sv[0];
+    sfd[0] = sfd[1] = sv[1];
+    return 0;
+  }
+  int up[2], down[2]; /* client -> server, server -> client */
+  if (pipe(up) == -1 || pipe(down) == -1)
+    return -1;
+  cfd[0] = down[0]; /* client reads */
+  cfd[1] = up[1];   /* client writes */
+  sfd[0] = up[0];
+  sfd[1] = down[1];
+  return 0;
+}
+
+static void close_pair(int fds[2]) {
+  close(fds[0]);
+  if (fds[1] != fds[0])
+    close(fds[1]);
+}
+
+static void run_server(int fds[2]) {
+  uint64_t msg;
+  while (read(fds[0], &msg, sizeof(msg)) == sizeof(msg))
+    if (write(fds[1], &msg, sizeof(msg)) != sizeof(msg))
+      break;
+  _exit(0);
+}
+
+static void run_client(int fds[2], double seconds) {
+  shm_hist_t h;
+  if (shm_hist_open(&h, HIST_NAME) == -1) {
+    perror("shm_hist_open");
+    _exit(1);
+  }
+  uint64_t end = now_ns() + (uint64_t)(seconds * 1e9), msg = 0;
+  for (uint64_t t = now_ns(); t < end;) {
+    if (write(fds[1], &msg, sizeof(msg)) != sizeof(msg) ||
+        read(fds[0], &msg, sizeof(msg)) != sizeof(msg)) {
+      perror("ping");
+      _exit(1);
+    }
+    uint64_t back = now_ns();
+    shm_hist_record(&h, back - t); /* The only shared write: no lock */
+    t = back;
+    msg++;
+  }
+  shm_hist_close(&h);
+  _exit(0);
+}
+
+static int children_left, children_failed;
+
+/* Reap without blocking, so the parent stops printing once all are done */
+static int children_done(void) {
+  int status;
+  while (waitpid(-1, &status, WNOHANG) > 0) {
+    children_left--;
+    children_failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+  }
+  return children_left <= 0;
+}
+
+int rtt(int pairs, double seconds, int use_unix) {
+  shm_hist_t h;
+  if (shm_hist_create(&h, HIST_NAME, 0, SHM_HIST_PER_PROCESS) == -1) {
+    perror("shm_hist_create");
+    return 1;
+  }
+
+  printf("=== %d client/server pairs over %s, %.0f s, every round trip "
+         "recorded in %s ===\n",
+         pairs, use_unix ? "UNIX sockets" : "pipes", seconds, HIST_NAME);
+  fflush(stdout);
+  for (int p = 0; p < pairs; p++) {
+    int cfd[2], sfd[2];
+    if (transport_fds(use_unix, cfd, sfd) == -1) {
+      perror("transport");
+      return 1;
+    }
+    if (fork() == 0) {
+      close_pair(cfd);
+      run_server(sfd);
+    }
+    if (fork() == 0) {
+      close_pair(sfd);
+      run_client(cfd, seconds);
+    }
+    close_pair(cfd);
+    close_pair(sfd);
+  }
+
+  /* Servers exit with their clients, so 2 children per pair */
+  children_left = 2 * pairs;
+  watch_loop(&h, seconds + 1, children_done);
+  int failed = wait_all() | children_failed;
+
+  shm_hist_snap_t *s = malloc(sizeof(*s));
+  printf("\nPer client (one shard each, so no two clients ever add to the "
+         "same line):\n");
+  print_header("pid");
+  for (int i = 0; i < h.nshards; i++) {
+    pid_t pid = shm_hist_shard_pid(&h, i);
+    if (pid == 0 || pid == getpid())
+      continue;
+    shm_hist_snapshot(&h, i, s);
+    char label[16];
+    snprintf(label, sizeof(label), "%d", (int)pid);
+    print_snap(label, s);
+  }
+  shm_hist_snapshot(&h, -1, s);
+  print_snap("all", s);
+  printf("\nDistribution:\n");
+  print_shape(s);
+  failed |= s->count == 0;
+  free(s);
+
+  shm_hist_close(&h);
+  shm_hist_unlink(HIST_NAME);
+  return failed;
+}
+
+int watch(const char *name, double seconds) {
+  shm_hist_t h;
+  if (shm_hist_open(&h, name) == -1) {
+    perror(name);
+    return 1;
+  }
+  printf("=== Watching %s for %.0f s ===\n", name, seconds);
+  watch_loop(&h, seconds, NULL);
+  shm_hist_close(&h);
+  return 0;
+}
+
+/* ---------------------------------------------------------------------- */
+/* cost: what one record costs, sharded vs shared vs locked                */
+/* ---------------------------------------------------------------------- */
+
+/* The obvious alternative: one plain histogram, one lock */
+typedef struct {
+  pthread_mutex_t lock;
+  uint64_t sum;
+  uint64_t buckets[SHM_HIST_BUCKETS];
+} locked_hist_t;
+
+static void locked_record(locked_hist_t *lh, uint64_t value) {
+  pthread_mutex_lock(&lh->lock);
+  lh->buckets[shm_hist_bucket(value)]++;
+  lh->sum += value;
+  pthread_mutex_unlock(&lh->lock);
+}
+
+/* ns per record with procs processes recording at once; -1 on failure */
+static double time_records(int kind, int procs, long records) {
+  shm_hist_t h;
+  locked_hist_t *lh = NULL;
+  if (kind == 2) {
+    lh = mmap(NULL, sizeof(*lh), PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (lh == MAP_FAILED)
+      return -1;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&lh->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+  } else if (shm_hist_create(&h, NULL, kind == 0 ? 0 : 1,
+                             SHM_HIST_PER_CPU) == -1) {
+    return -1;
+  }
+
+  uint64_t t0 = now_ns();
+  for (int p = 0; p < procs; p++) {
+    if (fork() == 0) {
+      unsigned seed = p + 1;
+      if (kind != 2)
+        shm_hist_join(&h);
+      for (long i = 0; i < records; i++) {
+        uint64_t v = 200 + rand_r(&seed) % 5000;
+        if (kind == 2)
+          locked_record(lh, v);
+        else
+          shm_hist_record(&h, v);
+      }
+      _exit(0);
+    }
+  }
+  int failed = wait_all();
+  double ns = (double)(now_ns() - t0) / ((double)procs * records);
+
+  shm_hist_snap_t *s = malloc(sizeof(*s));
+  uint64_t count = 0;
+  if (kind == 2) {
+    for (int b = 0; b < SHM_HIST_BUCKETS; b++)
+      count += lh->buckets[b];
+    munmap(lh, sizeof(*lh));
+  } else {
+    shm_hist_snapshot(&h, -1, s);
+    count = s->count;
+    shm_hist_close(&h);
+  }
+  free(s);
+  /* Lost updates would show here */
+  return failed || count != (uint64_t)procs * records ? -1 : ns;
+}
+
+int cost(int procs, long records) {
+  /* Accuracy first: the median of 1..1000000 is 500000 */
+  shm_hist_t h;
+  if (shm_hist_create(&h, NULL, 1, SHM_HIST_PER_CPU) == -1) {
+    perror("shm_hist_create");
+    return 1;
+  }
+  for (uint64_t v = 1; v <= 1000000; v++)
+    shm_hist_record(&h, v);
+  shm_hist_snap_t *s = malloc(sizeof(*s));
+  shm_hist_snapshot(&h, -1, s);
+  printf("=== Accuracy: 1..1000000 recorded once each ===\n");
+  int failed = 0;
+  double qs[] = {0.5, 0.9, 0.99, 0.999};
+  for (int i = 0; i < 4; i++) {
+    uint64_t got = shm_hist_percentile(s, qs[i]);
+    double exact = qs[i] * 1000000, err = (got - exact) / exact;
+    printf("p%-5g %8lu (exact %.0f, %+.2f%%)\n", qs[i] * 100,
+           (unsigned long)got, exact, err * 100);
+    failed |= err < 0 || err > 1.0 / SHM_HIST_SUB;
+  }
+  printf("%zu bytes per shard, whatever the count\n\n",
+         sizeof(struct shm_hist_shard));
+  free(s);
+  shm_hist_close(&h);
+
+  printf("=== %d processes recording %ld values each ===\n", procs, records);
+  const char *names[] = {"per-CPU shards", "one shared shard",
+                         "mutex + plain histogram"};
+  for (int kind = 0; kind < 3; kind++) {
+    fflush(stdout);
+    double ns = time_records(kind, procs, records);
+    if (ns < 0) {
+      printf("%-24s FAILED (lost updates?)\n", names[kind]);
+      failed = 1;
+    } else {
+      printf("%-24s %7.1f ns per record\n", names[kind], ns);
+    }
+  }
+  return failed;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("Usage: %s rtt [pairs] [seconds] [pipe|unix] | watch [name] "
+           "[seconds] | cost [procs] [records]\n",
+           argv[0]);
+    return 1;
+  }
+
+  if (strcmp(argv[1], "rtt") == 0) {
+    int pairs = argc > 2 ? atoi(argv[2]) : 4;
+    if (pairs < 1 || pairs > MAX_PAIRS) {
+      printf("Pairs must be 1-%d\n", MAX_PAIRS);
+      return 1;
+    }
+    return rtt(pairs, argc > 3 ? atof(argv[3]) : 5.0,
+               argc > 4 && strcmp(argv[4], "unix") == 0);
+  } else if (strcmp(argv[1], "watch") == 0) {
+    return watch(argc > 2 ? argv[2] : HIST_NAME,
+                 argc > 3 ? atof(argv[3]) : 10.0);
+  } else if (strcmp(argv[1], "cost") == 0) {
+    return cost(argc > 2 ? atoi(argv[2]) : 4,
+                argc > 3 ? atol(argv[3]) : 2000000);
+  } else {
+    printf("Invalid argument. Use 'rtt', 'watch' or 'cost'\n");
+    return 1;
+  }
+}
+
+/*
+ * TRY THIS:
+ *
+ * ./latency_hist rtt 4 30 &     # Then, while it runs:
+ * ./latency_hist watch          # A second reader, same numbers
+ * ./latency_hist rtt 4 5 unix   # Sockets vs pipes, same harness
+ * ./latency_hist cost 8         # Sharded adds vs one contended line
+ *
+ * Run rtt with more pairs than CPUs: the median barely moves, but p99.9
+ * grows to whole scheduler time slices. The mean hides that; the
+ * percentiles and the distribution show it.
+ *
+ * cost only shows a difference with several CPUs: on one, the processes
+ * take turns and no cache line ever moves, so all three cost the same.
+ */
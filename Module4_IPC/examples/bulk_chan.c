@@ -0,0 +1,352 @@
+/*
+ * bulk_chan.c - Zero-copy bulk payloads: sealed memfds over a UNIX socket
+ *
+ * See bulk_chan.h for the API.
+ *
+ * Wire format: one fixed 64-byte header per payload, with the memfd
+ * attached as SCM_RIGHTS ancillary data to the first byte of the header,
+ * or with the payload bytes right after it for an inline payload. A
+ * stream socket keeps headers in order and lets a reader pick up a header
+ * split across reads; the kernel delivers the fd together with the bytes
+ * it was sent with.
+ *
+ * Large memfds are asked for transparent huge pages before they are
+ * pre-faulted: allocating, mapping and freeing 2 MiB at a time instead of
+ * 4 KiB is most of what a fresh memfd per payload costs.
+ */
+
+#define _GNU_SOURCE
+
+#include "bulk_chan.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define BULK_MAGIC 0x424c4b31u /* "BLK1" */
+#define BULK_SEALS (F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)
+#define BULK_F_INLINE 0x1u
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+struct bulk_hdr {
+  uint32_t magic;
+  uint32_t tag;
+  uint32_t flags;
+  uint32_t reserved;
+  uint64_t size;
+  char label[BULK_LABEL_MAX];
+};
+
+_Static_assert(sizeof(struct bulk_hdr) == 64, "bulk header size");
+
+static int unix_addr(const char *path, struct sockaddr_un *addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr->sun_path, path);
+  return 0;
+}
+
+int bulk_listen(const char *path) {
+  struct sockaddr_un addr;
+  if (unix_addr(path, &addr) == -1)
+    return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return -1;
+  unlink(path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      listen(fd, 16) == -1) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+  return fd;
+}
+
+int bulk_connect(const char *path) {
+  struct sockaddr_un addr;
+  if (unix_addr(path, &addr) == -1)
+    return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+  return fd;
+}
+
+/* ------------------------------------------------------------------ */
+/* Sender                                                               */
+/* ------------------------------------------------------------------ */
+
+int bulk_alloc(bulk_buf_t *buf, size_t size) {
+  int saved;
+
+  memset(buf, 0, sizeof(*buf));
+  buf->size = size;
+  if (size < BULK_INLINE_MAX) {
+    buf->fd = -1;
+    buf->data = size ? malloc(size) : NULL;
+    return size && !buf->data ? -1 : 0;
+  }
+
+  buf->fd = memfd_create("bulk", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (buf->fd == -1)
+    return -1;
+  if (ftruncate(buf->fd, size) == -1)
+    goto fail;
+  buf->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, buf->fd, 0);
+  if (buf->data == MAP_FAILED) {
+    buf->data = NULL;
+    goto fail;
+  }
+  /* Best effort: THP needs shmem_enabled=advise, POPULATE Linux 5.14 */
+  madvise(buf->data, size, MADV_HUGEPAGE);
+  madvise(buf->data, size, MADV_POPULATE_WRITE);
+  return 0;
+
+fail:
+  saved = errno;
+  bulk_discard(buf);
+  errno = saved;
+  return -1;
+}
+
+void bulk_discard(bulk_buf_t *buf) {
+  if (buf->fd < 0)
+    free(buf->data);
+  else if (buf->data)
+    munmap(buf->data, buf->size);
+  if (buf->fd >= 0)
+    close(buf->fd);
+  buf->data = NULL;
+  buf->fd = -1;
+}
+
+static int send_all(int sock, const void *p, size_t len, int fd) {
+  const char *bytes = p;
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } ctrl;
+
+  while (len > 0) {
+    struct iovec iov = {(void *)bytes, len};
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+    if (fd >= 0) {
+      /* The descriptor rides on the first chunk only */
+      memset(&ctrl, 0, sizeof(ctrl));
+      msg.msg_control = ctrl.buf;
+      msg.msg_controllen = sizeof(ctrl.buf);
+      struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+      cm->cmsg_level = SOL_SOCKET;
+      cm->cmsg_type = SCM_RIGHTS;
+      cm->cmsg_len = CMSG_LEN(sizeof(int));
+      memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+    }
+    ssize_t n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    bytes += n;
+    len -= n;
+    fd = -1;
+  }
+  return 0;
+}
+
+int bulk_send(int sock, bulk_buf_t *buf, uint32_t tag, const char *label) {
+  struct bulk_hdr hdr = {BULK_MAGIC, tag, 0, 0, buf->size, ""};
+  int ret;
+
+  if (label)
+    snprintf(hdr.label, sizeof(hdr.label), "%s", label);
+
+  if (buf->fd < 0) {
+    hdr.flags = BULK_F_INLINE;
+    ret = send_all(sock, &hdr, sizeof(hdr), -1);
+    if (ret == 0)
+      ret = send_all(sock, buf->data, buf->size, -1);
+  } else {
+    /* F_SEAL_WRITE fails with EBUSY while a writable mapping exists */
+    munmap(buf->data, buf->size);
+    buf->data = NULL;
+    ret = fcntl(buf->fd, F_ADD_SEALS, BULK_SEALS);
+    if (ret == 0)
+      ret = send_all(sock, &hdr, sizeof(hdr), buf->fd);
+  }
+
+  int saved = errno;
+  bulk_discard(buf); /* The receiver holds its own reference now */
+  errno = saved;
+  return ret;
+}
+
+/* ------------------------------------------------------------------ */
+/* Receiver                                                             */
+/* ------------------------------------------------------------------ */
+
+static int recv_all(int sock, void *p, size_t len) {
+  for (size_t got = 0; got < len;) {
+    ssize_t n = recv(sock, (char *)p + got, len - got, 0);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      if (n == 0)
+        errno = EPROTO;
+      return -1;
+    }
+    got += n;
+  }
+  return 0;
+}
+
+/* Read the header and pick up the fd that came with it; 0 on EOF */
+static int recv_hdr(int sock, struct bulk_hdr *hdr, int *fd) {
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } ctrl;
+  char *p = (char *)hdr;
+  size_t got = 0;
+
+  *fd = -1;
+  while (got < sizeof(*hdr)) {
+    struct iovec iov = {p + got, sizeof(*hdr) - got};
+    struct msghdr msg = {.msg_iov = &iov,
+                         .msg_iovlen = 1,
+                         .msg_control = ctrl.buf,
+                         .msg_controllen = sizeof(ctrl.buf)};
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == 0 && got == 0)
+      return 0; /* Clean end of stream */
+    if (n <= 0) {
+      if (n == 0)
+        errno = EPROTO; /* Peer vanished mid-header */
+      goto fail;
+    }
+
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm;
+         cm = CMSG_NXTHDR(&msg, cm)) {
+      if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+        int received;
+        memcpy(&received, CMSG_DATA(cm), sizeof(int));
+        if (*fd >= 0)
+          close(received); /* Only one fd per header */
+        else
+          *fd = received;
+      }
+    }
+    if (msg.msg_flags & MSG_CTRUNC) {
+      errno = EPROTO;
+      goto fail;
+    }
+    got += n;
+  }
+  return 1;
+
+fail:
+  if (*fd >= 0)
+    close(*fd);
+  *fd = -1;
+  return -1;
+}
+
+int bulk_recv(int sock, bulk_msg_t *msg) {
+  struct bulk_hdr hdr;
+  struct stat sb;
+  int seals, saved;
+
+  memset(msg, 0, sizeof(*msg));
+  msg->fd = -1;
+  int ret = recv_hdr(sock, &hdr, &msg->fd);
+  if (ret <= 0)
+    return ret;
+  if (hdr.magic != BULK_MAGIC) {
+    errno = EPROTO;
+    goto fail;
+  }
+  msg->size = hdr.size;
+  msg->tag = hdr.tag;
+  memcpy(msg->label, hdr.label, sizeof(msg->label));
+  msg->label[sizeof(msg->label) - 1] = '\0';
+
+  if (hdr.flags & BULK_F_INLINE) {
+    unsigned char *data = NULL;
+    if (msg->fd >= 0 || hdr.size >= BULK_INLINE_MAX) {
+      errno = EPROTO;
+      goto fail;
+    }
+    if (hdr.size > 0 && ((data = malloc(hdr.size)) == NULL ||
+                         recv_all(sock, data, hdr.size) == -1)) {
+      free(data);
+      goto fail;
+    }
+    msg->data = data;
+    return 1;
+  }
+
+  if (msg->fd < 0 || fstat(msg->fd, &sb) == -1 ||
+      (uint64_t)sb.st_size != hdr.size) {
+    errno = EPROTO;
+    goto fail;
+  }
+  /* Unsealed, the sender could still rewrite or truncate the pages */
+  seals = fcntl(msg->fd, F_GET_SEALS);
+  if (seals == -1 || (seals & BULK_SEALS) != BULK_SEALS) {
+    errno = EPERM;
+    goto fail;
+  }
+
+  if (msg->size > 0) {
+    /* The pages exist already: map them all now instead of fault by fault */
+    void *data = mmap(NULL, msg->size, PROT_READ, MAP_SHARED | MAP_POPULATE,
+                      msg->fd, 0);
+    if (data == MAP_FAILED)
+      goto fail;
+    msg->data = data;
+  }
+  return 1;
+
+fail:
+  saved = errno;
+  bulk_release(msg);
+  errno = saved;
+  return -1;
+}
+
+void bulk_release(bulk_msg_t *msg) {
+  if (msg->fd < 0)
+    free((void *)msg->data);
+  else if (msg->data)
+    munmap((void *)msg->data, msg->size);
+  if (msg->fd >= 0)
+    close(msg->fd);
+  msg->data = NULL;
+  msg->fd = -1;
+}
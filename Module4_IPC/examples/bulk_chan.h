@@ -0,0 +1,83 @@
+/*
+ * bulk_chan.h - Zero-copy bulk payloads: sealed memfds over a UNIX socket
+ *
+ * msgsnd(), write() on a FIFO and the shared_data_t slot of
+ * 02_shared_memory.c all copy the payload through the kernel and cap its
+ * size. Here the sender builds the payload in its own memfd, seals it, and
+ * sends the descriptor (SCM_RIGHTS) with a small header. The receiver maps
+ * the same pages read-only. Only the header and the fd cross the socket,
+ * whatever the payload size.
+ *
+ * Payloads smaller than BULK_INLINE_MAX are cheaper to copy than to set
+ * up a fresh memfd for (page allocation, mapping and freeing cost more
+ * than a couple of memcpy() passes), so they travel inline after the
+ * header. The API is the same either way.
+ *
+ * Seals are what make this safe. Once a memfd carries
+ * F_SEAL_WRITE | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL, nobody,
+ * including the sender, can change or truncate it. The receiver can read
+ * it without copying and never sees the data change or gets SIGBUS from a
+ * shrinking file. bulk_recv() rejects descriptors without those seals.
+ *
+ *   sender                                 receiver
+ *   bulk_alloc()   memfd + RW mapping
+ *   ...fill buf.data...
+ *   bulk_send()    unmap, seal, sendmsg -> bulk_recv()  recvmsg, check
+ *                                                       seals, mmap RO
+ *                                          ...read msg.data...
+ *                                          bulk_release()
+ */
+
+#ifndef BULK_CHAN_H
+#define BULK_CHAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BULK_LABEL_MAX 40
+#define BULK_INLINE_MAX (2u << 20) /* One huge page: below this, copy */
+
+/* Sender side: a payload being built */
+typedef struct {
+  unsigned char *data; /* Writable until bulk_send() */
+  size_t size;
+  int fd; /* -1 for an inline payload */
+} bulk_buf_t;
+
+/* Receiver side: a payload that arrived */
+typedef struct {
+  const unsigned char *data; /* Read-only view of the sender's memfd */
+  size_t size;
+  uint32_t tag; /* Application-defined, e.g. message type */
+  char label[BULK_LABEL_MAX];
+  int fd; /* -1 if the payload came inline (data is a private copy) */
+} bulk_msg_t;
+
+/* UNIX stream socket setup. Each returns an fd, or -1 with errno set */
+int bulk_listen(const char *path);
+int bulk_connect(const char *path);
+
+/* Allocate a payload buffer of `size` bytes (may be 0) */
+int bulk_alloc(bulk_buf_t *buf, size_t size);
+
+/*
+ * Seal buf and pass it over `sock` with a tag and an optional label.
+ * buf is consumed either way: its mapping and fd are gone afterwards.
+ * Returns 0 on success, -1 with errno set on failure.
+ */
+int bulk_send(int sock, bulk_buf_t *buf, uint32_t tag, const char *label);
+
+/* Free a buffer that will not be sent */
+void bulk_discard(bulk_buf_t *buf);
+
+/*
+ * Receive the next payload. Returns 1 on success, 0 when the peer closed
+ * the connection, -1 with errno set on failure (EPROTO for a malformed
+ * message, EPERM for a payload that is not fully sealed).
+ */
+int bulk_recv(int sock, bulk_msg_t *msg);
+
+/* Unmap a received payload; its pages are freed once nobody maps them */
+void bulk_release(bulk_msg_t *msg);
+
+#endif /* BULK_CHAN_H */
@@ -0,0 +1,136 @@
+/*
+ * chat_proto.h - The HOMEWORK4 chat message protocol on a byte stream
+ *
+ * message_t is the structure from HOMEWORK4_ChatSystem.md. Sending it as
+ * is would put ~330 bytes on the wire for "hi", mostly zero padding, so
+ * over a socket each message travels as a small header followed by only
+ * the bytes in use:
+ *
+ *   +-------+------+----------+--------+-----+-----------+-----------+
+ *   |  len  | type | from_len | to_len | pad | client_id | timestamp |
+ *   +-------+------+----------+--------+-----+-----------+-----------+
+ *     4 B     1 B     1 B        1 B     5 B    4 B         8 B
+ *   followed by from_user, to_user and text (no terminating NULs)
+ *
+ * len counts the whole frame, header included, and is at most
+ * CHAT_FRAME_MAX, so a receiver needs no more buffer than that per peer.
+ */
+
+#ifndef CHAT_PROTO_H
+#define CHAT_PROTO_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define MSG_MAX_SIZE 256
+#define USERNAME_MAX 32
+
+#define CHAT_SOCKET_PATH "/tmp/chat.sock"
+
+typedef enum {
+  MSG_JOIN,       /* Client joining */
+  MSG_LEAVE,      /* Client leaving */
+  MSG_BROADCAST,  /* Message to all */
+  MSG_PRIVATE,    /* Private message */
+  MSG_LIST_USERS, /* Request user list */
+  MSG_USER_LIST,  /* Response with users */
+  MSG_ERROR,      /* Error message */
+  MSG_PING,       /* Keep-alive */
+  MSG_PONG        /* Keep-alive response */
+} message_type_t;
+
+typedef struct {
+  message_type_t type;
+  char from_user[USERNAME_MAX];
+  char to_user[USERNAME_MAX];
+  char text[MSG_MAX_SIZE];
+  time_t timestamp;
+  int client_id;
+} message_t;
+
+typedef struct {
+  uint32_t len;
+  uint8_t type;
+  uint8_t from_len;
+  uint8_t to_len;
+  uint8_t pad[5];
+  uint32_t client_id;
+  int64_t timestamp;
+} chat_wire_t;
+
+_Static_assert(sizeof(chat_wire_t) == 24, "wire header size");
+
+#define CHAT_FRAME_MAX                                                         \
+  (sizeof(chat_wire_t) + 2 * (USERNAME_MAX - 1) + MSG_MAX_SIZE - 1)
+
+/* Fill in the strings and type of a message; the rest is zeroed */
+static inline void chat_msg(message_t *m, message_type_t type,
+                            const char *from, const char *to,
+                            const char *text) {
+  m->type = type;
+  m->timestamp = time(NULL);
+  m->client_id = 0;
+  strncpy(m->from_user, from ? from : "", USERNAME_MAX - 1);
+  m->from_user[USERNAME_MAX - 1] = '\0';
+  strncpy(m->to_user, to ? to : "", USERNAME_MAX - 1);
+  m->to_user[USERNAME_MAX - 1] = '\0';
+  strncpy(m->text, text ? text : "", MSG_MAX_SIZE - 1);
+  m->text[MSG_MAX_SIZE - 1] = '\0';
+}
+
+/* Write m as a frame into buf (CHAT_FRAME_MAX bytes); returns its length */
+static inline size_t chat_encode(const message_t *m, void *buf) {
+  chat_wire_t w = {0};
+  size_t from = strnlen(m->from_user, USERNAME_MAX - 1);
+  size_t to = strnlen(m->to_user, USERNAME_MAX - 1);
+  size_t text = strnlen(m->text, MSG_MAX_SIZE - 1);
+  unsigned char *p = (unsigned char *)buf + sizeof(w);
+
+  w.len = sizeof(w) + from + to + text;
+  w.type = m->type;
+  w.from_len = from;
+  w.to_len = to;
+  w.client_id = m->client_id;
+  w.timestamp = m->timestamp;
+  memcpy(buf, &w, sizeof(w));
+  memcpy(p, m->from_user, from);
+  memcpy(p + from, m->to_user, to);
+  memcpy(p + from + to, m->text, text);
+  return w.len;
+}
+
+/*
+ * Decode the frame at the start of buf (avail bytes). Returns the frame
+ * length, 0 if the frame is not complete yet, or -1 if it is malformed.
+ */
+static inline ssize_t chat_decode(const void *buf, size_t avail,
+                                  message_t *m) {
+  chat_wire_t w;
+  if (avail < sizeof(w))
+    return 0;
+  memcpy(&w, buf, sizeof(w));
+
+  size_t text = w.len - sizeof(w) - w.from_len - w.to_len;
+  if (w.len < sizeof(w) || w.len > CHAT_FRAME_MAX ||
+      w.from_len >= USERNAME_MAX || w.to_len >= USERNAME_MAX ||
+      w.len < sizeof(w) + w.from_len + w.to_len || text >= MSG_MAX_SIZE)
+    return -1;
+  if (avail < w.len)
+    return 0;
+
+  const unsigned char *p = (const unsigned char *)buf + sizeof(w);
+  m->type = (message_type_t)w.type;
+  m->client_id = w.client_id;
+  m->timestamp = w.timestamp;
+  memcpy(m->from_user, p, w.from_len);
+  m->from_user[w.from_len] = '\0';
+  memcpy(m->to_user, p + w.from_len, w.to_len);
+  m->to_user[w.to_len] = '\0';
+  memcpy(m->text, p + w.from_len + w.to_len, text);
+  m->text[text] = '\0';
+  return w.len;
+}
+
+#endif /* CHAT_PROTO_H */
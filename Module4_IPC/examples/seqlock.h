@@ -0,0 +1,97 @@
+/*
+ * seqlock.h - Single-writer sequence lock for shared memory
+ *
+ * The writer makes the sequence odd, updates the data, and makes it even
+ * again. A reader copies the data between two reads of the sequence and
+ * retries if the sequence was odd or changed. Readers never store to
+ * shared memory, so any number of them can poll without slowing the writer
+ * or each other down (no cache-line ping-pong, no syscalls).
+ *
+ * Only ONE writer per seqlock: concurrent writers must serialize
+ * themselves (or use one seqlock each).
+ */
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct {
+  _Atomic uint32_t seq; /* Odd while an update is in progress */
+} seqlock_t;
+
+static inline void seqlock_init(seqlock_t *sl) { atomic_init(&sl->seq, 0); }
+
+static inline void seqlock_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+static inline void seqlock_write_begin(seqlock_t *sl) {
+  uint32_t s = atomic_load_explicit(&sl->seq, memory_order_relaxed);
+  atomic_store_explicit(&sl->seq, s + 1, memory_order_relaxed);
+  /* The odd sequence must be visible before any data store */
+  atomic_thread_fence(memory_order_release);
+}
+
+static inline void seqlock_write_end(seqlock_t *sl) {
+  uint32_t s = atomic_load_explicit(&sl->seq, memory_order_relaxed);
+  /* Release: all data stores are visible before the even sequence */
+  atomic_store_explicit(&sl->seq, s + 1, memory_order_release);
+}
+
+/*
+ * Returns the sequence to pass to seqlock_read_retry(), waiting out an
+ * update in progress. If the writer was preempted mid-update, spinning
+ * would only burn its timeslice, so yield after a short spin.
+ */
+static inline uint32_t seqlock_read_begin(const seqlock_t *sl) {
+  uint32_t s;
+  for (unsigned spins = 0;; spins++) {
+    s = atomic_load_explicit((_Atomic uint32_t *)&sl->seq,
+                             memory_order_acquire);
+    if (!(s & 1))
+      return s;
+    if (spins < 64)
+      seqlock_cpu_relax();
+    else
+      sched_yield();
+  }
+}
+
+/* Non-zero if the data read since seqlock_read_begin() may be torn */
+static inline int seqlock_read_retry(const seqlock_t *sl, uint32_t start) {
+  /* Data loads must complete before the sequence is checked again */
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit((_Atomic uint32_t *)&sl->seq,
+                              memory_order_relaxed) != start;
+}
+
+/* Publish `len` bytes from src into the protected area dst */
+static inline void seqlock_publish(seqlock_t *sl, void *dst, const void *src,
+                                   size_t len) {
+  seqlock_write_begin(sl);
+  memcpy(dst, src, len);
+  seqlock_write_end(sl);
+}
+
+/* Copy a consistent snapshot out of src; returns the number of retries */
+static inline unsigned seqlock_snapshot(const seqlock_t *sl, void *dst,
+                                        const void *src, size_t len) {
+  unsigned retries = 0;
+  uint32_t start;
+  do {
+    start = seqlock_read_begin(sl);
+    memcpy(dst, src, len);
+  } while (seqlock_read_retry(sl, start) && ++retries);
+  return retries;
+}
+
+#endif /* SEQLOCK_H */
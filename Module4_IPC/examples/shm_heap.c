@@ -0,0 +1,678 @@
+/*
+ * shm_heap.c - malloc/free for variable-size objects in a shared segment
+ *
+ * See shm_heap.h for the API and segment layout.
+ *
+ * Free blocks of a class are kept in batches of up to BATCH blocks chained
+ * through their second word. The batches form a Treiber stack through
+ * their first word, whose head carries a 24-bit tag next to the 40-bit
+ * offset so a stale CAS cannot succeed (ABA). Moving a whole batch costs
+ * one CAS, so a handle touches the shared list once per BATCH operations:
+ *
+ *   alloc: cache empty? pop a batch, keep the blocks in the cache
+ *   free:  cache full?  chain BATCH blocks, push them as one batch
+ *
+ * Crash safety comes from the order of the stores. A block is in a cache
+ * only once it is counted, and leaves it when the count drops, before it
+ * is pushed anywhere else: a crash in between leaks it, never lists it
+ * twice. Chunk states are written tails first and head last, and freed
+ * head first, so a half-done change leaves only orphan tails, which the
+ * next owner of the robust mutex returns to the free pool.
+ */
+
+#define _GNU_SOURCE
+
+#include "shm_heap.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SHM_HEAP_MAGIC 0x48454150u /* "HEAP" */
+#define CACHELINE 64
+#define PAGE 4096
+#define NCLASSES 36
+#define CACHE_MAX 32 /* Blocks a handle keeps per class */
+#define BATCH 16     /* Blocks moved to or from a class list at once */
+#define MAX_SLOTS 64
+
+#define OFF_BITS 40 /* Offsets up to 1 TiB; the rest of a head is a tag */
+#define OFF_MASK ((UINT64_C(1) << OFF_BITS) - 1)
+
+#define CHUNK_FREE 0u
+#define CHUNK_LARGE 0x80000000u /* | number of chunks, on the first */
+#define CHUNK_TAIL 0x40000000u  /* Rest of a large allocation */
+
+#define SLOT_RECOVERING (-1)
+
+struct class_list {
+  _Alignas(CACHELINE) _Atomic uint64_t head; /* tag << OFF_BITS | batch */
+};
+
+struct cache {
+  _Atomic uint32_t count;
+  shm_off_t blocks[CACHE_MAX];
+};
+
+struct slot {
+  _Alignas(CACHELINE) _Atomic int32_t pid; /* 0 free, or the owner */
+  struct cache cache[NCLASSES];
+};
+
+struct shm_heap_hdr {
+  uint32_t magic;
+  uint32_t nchunks;
+  uint64_t map_size;
+  uint64_t table_off; /* Chunk table: one state word per chunk */
+  uint64_t arena_off; /* First chunk */
+  _Atomic uint64_t root;
+  _Atomic unsigned long recovered;
+  pthread_mutex_t chunk_lock; /* Robust; guards the chunk table */
+  uint32_t chunk_hint;        /* Where the next first-fit scan starts */
+  struct class_list lists[NCLASSES];
+  struct slot slots[MAX_SLOTS];
+};
+
+/* The two words of a free block */
+struct free_block {
+  _Atomic uint64_t next_batch; /* Batch heads: the next batch on the list */
+  shm_off_t next;              /* Next block in this batch */
+};
+
+static unsigned fork_gen;
+static pthread_once_t fork_once = PTHREAD_ONCE_INIT;
+
+static void on_fork_child(void) { fork_gen++; }
+
+static void register_fork(void) {
+  pthread_atfork(NULL, NULL, on_fork_child);
+}
+
+/* ------------------------------------------------------------------ */
+/* Size classes: 16..128 in steps of 16, then four per power of two      */
+/* ------------------------------------------------------------------ */
+
+static size_t class_size(int c) {
+  if (c < 8)
+    return 16 * (size_t)(c + 1);
+  int k = 7 + (c - 8) / 4; /* (2^k, 2^(k+1)] */
+  return ((size_t)1 << k) + (size_t)((c - 8) % 4 + 1) * ((size_t)1 << (k - 2));
+}
+
+static int size_class(size_t size) {
+  if (size <= 128)
+    return size ? (int)((size + 15) / 16) - 1 : 0;
+  int k = 63 - __builtin_clzll(size - 1); /* 2^k < size <= 2^(k+1) */
+  size_t step = (size_t)1 << (k - 2);
+  return 8 + (k - 7) * 4 + (int)((size - ((size_t)1 << k) + step - 1) / step) -
+         1;
+}
+
+_Static_assert(NCLASSES == 8 + 4 * 7, "classes up to 16 KiB");
+_Static_assert(BATCH <= CACHE_MAX, "a refill must fit in the cache");
+
+/* ------------------------------------------------------------------ */
+/* Helpers                                                              */
+/* ------------------------------------------------------------------ */
+
+static inline struct free_block *fb(const shm_heap_t *h, shm_off_t off) {
+  return (struct free_block *)(h->base + off);
+}
+
+static inline _Atomic uint32_t *chunk_table(const shm_heap_t *h) {
+  return (_Atomic uint32_t *)(h->base + h->hdr->table_off);
+}
+
+static inline shm_off_t chunk_off(const shm_heap_t *h, uint32_t i) {
+  return h->hdr->arena_off + (shm_off_t)i * SHM_HEAP_CHUNK;
+}
+
+/* Chunk index of an offset, or -1 if it is outside the arena */
+static inline long chunk_of(const shm_heap_t *h, shm_off_t off) {
+  if (off < h->hdr->arena_off)
+    return -1;
+  uint64_t i = (off - h->hdr->arena_off) / SHM_HEAP_CHUNK;
+  return i < h->hdr->nchunks ? (long)i : -1;
+}
+
+static void list_push(shm_heap_t *h, int c, shm_off_t batch) {
+  _Atomic uint64_t *head = &h->hdr->lists[c].head;
+  uint64_t old = atomic_load_explicit(head, memory_order_relaxed), new;
+  do {
+    atomic_store_explicit(&fb(h, batch)->next_batch, old & OFF_MASK,
+                          memory_order_relaxed);
+    new = ((old >> OFF_BITS) + 1) << OFF_BITS | batch;
+  } while (!atomic_compare_exchange_weak_explicit(
+      head, &old, new, memory_order_release, memory_order_relaxed));
+}
+
+static shm_off_t list_pop(shm_heap_t *h, int c) {
+  _Atomic uint64_t *head = &h->hdr->lists[c].head;
+  uint64_t old = atomic_load_explicit(head, memory_order_acquire), new;
+  shm_off_t batch;
+  do {
+    batch = old & OFF_MASK;
+    if (!batch)
+      return 0;
+    /* batch may be popped and reused meanwhile: then the tag differs */
+    uint64_t next =
+        atomic_load_explicit(&fb(h, batch)->next_batch, memory_order_relaxed);
+    new = ((old >> OFF_BITS) + 1) << OFF_BITS | next;
+  } while (!atomic_compare_exchange_weak_explicit(
+      head, &old, new, memory_order_acquire, memory_order_acquire));
+  return batch;
+}
+
+/* Chain n blocks into one batch and push it */
+static void push_blocks(shm_heap_t *h, int c, const shm_off_t *blocks,
+                        unsigned n) {
+  for (unsigned i = 0; i < n; i++)
+    fb(h, blocks[i])->next = i + 1 < n ? blocks[i + 1] : 0;
+  list_push(h, c, blocks[0]);
+}
+
+/* ------------------------------------------------------------------ */
+/* Chunk table (under the robust mutex)                                 */
+/* ------------------------------------------------------------------ */
+
+/* The previous owner died holding the lock: drop its half-made changes */
+static void repair_chunks(shm_heap_t *h) {
+  _Atomic uint32_t *st = chunk_table(h);
+  for (uint32_t i = 0; i < h->hdr->nchunks;) {
+    uint32_t s = atomic_load_explicit(&st[i], memory_order_relaxed);
+    if (s & CHUNK_LARGE) {
+      i += s & ~CHUNK_LARGE;
+    } else {
+      if (s == CHUNK_TAIL)
+        atomic_store_explicit(&st[i], CHUNK_FREE, memory_order_relaxed);
+      i++;
+    }
+  }
+}
+
+static void lock_chunks(shm_heap_t *h) {
+  if (pthread_mutex_lock(&h->hdr->chunk_lock) == EOWNERDEAD) {
+    repair_chunks(h);
+    pthread_mutex_consistent(&h->hdr->chunk_lock);
+  }
+}
+
+static void unlock_chunks(shm_heap_t *h) {
+  pthread_mutex_unlock(&h->hdr->chunk_lock);
+}
+
+/* First fit for n free chunks; returns the index or -1 */
+static long find_chunks(shm_heap_t *h, uint32_t n) {
+  _Atomic uint32_t *st = chunk_table(h);
+  uint32_t total = h->hdr->nchunks;
+
+  for (int pass = 0; pass < 2; pass++) {
+    uint32_t start = pass == 0 ? h->hdr->chunk_hint : 0;
+    uint32_t run = 0;
+    for (uint32_t i = start; i < total; i++) {
+      run = atomic_load_explicit(&st[i], memory_order_relaxed) == CHUNK_FREE
+                ? run + 1
+                : 0;
+      if (run == n)
+        return i + 1 - n;
+    }
+  }
+  return -1;
+}
+
+static shm_off_t alloc_large(shm_heap_t *h, size_t size) {
+  uint64_t n = (size + SHM_HEAP_CHUNK - 1) / SHM_HEAP_CHUNK;
+  _Atomic uint32_t *st = chunk_table(h);
+
+  lock_chunks(h);
+  long i = n < CHUNK_TAIL ? find_chunks(h, n) : -1;
+  if (i < 0) {
+    unlock_chunks(h);
+    errno = ENOMEM;
+    return 0;
+  }
+  for (uint64_t k = 1; k < n; k++)
+    atomic_store_explicit(&st[i + k], CHUNK_TAIL, memory_order_relaxed);
+  atomic_store_explicit(&st[i], CHUNK_LARGE | (uint32_t)n,
+                        memory_order_release);
+  h->hdr->chunk_hint = i + n;
+  unlock_chunks(h);
+  return chunk_off(h, i);
+}
+
+static void free_large(shm_heap_t *h, long i) {
+  _Atomic uint32_t *st = chunk_table(h);
+
+  lock_chunks(h);
+  uint32_t s = atomic_load_explicit(&st[i], memory_order_relaxed);
+  if (s & CHUNK_LARGE) {
+    atomic_store_explicit(&st[i], CHUNK_FREE, memory_order_relaxed);
+    for (uint32_t k = 1; k < (s & ~CHUNK_LARGE); k++)
+      atomic_store_explicit(&st[i + k], CHUNK_FREE, memory_order_relaxed);
+    if ((uint32_t)i < h->hdr->chunk_hint)
+      h->hdr->chunk_hint = i;
+  }
+  unlock_chunks(h);
+}
+
+/*
+ * Give class c a fresh chunk. All its blocks but the first batch go on
+ * the class list; the first batch is returned.
+ */
+static shm_off_t carve(shm_heap_t *h, int c) {
+  lock_chunks(h);
+  long i = find_chunks(h, 1);
+  if (i >= 0) {
+    atomic_store_explicit(&chunk_table(h)[i], 1 + (uint32_t)c,
+                          memory_order_release);
+    h->hdr->chunk_hint = i + 1;
+  }
+  unlock_chunks(h);
+  if (i < 0) {
+    errno = ENOMEM;
+    return 0;
+  }
+
+  size_t size = class_size(c);
+  unsigned nblocks = SHM_HEAP_CHUNK / size;
+  shm_off_t base = chunk_off(h, i), first = 0;
+  shm_off_t batch[BATCH];
+  unsigned n = 0;
+
+  for (unsigned b = 0; b < nblocks; b++) {
+    batch[n++] = base + (shm_off_t)b * size;
+    if (n == BATCH || b + 1 == nblocks) {
+      if (!first) {
+        for (unsigned k = 0; k < n; k++)
+          fb(h, batch[k])->next = k + 1 < n ? batch[k + 1] : 0;
+        first = batch[0];
+      } else {
+        push_blocks(h, c, batch, n);
+      }
+      n = 0;
+    }
+  }
+  return first;
+}
+
+/* ------------------------------------------------------------------ */
+/* Per-handle caches                                                    */
+/* ------------------------------------------------------------------ */
+
+static void drain_cache(shm_heap_t *h, struct cache *cache, int c) {
+  uint32_t n = atomic_load_explicit(&cache->count, memory_order_acquire);
+  shm_off_t blocks[CACHE_MAX];
+
+  while (n > 0) {
+    uint32_t take = n < BATCH ? n : BATCH;
+    memcpy(blocks, &cache->blocks[n - take], take * sizeof(shm_off_t));
+    n -= take;
+    /* Out of the cache before it is on the list: a crash here leaks */
+    atomic_store_explicit(&cache->count, n, memory_order_release);
+    push_blocks(h, c, blocks, take);
+  }
+}
+
+/* Claim a slot for this handle; -1 (uncached operation) if none is free */
+static int attach(shm_heap_t *h) {
+  pthread_once(&fork_once, register_fork);
+  h->fork_gen = fork_gen;
+  h->slot = -1;
+
+  for (int tries = 0; tries < 2; tries++) {
+    for (int i = 0; i < MAX_SLOTS; i++) {
+      int32_t expected = 0;
+      if (atomic_compare_exchange_strong(&h->hdr->slots[i].pid, &expected,
+                                         getpid())) {
+        h->slot = i;
+        return i;
+      }
+    }
+    if (shm_heap_recover(h) == 0)
+      break;
+  }
+  return -1;
+}
+
+/* This handle's slot; a child after fork() must not use its parent's */
+static inline struct slot *my_slot(shm_heap_t *h) {
+  if (__builtin_expect(h->slot < 0 || h->fork_gen != fork_gen, 0) &&
+      attach(h) < 0)
+    return NULL;
+  return &h->hdr->slots[h->slot];
+}
+
+int shm_heap_recover(shm_heap_t *h) {
+  int reclaimed = 0;
+
+  for (int i = 0; i < MAX_SLOTS; i++) {
+    struct slot *s = &h->hdr->slots[i];
+    int32_t pid = atomic_load(&s->pid);
+    if (pid <= 0 || pid == getpid() || kill(pid, 0) == 0 || errno != ESRCH)
+      continue;
+    /* Only one recoverer gets to empty it */
+    if (!atomic_compare_exchange_strong(&s->pid, &pid, SLOT_RECOVERING))
+      continue;
+    for (int c = 0; c < NCLASSES; c++)
+      drain_cache(h, &s->cache[c], c);
+    atomic_store(&s->pid, 0);
+    atomic_fetch_add(&h->hdr->recovered, 1);
+    reclaimed++;
+  }
+  return reclaimed;
+}
+
+/* ------------------------------------------------------------------ */
+/* Allocation                                                           */
+/* ------------------------------------------------------------------ */
+
+shm_off_t shm_heap_alloc(shm_heap_t *h, size_t size) {
+  if (size > SHM_HEAP_SMALL_MAX)
+    return alloc_large(h, size);
+
+  int c = size_class(size);
+  struct slot *s = my_slot(h);
+
+  if (s) {
+    struct cache *cache = &s->cache[c];
+    uint32_t n = atomic_load_explicit(&cache->count, memory_order_relaxed);
+    if (n > 0) {
+      shm_off_t off = cache->blocks[n - 1];
+      atomic_store_explicit(&cache->count, n - 1, memory_order_release);
+      return off;
+    }
+  }
+
+  shm_off_t batch = list_pop(h, c);
+  if (!batch && !(batch = carve(h, c)))
+    return 0;
+
+  /* Keep the first block, cache the rest of the batch */
+  shm_off_t rest = fb(h, batch)->next;
+  if (!s) {
+    if (rest)
+      list_push(h, c, rest);
+    return batch;
+  }
+  struct cache *cache = &s->cache[c];
+  uint32_t n = 0;
+  for (; rest; rest = fb(h, rest)->next) {
+    cache->blocks[n++] = rest;
+    atomic_store_explicit(&cache->count, n, memory_order_release);
+  }
+  return batch;
+}
+
+void shm_heap_free(shm_heap_t *h, shm_off_t off) {
+  long i = off ? chunk_of(h, off) : -1;
+  if (i < 0)
+    return;
+  uint32_t st = atomic_load_explicit(&chunk_table(h)[i], memory_order_acquire);
+  if (st & CHUNK_LARGE) {
+    if (off == chunk_off(h, i))
+      free_large(h, i);
+    return;
+  }
+  if (st == CHUNK_FREE || st > NCLASSES)
+    return; /* Not an allocated block */
+
+  int c = st - 1;
+  struct slot *s = my_slot(h);
+  if (!s) {
+    push_blocks(h, c, &off, 1);
+    return;
+  }
+  struct cache *cache = &s->cache[c];
+  uint32_t n = atomic_load_explicit(&cache->count, memory_order_relaxed);
+  if (n == CACHE_MAX) {
+    /* Hand a batch back; entries are never moved, only uncounted */
+    shm_off_t blocks[BATCH];
+    n -= BATCH;
+    memcpy(blocks, &cache->blocks[n], sizeof(blocks));
+    atomic_store_explicit(&cache->count, n, memory_order_release);
+    push_blocks(h, c, blocks, BATCH);
+  }
+  cache->blocks[n] = off;
+  atomic_store_explicit(&cache->count, n + 1, memory_order_release);
+}
+
+size_t shm_heap_usable(const shm_heap_t *h, shm_off_t off) {
+  long i = off ? chunk_of(h, off) : -1;
+  if (i < 0)
+    return 0;
+  uint32_t st = atomic_load_explicit(&chunk_table(h)[i], memory_order_acquire);
+  if (st & CHUNK_LARGE)
+    return (size_t)(st & ~CHUNK_LARGE) * SHM_HEAP_CHUNK;
+  return st >= 1 && st <= NCLASSES ? class_size(st - 1) : 0;
+}
+
+int shm_heap_set_root(shm_heap_t *h, shm_off_t expected, shm_off_t root) {
+  if (!atomic_compare_exchange_strong(&h->hdr->root, &expected, root)) {
+    errno = EEXIST;
+    return -1;
+  }
+  return 0;
+}
+
+shm_off_t shm_heap_root(const shm_heap_t *h) {
+  return atomic_load(&h->hdr->root);
+}
+
+/* ------------------------------------------------------------------ */
+/* Segment                                                              */
+/* ------------------------------------------------------------------ */
+
+static size_t meta_bytes(uint32_t nchunks) {
+  size_t n = sizeof(struct shm_heap_hdr) + (size_t)nchunks * sizeof(uint32_t);
+  return (n + PAGE - 1) & ~(size_t)(PAGE - 1);
+}
+
+static int map_heap(shm_heap_t *h, int fd, size_t map_size) {
+  void *base =
+      mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED)
+    return -1;
+
+  memset(h, 0, sizeof(*h));
+  h->hdr = base;
+  h->base = base;
+  h->map_size = map_size;
+  h->fd = fd;
+  h->slot = -1;
+  return 0;
+}
+
+int shm_heap_create(shm_heap_t *h, const char *name, size_t size) {
+  uint64_t nchunks = size / SHM_HEAP_CHUNK;
+  if (nchunks == 0)
+    nchunks = 1;
+  size_t meta = meta_bytes(nchunks);
+  size_t total = meta + nchunks * SHM_HEAP_CHUNK;
+  if (nchunks >= CHUNK_TAIL || total > OFF_MASK) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  int fd = shm_open(name, O_CREAT | O_RDWR, 0666);
+  if (fd == -1)
+    return -1;
+  if (ftruncate(fd, 0) == -1 || ftruncate(fd, total) == -1 ||
+      map_heap(h, fd, total) == -1) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+
+  /* The fresh file reads as zeros: every list, slot and chunk is empty */
+  struct shm_heap_hdr *hdr = h->hdr;
+  hdr->nchunks = nchunks;
+  hdr->map_size = total;
+  hdr->table_off = sizeof(struct shm_heap_hdr);
+  hdr->arena_off = meta;
+
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&hdr->chunk_lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+
+  atomic_thread_fence(memory_order_release);
+  hdr->magic = SHM_HEAP_MAGIC;
+  return 0;
+}
+
+int shm_heap_open(shm_heap_t *h, const char *name) {
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd == -1)
+    return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct shm_heap_hdr) ||
+      map_heap(h, fd, st.st_size) == -1) {
+    int saved = errno ? errno : EINVAL;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+
+  struct shm_heap_hdr *hdr = h->hdr;
+  if (hdr->magic != SHM_HEAP_MAGIC || hdr->map_size != (size_t)st.st_size ||
+      hdr->arena_off != meta_bytes(hdr->nchunks)) {
+    shm_heap_close(h);
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+void shm_heap_close(shm_heap_t *h) {
+  if (h->hdr && h->slot >= 0 && h->fork_gen == fork_gen) {
+    struct slot *s = &h->hdr->slots[h->slot];
+    for (int c = 0; c < NCLASSES; c++)
+      drain_cache(h, &s->cache[c], c);
+    atomic_store(&s->pid, 0);
+  }
+  if (h->hdr)
+    munmap(h->hdr, h->map_size);
+  if (h->fd != -1)
+    close(h->fd);
+  h->hdr = NULL;
+  h->base = NULL;
+  h->fd = -1;
+  h->slot = -1;
+}
+
+int shm_heap_unlink(const char *name) { return shm_unlink(name); }
+
+/* ------------------------------------------------------------------ */
+/* Inspection                                                           */
+/* ------------------------------------------------------------------ */
+
+void shm_heap_stats(const shm_heap_t *h, shm_heap_stats_t *st) {
+  const struct shm_heap_hdr *hdr = h->hdr;
+  _Atomic uint32_t *table = chunk_table(h);
+
+  memset(st, 0, sizeof(*st));
+  st->chunks = hdr->nchunks;
+  for (uint32_t i = 0; i < hdr->nchunks; i++) {
+    uint32_t s = atomic_load_explicit(&table[i], memory_order_relaxed);
+    if (s == CHUNK_FREE)
+      st->free_chunks++;
+    else if (s & (CHUNK_LARGE | CHUNK_TAIL))
+      st->large_chunks++;
+    else
+      st->class_chunks++;
+  }
+  st->free_bytes = st->free_chunks * SHM_HEAP_CHUNK;
+
+  /* Lists may change under us: never walk more blocks than exist */
+  size_t limit = (size_t)hdr->nchunks * (SHM_HEAP_CHUNK / 16);
+  for (int c = 0; c < NCLASSES; c++) {
+    shm_off_t b = atomic_load(&h->hdr->lists[c].head) & OFF_MASK;
+    for (size_t seen = 0; b && seen < limit; seen++) {
+      for (shm_off_t x = b; x && st->free_blocks < limit;
+           x = fb(h, x)->next) {
+        st->free_blocks++;
+        st->free_bytes += class_size(c);
+      }
+      b = atomic_load_explicit(&fb(h, b)->next_batch, memory_order_relaxed);
+    }
+  }
+  for (int i = 0; i < MAX_SLOTS; i++) {
+    const struct slot *s = &hdr->slots[i];
+    if (atomic_load(&s->pid) == 0)
+      continue;
+    st->live_slots++;
+    for (int c = 0; c < NCLASSES; c++) {
+      uint32_t n = atomic_load(&s->cache[c].count);
+      st->free_blocks += n;
+      st->free_bytes += n * class_size(c);
+    }
+  }
+  st->recovered = atomic_load(&hdr->recovered);
+}
+
+/* Mark one free block of class c as seen; 0 if it is fine */
+static int check_block(const shm_heap_t *h, int c, shm_off_t off,
+                       unsigned char *seen) {
+  long i = chunk_of(h, off);
+  if (i < 0 ||
+      atomic_load_explicit(&chunk_table(h)[i], memory_order_relaxed) !=
+          1 + (uint32_t)c)
+    return -1;
+  size_t size = class_size(c), in_chunk = off - chunk_off(h, i);
+  if (in_chunk % size != 0 || in_chunk + size > SHM_HEAP_CHUNK)
+    return -1;
+  uint64_t bit = (off - h->hdr->arena_off) / 16;
+  if (seen[bit / 8] & (1u << (bit % 8)))
+    return -1; /* Listed twice */
+  seen[bit / 8] |= 1u << (bit % 8);
+  return 0;
+}
+
+long shm_heap_check(const shm_heap_t *h) {
+  const struct shm_heap_hdr *hdr = h->hdr;
+  size_t bits = (size_t)hdr->nchunks * (SHM_HEAP_CHUNK / 16);
+  unsigned char *seen = calloc(bits / 8 + 1, 1);
+  long count = 0;
+  int bad = 0;
+
+  if (!seen)
+    return -1;
+  for (int c = 0; c < NCLASSES && !bad; c++) {
+    shm_off_t b = atomic_load(&h->hdr->lists[c].head) & OFF_MASK;
+    while (b && !bad) {
+      for (shm_off_t x = b; x; x = fb(h, x)->next, count++) {
+        if ((bad = check_block(h, c, x, seen)) != 0)
+          break;
+      }
+      if (!bad)
+        b = atomic_load_explicit(&fb(h, b)->next_batch, memory_order_relaxed);
+    }
+  }
+  for (int i = 0; i < MAX_SLOTS && !bad; i++) {
+    const struct slot *s = &hdr->slots[i];
+    if (atomic_load(&s->pid) == 0)
+      continue;
+    for (int c = 0; c < NCLASSES && !bad; c++) {
+      uint32_t n = atomic_load(&s->cache[c].count);
+      for (uint32_t k = 0; k < n && k < CACHE_MAX && !bad; k++, count++)
+        bad = check_block(h, c, s->cache[c].blocks[k], seen);
+    }
+  }
+  free(seen);
+  if (bad) {
+    errno = EUCLEAN;
+    return -1;
+  }
+  return count;
+}
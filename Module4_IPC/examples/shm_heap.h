@@ -0,0 +1,122 @@
+/*
+ * shm_heap.h - malloc/free for variable-size objects in a shared segment
+ *
+ * 02_shared_memory.c puts one fixed struct at offset 0; anything whose size
+ * is not known up front needs another segment. A heap is one large segment
+ * that many processes allocate from and free into, so they can build
+ * lists, trees and hash tables together.
+ *
+ * Every process may map the segment at a different address, so shared
+ * structures must not contain pointers. They link with shm_off_t offsets
+ * from the start of the segment instead (0 is the null offset), turned
+ * into pointers with shm_heap_ptr() in each process.
+ *
+ *   [ header, class lists, process slots ][ chunk table ][ chunks ... ]
+ *
+ * The arena is cut into 64 KiB chunks. A chunk either holds blocks of
+ * one size class (16 bytes up to 16 KiB, four classes per power of two)
+ * or is part of one large allocation. Free blocks of each class sit on a
+ * lock-free list in batches. Each handle also keeps a cache of free
+ * blocks per class, in its own slot in the segment, so most calls to
+ * shm_heap_alloc()/shm_heap_free() touch no shared cache line at all.
+ *
+ * Crashes: the class lists change only by single CAS operations, and the
+ * chunk table is guarded by a robust mutex and repaired by the next
+ * process to take it, so a process dying at any point cannot corrupt
+ * them. What it held is not lost forever either: shm_heap_recover() puts
+ * the caches of dead processes back. The blocks it had allocated, and at
+ * most one batch it was moving, stay leaked.
+ */
+
+#ifndef SHM_HEAP_H
+#define SHM_HEAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint64_t shm_off_t; /* Offset from the segment start, 0 = null */
+
+#define SHM_HEAP_CHUNK (64 * 1024)
+#define SHM_HEAP_SMALL_MAX (16 * 1024) /* Larger requests take whole chunks */
+
+struct shm_heap_hdr; /* Lives in shared memory, see shm_heap.c */
+
+/* Per-process (per-thread, if threads allocate) handle onto a heap */
+typedef struct {
+  struct shm_heap_hdr *hdr;
+  unsigned char *base;
+  size_t map_size;
+  int fd;
+  int slot; /* This handle's cache slot, -1 before the first allocation */
+  unsigned fork_gen;
+} shm_heap_t;
+
+typedef struct {
+  size_t chunks, free_chunks, class_chunks, large_chunks;
+  size_t free_blocks;     /* Blocks on the class lists and in caches */
+  size_t free_bytes;      /* Their total size, plus the free chunks */
+  unsigned live_slots;    /* Attached handles */
+  unsigned long recovered; /* Slots reclaimed from dead processes */
+} shm_heap_stats_t;
+
+/*
+ * Create (or truncate) heap `name` of about `size` bytes.
+ * Returns 0 on success, -1 with errno set on failure.
+ */
+int shm_heap_create(shm_heap_t *h, const char *name, size_t size);
+
+/* Map an existing heap, wherever the kernel likes */
+int shm_heap_open(shm_heap_t *h, const char *name);
+
+/* Return this handle's cached blocks and unmap */
+void shm_heap_close(shm_heap_t *h);
+
+int shm_heap_unlink(const char *name);
+
+/*
+ * Allocate `size` bytes, 16-byte aligned. Returns the offset of the new
+ * block, or 0 with errno = ENOMEM.
+ */
+shm_off_t shm_heap_alloc(shm_heap_t *h, size_t size);
+
+/* Free a block from any process; 0 is ignored */
+void shm_heap_free(shm_heap_t *h, shm_off_t off);
+
+/* Usable size of an allocated block */
+size_t shm_heap_usable(const shm_heap_t *h, shm_off_t off);
+
+static inline void *shm_heap_ptr(const shm_heap_t *h, shm_off_t off) {
+  return off ? h->base + off : NULL;
+}
+
+static inline shm_off_t shm_heap_off(const shm_heap_t *h, const void *p) {
+  return p ? (shm_off_t)((const unsigned char *)p - h->base) : 0;
+}
+
+/*
+ * One well-known offset per heap, so that a process that just opened it
+ * can find the shared structures (a hash table's bucket array, ...).
+ * set_root succeeds only if the root is still `expected`; returns 0 or
+ * -1/EEXIST.
+ */
+int shm_heap_set_root(shm_heap_t *h, shm_off_t expected, shm_off_t root);
+shm_off_t shm_heap_root(const shm_heap_t *h);
+
+/*
+ * Give the cached blocks of every process that died while attached back
+ * to the class lists. Also done automatically when no slot is free.
+ * Returns the number of slots reclaimed.
+ */
+int shm_heap_recover(shm_heap_t *h);
+
+void shm_heap_stats(const shm_heap_t *h, shm_heap_stats_t *st);
+
+/*
+ * Walk every free list and cache and check that each free block is in a
+ * chunk of its class, properly aligned, and listed only once. Only
+ * meaningful while no one else is using the heap.
+ * Returns the number of free blocks, or -1/EUCLEAN if anything is wrong.
+ */
+long shm_heap_check(const shm_heap_t *h);
+
+#endif /* SHM_HEAP_H */
@@ -0,0 +1,237 @@
+/*
+ * shm_hist.c - Latency histogram in shared memory, recorded without locks
+ *
+ * See shm_hist.h for the API and segment layout.
+ *
+ * Only shm_hist_record() is on the hot path, and it lives in the header.
+ * Everything here is setup and reading: the reader's loads are relaxed
+ * too, since a snapshot only promises to hold each value or not, never a
+ * consistent cut across shards.
+ */
+
+#define _GNU_SOURCE
+
+#include "shm_hist.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SHM_HIST_MAGIC 0x48495354u /* "HIST" */
+#define MAX_SHARDS 1024
+#define PAGE 4096
+
+struct shm_hist_hdr {
+  uint32_t magic;
+  uint32_t mode;
+  uint32_t nshards;
+  _Atomic uint32_t next_shared; /* Round-robin when every shard is taken */
+};
+
+static size_t shards_offset(void) {
+  size_t n = sizeof(struct shm_hist_hdr);
+  size_t align = _Alignof(struct shm_hist_shard);
+  return (n + align - 1) & ~(align - 1);
+}
+
+static size_t map_bytes(int nshards) {
+  size_t n = shards_offset() + (size_t)nshards * sizeof(struct shm_hist_shard);
+  return (n + PAGE - 1) & ~(size_t)(PAGE - 1);
+}
+
+static void set_map(shm_hist_t *h, void *base, size_t map_size, int fd) {
+  memset(h, 0, sizeof(*h));
+  h->hdr = base;
+  h->shards = (struct shm_hist_shard *)((char *)base + shards_offset());
+  h->map_size = map_size;
+  h->fd = fd;
+  h->shard = -1;
+}
+
+int shm_hist_create(shm_hist_t *h, const char *name, int nshards,
+                    shm_hist_mode_t mode) {
+  if (mode != SHM_HIST_PER_CPU && mode != SHM_HIST_PER_PROCESS) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (nshards == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    nshards = mode == SHM_HIST_PER_PROCESS ? 64 : cpus > 0 ? (int)cpus : 1;
+  }
+  if (nshards < 1 || nshards > MAX_SHARDS) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  size_t size = map_bytes(nshards);
+  void *base;
+  int fd = -1;
+  if (!name) {
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+      return -1;
+  } else {
+    fd = shm_open(name, O_CREAT | O_RDWR, 0666);
+    if (fd == -1)
+      return -1;
+    /* Truncate to zero first so counts from a reused name are gone */
+    if (ftruncate(fd, 0) == -1 || ftruncate(fd, size) == -1 ||
+        (base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                     0)) == MAP_FAILED) {
+      int saved = errno;
+      close(fd);
+      errno = saved;
+      return -1;
+    }
+  }
+  set_map(h, base, size, fd);
+
+  /* Fresh pages are zero: every counter and pid starts out right */
+  struct shm_hist_hdr *hdr = h->hdr;
+  hdr->mode = mode;
+  hdr->nshards = nshards;
+  atomic_init(&hdr->next_shared, 0);
+  atomic_thread_fence(memory_order_release);
+  hdr->magic = SHM_HIST_MAGIC;
+
+  h->nshards = nshards;
+  shm_hist_join(h);
+  return 0;
+}
+
+int shm_hist_open(shm_hist_t *h, const char *name) {
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd == -1)
+    return -1;
+
+  struct stat st;
+  void *base = MAP_FAILED;
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < map_bytes(1) ||
+      (base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0)) == MAP_FAILED) {
+    int saved = base == MAP_FAILED && errno ? errno : EINVAL;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+  set_map(h, base, st.st_size, fd);
+
+  struct shm_hist_hdr *hdr = h->hdr;
+  if (hdr->magic != SHM_HIST_MAGIC || hdr->nshards < 1 ||
+      hdr->nshards > MAX_SHARDS ||
+      map_bytes(hdr->nshards) != (size_t)st.st_size) {
+    shm_hist_close(h);
+    errno = EINVAL;
+    return -1;
+  }
+  h->nshards = hdr->nshards;
+  shm_hist_join(h);
+  return 0;
+}
+
+void shm_hist_join(shm_hist_t *h) {
+  h->shard = -1;
+  if (h->hdr->mode != SHM_HIST_PER_PROCESS)
+    return;
+
+  int32_t me = getpid();
+  for (int pass = 0; pass < 2; pass++) {
+    for (int s = 0; s < h->nshards; s++) {
+      _Atomic int32_t *owner = &h->shards[s].pid;
+      int32_t pid = atomic_load(owner);
+      if (pid == me) {
+        h->shard = s;
+        return;
+      }
+      /* First pass: free shards only. Second: those of dead processes,
+         whose counts then count as ours in per-process reports. */
+      int free = pid == 0 ||
+                 (pass == 1 && kill(pid, 0) == -1 && errno == ESRCH);
+      if (free && atomic_compare_exchange_strong(owner, &pid, me)) {
+        h->shard = s;
+        return;
+      }
+    }
+  }
+  h->shard = atomic_fetch_add(&h->hdr->next_shared, 1) % h->nshards;
+}
+
+void shm_hist_close(shm_hist_t *h) {
+  if (h->hdr)
+    munmap(h->hdr, h->map_size);
+  if (h->fd != -1)
+    close(h->fd);
+  h->hdr = NULL;
+  h->shards = NULL;
+  h->fd = -1;
+}
+
+int shm_hist_unlink(const char *name) { return shm_unlink(name); }
+
+void shm_hist_snapshot(shm_hist_t *h, int shard, shm_hist_snap_t *snap) {
+  memset(snap, 0, sizeof(*snap));
+  int first = shard < 0 ? 0 : shard;
+  int last = shard < 0 ? h->nshards - 1 : shard;
+  for (int s = first; s <= last; s++) {
+    struct shm_hist_shard *sh = &h->shards[s];
+    for (int b = 0; b < SHM_HIST_BUCKETS; b++) {
+      uint64_t n =
+          atomic_load_explicit(&sh->buckets[b], memory_order_relaxed);
+      snap->buckets[b] += n;
+      snap->count += n;
+    }
+    snap->sum += atomic_load_explicit(&sh->sum, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&sh->max, memory_order_relaxed);
+    if (max > snap->max)
+      snap->max = max;
+  }
+}
+
+void shm_hist_sub(shm_hist_snap_t *out, const shm_hist_snap_t *now,
+                  const shm_hist_snap_t *before) {
+  out->count = 0;
+  out->max = 0;
+  for (int b = 0; b < SHM_HIST_BUCKETS; b++) {
+    uint64_t n = now->buckets[b] - before->buckets[b];
+    out->buckets[b] = n;
+    out->count += n;
+    /* The exact maximum of an interval is lost; its bucket is not */
+    if (n)
+      out->max = shm_hist_bucket_low(b + 1) - 1;
+  }
+  out->sum = now->sum - before->sum;
+  if (out->max > now->max)
+    out->max = now->max;
+}
+
+uint64_t shm_hist_percentile(const shm_hist_snap_t *snap, double q) {
+  if (snap->count == 0)
+    return 0;
+  /* Rank of the value wanted, 1-based: the median of 1..100 is the 50th */
+  uint64_t rank = (uint64_t)(q * snap->count + 0.5);
+  if (rank < 1)
+    rank = 1;
+  if (rank > snap->count)
+    rank = snap->count;
+
+  uint64_t seen = 0;
+  for (int b = 0; b < SHM_HIST_BUCKETS; b++) {
+    seen += snap->buckets[b];
+    if (seen >= rank) {
+      uint64_t high = b + 1 < SHM_HIST_BUCKETS
+                          ? shm_hist_bucket_low(b + 1) - 1
+                          : UINT64_MAX;
+      return high < snap->max ? high : snap->max;
+    }
+  }
+  return snap->max;
+}
+
+pid_t shm_hist_shard_pid(const shm_hist_t *h, int shard) {
+  return atomic_load(&h->shards[shard].pid);
+}
@@ -0,0 +1,172 @@
+/*
+ * shm_hist.h - Latency histogram in shared memory, recorded without locks
+ *
+ * Percentiles need the whole distribution, not an average. Keeping every
+ * sample (and sorting them) costs memory in proportion to the run; a
+ * histogram costs a fixed 16 KiB no matter how many values go in, and many
+ * processes can fill the same one while another process reads it.
+ *
+ * Buckets are log-linear, as in HdrHistogram: values below 128 ns get one
+ * bucket each, and every power of two above that is split into 64 equal
+ * buckets. So any value is known to within 1/64 (1.6%) of itself, from
+ * nanoseconds up to 2^37 ns (~137 s); bigger values land in the last
+ * bucket. 2048 buckets in all.
+ *
+ * Segment layout (one shm object, or an anonymous mapping shared over
+ * fork()):
+ *
+ *   [ header: magic, mode, nshards ][ shard 0 ][ shard 1 ] ...
+ *   shard: [ sum | max | pid ][ 2048 bucket counters ]
+ *
+ * Recording adds 1 to a bucket and the value to sum with relaxed atomic
+ * adds: no lock, no fence, nothing anyone waits for. To keep recorders
+ * from fighting over the same cache lines, each writes its own shard:
+ *
+ *   SHM_HIST_PER_CPU      the shard of the CPU it runs on (sched_getcpu()).
+ *                         Recorders on different CPUs never share a line,
+ *                         however many processes there are.
+ *   SHM_HIST_PER_PROCESS  a shard of its own, claimed by shm_hist_join().
+ *                         The reader can then also report per process.
+ *
+ * Either way a shard may still get two writers (a process migrated
+ * between sched_getcpu() and the add, or more processes than shards),
+ * which is why the adds are atomic; they just rarely contend.
+ *
+ * A reader sums the shards into a private snapshot and computes
+ * percentiles from it. Counters only grow, so the difference of two
+ * snapshots is the histogram of the values recorded in between.
+ */
+
+#ifndef SHM_HIST_H
+#define SHM_HIST_H
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SHM_HIST_SUB_BITS 6
+#define SHM_HIST_SUB (1 << SHM_HIST_SUB_BITS) /* Buckets per power of two */
+#define SHM_HIST_MAX_SHIFT 30                 /* Values < 2^37 ns */
+#define SHM_HIST_BUCKETS ((SHM_HIST_MAX_SHIFT + 2) * SHM_HIST_SUB)
+
+typedef enum {
+  SHM_HIST_PER_CPU = 0,
+  SHM_HIST_PER_PROCESS = 1
+} shm_hist_mode_t;
+
+/* One shard, in shared memory. Public so recording can be inline. */
+struct shm_hist_shard {
+  _Alignas(64) _Atomic uint64_t sum; /* Of all values recorded, in ns */
+  _Atomic uint64_t max;
+  _Atomic int32_t pid; /* SHM_HIST_PER_PROCESS: who claimed it */
+  _Alignas(64) _Atomic uint64_t buckets[SHM_HIST_BUCKETS];
+};
+
+struct shm_hist_hdr; /* Lives in shared memory, see shm_hist.c */
+
+/* Per-process handle onto a histogram */
+typedef struct {
+  struct shm_hist_hdr *hdr;
+  struct shm_hist_shard *shards;
+  int nshards;
+  int shard; /* Shard this process records into; -1: per CPU */
+  size_t map_size;
+  int fd;
+} shm_hist_t;
+
+/* A private copy of a histogram (or of one shard), for reading */
+typedef struct {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max; /* Exact for a snapshot, bucket-accurate after _sub() */
+  uint64_t buckets[SHM_HIST_BUCKETS];
+} shm_hist_snap_t;
+
+/*
+ * Create histogram `name` (or truncate an old one) with `nshards` shards;
+ * 0 picks the number of CPUs for SHM_HIST_PER_CPU and 64 for
+ * SHM_HIST_PER_PROCESS. A NULL name makes an anonymous shared mapping,
+ * which children inherit over fork(). The caller is joined.
+ * Returns 0 on success, -1 with errno set on failure.
+ */
+int shm_hist_create(shm_hist_t *h, const char *name, int nshards,
+                    shm_hist_mode_t mode);
+
+/* Attach to an existing histogram; the caller is joined */
+int shm_hist_open(shm_hist_t *h, const char *name);
+
+/*
+ * Pick the shard this process records into. create and open do it; a
+ * child that inherited the handle over fork() must call it again, or it
+ * would record into its parent's shard. In SHM_HIST_PER_PROCESS mode it
+ * takes a free shard, else one whose process died, else shares one.
+ */
+void shm_hist_join(shm_hist_t *h);
+
+/* Detach (does not remove the shm object) */
+void shm_hist_close(shm_hist_t *h);
+
+/* Remove the shm object name */
+int shm_hist_unlink(const char *name);
+
+static inline int shm_hist_bucket(uint64_t value) {
+  if (value < 2 * SHM_HIST_SUB)
+    return (int)value;
+  int shift = 63 - __builtin_clzll(value) - SHM_HIST_SUB_BITS;
+  if (shift > SHM_HIST_MAX_SHIFT)
+    return SHM_HIST_BUCKETS - 1;
+  return shift * SHM_HIST_SUB + (int)(value >> shift);
+}
+
+/* Smallest value that lands in bucket b; it holds (1 << shift) values */
+static inline uint64_t shm_hist_bucket_low(int b) {
+  if (b < 2 * SHM_HIST_SUB)
+    return b;
+  int shift = b / SHM_HIST_SUB - 1;
+  return (uint64_t)(b - shift * SHM_HIST_SUB) << shift;
+}
+
+/* Record one value (nanoseconds, by convention). Lock-free, never waits. */
+static inline void shm_hist_record(shm_hist_t *h, uint64_t value) {
+  int s = h->shard;
+  if (s < 0) {
+    s = sched_getcpu();
+    if ((unsigned)s >= (unsigned)h->nshards)
+      s = (s < 0 ? 0 : s) % h->nshards;
+  }
+  struct shm_hist_shard *sh = &h->shards[s];
+  atomic_fetch_add_explicit(&sh->buckets[shm_hist_bucket(value)], 1,
+                            memory_order_relaxed);
+  atomic_fetch_add_explicit(&sh->sum, value, memory_order_relaxed);
+  uint64_t max = atomic_load_explicit(&sh->max, memory_order_relaxed);
+  while (value > max &&
+         !atomic_compare_exchange_weak_explicit(&sh->max, &max, value,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+    ;
+}
+
+/*
+ * Copy shard `shard` (-1: all of them, merged) into *snap. Recorders keep
+ * going meanwhile; values they add during the copy may or may not be in
+ * it, but count is always the sum of the buckets copied.
+ */
+void shm_hist_snapshot(shm_hist_t *h, int shard, shm_hist_snap_t *snap);
+
+/* out = now - before: the values recorded between the two snapshots */
+void shm_hist_sub(shm_hist_snap_t *out, const shm_hist_snap_t *now,
+                  const shm_hist_snap_t *before);
+
+/*
+ * Value at quantile q (0.5 = median, 0.999 = p99.9): the highest value of
+ * the bucket it falls in, so never below the true one and at most 1.6%
+ * above it. 0 for an empty snapshot.
+ */
+uint64_t shm_hist_percentile(const shm_hist_snap_t *snap, double q);
+
+/* Process that claimed a shard in SHM_HIST_PER_PROCESS mode (0: none) */
+pid_t shm_hist_shard_pid(const shm_hist_t *h, int shard);
+
+#endif /* SHM_HIST_H */
@@ -0,0 +1,447 @@
+/*
+ * shm_log.c - One-publisher broadcast log over POSIX shared memory
+ *
+ * See shm_log.h for the API and segment layout.
+ *
+ * head and tail are 64-bit byte positions that only grow, as in
+ * shm_ring.c. head is the end of the last published record; tail is the
+ * oldest record still intact. Before the publisher overwrites anything it
+ * moves tail past it, so the protocol is a seqlock over the whole log:
+ *
+ *   publisher                         subscriber
+ *   tail = first record kept          read record at cursor (in place)
+ *   release fence                     acquire fence
+ *   overwrite the old records         tail <= cursor? then what was read
+ *   stamp = pos, head += size         is intact, else it was lapped
+ *
+ * Subscribers only ever store to their own slot (cursor, missed), one
+ * cache line each, so hundreds of them do not slow the publisher down.
+ */
+
+#define _GNU_SOURCE
+
+#include "shm_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define SHM_LOG_MAGIC 0x424c4f47u /* "BLOG" */
+#define CACHELINE 64
+#define PAGE 4096
+#define REC_HDR 16
+#define REC_PAD UINT32_MAX /* len of a padding record */
+#define SPIN_BEFORE_SLEEP 200
+
+enum { SLOT_FREE = 0, SLOT_ACTIVE, SLOT_DROPPED };
+
+struct shm_log_hdr {
+  uint32_t magic;
+  uint32_t policy;
+  uint64_t capacity;
+  uint32_t max_subs;
+  uint32_t header_bytes;
+  /* Publisher: end of the last published record */
+  _Alignas(CACHELINE) _Atomic uint64_t head;
+  /* Publisher: oldest intact record, raised before overwriting */
+  _Alignas(CACHELINE) _Atomic uint64_t tail;
+  /* Sleeping subscribers */
+  _Alignas(CACHELINE) _Atomic uint32_t data_seq; /* futex word */
+  _Atomic uint32_t need_wake;                    /* someone may sleep */
+  _Atomic uint32_t shutdown;
+};
+
+struct sub_slot {
+  _Alignas(CACHELINE) _Atomic uint32_t state;
+  _Atomic int32_t pid;
+  _Atomic uint64_t cursor;
+  _Atomic uint64_t missed;
+};
+
+struct rec_hdr {
+  _Atomic uint64_t stamp; /* Position the record was written at */
+  uint32_t len;
+  uint32_t seq;
+};
+
+_Static_assert(sizeof(struct sub_slot) == CACHELINE, "one slot per line");
+_Static_assert(sizeof(struct rec_hdr) == REC_HDR, "record header size");
+
+static inline uint64_t rec_size(uint32_t len) {
+  return REC_HDR + (((uint64_t)len + 15) & ~(uint64_t)15);
+}
+
+static inline struct rec_hdr *rec_at(const shm_log_t *log, uint64_t pos) {
+  return (struct rec_hdr *)(log->data + (pos & log->mask));
+}
+
+static inline struct sub_slot *slot_at(const shm_log_t *log, int i) {
+  return (struct sub_slot *)((unsigned char *)log->hdr +
+                             sizeof(struct shm_log_hdr)) +
+         i;
+}
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+static int futex_wait(_Atomic uint32_t *addr, uint32_t expected) {
+  return syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT, expected, NULL,
+                 NULL, 0);
+}
+
+static int futex_wake(_Atomic uint32_t *addr, int count) {
+  return syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE, count, NULL, NULL,
+                 0);
+}
+
+static size_t header_bytes(int max_subs) {
+  size_t n = sizeof(struct shm_log_hdr) +
+             (size_t)max_subs * sizeof(struct sub_slot);
+  return (n + PAGE - 1) & ~(size_t)(PAGE - 1);
+}
+
+static int map_log(shm_log_t *log, int fd, size_t map_size) {
+  void *base =
+      mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED)
+    return -1;
+
+  memset(log, 0, sizeof(*log));
+  log->hdr = base;
+  log->map_size = map_size;
+  log->fd = fd;
+  return 0;
+}
+
+int shm_log_create(shm_log_t *log, const char *name, size_t capacity,
+                   int max_subs, shm_log_policy_t policy) {
+  if (max_subs < 1 || (policy != SHM_LOG_SKIP && policy != SHM_LOG_DROP)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  size_t cap = 4096;
+  while (cap < capacity)
+    cap <<= 1;
+  size_t hdr_bytes = header_bytes(max_subs);
+
+  int fd = shm_open(name, O_CREAT | O_RDWR, 0666);
+  if (fd == -1)
+    return -1;
+
+  /* Truncate to zero first so stale stamps from a reused name are gone */
+  if (ftruncate(fd, 0) == -1 || ftruncate(fd, hdr_bytes + cap) == -1 ||
+      map_log(log, fd, hdr_bytes + cap) == -1) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+
+  struct shm_log_hdr *hdr = log->hdr;
+  hdr->policy = policy;
+  hdr->capacity = cap;
+  hdr->max_subs = max_subs;
+  hdr->header_bytes = hdr_bytes;
+  atomic_init(&hdr->head, 0);
+  atomic_init(&hdr->tail, 0);
+  atomic_init(&hdr->data_seq, 0);
+  atomic_init(&hdr->need_wake, 0);
+  atomic_init(&hdr->shutdown, 0);
+  atomic_thread_fence(memory_order_release);
+  hdr->magic = SHM_LOG_MAGIC;
+
+  log->data = (unsigned char *)log->hdr + hdr_bytes;
+  log->mask = cap - 1;
+  return 0;
+}
+
+int shm_log_open(shm_log_t *log, const char *name) {
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd == -1)
+    return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size <= PAGE ||
+      map_log(log, fd, st.st_size) == -1) {
+    int saved = errno ? errno : EINVAL;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+
+  struct shm_log_hdr *hdr = log->hdr;
+  if (hdr->magic != SHM_LOG_MAGIC ||
+      hdr->header_bytes != header_bytes(hdr->max_subs) ||
+      hdr->header_bytes + hdr->capacity != (size_t)st.st_size) {
+    shm_log_close(log);
+    errno = EINVAL;
+    return -1;
+  }
+
+  log->data = (unsigned char *)hdr + hdr->header_bytes;
+  log->mask = hdr->capacity - 1;
+  return 0;
+}
+
+void shm_log_close(shm_log_t *log) {
+  if (log->hdr)
+    munmap(log->hdr, log->map_size);
+  if (log->fd != -1)
+    close(log->fd);
+  log->hdr = NULL;
+  log->fd = -1;
+}
+
+int shm_log_unlink(const char *name) { return shm_unlink(name); }
+
+size_t shm_log_max_msg(const shm_log_t *log) {
+  /* Small enough that a record plus padding never covers the whole log */
+  return log->hdr->capacity / 4 - REC_HDR;
+}
+
+/* ------------------------------------------------------------------ */
+/* Publisher                                                            */
+/* ------------------------------------------------------------------ */
+
+/* Bytes from pos to the next record (pos holds one of ours) */
+static uint64_t rec_span(const shm_log_t *log, uint64_t pos) {
+  uint32_t len = rec_at(log, pos)->len;
+  return len == REC_PAD ? log->hdr->capacity - (pos & log->mask)
+                        : rec_size(len);
+}
+
+/* Retire every record that writing up to `end` would overwrite */
+static void make_room(shm_log_t *log, uint64_t end) {
+  uint64_t tail = log->tail;
+  while (tail + log->hdr->capacity < end)
+    tail += rec_span(log, tail);
+  if (tail == log->tail)
+    return;
+
+  log->tail = tail;
+  atomic_store_explicit(&log->hdr->tail, tail, memory_order_relaxed);
+  /* Subscribers must be able to see the new tail before any overwrite */
+  atomic_thread_fence(memory_order_release);
+}
+
+static void put_record(shm_log_t *log, uint32_t len, const void *buf) {
+  struct rec_hdr *rec = rec_at(log, log->head);
+  if (len != REC_PAD)
+    memcpy(rec + 1, buf, len);
+  rec->len = len;
+  rec->seq = len == REC_PAD ? 0 : log->seq++;
+  atomic_store_explicit(&rec->stamp, log->head, memory_order_release);
+}
+
+int shm_log_append(shm_log_t *log, const void *buf, size_t len) {
+  if (len == 0 || len > shm_log_max_msg(log)) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  uint64_t size = rec_size(len);
+  uint64_t room = log->hdr->capacity - (log->head & log->mask);
+  if (room < size) {
+    /* Records never wrap: pad out to the end of the data area */
+    make_room(log, log->head + room);
+    put_record(log, REC_PAD, NULL);
+    log->head += room;
+  }
+  make_room(log, log->head + size);
+  put_record(log, len, buf);
+  log->head += size;
+  atomic_store_explicit(&log->hdr->head, log->head, memory_order_release);
+  return 0;
+}
+
+void shm_log_wake(shm_log_t *log) {
+  /* Wake sleepers only if one announced itself; see shm_ring.c */
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&log->hdr->need_wake, memory_order_relaxed) &&
+      atomic_exchange(&log->hdr->need_wake, 0)) {
+    atomic_fetch_add(&log->hdr->data_seq, 1);
+    futex_wake(&log->hdr->data_seq, INT_MAX);
+  }
+}
+
+int shm_log_publish(shm_log_t *log, const void *buf, size_t len) {
+  if (shm_log_append(log, buf, len) == -1)
+    return -1;
+  shm_log_wake(log);
+  return 0;
+}
+
+void shm_log_shutdown(shm_log_t *log) {
+  atomic_store(&log->hdr->shutdown, 1);
+  atomic_fetch_add(&log->hdr->data_seq, 1);
+  futex_wake(&log->hdr->data_seq, INT_MAX);
+}
+
+int shm_log_scan(shm_log_t *log, uint64_t max_lag, shm_log_sub_info_t *info,
+                 int max) {
+  uint64_t head = atomic_load(&log->hdr->head);
+  int n = 0;
+
+  for (int i = 0; i < (int)log->hdr->max_subs; i++) {
+    struct sub_slot *s = slot_at(log, i);
+    uint32_t state = atomic_load(&s->state);
+    if (state == SLOT_FREE)
+      continue;
+
+    pid_t pid = atomic_load(&s->pid);
+    if (kill(pid, 0) == -1 && errno == ESRCH) {
+      /* Died without unsubscribing: give the slot back */
+      atomic_compare_exchange_strong(&s->state, &state, SLOT_FREE);
+      continue;
+    }
+
+    uint64_t lag = head - atomic_load(&s->cursor);
+    if (state == SLOT_ACTIVE && max_lag && lag > max_lag &&
+        atomic_compare_exchange_strong(&s->state, &state, SLOT_DROPPED))
+      state = SLOT_DROPPED;
+    if (n < max && info)
+      info[n++] = (shm_log_sub_info_t){.slot = i,
+                                       .pid = pid,
+                                       .lag = lag,
+                                       .missed = atomic_load(&s->missed),
+                                       .dropped = state == SLOT_DROPPED};
+  }
+  return n;
+}
+
+/* ------------------------------------------------------------------ */
+/* Subscribers                                                          */
+/* ------------------------------------------------------------------ */
+
+int shm_log_subscribe(shm_log_t *log, shm_log_sub_t *sub) {
+  for (int i = 0; i < (int)log->hdr->max_subs; i++) {
+    struct sub_slot *s = slot_at(log, i);
+    uint32_t expected = SLOT_FREE;
+    if (!atomic_compare_exchange_strong(&s->state, &expected, SLOT_ACTIVE))
+      continue;
+
+    memset(sub, 0, sizeof(*sub));
+    sub->log = log;
+    sub->slot = i;
+    sub->cursor = atomic_load_explicit(&log->hdr->head, memory_order_acquire);
+    sub->last = sub->cursor;
+    atomic_store(&s->pid, getpid());
+    atomic_store(&s->cursor, sub->cursor);
+    atomic_store(&s->missed, 0);
+    return 0;
+  }
+  errno = EUSERS;
+  return -1;
+}
+
+void shm_log_unsubscribe(shm_log_sub_t *sub) {
+  if (sub->log)
+    atomic_store(&slot_at(sub->log, sub->slot)->state, SLOT_FREE);
+  sub->log = NULL;
+}
+
+/* The publisher overwrote our cursor: resync, or give up (policy) */
+static ssize_t lapped(shm_log_sub_t *sub, struct sub_slot *s) {
+  struct shm_log_hdr *hdr = sub->log->hdr;
+  if (hdr->policy == SHM_LOG_DROP) {
+    atomic_store(&s->state, SLOT_DROPPED);
+    errno = ECONNRESET;
+    return -1;
+  }
+  sub->cursor = atomic_load_explicit(&hdr->tail, memory_order_acquire);
+  atomic_store_explicit(&s->cursor, sub->cursor, memory_order_relaxed);
+  errno = EOVERFLOW;
+  return -1;
+}
+
+ssize_t shm_log_try_next(shm_log_sub_t *sub, const void **data) {
+  shm_log_t *log = sub->log;
+  struct shm_log_hdr *hdr = log->hdr;
+  struct sub_slot *s = slot_at(log, sub->slot);
+
+  if (atomic_load_explicit(&s->state, memory_order_relaxed) != SLOT_ACTIVE) {
+    errno = ECONNRESET;
+    return -1;
+  }
+
+  for (;;) {
+    uint64_t head = atomic_load_explicit(&hdr->head, memory_order_acquire);
+    if (sub->cursor == head) {
+      errno = EAGAIN;
+      return -1;
+    }
+
+    struct rec_hdr *rec = rec_at(log, sub->cursor);
+    uint64_t stamp = atomic_load_explicit(&rec->stamp, memory_order_acquire);
+    uint32_t len = rec->len;
+    uint32_t seq = rec->seq;
+    /* Was any of that overwritten while we read it? */
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t tail = atomic_load_explicit(&hdr->tail, memory_order_relaxed);
+    if (stamp != sub->cursor || tail > sub->cursor)
+      return lapped(sub, s);
+
+    if (len == REC_PAD) {
+      sub->cursor += hdr->capacity - (sub->cursor & log->mask);
+      continue;
+    }
+
+    if (sub->synced && seq != sub->next_seq) {
+      sub->missed += (uint32_t)(seq - sub->next_seq);
+      atomic_store_explicit(&s->missed, sub->missed, memory_order_relaxed);
+    }
+    sub->synced = 1;
+    sub->next_seq = seq + 1;
+    sub->last = sub->cursor;
+    sub->cursor += rec_size(len);
+    /* Our own cache line: lets the publisher see how far behind we are */
+    atomic_store_explicit(&s->cursor, sub->cursor, memory_order_relaxed);
+    *data = rec + 1;
+    return len;
+  }
+}
+
+ssize_t shm_log_next(shm_log_sub_t *sub, const void **data) {
+  struct shm_log_hdr *hdr = sub->log->hdr;
+
+  for (;;) {
+    for (int spin = 0; spin < SPIN_BEFORE_SLEEP; spin++) {
+      ssize_t n = shm_log_try_next(sub, data);
+      if (n >= 0 || errno != EAGAIN)
+        return n;
+      cpu_relax();
+    }
+
+    /* Announce, then re-check: same handshake as shm_ring_recv() */
+    uint32_t seq = atomic_load(&hdr->data_seq);
+    atomic_store(&hdr->need_wake, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load(&hdr->head) == sub->cursor) {
+      if (atomic_load(&hdr->shutdown))
+        return 0;
+      futex_wait(&hdr->data_seq, seq);
+    }
+  }
+}
+
+int shm_log_intact(const shm_log_sub_t *sub) {
+  /* Order the caller's reads of the payload before the tail check */
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit(&sub->log->hdr->tail, memory_order_relaxed) <=
+         sub->last;
+}
@@ -0,0 +1,151 @@
+/*
+ * shm_log.h - One-publisher broadcast log over POSIX shared memory
+ *
+ * The reverse of the many-writers-one-reader FIFO demos: one publisher and
+ * any number of subscribers. The publisher appends each record ONCE; every
+ * subscriber keeps its own cursor and reads the records in place. Fanning
+ * out over N FIFOs instead costs N write() copies into the kernel and N
+ * read() copies out for every message; here adding a subscriber adds no
+ * work at all for the publisher.
+ *
+ * The publisher never waits for anyone. When it needs the space, it
+ * overwrites the oldest records whether or not everybody has read them. A
+ * subscriber that falls a whole lap behind notices and, depending on the
+ * log's policy, either skips ahead and is told how many records it missed
+ * (SHM_LOG_SKIP) or is dropped (SHM_LOG_DROP). The publisher can also
+ * evict subscribers that lag too far before it gets that far.
+ *
+ * Segment layout (one shm object):
+ *
+ *   [ header: config, head, tail, futex word ][ subscriber slots, one
+ *     cache line each ] ... padded to a page
+ *   [ data: capacity bytes of 16-byte aligned records ]
+ *
+ * Records never wrap, as in shm_ring.h. Each carries the position it was
+ * written at and a sequence number, so a subscriber can tell a record from
+ * stale bytes of an earlier lap and count the ones it missed.
+ */
+
+#ifndef SHM_LOG_H
+#define SHM_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef enum {
+  SHM_LOG_SKIP = 0, /* Lapped subscribers jump ahead, missed is counted */
+  SHM_LOG_DROP = 1  /* Lapped subscribers are disconnected */
+} shm_log_policy_t;
+
+struct shm_log_hdr; /* Lives in shared memory, see shm_log.c */
+
+/* Per-process handle onto a log segment */
+typedef struct {
+  struct shm_log_hdr *hdr;
+  unsigned char *data;
+  size_t map_size;
+  uint64_t mask;
+  int fd;
+  /* Publisher only: private copies of head and tail */
+  uint64_t head;
+  uint64_t tail;
+  uint32_t seq;
+} shm_log_t;
+
+/* A subscriber's position in the log */
+typedef struct {
+  shm_log_t *log;
+  int slot;
+  uint64_t cursor;   /* Next record to read */
+  uint64_t last;     /* Record returned by the last successful next() */
+  uint32_t next_seq; /* Sequence number expected next */
+  int synced;        /* next_seq is known */
+  uint64_t missed;   /* Records lost to being lapped, so far */
+} shm_log_sub_t;
+
+/* What the publisher can see about each subscriber */
+typedef struct {
+  int slot;
+  pid_t pid;
+  uint64_t lag; /* Bytes published that it has not read yet */
+  uint64_t missed;
+  int dropped;
+} shm_log_sub_info_t;
+
+/*
+ * Create (or truncate) log `name` with `capacity` bytes of record space
+ * (rounded up to a power of two, minimum 4 KiB) and room for max_subs
+ * subscribers. The caller becomes the publisher.
+ * Returns 0 on success, -1 with errno set on failure.
+ */
+int shm_log_create(shm_log_t *log, const char *name, size_t capacity,
+                   int max_subs, shm_log_policy_t policy);
+
+/* Attach to an existing log (subscribers) */
+int shm_log_open(shm_log_t *log, const char *name);
+
+/* Detach (does not remove the shm object) */
+void shm_log_close(shm_log_t *log);
+
+/* Remove the shm object name */
+int shm_log_unlink(const char *name);
+
+/* Largest payload one record may carry */
+size_t shm_log_max_msg(const shm_log_t *log);
+
+/*
+ * Publisher: append one record (1..shm_log_max_msg() bytes). Never waits:
+ * overwrites the oldest records when the log is full.
+ * Returns 0, or -1/EMSGSIZE.
+ */
+int shm_log_publish(shm_log_t *log, const void *buf, size_t len);
+
+/*
+ * Publisher: append without waking sleeping subscribers, then wake them
+ * once for the whole batch. Every wake-up of N sleepers costs N context
+ * switches, so a burst should pay for it once, not per record.
+ */
+int shm_log_append(shm_log_t *log, const void *buf, size_t len);
+void shm_log_wake(shm_log_t *log);
+
+/* Publisher: no more records; subscribers drain and then get 0 */
+void shm_log_shutdown(shm_log_t *log);
+
+/*
+ * Publisher: fill info[] (up to max entries) with the current
+ * subscribers, and drop every subscriber lagging more than max_lag bytes
+ * (0: drop none). Slots of subscribers whose process died are freed.
+ * Returns the number of entries filled in.
+ */
+int shm_log_scan(shm_log_t *log, uint64_t max_lag, shm_log_sub_info_t *info,
+                 int max);
+
+/*
+ * Join as a subscriber, starting with the next record published.
+ * Returns 0, or -1/EUSERS when every slot is taken.
+ */
+int shm_log_subscribe(shm_log_t *log, shm_log_sub_t *sub);
+void shm_log_unsubscribe(shm_log_sub_t *sub);
+
+/*
+ * Next record: returns its length and points *data at the payload INSIDE
+ * the log (no copy). try_next returns -1/EAGAIN when there is nothing new;
+ * next sleeps until there is, and returns 0 once the log is shut down and
+ * drained. Both fail with:
+ *   -1/EOVERFLOW   lapped (SHM_LOG_SKIP): the cursor moved to the oldest
+ *                  record still in the log; sub->missed is updated when
+ *                  that record is read
+ *   -1/ECONNRESET  dropped by the publisher or lapped under SHM_LOG_DROP
+ */
+ssize_t shm_log_try_next(shm_log_sub_t *sub, const void **data);
+ssize_t shm_log_next(shm_log_sub_t *sub, const void **data);
+
+/*
+ * Non-zero if the record from the last next() has not been overwritten.
+ * Check it AFTER using the data in place: if the publisher lapped the
+ * subscriber meanwhile, whatever was computed from it must be discarded.
+ */
+int shm_log_intact(const shm_log_sub_t *sub);
+
+#endif /* SHM_LOG_H */
@@ -0,0 +1,886 @@
+/*
+ * shm_map.c - Concurrent hash map shared by many processes
+ *
+ * See shm_map.h for the design.
+ *
+ * Locks (spinlocks in the groups, always taken in this order; each holds
+ * its owner's PID, so a waiter can take over from a dead owner, see
+ * "Crashes" in shm_map.h):
+ *   1. home lock of the key's home group in the old table, if resizing
+ *   2. home lock of the key's home group in the current table
+ *   3. write lock of the one group being changed (never held while
+ *      waiting for anything else)
+ * The home lock makes "is the key there? then insert" atomic, and it is
+ * also the unit of migration: a home group is "moved" once every key
+ * whose home it is has been copied to the next table. Nobody adds keys to
+ * a moved home group, so the old table only ever shrinks.
+ *
+ * Keys are copied to the new table BEFORE they are removed from the old
+ * one, and lookups try the old table first: whenever a key is missing from
+ * the old table, it is already in the new one.
+ *
+ * The table pointers (cur, old) change under a seqlock. A lookup that saw
+ * them change retries; a writer that saw them change after taking its
+ * locks starts over.
+ */
+
+#define _GNU_SOURCE
+
+#include "shm_map.h"
+#include "seqlock.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define SHM_MAP_MAGIC 0x534d4150u /* "SMAP" */
+#define CACHELINE 64
+#define GROUP_SLOTS 16
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xfe
+#define MAX_READERS 64
+#define MAX_RETIRED 8
+#define MIGRATE_STEP 8 /* Home groups moved per write while resizing */
+#define INIT_STEP 8    /* Groups of the spare table initialized per write */
+#define DEAD_CHECK 1024 /* Spins between checks that a lock's owner lives */
+
+struct group {
+  seqlock_t seq;          /* Odd while a slot of this group changes */
+  _Atomic uint32_t wlock; /* Held while changing this group */
+  _Atomic uint32_t home;  /* Held by writers of keys whose home this is */
+  _Atomic uint8_t moved;  /* Those keys are all in the next table */
+  uint8_t busy;           /* 1 + the slot last changed, for repairs */
+  uint8_t pad[2];
+  uint8_t ctrl[GROUP_SLOTS];
+  uint64_t keys[GROUP_SLOTS];
+  uint64_t vals[GROUP_SLOTS];
+};
+
+struct table {
+  uint64_t ngroups; /* Power of two */
+  shm_off_t next;   /* Where the keys go while this table is retiring */
+  _Atomic uint64_t used; /* Slots no longer EMPTY */
+  _Atomic uint64_t live;
+  _Atomic uint64_t mig_cursor; /* Next home group to move */
+  _Atomic uint64_t migrated;   /* Home groups moved */
+  _Atomic uint64_t init_cursor; /* Next group to initialize, as a spare */
+  _Atomic uint32_t init_lock;   /* Held while initializing from there */
+  uint32_t pad;
+  struct group groups[];
+};
+
+struct reader {
+  _Alignas(CACHELINE) _Atomic int32_t pid;
+  _Atomic uint64_t active; /* Epoch entered, 0 when not in the map */
+};
+
+struct shm_map_hdr {
+  uint32_t magic;
+  seqlock_t view; /* cur and old change under it */
+  _Atomic shm_off_t cur;
+  _Atomic shm_off_t old; /* Table being emptied into cur, 0 if none */
+  _Atomic shm_off_t spare; /* Next cur, being initialized; resize_lock */
+  _Atomic uint32_t resize_lock;
+  _Atomic uint32_t nretired;
+  _Atomic uint64_t epoch;
+  _Atomic unsigned long resizes;
+  struct {
+    shm_off_t table;
+    uint64_t epoch; /* Free once every reader is in this epoch or later */
+  } retired[MAX_RETIRED];
+  struct reader readers[MAX_READERS];
+};
+
+_Static_assert(sizeof(struct table) % 16 == 0, "groups 16-byte aligned");
+_Static_assert(sizeof(struct group) % 16 == 0, "groups 16-byte aligned");
+
+/* ------------------------------------------------------------------ */
+/* Helpers                                                              */
+/* ------------------------------------------------------------------ */
+
+static void backoff(unsigned spins) {
+  if (spins < 64)
+    seqlock_cpu_relax();
+  else
+    sched_yield(); /* The holder may be preempted */
+}
+
+static int pid_dead(uint32_t pid) {
+  int saved = errno;
+  int dead = kill((pid_t)pid, 0) == -1 && errno == ESRCH;
+  errno = saved;
+  return dead;
+}
+
+/* Lock words hold the owner's PID (0 when free) */
+static int spin_trylock(_Atomic uint32_t *l, uint32_t me) {
+  uint32_t free = 0;
+  return !atomic_load_explicit(l, memory_order_relaxed) &&
+         atomic_compare_exchange_strong_explicit(
+             l, &free, me, memory_order_acquire, memory_order_relaxed);
+}
+
+/* Take l if its owner has died; 1 if it is now ours */
+static int take_dead(_Atomic uint32_t *l, uint32_t me) {
+  uint32_t owner = atomic_load_explicit(l, memory_order_relaxed);
+  return owner && pid_dead(owner) &&
+         atomic_compare_exchange_strong_explicit(
+             l, &owner, me, memory_order_acquire, memory_order_relaxed);
+}
+
+/*
+ * Returns 1 if the lock was taken over from a dead owner, which may have
+ * left what the lock protects half-changed; 0 otherwise.
+ */
+static int spin_lock(_Atomic uint32_t *l, uint32_t me) {
+  for (unsigned spins = 0;; spins++) {
+    if (spin_trylock(l, me))
+      return 0;
+    if (spins % DEAD_CHECK == DEAD_CHECK - 1 && take_dead(l, me))
+      return 1;
+    backoff(spins);
+  }
+}
+
+static void spin_unlock(_Atomic uint32_t *l) {
+  atomic_store_explicit(l, 0, memory_order_release);
+}
+
+static inline uint64_t hash_key(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdull;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ull;
+  k ^= k >> 33;
+  return k;
+}
+
+static inline uint8_t h2_of(uint64_t h) { return h & 0x7f; }
+
+static inline uint64_t home_of(const struct table *t, uint64_t h) {
+  return (h >> 7) & (t->ngroups - 1);
+}
+
+/* i-th group of the probe sequence; triangular steps visit every group */
+static inline struct group *probe(struct table *t, uint64_t home,
+                                  uint64_t i) {
+  return &t->groups[(home + i * (i + 1) / 2) & (t->ngroups - 1)];
+}
+
+/* Bit i set where ctrl[i] == b */
+static inline uint32_t match_byte(const uint8_t *ctrl, uint8_t b) {
+#if defined(__SSE2__)
+  __m128i c = _mm_loadu_si128((const __m128i *)ctrl);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8((char)b)));
+#else
+  uint32_t m = 0;
+  for (int i = 0; i < GROUP_SLOTS; i++)
+    m |= (uint32_t)(ctrl[i] == b) << i;
+  return m;
+#endif
+}
+
+/* Bit i set where slot i is EMPTY or DELETED (high bit of ctrl) */
+static inline uint32_t match_free(const uint8_t *ctrl) {
+#if defined(__SSE2__)
+  return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+  uint32_t m = 0;
+  for (int i = 0; i < GROUP_SLOTS; i++)
+    m |= (uint32_t)(ctrl[i] >> 7) << i;
+  return m;
+#endif
+}
+
+static inline struct table *tbl(const shm_map_t *m, shm_off_t off) {
+  return shm_heap_ptr(m->heap, off);
+}
+
+/* ------------------------------------------------------------------ */
+/* One table                                                            */
+/* ------------------------------------------------------------------ */
+
+/*
+ * g's write lock was taken from a dead writer. If it died between
+ * seqlock_write_begin() and _end(), slot busy - 1 may be half-written:
+ * drop it (that one key is lost) and make the sequence even again.
+ */
+static void group_repair(struct group *g) {
+  if (atomic_load_explicit(&g->seq.seq, memory_order_relaxed) & 1) {
+    if (g->busy)
+      g->ctrl[g->busy - 1] = CTRL_DELETED;
+    seqlock_write_end(&g->seq);
+  }
+}
+
+static void group_lock(shm_map_t *m, struct group *g) {
+  if (spin_lock(&g->wlock, m->pid))
+    group_repair(g);
+}
+
+/* seqlock_write_begin() for slot j, with wlock held */
+static void group_write_begin(struct group *g, int j) {
+  g->busy = j + 1;
+  seqlock_write_begin(&g->seq);
+}
+
+/*
+ * seqlock_read_begin(), except that a group whose writer died mid-change
+ * gets repaired here: waiting would never end.
+ */
+static uint32_t group_read_begin(shm_map_t *m, struct group *g) {
+  uint32_t s;
+  for (unsigned spins = 0;
+       (s = atomic_load_explicit(&g->seq.seq, memory_order_acquire)) & 1;
+       spins++) {
+    if (spins % DEAD_CHECK == DEAD_CHECK - 1 &&
+        take_dead(&g->wlock, m->pid)) {
+      group_repair(g);
+      spin_unlock(&g->wlock);
+    } else {
+      backoff(spins);
+    }
+  }
+  return s;
+}
+
+/*
+ * Look for key in group g. Returns its slot or -1; *end is set if the
+ * group has an EMPTY slot, which ends the probe sequence.
+ */
+static int group_find(shm_map_t *m, struct group *g, uint64_t key,
+                      uint8_t h2, uint64_t *value, int *end) {
+  uint32_t s;
+  int slot;
+  do {
+    s = group_read_begin(m, g);
+    slot = -1;
+    for (uint32_t mm = match_byte(g->ctrl, h2); mm; mm &= mm - 1) {
+      int j = __builtin_ctz(mm);
+      if (g->keys[j] == key) {
+        *value = g->vals[j];
+        slot = j;
+        break;
+      }
+    }
+    *end = match_byte(g->ctrl, CTRL_EMPTY) != 0;
+  } while (seqlock_read_retry(&g->seq, s));
+  return slot;
+}
+
+static struct group *table_find(shm_map_t *m, struct table *t, uint64_t key,
+                                uint64_t h, uint64_t *value, int *slot) {
+  uint64_t home = home_of(t, h), v;
+  for (uint64_t i = 0; i < t->ngroups; i++) {
+    struct group *g = probe(t, home, i);
+    int end;
+    if ((*slot = group_find(m, g, key, h2_of(h), &v, &end)) >= 0) {
+      if (value)
+        *value = v;
+      return g;
+    }
+    if (end)
+      break;
+  }
+  return NULL;
+}
+
+/* Insert or replace; the caller holds the key's home lock in t */
+static int table_put(shm_map_t *m, struct table *t, uint64_t key,
+                     uint64_t h, uint64_t value) {
+  int j;
+  struct group *g = table_find(m, t, key, h, NULL, &j);
+  if (g) {
+    group_lock(m, g);
+    group_write_begin(g, j);
+    g->vals[j] = value;
+    seqlock_write_end(&g->seq);
+    spin_unlock(&g->wlock);
+    return 0;
+  }
+
+  uint64_t home = home_of(t, h);
+  for (uint64_t i = 0; i < t->ngroups; i++) {
+    g = probe(t, home, i);
+    if (!match_free(g->ctrl))
+      continue;
+    group_lock(m, g);
+    uint32_t free_mask = match_free(g->ctrl); /* Again, now that it is ours */
+    if (free_mask) {
+      j = __builtin_ctz(free_mask);
+      int was_empty = g->ctrl[j] == CTRL_EMPTY;
+      group_write_begin(g, j);
+      g->keys[j] = key;
+      g->vals[j] = value;
+      g->ctrl[j] = h2_of(h);
+      seqlock_write_end(&g->seq);
+      spin_unlock(&g->wlock);
+      if (was_empty)
+        atomic_fetch_add(&t->used, 1);
+      atomic_fetch_add(&t->live, 1);
+      return 0;
+    }
+    spin_unlock(&g->wlock);
+  }
+  errno = ENOSPC;
+  return -1;
+}
+
+static void clear_slot(shm_map_t *m, struct table *t, struct group *g,
+                       int j) {
+  group_lock(m, g);
+  group_write_begin(g, j);
+  g->ctrl[j] = CTRL_DELETED;
+  seqlock_write_end(&g->seq);
+  spin_unlock(&g->wlock);
+  atomic_fetch_sub(&t->live, 1);
+}
+
+/* The caller holds the key's home lock in t */
+static int table_del(shm_map_t *m, struct table *t, uint64_t key,
+                     uint64_t h) {
+  int j;
+  struct group *g = table_find(m, t, key, h, NULL, &j);
+  if (!g)
+    return 0;
+  clear_slot(m, t, g, j);
+  return 1;
+}
+
+static size_t table_bytes(const struct table *t) {
+  return sizeof(struct table) + t->ngroups * sizeof(struct group);
+}
+
+/* A table with no group initialized yet */
+static shm_off_t table_alloc(shm_map_t *m, uint64_t ngroups) {
+  shm_off_t off = shm_heap_alloc(
+      m->heap, sizeof(struct table) + ngroups * sizeof(struct group));
+  if (!off)
+    return 0;
+  struct table *t = tbl(m, off);
+  memset(t, 0, sizeof(*t));
+  t->ngroups = ngroups;
+  return off;
+}
+
+/* Keys and values need no initializing: only full slots' are used */
+static void table_init(struct table *t, uint64_t first, uint64_t last) {
+  for (uint64_t i = first; i < last; i++) {
+    memset(&t->groups[i], 0, offsetof(struct group, ctrl));
+    memset(t->groups[i].ctrl, CTRL_EMPTY, GROUP_SLOTS);
+  }
+}
+
+/* ------------------------------------------------------------------ */
+/* Epochs: when can nobody be reading a retired table any more?         */
+/* ------------------------------------------------------------------ */
+
+static inline void enter(shm_map_t *m) {
+  /* seq_cst: ordered before the loads of cur/old that follow */
+  atomic_store(&m->hdr->readers[m->reader].active,
+               atomic_load(&m->hdr->epoch));
+}
+
+static inline void leave(shm_map_t *m) {
+  atomic_store_explicit(&m->hdr->readers[m->reader].active, 0,
+                        memory_order_release);
+}
+
+/*
+ * Has every reader left the epochs before `epoch`? A reader that stopped
+ * short of it is only checked for being dead (a syscall) if `check_dead`.
+ */
+static int quiescent_since(shm_map_t *m, uint64_t epoch, int check_dead) {
+  for (int i = 0; i < MAX_READERS; i++) {
+    struct reader *r = &m->hdr->readers[i];
+    int32_t pid = atomic_load(&r->pid);
+    uint64_t a = atomic_load(&r->active);
+    if (pid != 0 && a != 0 && a < epoch &&
+        (!check_dead || !pid_dead(pid)))
+      return 0;
+  }
+  return 1;
+}
+
+/* Free retired tables nobody can see any more; resize_lock held */
+static void reclaim_locked(shm_map_t *m, int check_dead) {
+  struct shm_map_hdr *hdr = m->hdr;
+  for (int i = 0; i < MAX_RETIRED; i++) {
+    shm_off_t t = hdr->retired[i].table;
+    if (t && quiescent_since(m, hdr->retired[i].epoch, check_dead)) {
+      /* Forget it first: dying in between leaks it, not frees it twice */
+      hdr->retired[i].table = 0;
+      atomic_fetch_sub(&hdr->nretired, 1);
+      shm_heap_free(m->heap, t);
+    }
+  }
+}
+
+static void try_reclaim(shm_map_t *m) {
+  if (atomic_load_explicit(&m->hdr->nretired, memory_order_relaxed) == 0 ||
+      !spin_trylock(&m->hdr->resize_lock, m->pid))
+    return;
+  reclaim_locked(m, 0);
+  spin_unlock(&m->hdr->resize_lock);
+}
+
+/* ------------------------------------------------------------------ */
+/* Resizing                                                             */
+/* ------------------------------------------------------------------ */
+
+/*
+ * resize_lock was taken from a dead holder. If it died while switching
+ * tables, put cur/old back in a consistent state and make the view
+ * sequence even; also recount what it may have been retiring.
+ */
+static void resize_repair(shm_map_t *m) {
+  struct shm_map_hdr *hdr = m->hdr;
+  if (atomic_load_explicit(&hdr->view.seq, memory_order_relaxed) & 1) {
+    /* start_resize() stored old but not cur yet: undo it */
+    if (atomic_load(&hdr->old) == atomic_load(&hdr->cur))
+      atomic_store(&hdr->old, 0);
+    seqlock_write_end(&hdr->view);
+  }
+  if (atomic_load(&hdr->spare) == atomic_load(&hdr->cur))
+    atomic_store(&hdr->spare, 0); /* It did switch */
+  uint32_t n = 0;
+  for (int i = 0; i < MAX_RETIRED; i++)
+    n += hdr->retired[i].table != 0;
+  atomic_store(&hdr->nretired, n);
+}
+
+static void lock_resize(shm_map_t *m) {
+  if (spin_lock(&m->hdr->resize_lock, m->pid))
+    resize_repair(m);
+}
+
+static uint32_t read_view(shm_map_t *m, struct table **old,
+                          struct table **cur) {
+  struct shm_map_hdr *hdr = m->hdr;
+  uint32_t s;
+  /* seqlock_read_begin(), repairing the view if its writer died */
+  for (unsigned spins = 0;
+       (s = atomic_load_explicit(&hdr->view.seq, memory_order_acquire)) & 1;
+       spins++) {
+    if (spins % DEAD_CHECK == DEAD_CHECK - 1 &&
+        take_dead(&hdr->resize_lock, m->pid)) {
+      resize_repair(m);
+      spin_unlock(&hdr->resize_lock);
+    } else {
+      backoff(spins);
+    }
+  }
+  *cur = tbl(m, atomic_load(&m->hdr->cur));
+  *old = tbl(m, atomic_load(&m->hdr->old));
+  return s;
+}
+
+/*
+ * Touching every page of a big new table at once would stall one writer
+ * for milliseconds (page faults). So the next table is allocated when the
+ * current one is half full, and each write after that initializes a few
+ * of its groups, well before the table is needed. Inside an epoch.
+ */
+static void prepare_spare(shm_map_t *m, struct table *c) {
+  struct shm_map_hdr *hdr = m->hdr;
+  if (!spin_trylock(&hdr->resize_lock, m->pid))
+    return;
+  if (!atomic_load(&hdr->spare) && !atomic_load(&hdr->old) &&
+      tbl(m, atomic_load(&hdr->cur)) == c) {
+    /* Same size if the slots are mostly tombstones, else double */
+    uint64_t ngroups = c->ngroups;
+    if (atomic_load(&c->live) * 4 >= ngroups * GROUP_SLOTS)
+      ngroups *= 2;
+    atomic_store(&hdr->spare, table_alloc(m, ngroups));
+  }
+  spin_unlock(&hdr->resize_lock);
+}
+
+/*
+ * Initialize the next INIT_STEP groups of the spare, unless another
+ * writer is at it. One at a time, and the cursor only moves once the
+ * groups are done: nobody can still be clearing a group after the spare
+ * went live, and a dead initializer's groups are just done again.
+ */
+static void init_spare(shm_map_t *m, struct table *t) {
+  if (!spin_trylock(&t->init_lock, m->pid))
+    return;
+  uint64_t first = atomic_load(&t->init_cursor);
+  uint64_t last = first + INIT_STEP < t->ngroups ? first + INIT_STEP
+                                                 : t->ngroups;
+  table_init(t, first, last);
+  atomic_store(&t->init_cursor, last);
+  spin_unlock(&t->init_lock);
+}
+
+/*
+ * Start moving everything from c to the spare table; inside an epoch.
+ * Returns 0, also if someone else resized first, or -1 with errno set.
+ */
+static int start_resize(shm_map_t *m, struct table *c) {
+  struct shm_map_hdr *hdr = m->hdr;
+  lock_resize(m);
+
+  int rc = 0;
+  shm_off_t coff = atomic_load(&hdr->cur);
+  if (atomic_load(&hdr->old) == 0 && tbl(m, coff) == c) {
+    reclaim_locked(m, 1);
+    shm_off_t noff = atomic_load(&hdr->spare);
+    if (!noff) /* Grew from below half full in one go */
+      noff = table_alloc(m, c->ngroups * 2);
+    if (atomic_load(&hdr->nretired) == MAX_RETIRED) {
+      errno = EBUSY; /* Readers stuck in old tables */
+      rc = -1;
+    } else if (!noff) {
+      rc = -1;
+    } else {
+      /* Finish the spare; its lock keeps late initializers out */
+      struct table *n = tbl(m, noff);
+      spin_lock(&n->init_lock, m->pid);
+      table_init(n, atomic_load(&n->init_cursor), n->ngroups);
+      atomic_store(&n->init_cursor, n->ngroups);
+      spin_unlock(&n->init_lock);
+      c->next = noff;
+      seqlock_write_begin(&hdr->view);
+      atomic_store(&hdr->old, coff);
+      atomic_store(&hdr->cur, noff);
+      seqlock_write_end(&hdr->view);
+      atomic_store(&hdr->spare, 0);
+      atomic_fetch_add(&hdr->resizes, 1);
+    }
+    if (rc == -1 && noff && !atomic_load(&hdr->spare))
+      atomic_store(&hdr->spare, noff); /* Keep it for next time */
+  }
+  int saved = errno;
+  spin_unlock(&hdr->resize_lock);
+  errno = saved;
+  return rc;
+}
+
+/*
+ * Every home group of o has moved: o is no longer part of the map. Does
+ * nothing if someone already finished it.
+ */
+static void finish_resize(shm_map_t *m, struct table *o) {
+  struct shm_map_hdr *hdr = m->hdr;
+  lock_resize(m);
+  if (atomic_load(&hdr->old) != shm_heap_off(m->heap, o)) {
+    spin_unlock(&hdr->resize_lock);
+    return;
+  }
+  seqlock_write_begin(&hdr->view);
+  atomic_store(&hdr->old, 0);
+  seqlock_write_end(&hdr->view);
+  /* Readers that entered before this epoch may still be looking at o */
+  uint64_t epoch = atomic_fetch_add(&hdr->epoch, 1) + 1;
+  for (int i = 0; i < MAX_RETIRED; i++) {
+    if (!hdr->retired[i].table) {
+      hdr->retired[i].epoch = epoch; /* Before the table, for repairs */
+      hdr->retired[i].table = shm_heap_off(m->heap, o);
+      atomic_fetch_add(&hdr->nretired, 1);
+      break;
+    }
+  }
+  spin_unlock(&hdr->resize_lock);
+}
+
+/*
+ * Move every key whose home is group s of o into o's successor. Keys are
+ * copied before they are cleared, so this may run again on a group whose
+ * mover died halfway. Returns 1 if this call moved the group, 0 if it had
+ * been moved already.
+ */
+static int migrate_home(shm_map_t *m, struct table *o, uint64_t s) {
+  struct table *n = tbl(m, o->next);
+  struct group *hg = &o->groups[s];
+
+  spin_lock(&hg->home, m->pid);
+  if (atomic_load(&hg->moved)) {
+    spin_unlock(&hg->home);
+    return 0;
+  }
+  for (uint64_t i = 0; i < o->ngroups; i++) {
+    struct group *g = probe(o, s, i);
+    uint8_t ctrl[GROUP_SLOTS];
+    uint64_t keys[GROUP_SLOTS], vals[GROUP_SLOTS];
+    uint32_t seq;
+    do {
+      seq = group_read_begin(m, g);
+      memcpy(ctrl, g->ctrl, sizeof(ctrl));
+      memcpy(keys, g->keys, sizeof(keys));
+      memcpy(vals, g->vals, sizeof(vals));
+    } while (seqlock_read_retry(&g->seq, seq));
+
+    /* Slots of our home group are stable: only we may change them now */
+    for (uint32_t full = ~match_free(ctrl) & 0xffff; full; full &= full - 1) {
+      int j = __builtin_ctz(full);
+      uint64_t h = hash_key(keys[j]);
+      if (home_of(o, h) != s)
+        continue;
+      struct group *nh = &n->groups[home_of(n, h)];
+      spin_lock(&nh->home, m->pid);
+      table_put(m, n, keys[j], h, vals[j]);
+      spin_unlock(&nh->home);
+      clear_slot(m, o, g, j);
+    }
+    if (match_byte(ctrl, CTRL_EMPTY))
+      break;
+  }
+  atomic_store(&hg->moved, 1);
+  spin_unlock(&hg->home);
+  return 1;
+}
+
+/* Writers pay for the resize a few home groups at a time */
+static void help_migrate(shm_map_t *m) {
+  struct table *o, *c;
+  enter(m);
+  read_view(m, &o, &c);
+  for (int k = 0; o && k < MIGRATE_STEP; k++) {
+    uint64_t s = atomic_fetch_add(&o->mig_cursor, 1);
+    if (s >= o->ngroups)
+      break;
+    if (migrate_home(m, o, s) &&
+        atomic_fetch_add(&o->migrated, 1) + 1 == o->ngroups)
+      finish_resize(m, o);
+  }
+  leave(m);
+}
+
+/*
+ * Every home group has been handed out but the resize is not finishing:
+ * a mover may have died. Move whatever is left ourselves (migrate_home()
+ * waits for live movers and takes over from dead ones). After that every
+ * group has moved, so finish the resize even if `migrated` never got
+ * there: a mover may have died between moving a group and counting it.
+ */
+static void adopt_moves(shm_map_t *m) {
+  struct table *o, *c;
+  enter(m);
+  read_view(m, &o, &c);
+  if (o && atomic_load(&o->mig_cursor) >= o->ngroups) {
+    for (uint64_t s = 0; s < o->ngroups; s++)
+      if (!atomic_load(&o->groups[s].moved) && migrate_home(m, o, s))
+        atomic_fetch_add(&o->migrated, 1);
+    finish_resize(m, o);
+  }
+  leave(m);
+}
+
+static void wait_resize(shm_map_t *m) {
+  for (unsigned rounds = 1; atomic_load(&m->hdr->old); rounds++) {
+    help_migrate(m);
+    if (rounds % DEAD_CHECK == 0)
+      adopt_moves(m);
+    sched_yield();
+  }
+}
+
+/* ------------------------------------------------------------------ */
+/* API                                                                  */
+/* ------------------------------------------------------------------ */
+
+int shm_map_create(shm_map_t *m, shm_heap_t *heap, size_t capacity,
+                   shm_off_t *where) {
+  uint64_t ngroups = 1;
+  while (ngroups * GROUP_SLOTS * 7 / 8 < capacity)
+    ngroups *= 2;
+
+  m->heap = heap;
+  shm_off_t hoff = shm_heap_alloc(heap, sizeof(struct shm_map_hdr));
+  if (!hoff)
+    return -1;
+  shm_off_t toff = table_alloc(m, ngroups);
+  if (!toff) {
+    int saved = errno;
+    shm_heap_free(heap, hoff);
+    errno = saved;
+    return -1;
+  }
+
+  table_init(tbl(m, toff), 0, ngroups);
+
+  struct shm_map_hdr *hdr = shm_heap_ptr(heap, hoff);
+  memset(hdr, 0, sizeof(*hdr));
+  seqlock_init(&hdr->view);
+  atomic_init(&hdr->cur, toff);
+  atomic_init(&hdr->epoch, 1);
+  atomic_thread_fence(memory_order_release);
+  hdr->magic = SHM_MAP_MAGIC;
+
+  *where = hoff;
+  return shm_map_attach(m, heap, hoff);
+}
+
+int shm_map_attach(shm_map_t *m, shm_heap_t *heap, shm_off_t where) {
+  m->heap = heap;
+  m->hdr = shm_heap_ptr(heap, where);
+  m->reader = -1;
+  m->pid = getpid();
+  if (!m->hdr || m->hdr->magic != SHM_MAP_MAGIC) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  for (int i = 0; i < MAX_READERS; i++) {
+    struct reader *r = &m->hdr->readers[i];
+    int32_t pid = atomic_load(&r->pid);
+    if ((pid == 0 || pid_dead(pid)) &&
+        atomic_compare_exchange_strong(&r->pid, &pid, getpid())) {
+      atomic_store(&r->active, 0);
+      m->reader = i;
+      return 0;
+    }
+  }
+  errno = EUSERS;
+  return -1;
+}
+
+void shm_map_detach(shm_map_t *m) {
+  if (m->reader >= 0)
+    atomic_store(&m->hdr->readers[m->reader].pid, 0);
+  m->reader = -1;
+}
+
+int shm_map_get(shm_map_t *m, uint64_t key, uint64_t *value) {
+  uint64_t h = hash_key(key);
+  struct table *o, *c;
+  int slot;
+
+  enter(m);
+  for (;;) {
+    uint32_t s = read_view(m, &o, &c);
+    /* Old table first: a key missing there has already been copied */
+    int found = (o && table_find(m, o, key, h, value, &slot)) ||
+                table_find(m, c, key, h, value, &slot);
+    if (!seqlock_read_retry(&m->hdr->view, s)) {
+      leave(m);
+      return found;
+    }
+  }
+}
+
+/*
+ * Lock the key's home groups (old table, then current) for a valid view.
+ * *oh is NULL when there is no old table or the key's home there has
+ * already moved.
+ */
+static void lock_homes(shm_map_t *m, uint64_t h, struct table **o,
+                       struct table **c, struct group **oh,
+                       struct group **ch) {
+  for (;;) {
+    uint32_t s = read_view(m, o, c);
+    *oh = NULL;
+    if (*o) {
+      *oh = &(*o)->groups[home_of(*o, h)];
+      spin_lock(&(*oh)->home, m->pid);
+      if (atomic_load(&(*oh)->moved)) {
+        spin_unlock(&(*oh)->home);
+        *oh = NULL;
+      }
+    }
+    *ch = &(*c)->groups[home_of(*c, h)];
+    spin_lock(&(*ch)->home, m->pid);
+    if (!seqlock_read_retry(&m->hdr->view, s))
+      return;
+    /* A resize started or finished meanwhile */
+    spin_unlock(&(*ch)->home);
+    if (*oh)
+      spin_unlock(&(*oh)->home);
+  }
+}
+
+static void unlock_homes(struct group *oh, struct group *ch) {
+  spin_unlock(&ch->home);
+  if (oh)
+    spin_unlock(&oh->home);
+}
+
+int shm_map_put(shm_map_t *m, uint64_t key, uint64_t value) {
+  uint64_t h = hash_key(key);
+  struct table *o, *c;
+  struct group *oh, *ch;
+
+  try_reclaim(m);
+  help_migrate(m);
+
+  for (;;) {
+    enter(m);
+    lock_homes(m, h, &o, &c, &oh, &ch);
+    if (atomic_load(&c->used) >= c->ngroups * GROUP_SLOTS * 7 / 8) {
+      /* Full enough that probe chains get long: resize, or wait for the
+       * resize in progress (its last home groups may belong to a
+       * preempted process) instead of filling the new table up */
+      unlock_homes(oh, ch);
+      int wait = o != NULL;
+      if (!o && start_resize(m, c) == -1) {
+        /* Out of memory: keep filling this table while it lasts */
+        lock_homes(m, h, &o, &c, &oh, &ch);
+      } else {
+        leave(m);
+        if (wait)
+          wait_resize(m);
+        continue;
+      }
+    }
+    int rc = table_put(m, c, key, h, value);
+    if (rc == 0 && oh)
+      table_del(m, o, key, h); /* Only after the new copy is visible */
+    int saved = errno;
+    unlock_homes(oh, ch);
+
+    if (!o && atomic_load(&c->used) >= c->ngroups * GROUP_SLOTS / 2) {
+      struct table *spare = tbl(m, atomic_load(&m->hdr->spare));
+      if (spare)
+        init_spare(m, spare);
+      else
+        prepare_spare(m, c);
+    }
+    leave(m);
+    errno = saved;
+    return rc;
+  }
+}
+
+int shm_map_del(shm_map_t *m, uint64_t key) {
+  uint64_t h = hash_key(key);
+  struct table *o, *c;
+  struct group *oh, *ch;
+
+  try_reclaim(m);
+  help_migrate(m);
+
+  enter(m);
+  lock_homes(m, h, &o, &c, &oh, &ch);
+  /* New table first, so a lookup cannot find the old copy after the new
+   * one is gone and then miss in both */
+  int found = table_del(m, c, key, h);
+  if (oh)
+    found |= table_del(m, o, key, h);
+  unlock_homes(oh, ch);
+  leave(m);
+  return found;
+}
+
+void shm_map_stats(shm_map_t *m, shm_map_stats_t *st) {
+  struct table *o, *c;
+
+  enter(m);
+  read_view(m, &o, &c);
+  st->size = atomic_load(&c->live) + (o ? atomic_load(&o->live) : 0);
+  st->capacity = c->ngroups * GROUP_SLOTS;
+  st->tombstones = atomic_load(&c->used) - atomic_load(&c->live);
+  st->resizing = o != NULL;
+  st->resizes = atomic_load(&m->hdr->resizes);
+  st->table_bytes = table_bytes(c) + (o ? table_bytes(o) : 0);
+  struct table *spare = tbl(m, atomic_load(&m->hdr->spare));
+  st->spare_bytes = spare ? table_bytes(spare) : 0;
+  leave(m);
+}
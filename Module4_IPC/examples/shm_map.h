@@ -0,0 +1,109 @@
+/*
+ * shm_map.h - Concurrent hash map shared by many processes
+ *
+ * N worker processes that each build a private copy of the same lookup
+ * table hold N copies of it in RAM. One shm_map in a shared heap
+ * (shm_heap.h) is built once and mapped by all of them.
+ *
+ * Layout (all in the heap, linked by offsets):
+ *
+ *   group: [ seq | locks | 16 control bytes | 16 keys | 16 values ]
+ *
+ * Open addressing over groups of 16 slots, like SwissTable. Each slot has
+ * a control byte: EMPTY, DELETED, or 7 bits of the key's hash. A lookup
+ * compares all 16 control bytes of a group with one SSE2 instruction and
+ * looks at the keys only where the 7 bits match, so a probe is usually
+ * one control-byte load and one key compare.
+ *
+ * Lookups take no lock and store nothing shared but their own epoch word:
+ * each group carries a seqlock (seqlock.h), and a lookup that raced a
+ * writer in that group just reads the group again. Writers lock the key's
+ * home group (all writers of one key serialize there) and then, briefly,
+ * the group they change.
+ *
+ * Growing is incremental. At half full, a table twice the size is
+ * allocated, and writes initialize it a few groups at a time. Past 7/8
+ * full it becomes the current table and every later write also moves a
+ * few home groups' keys over. Meanwhile lookups try the old table first,
+ * then the new one, so no caller ever waits for a whole-table rehash. The
+ * old table is freed once no process can still be reading it (epoch-based
+ * reclamation).
+ *
+ * Crashes: a process killed mid-lookup only delays the freeing of old
+ * tables until its death is noticed. Every lock word holds its owner's
+ * PID, and whoever has waited on a lock for a while checks that owner
+ * with kill(pid, 0); if it is gone, the waiter takes the lock over and
+ * repairs what the dead writer may have left behind:
+ *   - a group it was changing (odd sequence): the slot it was writing is
+ *     marked DELETED, which loses that one key, and the sequence is made
+ *     even. Lookups probing the group do this themselves rather than
+ *     wait forever;
+ *   - a home group it was moving during a resize: moving is safe to
+ *     redo, since keys are copied before they are cleared, so writers
+ *     waiting for the resize move it (and finish the resize) themselves;
+ *   - a table switch: cur/old are put back in a consistent state.
+ * What is not repaired: a put that died between writing the new table
+ * and deleting the old copy leaves that key's old value visible; a
+ * writer that died while retiring or freeing a table leaks it; the size
+ * statistics may be off by one per repair; and a dead owner's PID reused
+ * by a new process before anyone noticed keeps its locks held. Detection
+ * takes a few thousand spins (milliseconds), not a timeout.
+ *
+ * Keys and values are 64-bit. For bigger records, hash the key to 64 bits
+ * and store the shm_off_t of the record as the value.
+ */
+
+#ifndef SHM_MAP_H
+#define SHM_MAP_H
+
+#include "shm_heap.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct shm_map_hdr; /* Lives in the heap, see shm_map.c */
+
+/* Per-process (per-thread) handle onto a map */
+typedef struct {
+  shm_heap_t *heap;
+  struct shm_map_hdr *hdr;
+  int reader;   /* Epoch slot */
+  uint32_t pid; /* Lock owner ID: getpid() at attach */
+} shm_map_t;
+
+typedef struct {
+  size_t size;       /* Keys stored */
+  size_t capacity;   /* Slots in the current table */
+  size_t tombstones; /* DELETED slots in the current table */
+  int resizing;      /* Keys are still moving from an older table */
+  unsigned long resizes;
+  size_t table_bytes; /* Current table, plus the old one while resizing */
+  size_t spare_bytes; /* Next table, allocated early (untouched pages of it
+                         take no RAM yet) */
+} shm_map_stats_t;
+
+/*
+ * Create a map in `heap` sized for about `capacity` keys (it grows as
+ * needed) and attach to it. *where receives its offset, for other
+ * processes' shm_map_attach() (shm_heap_set_root() is a good place).
+ * Returns 0 on success, -1 with errno set on failure.
+ */
+int shm_map_create(shm_map_t *m, shm_heap_t *heap, size_t capacity,
+                   shm_off_t *where);
+
+/* Attach to the map at `where`; -1/EUSERS if all epoch slots are taken */
+int shm_map_attach(shm_map_t *m, shm_heap_t *heap, shm_off_t where);
+void shm_map_detach(shm_map_t *m);
+
+/* Lock-free lookup: 1 and *value set if found, 0 if not */
+int shm_map_get(shm_map_t *m, uint64_t key, uint64_t *value);
+
+/* Insert or replace. Returns 0, or -1 with errno ENOMEM/ENOSPC */
+int shm_map_put(shm_map_t *m, uint64_t key, uint64_t value);
+
+/* Returns 1 if the key was removed, 0 if it was not there */
+int shm_map_del(shm_map_t *m, uint64_t key);
+
+void shm_map_stats(shm_map_t *m, shm_map_stats_t *st);
+
+#endif /* SHM_MAP_H */
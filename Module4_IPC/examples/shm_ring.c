@@ -0,0 +1,450 @@
+/*
+ * shm_ring.c - Lock-free ring buffer transport over POSIX shared memory
+ *
+ * See shm_ring.h for the API and segment layout.
+ *
+ * Indices are 64-bit byte positions that only ever grow; the offset into
+ * the data area is (position & mask). They never wrap in practice, which
+ * makes "empty" (head == tail) and "full" (head - tail == capacity)
+ * unambiguous and rules out ABA on the compare-and-swap loops.
+ *
+ * MPMC records carry a stamp so consumers can tell a committed record from
+ * a reserved-but-unwritten one or stale bytes from an earlier lap:
+ *   stamp == pos + 1   record at pos is committed and ready
+ *   stamp == ~pos      record at pos has been consumed
+ * Consumers release space out of order by marking records consumed; whoever
+ * finds the oldest record consumed moves tail forward over it.
+ */
+
+#define _GNU_SOURCE
+
+#include "shm_ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define SHM_RING_MAGIC 0x52494e47u /* "RING" */
+#define CACHELINE 64
+#define HEADER_BYTES 4096 /* Data starts on its own page */
+#define REC_HDR 16
+#define REC_PAD 0x1u
+#define SPIN_BEFORE_SLEEP 200
+
+#define STAMP_READY(pos) ((pos) + 1)
+#define STAMP_CONSUMED(pos) (~(pos))
+
+struct shm_ring_hdr {
+  uint32_t magic;
+  uint32_t mode;
+  uint64_t capacity;
+  /* Producers: next byte to reserve */
+  _Alignas(CACHELINE) _Atomic uint64_t head;
+  /* MPMC consumers: next record to claim */
+  _Alignas(CACHELINE) _Atomic uint64_t claim;
+  /* First byte still in use; space before it is free */
+  _Alignas(CACHELINE) _Atomic uint64_t tail;
+  /* Sleeping consumers */
+  _Alignas(CACHELINE) _Atomic uint32_t data_seq; /* futex word */
+  _Atomic uint32_t need_wake;                    /* a consumer may sleep */
+  _Atomic uint32_t shutdown;
+};
+
+struct rec_hdr {
+  _Atomic uint64_t stamp; /* MPMC only */
+  uint32_t len;
+  uint32_t flags;
+};
+
+_Static_assert(sizeof(struct shm_ring_hdr) <= HEADER_BYTES,
+               "ring header must fit in the header page");
+_Static_assert(sizeof(struct rec_hdr) == REC_HDR, "record header size");
+
+static inline uint64_t rec_size(uint32_t len) {
+  return REC_HDR + (((uint64_t)len + 15) & ~(uint64_t)15);
+}
+
+static inline struct rec_hdr *rec_at(const shm_ring_t *ring, uint64_t pos) {
+  return (struct rec_hdr *)(ring->data + (pos & ring->mask));
+}
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+static int futex_wait(_Atomic uint32_t *addr, uint32_t expected) {
+  return syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT, expected, NULL,
+                 NULL, 0);
+}
+
+static int futex_wake(_Atomic uint32_t *addr, int count) {
+  return syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE, count, NULL, NULL,
+                 0);
+}
+
+/*
+ * Called by producers after publishing: wake consumers only if one is
+ * about to sleep. The flag is cleared by exchange, so a burst of sends
+ * costs one futex_wake() rather than one per message.
+ */
+static inline void wake_consumers(shm_ring_t *ring) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&ring->hdr->need_wake, memory_order_relaxed) &&
+      atomic_exchange(&ring->hdr->need_wake, 0)) {
+    atomic_fetch_add(&ring->hdr->data_seq, 1);
+    futex_wake(&ring->hdr->data_seq, INT_MAX);
+  }
+}
+
+static int map_ring(shm_ring_t *ring, int fd, size_t map_size) {
+  void *base =
+      mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED)
+    return -1;
+
+  memset(ring, 0, sizeof(*ring));
+  ring->hdr = base;
+  ring->data = (unsigned char *)base + HEADER_BYTES;
+  ring->map_size = map_size;
+  ring->fd = fd;
+  return 0;
+}
+
+int shm_ring_create(shm_ring_t *ring, const char *name, size_t capacity,
+                    shm_ring_mode_t mode) {
+  if (mode != SHM_RING_SPSC && mode != SHM_RING_MPMC) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  size_t cap = 4096;
+  while (cap < capacity)
+    cap <<= 1;
+
+  int fd = shm_open(name, O_CREAT | O_RDWR, 0666);
+  if (fd == -1)
+    return -1;
+
+  /* Truncate to zero first so a reused name starts with zeroed records */
+  if (ftruncate(fd, 0) == -1 || ftruncate(fd, HEADER_BYTES + cap) == -1 ||
+      map_ring(ring, fd, HEADER_BYTES + cap) == -1) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+
+  struct shm_ring_hdr *hdr = ring->hdr;
+  hdr->mode = mode;
+  hdr->capacity = cap;
+  atomic_init(&hdr->head, 0);
+  atomic_init(&hdr->claim, 0);
+  atomic_init(&hdr->tail, 0);
+  atomic_init(&hdr->data_seq, 0);
+  atomic_init(&hdr->need_wake, 0);
+  atomic_init(&hdr->shutdown, 0);
+  atomic_thread_fence(memory_order_release);
+  hdr->magic = SHM_RING_MAGIC;
+
+  ring->mask = cap - 1;
+  return 0;
+}
+
+int shm_ring_open(shm_ring_t *ring, const char *name) {
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd == -1)
+    return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size <= HEADER_BYTES ||
+      map_ring(ring, fd, st.st_size) == -1) {
+    int saved = errno ? errno : EINVAL;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+
+  if (ring->hdr->magic != SHM_RING_MAGIC ||
+      HEADER_BYTES + ring->hdr->capacity != (size_t)st.st_size) {
+    shm_ring_close(ring);
+    errno = EINVAL;
+    return -1;
+  }
+
+  ring->mask = ring->hdr->capacity - 1;
+  return 0;
+}
+
+void shm_ring_close(shm_ring_t *ring) {
+  if (ring->hdr)
+    munmap(ring->hdr, ring->map_size);
+  if (ring->fd != -1)
+    close(ring->fd);
+  ring->hdr = NULL;
+  ring->fd = -1;
+}
+
+int shm_ring_unlink(const char *name) { return shm_unlink(name); }
+
+size_t shm_ring_max_msg(const shm_ring_t *ring) {
+  /* Keep wrap padding from wasting more than a quarter of the ring */
+  return ring->hdr->capacity / 4 - REC_HDR;
+}
+
+/* ---------------------------------------------------------------------- */
+/* SPSC: single writer per index, plain acquire/release                   */
+/* ---------------------------------------------------------------------- */
+
+static int spsc_try_send(shm_ring_t *ring, const void *buf, size_t len) {
+  struct shm_ring_hdr *hdr = ring->hdr;
+  uint64_t head = atomic_load_explicit(&hdr->head, memory_order_relaxed);
+  uint64_t size = rec_size(len);
+  uint64_t to_end = hdr->capacity - (head & ring->mask);
+  uint64_t total = size <= to_end ? size : to_end + size;
+
+  if (head + total - ring->cached_tail > hdr->capacity) {
+    ring->cached_tail =
+        atomic_load_explicit(&hdr->tail, memory_order_acquire);
+    if (head + total - ring->cached_tail > hdr->capacity) {
+      errno = EAGAIN;
+      return -1;
+    }
+  }
+
+  uint64_t pos = head;
+  if (size > to_end) {
+    struct rec_hdr *pad = rec_at(ring, pos);
+    pad->len = to_end - REC_HDR;
+    pad->flags = REC_PAD;
+    pos += to_end;
+  }
+
+  struct rec_hdr *rec = rec_at(ring, pos);
+  rec->len = len;
+  rec->flags = 0;
+  memcpy(rec + 1, buf, len);
+
+  atomic_store_explicit(&hdr->head, head + total, memory_order_release);
+  wake_consumers(ring);
+  return 0;
+}
+
+static ssize_t spsc_try_recv(shm_ring_t *ring, void *buf, size_t buflen) {
+  struct shm_ring_hdr *hdr = ring->hdr;
+  uint64_t tail = atomic_load_explicit(&hdr->tail, memory_order_relaxed);
+
+  for (;;) {
+    if (tail == ring->cached_head) {
+      ring->cached_head =
+          atomic_load_explicit(&hdr->head, memory_order_acquire);
+      if (tail == ring->cached_head) {
+        errno = EAGAIN;
+        return -1;
+      }
+    }
+
+    struct rec_hdr *rec = rec_at(ring, tail);
+    if (rec->flags & REC_PAD) {
+      tail += rec_size(rec->len);
+      atomic_store_explicit(&hdr->tail, tail, memory_order_release);
+      continue;
+    }
+
+    if (rec->len > buflen) {
+      errno = EMSGSIZE;
+      return -1;
+    }
+
+    size_t len = rec->len;
+    memcpy(buf, rec + 1, len);
+    atomic_store_explicit(&hdr->tail, tail + rec_size(len),
+                          memory_order_release);
+    return len;
+  }
+}
+
+/* ---------------------------------------------------------------------- */
+/* MPMC: CAS to reserve/claim, stamps to publish, out-of-order release    */
+/* ---------------------------------------------------------------------- */
+
+static int mpmc_try_send(shm_ring_t *ring, const void *buf, size_t len) {
+  struct shm_ring_hdr *hdr = ring->hdr;
+  uint64_t size = rec_size(len);
+  uint64_t head = atomic_load_explicit(&hdr->head, memory_order_relaxed);
+  uint64_t to_end, total;
+
+  do {
+    uint64_t tail = atomic_load_explicit(&hdr->tail, memory_order_acquire);
+    to_end = hdr->capacity - (head & ring->mask);
+    total = size <= to_end ? size : to_end + size;
+    if (head + total - tail > hdr->capacity) {
+      errno = EAGAIN;
+      return -1;
+    }
+  } while (!atomic_compare_exchange_weak_explicit(
+      &hdr->head, &head, head + total, memory_order_relaxed,
+      memory_order_relaxed));
+
+  uint64_t pos = head;
+  if (size > to_end) {
+    struct rec_hdr *pad = rec_at(ring, pos);
+    pad->len = to_end - REC_HDR;
+    pad->flags = REC_PAD;
+    atomic_store_explicit(&pad->stamp, STAMP_READY(pos),
+                          memory_order_release);
+    pos += to_end;
+  }
+
+  struct rec_hdr *rec = rec_at(ring, pos);
+  rec->len = len;
+  rec->flags = 0;
+  memcpy(rec + 1, buf, len);
+  atomic_store_explicit(&rec->stamp, STAMP_READY(pos), memory_order_release);
+
+  wake_consumers(ring);
+  return 0;
+}
+
+/* Move tail over every consumed record at the front of the ring */
+static void mpmc_release(shm_ring_t *ring) {
+  struct shm_ring_hdr *hdr = ring->hdr;
+  uint64_t tail = atomic_load(&hdr->tail);
+
+  for (;;) {
+    struct rec_hdr *rec = rec_at(ring, tail);
+    if (atomic_load(&rec->stamp) != STAMP_CONSUMED(tail))
+      return; /* Oldest record still being read: its reader will advance */
+    uint64_t next = tail + rec_size(rec->len);
+    if (atomic_compare_exchange_strong(&hdr->tail, &tail, next))
+      tail = next;
+    /* On failure tail was reloaded: another consumer moved it */
+  }
+}
+
+static ssize_t mpmc_try_recv(shm_ring_t *ring, void *buf, size_t buflen) {
+  struct shm_ring_hdr *hdr = ring->hdr;
+  uint64_t pos = atomic_load_explicit(&hdr->claim, memory_order_acquire);
+
+  for (;;) {
+    struct rec_hdr *rec = rec_at(ring, pos);
+    if (atomic_load_explicit(&rec->stamp, memory_order_acquire) !=
+        STAMP_READY(pos)) {
+      errno = EAGAIN; /* Empty, or the producer has not committed yet */
+      return -1;
+    }
+
+    uint32_t len = rec->len;
+    int is_pad = rec->flags & REC_PAD;
+    if (!is_pad && len > buflen) {
+      errno = EMSGSIZE;
+      return -1;
+    }
+
+    /* Claim it; on failure pos is reloaded with the new claim index */
+    if (!atomic_compare_exchange_weak_explicit(
+            &hdr->claim, &pos, pos + rec_size(len), memory_order_acquire,
+            memory_order_acquire))
+      continue;
+
+    if (!is_pad)
+      memcpy(buf, rec + 1, len);
+    atomic_store(&rec->stamp, STAMP_CONSUMED(pos));
+    mpmc_release(ring);
+
+    if (!is_pad)
+      return len;
+    pos += rec_size(len);
+  }
+}
+
+/* ---------------------------------------------------------------------- */
+/* Public entry points                                                    */
+/* ---------------------------------------------------------------------- */
+
+int shm_ring_try_send(shm_ring_t *ring, const void *buf, size_t len) {
+  if (len == 0) {
+    errno = EINVAL; /* recv's 0 means "shut down", like read()'s EOF */
+    return -1;
+  }
+  if (len > shm_ring_max_msg(ring)) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  return ring->hdr->mode == SHM_RING_SPSC ? spsc_try_send(ring, buf, len)
+                                          : mpmc_try_send(ring, buf, len);
+}
+
+int shm_ring_send(shm_ring_t *ring, const void *buf, size_t len) {
+  int spins = 0;
+  while (shm_ring_try_send(ring, buf, len) == -1) {
+    if (errno != EAGAIN)
+      return -1;
+    if (++spins < SPIN_BEFORE_SLEEP)
+      cpu_relax();
+    else
+      sched_yield(); /* Full: let the consumer run */
+  }
+  return 0;
+}
+
+ssize_t shm_ring_try_recv(shm_ring_t *ring, void *buf, size_t buflen) {
+  return ring->hdr->mode == SHM_RING_SPSC
+             ? spsc_try_recv(ring, buf, buflen)
+             : mpmc_try_recv(ring, buf, buflen);
+}
+
+/* Is there a record a consumer could take right now? */
+static int ring_has_data(shm_ring_t *ring) {
+  struct shm_ring_hdr *hdr = ring->hdr;
+  if (hdr->mode == SHM_RING_SPSC)
+    return atomic_load(&hdr->head) != atomic_load(&hdr->tail);
+
+  uint64_t pos = atomic_load(&hdr->claim);
+  return atomic_load(&rec_at(ring, pos)->stamp) == STAMP_READY(pos);
+}
+
+ssize_t shm_ring_recv(shm_ring_t *ring, void *buf, size_t buflen) {
+  struct shm_ring_hdr *hdr = ring->hdr;
+
+  for (;;) {
+    for (int spin = 0; spin < SPIN_BEFORE_SLEEP; spin++) {
+      ssize_t n = shm_ring_try_recv(ring, buf, buflen);
+      if (n >= 0 || errno != EAGAIN)
+        return n;
+      cpu_relax();
+    }
+
+    /*
+     * Announce ourselves, then re-check. A producer publishes and then
+     * checks need_wake, so one of the two sides always sees the other.
+     * If a wake slips in after the snapshot, futex_wait returns at once.
+     */
+    uint32_t seq = atomic_load(&hdr->data_seq);
+    atomic_store(&hdr->need_wake, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (!ring_has_data(ring)) {
+      if (atomic_load(&hdr->shutdown))
+        return 0;
+      futex_wait(&hdr->data_seq, seq);
+    }
+  }
+}
+
+void shm_ring_shutdown(shm_ring_t *ring) {
+  atomic_store(&ring->hdr->shutdown, 1);
+  atomic_fetch_add(&ring->hdr->data_seq, 1);
+  futex_wake(&ring->hdr->data_seq, INT_MAX);
+}
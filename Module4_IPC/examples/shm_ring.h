@@ -0,0 +1,90 @@
+/*
+ * shm_ring.h - Lock-free ring buffer transport over POSIX shared memory
+ *
+ * Same shm_open()/mmap() setup as 02_shared_memory.c, but instead of one
+ * slot guarded by a semaphore the segment holds a ring of variable-length
+ * records. Producers and consumers never take a lock:
+ *
+ *   SHM_RING_SPSC - one producer, one consumer. head/tail are plain
+ *                   release/acquire stores, no read-modify-write at all.
+ *   SHM_RING_MPMC - any number of producers and consumers. Space is
+ *                   reserved and records are claimed with compare-and-swap.
+ *
+ * A consumer that finds the ring empty spins briefly, then sleeps on a
+ * futex. Producers only pay for a futex_wake() when someone is sleeping.
+ *
+ * Segment layout (one shm object):
+ *
+ *   [ header page: config + cache-line padded indices + futex word ]
+ *   [ data: capacity bytes of 16-byte aligned records ]
+ *
+ * Each record is a 16-byte header (position stamp + length) followed by the
+ * payload rounded up to 16 bytes. A record never wraps: if it does not fit
+ * before the end of the data area, a padding record fills the gap.
+ */
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef enum { SHM_RING_SPSC = 1, SHM_RING_MPMC = 2 } shm_ring_mode_t;
+
+struct shm_ring_hdr; /* Lives in shared memory, see shm_ring.c */
+
+/* Per-process handle onto a ring segment */
+typedef struct {
+  struct shm_ring_hdr *hdr;
+  unsigned char *data;
+  size_t map_size;
+  uint64_t mask;
+  int fd;
+  /* SPSC only: last index seen from the other side (avoids sharing lines) */
+  uint64_t cached_head;
+  uint64_t cached_tail;
+} shm_ring_t;
+
+/*
+ * Create (or truncate) ring `name` with `capacity` bytes of record space.
+ * capacity is rounded up to a power of two (minimum 4 KiB).
+ * Returns 0 on success, -1 with errno set on failure.
+ */
+int shm_ring_create(shm_ring_t *ring, const char *name, size_t capacity,
+                    shm_ring_mode_t mode);
+
+/* Attach to an existing ring created by another process */
+int shm_ring_open(shm_ring_t *ring, const char *name);
+
+/* Detach (does not remove the shm object) */
+void shm_ring_close(shm_ring_t *ring);
+
+/* Remove the shm object name */
+int shm_ring_unlink(const char *name);
+
+/* Largest payload one record may carry for this ring */
+size_t shm_ring_max_msg(const shm_ring_t *ring);
+
+/*
+ * Append one record. try_send returns -1/EAGAIN when the ring is full;
+ * send spins (yielding the CPU) until space frees up.
+ * Both return -1/EMSGSIZE if len > shm_ring_max_msg(), and -1/EINVAL if
+ * len is 0: an empty record would look like shutdown to shm_ring_recv().
+ */
+int shm_ring_try_send(shm_ring_t *ring, const void *buf, size_t len);
+int shm_ring_send(shm_ring_t *ring, const void *buf, size_t len);
+
+/*
+ * Take one record. Returns the payload length. try_recv returns -1/EAGAIN
+ * when empty; recv sleeps on the futex until data arrives and returns 0
+ * once the ring is shut down and drained. -1/EMSGSIZE if buflen is too
+ * small (the record stays in the ring).
+ */
+ssize_t shm_ring_try_recv(shm_ring_t *ring, void *buf, size_t buflen);
+ssize_t shm_ring_recv(shm_ring_t *ring, void *buf, size_t buflen);
+
+/* Mark the ring finished and wake every sleeping consumer */
+void shm_ring_shutdown(shm_ring_t *ring);
+
+#endif /* SHM_RING_H */
@@ -0,0 +1,308 @@
+/*
+ * shm_seg.c - Shared memory segments with huge pages and NUMA placement
+ *
+ * See shm_seg.h for the API.
+ *
+ * Order matters when mapping: a page's size and NUMA node are decided
+ * when it is first faulted in. MADV_HUGEPAGE and mbind() therefore have to
+ * come before the pages are touched, which rules out MAP_POPULATE when
+ * either is used. In that case the segment is pre-faulted afterwards with
+ * MADV_POPULATE_WRITE (Linux 5.14+), or by touching one byte per page.
+ */
+
+#define _GNU_SOURCE
+
+#include "shm_seg.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/mempolicy.h>
+#include <mntent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+#define THP_SIZE_FILE "/sys/kernel/mm/transparent_hugepage/hpage_pmd_size"
+#define MAX_NODES 1024
+
+const char *shm_pages_name(shm_pages_t pages) {
+  switch (pages) {
+  case SHM_PAGES_SMALL:
+    return "small";
+  case SHM_PAGES_THP:
+    return "thp";
+  case SHM_PAGES_HUGETLB:
+    return "hugetlb";
+  }
+  return "?";
+}
+
+/* First mounted hugetlbfs, e.g. /dev/hugepages */
+static int hugetlbfs_path(const char *name, char *path, size_t len) {
+  FILE *f = setmntent("/proc/mounts", "r");
+  struct mntent *m;
+  int found = 0;
+
+  if (!f)
+    return -1;
+  while (!found && (m = getmntent(f)) != NULL) {
+    if (strcmp(m->mnt_type, "hugetlbfs") == 0) {
+      snprintf(path, len, "%s/%s", m->mnt_dir,
+               name[0] == '/' ? name + 1 : name);
+      found = 1;
+    }
+  }
+  endmntent(f);
+  if (!found)
+    errno = ENOTSUP; /* Nowhere to put a named hugetlb segment */
+  return found ? 0 : -1;
+}
+
+static int open_backing(const char *name, shm_pages_t pages, int flags) {
+  if (!name)
+    return memfd_create("shm_seg",
+                        pages == SHM_PAGES_HUGETLB ? MFD_CLOEXEC | MFD_HUGETLB
+                                                   : MFD_CLOEXEC);
+  if (pages != SHM_PAGES_HUGETLB)
+    return shm_open(name, flags, 0666);
+
+  char path[512];
+  if (hugetlbfs_path(name, path, sizeof(path)) == -1)
+    return -1;
+  return open(path, flags | O_CLOEXEC, 0666);
+}
+
+static size_t page_size_for(int fd, shm_pages_t pages) {
+  size_t size = 0;
+
+  if (pages == SHM_PAGES_HUGETLB) {
+    /* hugetlbfs and hugetlb memfds report their page size as f_bsize */
+    struct statfs sfs;
+    if (fstatfs(fd, &sfs) == 0)
+      size = sfs.f_bsize;
+  } else if (pages == SHM_PAGES_THP) {
+    FILE *f = fopen(THP_SIZE_FILE, "r");
+    if (f) {
+      if (fscanf(f, "%zu", &size) != 1)
+        size = 0;
+      fclose(f);
+    }
+    if (size == 0)
+      size = 2 * 1024 * 1024;
+  }
+  return size ? size : (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/*
+ * A huge page can only back a huge-page-aligned virtual range. hugetlb
+ * mappings are aligned by the kernel; for THP reserve a larger range and
+ * place the segment on an aligned address inside it.
+ */
+static void *map_aligned(size_t size, size_t align, int prot, int flags,
+                         int fd) {
+  if (align <= (size_t)sysconf(_SC_PAGESIZE))
+    return mmap(NULL, size, prot, flags, fd, 0);
+
+  unsigned char *area =
+      mmap(NULL, size + align, PROT_NONE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (area == MAP_FAILED)
+    return MAP_FAILED;
+  uintptr_t start = ((uintptr_t)area + align - 1) & ~(uintptr_t)(align - 1);
+  void *addr = mmap((void *)start, size, prot, flags | MAP_FIXED, fd, 0);
+  if (addr == MAP_FAILED) {
+    munmap(area, size + align);
+    return MAP_FAILED;
+  }
+  if (start > (uintptr_t)area)
+    munmap(area, start - (uintptr_t)area);
+  munmap((void *)(start + size), (uintptr_t)area + align - start);
+  return addr;
+}
+
+static int bind_node(void *addr, size_t size, int node) {
+  unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+  const unsigned bits = 8 * sizeof(unsigned long);
+
+  if (node < 0 || node >= MAX_NODES) {
+    errno = EINVAL;
+    return -1;
+  }
+  mask[node / bits] |= 1UL << (node % bits);
+  /* glibc has no wrapper (that lives in libnuma); maxnode counts one extra */
+  return (int)syscall(SYS_mbind, addr, size, MPOL_BIND, mask, MAX_NODES + 1,
+                      MPOL_MF_STRICT);
+}
+
+static void prefault(void *addr, size_t size, size_t page_size) {
+  if (madvise(addr, size, MADV_POPULATE_WRITE) == 0)
+    return;
+  /* Older kernel: one write per page. The segment is new, so zero is safe */
+  for (size_t off = 0; off < size; off += page_size)
+    ((volatile unsigned char *)addr)[off] = 0;
+}
+
+int shm_seg_create(shm_seg_t *seg, const char *name, size_t size,
+                   const shm_seg_opts_t *opts) {
+  static const shm_seg_opts_t defaults = {SHM_PAGES_SMALL, -1, 0};
+  int saved;
+
+  if (!opts)
+    opts = &defaults;
+
+  memset(seg, 0, sizeof(*seg));
+  seg->pages = opts->pages;
+  seg->fd = open_backing(name, opts->pages, O_CREAT | O_RDWR | O_TRUNC);
+  if (seg->fd == -1)
+    return -1;
+
+  seg->page_size = page_size_for(seg->fd, opts->pages);
+  seg->size = (size + seg->page_size - 1) & ~(seg->page_size - 1);
+  if (seg->size == 0)
+    seg->size = seg->page_size;
+
+  /* MAP_POPULATE would fault pages in before madvise/mbind could act */
+  int late_policy = opts->pages == SHM_PAGES_THP || opts->numa_node >= 0;
+  int flags = MAP_SHARED | (opts->populate && !late_policy ? MAP_POPULATE : 0);
+
+  if (ftruncate(seg->fd, seg->size) == -1)
+    goto fail;
+  seg->addr = map_aligned(seg->size, seg->page_size, PROT_READ | PROT_WRITE,
+                          flags, seg->fd);
+  if (seg->addr == MAP_FAILED) {
+    seg->addr = NULL;
+    goto fail;
+  }
+  if (opts->pages == SHM_PAGES_THP &&
+      madvise(seg->addr, seg->size, MADV_HUGEPAGE) == -1)
+    goto fail;
+  if (opts->numa_node >= 0 &&
+      bind_node(seg->addr, seg->size, opts->numa_node) == -1)
+    goto fail;
+  if (opts->populate && late_policy)
+    prefault(seg->addr, seg->size, seg->page_size);
+  return 0;
+
+fail:
+  saved = errno;
+  shm_seg_close(seg);
+  if (name)
+    shm_seg_unlink(name, opts->pages);
+  errno = saved;
+  return -1;
+}
+
+int shm_seg_open(shm_seg_t *seg, const char *name, shm_pages_t pages,
+                 int writable) {
+  struct stat sb;
+  int saved;
+
+  memset(seg, 0, sizeof(*seg));
+  seg->pages = pages;
+  seg->fd = open_backing(name, pages, writable ? O_RDWR : O_RDONLY);
+  if (seg->fd == -1)
+    return -1;
+  if (fstat(seg->fd, &sb) == -1)
+    goto fail;
+
+  seg->page_size = page_size_for(seg->fd, pages);
+  seg->size = sb.st_size;
+  seg->addr =
+      map_aligned(seg->size, seg->page_size,
+                  writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+                  seg->fd);
+  if (seg->addr == MAP_FAILED) {
+    seg->addr = NULL;
+    goto fail;
+  }
+  /* A THP segment's existing huge pages are mapped huge only if advised */
+  if (pages == SHM_PAGES_THP)
+    madvise(seg->addr, seg->size, MADV_HUGEPAGE);
+  return 0;
+
+fail:
+  saved = errno;
+  shm_seg_close(seg);
+  errno = saved;
+  return -1;
+}
+
+void shm_seg_close(shm_seg_t *seg) {
+  if (seg->addr)
+    munmap(seg->addr, seg->size);
+  if (seg->fd >= 0)
+    close(seg->fd);
+  seg->addr = NULL;
+  seg->fd = -1;
+}
+
+int shm_seg_unlink(const char *name, shm_pages_t pages) {
+  if (pages != SHM_PAGES_HUGETLB)
+    return shm_unlink(name);
+
+  char path[512];
+  if (hugetlbfs_path(name, path, sizeof(path)) == -1)
+    return -1;
+  return unlink(path);
+}
+
+int shm_seg_stats(const shm_seg_t *seg, shm_seg_stats_t *st) {
+  FILE *f = fopen("/proc/self/smaps", "r");
+  char line[256];
+  int in_seg = 0, found = 0;
+
+  memset(st, 0, sizeof(*st));
+  st->node = -1;
+  if (!f)
+    return -1;
+
+  while (fgets(line, sizeof(line), f)) {
+    unsigned long start, end;
+    size_t kb;
+
+    /* Mapping headers look like "7f12a0000000-7f12a4000000 rw-s ..." */
+    if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+      if (found && in_seg)
+        break;
+      in_seg = start == (unsigned long)seg->addr;
+      found |= in_seg;
+      continue;
+    }
+    if (!in_seg)
+      continue;
+    if (sscanf(line, "Rss: %zu kB", &kb) == 1) {
+      st->rss += kb * 1024;
+    } else if (sscanf(line, "ShmemPmdMapped: %zu kB", &kb) == 1 ||
+               sscanf(line, "FilePmdMapped: %zu kB", &kb) == 1) {
+      st->huge_bytes += kb * 1024;
+    } else if (sscanf(line, "Shared_Hugetlb: %zu kB", &kb) == 1 ||
+               sscanf(line, "Private_Hugetlb: %zu kB", &kb) == 1) {
+      /* hugetlb pages are not counted in Rss */
+      st->rss += kb * 1024;
+      st->huge_bytes += kb * 1024;
+    }
+  }
+  fclose(f);
+  if (!found) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  /* Asking for the node of an absent page would fault it in: skip that */
+  if (st->rss > 0) {
+    int node;
+    if (syscall(SYS_get_mempolicy, &node, NULL, 0, seg->addr,
+                MPOL_F_NODE | MPOL_F_ADDR) == 0)
+      st->node = node;
+  }
+  return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * shm_seg.h - Shared memory segments with huge pages and NUMA placement
+ *
+ * 02_shared_memory.c maps its segment with default 4 KiB pages. For a
+ * multi-GB shared cache that means one TLB entry per 4 KiB: random
+ * accesses miss the TLB almost every time and pay for a page-table walk.
+ * A segment created here can instead be backed by:
+ *
+ *   SHM_PAGES_SMALL    - default pages (same as plain shm_open + mmap)
+ *   SHM_PAGES_THP      - transparent huge pages, requested with
+ *                        madvise(MADV_HUGEPAGE). Anonymous segments need
+ *                        "advise" (or "always") in
+ *                        /sys/kernel/mm/transparent_hugepage/shmem_enabled,
+ *                        named ones a /dev/shm mounted with huge=advise.
+ *                        Best effort: the kernel falls back to small pages.
+ *   SHM_PAGES_HUGETLB  - explicit huge pages from the hugetlb pool, sized
+ *                        with /proc/sys/vm/nr_hugepages. Guaranteed huge,
+ *                        and the pages are reserved when the segment is
+ *                        mapped, so a short pool fails early with ENOMEM.
+ *
+ * Named segments live in /dev/shm (small, THP) or in a mounted hugetlbfs
+ * (hugetlb, e.g. "mount -t hugetlbfs none /dev/hugepages"). Anonymous
+ * segments (name == NULL) are memfds, shared with children across fork()
+ * or with other processes by passing the fd.
+ *
+ * The NUMA policy (mbind) is set on the shared object before any page is
+ * faulted in, so it binds every process that maps the segment.
+ */
+
+#ifndef SHM_SEG_H
+#define SHM_SEG_H
+
+#include <stddef.h>
+
+typedef enum {
+  SHM_PAGES_SMALL = 0,
+  SHM_PAGES_THP = 1,
+  SHM_PAGES_HUGETLB = 2
+} shm_pages_t;
+
+typedef struct {
+  shm_pages_t pages;
+  int numa_node; /* Bind to this node, -1 for the default policy */
+  int populate;  /* Fault every page in now instead of on first touch */
+} shm_seg_opts_t;
+
+/* Per-process handle onto a segment */
+typedef struct {
+  void *addr;
+  size_t size;      /* Mapped bytes, a multiple of page_size */
+  size_t page_size; /* Page size the segment was sized for */
+  shm_pages_t pages;
+  int fd;
+} shm_seg_t;
+
+/*
+ * Create (or truncate) segment `name`, or an anonymous one if name is
+ * NULL, with at least `size` bytes mapped read-write. size is rounded up
+ * to the page size (2 MiB for THP and hugetlb on x86-64).
+ * Returns 0 on success, -1 with errno set on failure.
+ */
+int shm_seg_create(shm_seg_t *seg, const char *name, size_t size,
+                   const shm_seg_opts_t *opts);
+
+/* Map an existing named segment; `pages` selects where to look for it */
+int shm_seg_open(shm_seg_t *seg, const char *name, shm_pages_t pages,
+                 int writable);
+
+/* Unmap and close (does not remove a named segment) */
+void shm_seg_close(shm_seg_t *seg);
+
+/* Remove a named segment */
+int shm_seg_unlink(const char *name, shm_pages_t pages);
+
+/* What the kernel actually did, from /proc/self/smaps and get_mempolicy */
+typedef struct {
+  size_t rss;        /* Resident bytes of this mapping */
+  size_t huge_bytes; /* ...of which mapped with huge pages */
+  int node; /* NUMA node of the first page, -1 if unknown */
+} shm_seg_stats_t;
+
+int shm_seg_stats(const shm_seg_t *seg, shm_seg_stats_t *st);
+
+const char *shm_pages_name(shm_pages_t pages);
+
+#endif /* SHM_SEG_H */
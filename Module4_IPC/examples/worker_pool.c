@@ -0,0 +1,464 @@
+/*
+ * worker_pool.c - Preforked worker processes fed over socketpairs
+ *
+ * See worker_pool.h for the API.
+ *
+ * Wire format, both directions: a 16-byte header (payload length, status,
+ * task id) and the payload. A worker handles its tasks strictly in order,
+ * so the parent keeps a FIFO of the ids in flight per worker: that is the
+ * worker's load, and the list of tasks to report lost if it dies.
+ *
+ * The parent's ends of the sockets are non-blocking. When a worker's
+ * socket is full, the parent reads replies from every worker while it
+ * waits; otherwise a worker blocked writing a reply and a parent blocked
+ * writing a task would wait for each other forever.
+ */
+
+#define _GNU_SOURCE
+
+#include "worker_pool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WP_OK 0
+#define WP_FAILED 1
+#define RX_CAP (2 * (sizeof(struct wp_frame) + WP_MAX_MSG))
+
+struct wp_frame {
+  uint32_t len;
+  uint32_t status;
+  uint64_t id;
+};
+
+struct wp_worker {
+  pid_t pid;
+  int fd; /* Parent's end, -1 if the worker could not be respawned */
+  uint64_t *ids; /* Tasks in flight, oldest first (ring) */
+  unsigned ids_head, ids_count, ids_cap;
+  unsigned char *rx; /* Partial replies */
+  size_t rx_len;
+};
+
+struct wp_result {
+  struct wp_result *next;
+  uint64_t id;
+  int err;
+  size_t len;
+  unsigned char data[];
+};
+
+_Static_assert(sizeof(struct wp_frame) == 16, "frame header size");
+
+/* ------------------------------------------------------------------ */
+/* Worker side                                                          */
+/* ------------------------------------------------------------------ */
+
+/* Buffered reads: pipelined tasks arrive many per read() */
+typedef struct {
+  int fd;
+  unsigned char buf[RX_CAP];
+  size_t pos, len;
+} reader_t;
+
+static int read_exact(reader_t *r, void *dst, size_t want) {
+  unsigned char *out = dst;
+  while (want > 0) {
+    if (r->pos == r->len) {
+      ssize_t n = read(r->fd, r->buf, sizeof(r->buf));
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return -1;
+      r->pos = 0;
+      r->len = n;
+    }
+    size_t take = r->len - r->pos < want ? r->len - r->pos : want;
+    memcpy(out, r->buf + r->pos, take);
+    r->pos += take;
+    out += take;
+    want -= take;
+  }
+  return 0;
+}
+
+static int write_all(int fd, struct iovec *iov, int cnt) {
+  while (cnt > 0) {
+    ssize_t n = writev(fd, iov, cnt);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    while (cnt > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      cnt--;
+    }
+    if (cnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return 0;
+}
+
+static void worker_main(int fd, wp_handler_t handler, void *arg) {
+  static reader_t r;
+  static unsigned char task[WP_MAX_MSG], reply[WP_MAX_MSG];
+  struct wp_frame f;
+
+  r.fd = fd;
+  while (read_exact(&r, &f, sizeof(f)) == 0) {
+    if (f.len > WP_MAX_MSG || read_exact(&r, task, f.len) == -1)
+      break;
+
+    ssize_t n = handler(task, f.len, reply, arg);
+    struct wp_frame out = {.len = 0, .status = WP_FAILED, .id = f.id};
+    if (n >= 0 && n <= WP_MAX_MSG) {
+      out.len = n;
+      out.status = WP_OK;
+    }
+    struct iovec iov[2] = {{&out, sizeof(out)}, {reply, out.len}};
+    if (write_all(fd, iov, 2) == -1)
+      break;
+  }
+  _exit(0); /* Parent closed its end (or vanished) */
+}
+
+/* ------------------------------------------------------------------ */
+/* Parent side                                                          */
+/* ------------------------------------------------------------------ */
+
+static int spawn(wp_pool_t *pool, int i) {
+  struct wp_worker *w = &pool->workers[i];
+  int sv[2];
+
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
+    return -1;
+  pid_t pid = fork();
+  if (pid == -1) {
+    int saved = errno;
+    close(sv[0]);
+    close(sv[1]);
+    errno = saved;
+    return -1;
+  }
+
+  if (pid == 0) {
+    /* Holding other workers' sockets would hide their EOF from them */
+    for (int j = 0; j < pool->nworkers; j++) {
+      if (pool->workers[j].fd >= 0)
+        close(pool->workers[j].fd);
+    }
+    close(sv[0]);
+    worker_main(sv[1], pool->handler, pool->arg);
+  }
+
+  close(sv[1]);
+  fcntl(sv[0], F_SETFL, O_NONBLOCK);
+  w->pid = pid;
+  w->fd = sv[0];
+  w->ids_head = w->ids_count = 0;
+  w->rx_len = 0;
+  return 0;
+}
+
+static int push_result(wp_pool_t *pool, uint64_t id, int err,
+                       const void *data, size_t len) {
+  struct wp_result *res = malloc(sizeof(*res) + len);
+  if (!res)
+    return -1;
+  res->next = NULL;
+  res->id = id;
+  res->err = err;
+  res->len = len;
+  if (len > 0)
+    memcpy(res->data, data, len);
+  if (pool->done_tail)
+    pool->done_tail->next = res;
+  else
+    pool->done_head = res;
+  pool->done_tail = res;
+  return 0;
+}
+
+static uint64_t pop_id(struct wp_worker *w) {
+  uint64_t id = w->ids[w->ids_head];
+  w->ids_head = (w->ids_head + 1) % w->ids_cap;
+  w->ids_count--;
+  return id;
+}
+
+static int push_id(struct wp_worker *w, uint64_t id) {
+  if (w->ids_count == w->ids_cap) {
+    unsigned cap = w->ids_cap ? w->ids_cap * 2 : 64;
+    uint64_t *ids = malloc(cap * sizeof(*ids));
+    if (!ids)
+      return -1;
+    for (unsigned k = 0; k < w->ids_count; k++)
+      ids[k] = w->ids[(w->ids_head + k) % w->ids_cap];
+    free(w->ids);
+    w->ids = ids;
+    w->ids_cap = cap;
+    w->ids_head = 0;
+  }
+  w->ids[(w->ids_head + w->ids_count) % w->ids_cap] = id;
+  w->ids_count++;
+  return 0;
+}
+
+/* The worker is gone: report its tasks lost and put a new one in its place */
+static void replace_worker(wp_pool_t *pool, int i) {
+  struct wp_worker *w = &pool->workers[i];
+
+  close(w->fd);
+  w->fd = -1;
+  kill(w->pid, SIGKILL); /* In case it is only misbehaving */
+  waitpid(w->pid, NULL, 0);
+  while (w->ids_count > 0)
+    push_result(pool, pop_id(w), ECHILD, NULL, 0);
+
+  if (spawn(pool, i) == 0)
+    pool->respawns++;
+}
+
+/* Read whatever replies worker i has sent */
+static void collect(wp_pool_t *pool, int i) {
+  struct wp_worker *w = &pool->workers[i];
+
+  for (;;) {
+    ssize_t n = read(w->fd, w->rx + w->rx_len, RX_CAP - w->rx_len);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1 && errno == EAGAIN)
+      return;
+    if (n <= 0) {
+      replace_worker(pool, i); /* EOF: crashed or killed */
+      return;
+    }
+    w->rx_len += n;
+
+    size_t pos = 0;
+    struct wp_frame f;
+    while (w->rx_len - pos >= sizeof(f)) {
+      memcpy(&f, w->rx + pos, sizeof(f));
+      if (f.len > WP_MAX_MSG || w->ids_count == 0 ||
+          w->ids[w->ids_head] != f.id) {
+        replace_worker(pool, i); /* Out of sync: start over */
+        return;
+      }
+      if (w->rx_len - pos < sizeof(f) + f.len)
+        break;
+      pop_id(w);
+      push_result(pool, f.id, f.status == WP_OK ? 0 : EPROTO,
+                  w->rx + pos + sizeof(f), f.len);
+      pos += sizeof(f) + f.len;
+    }
+    memmove(w->rx, w->rx + pos, w->rx_len - pos);
+    w->rx_len -= pos;
+  }
+}
+
+/*
+ * Wait up to timeout_ms for replies from any worker, and for worker
+ * `writer` (if >= 0) to have room for more tasks. Returns poll()'s result.
+ */
+static int pump(wp_pool_t *pool, int writer, int timeout_ms) {
+  struct pollfd pfd[pool->nworkers];
+  for (int i = 0; i < pool->nworkers; i++) {
+    pfd[i].fd = pool->workers[i].fd;
+    pfd[i].events = POLLIN | (i == writer ? POLLOUT : 0);
+    pfd[i].revents = 0;
+  }
+
+  int n = poll(pfd, pool->nworkers, timeout_ms);
+  for (int i = 0; n > 0 && i < pool->nworkers; i++) {
+    if (pfd[i].revents & (POLLIN | POLLHUP | POLLERR))
+      collect(pool, i);
+  }
+  return n;
+}
+
+static int pick_worker(wp_pool_t *pool) {
+  int best = -1;
+  for (int k = 0; k < pool->nworkers; k++) {
+    int i = (pool->next + k) % pool->nworkers;
+    struct wp_worker *w = &pool->workers[i];
+    if (w->fd < 0)
+      continue;
+    if (pool->policy == WP_ROUND_ROBIN) {
+      best = i;
+      break;
+    }
+    if (best < 0 || w->ids_count < pool->workers[best].ids_count)
+      best = i;
+  }
+  if (best >= 0)
+    pool->next = best + 1;
+  return best;
+}
+
+int wp_start(wp_pool_t *pool, int nworkers, wp_policy_t policy,
+             wp_handler_t handler, void *arg) {
+  memset(pool, 0, sizeof(*pool));
+  if (nworkers < 1) {
+    errno = EINVAL;
+    return -1;
+  }
+  pool->workers = calloc(nworkers, sizeof(*pool->workers));
+  if (!pool->workers)
+    return -1;
+  pool->nworkers = nworkers;
+  pool->policy = policy;
+  pool->handler = handler;
+  pool->arg = arg;
+  pool->next_id = 1;
+  for (int i = 0; i < nworkers; i++)
+    pool->workers[i].fd = -1;
+
+  for (int i = 0; i < nworkers; i++) {
+    pool->workers[i].rx = malloc(RX_CAP);
+    if (!pool->workers[i].rx || spawn(pool, i) == -1) {
+      int saved = errno;
+      wp_stop(pool);
+      errno = saved;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void wp_stop(wp_pool_t *pool) {
+  /* EOF on its socket is a worker's signal to exit */
+  for (int i = 0; i < pool->nworkers; i++) {
+    if (pool->workers[i].fd >= 0)
+      close(pool->workers[i].fd);
+  }
+  for (int i = 0; i < pool->nworkers; i++) {
+    struct wp_worker *w = &pool->workers[i];
+    if (w->fd >= 0)
+      waitpid(w->pid, NULL, 0);
+    free(w->ids);
+    free(w->rx);
+  }
+  while (pool->done_head) {
+    struct wp_result *res = pool->done_head;
+    pool->done_head = res->next;
+    free(res);
+  }
+  free(pool->workers);
+  memset(pool, 0, sizeof(*pool));
+}
+
+int64_t wp_submit(wp_pool_t *pool, const void *task, size_t len) {
+  if (len > WP_MAX_MSG) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  uint64_t id = pool->next_id++;
+  for (;;) {
+    int i = pick_worker(pool);
+    if (i < 0) {
+      errno = EAGAIN; /* Every worker died and could not be replaced */
+      return -1;
+    }
+    struct wp_worker *w = &pool->workers[i];
+    struct wp_frame f = {.len = len, .status = WP_OK, .id = id};
+    struct iovec iov[2] = {{&f, sizeof(f)}, {(void *)task, len}};
+    int cnt = 2;
+    pid_t pid = w->pid;
+
+    while (cnt > 0 && w->pid == pid) {
+      struct msghdr msg = {.msg_iov = iov + 2 - cnt, .msg_iovlen = cnt};
+      ssize_t n = sendmsg(w->fd, &msg, MSG_NOSIGNAL);
+      if (n == -1 && errno == EAGAIN) {
+        pump(pool, i, -1); /* Full: drain replies until there is room */
+        continue;
+      }
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n == -1) {
+        replace_worker(pool, i); /* EPIPE: it died */
+        break;
+      }
+      while (cnt > 0 && (size_t)n >= iov[2 - cnt].iov_len) {
+        n -= iov[2 - cnt].iov_len;
+        cnt--;
+      }
+      if (cnt > 0) {
+        iov[2 - cnt].iov_base = (char *)iov[2 - cnt].iov_base + n;
+        iov[2 - cnt].iov_len -= n;
+      }
+    }
+    /* If the worker was replaced mid-frame, send it all again elsewhere */
+    if (cnt == 0 && w->pid == pid) {
+      if (push_id(w, id) == -1)
+        return -1;
+      return id;
+    }
+  }
+}
+
+unsigned wp_inflight(const wp_pool_t *pool) {
+  unsigned n = 0;
+  for (int i = 0; i < pool->nworkers; i++)
+    n += pool->workers[i].ids_count;
+  for (struct wp_result *res = pool->done_head; res; res = res->next)
+    n++;
+  return n;
+}
+
+static long now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+ssize_t wp_wait(wp_pool_t *pool, uint64_t *id, void *buf, size_t buflen,
+                int timeout_ms) {
+  long deadline = timeout_ms < 0 ? -1 : now_ms() + timeout_ms;
+
+  while (!pool->done_head) {
+    if (wp_inflight(pool) == 0) {
+      errno = ENOENT;
+      return -1;
+    }
+    int left = deadline < 0 ? -1 : (int)(deadline - now_ms());
+    if (deadline >= 0 && left < 0)
+      left = 0;
+    if (pump(pool, -1, left) == 0) {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+  }
+
+  struct wp_result *res = pool->done_head;
+  pool->done_head = res->next;
+  if (!pool->done_head)
+    pool->done_tail = NULL;
+
+  *id = res->id;
+  ssize_t ret = res->len;
+  if (res->err) {
+    errno = res->err;
+    ret = -1;
+  } else if (res->len > buflen) {
+    errno = EMSGSIZE;
+    ret = -1;
+  } else {
+    memcpy(buf, res->data, res->len);
+  }
+  free(res);
+  return ret;
+}
@@ -0,0 +1,88 @@
+/*
+ * worker_pool.h - Preforked worker processes fed over socketpairs
+ *
+ * Forking (or worse, fork + exec) a fresh child per task pays for page
+ * tables, copy-on-write faults, exec and dynamic linking every time. A pool
+ * forks N workers once; each then loops reading tasks from its end of a
+ * UNIX socketpair and writing the replies back.
+ *
+ *   parent                                   worker i
+ *   wp_submit() --[len|status|id|task]-->    read, run handler
+ *   wp_wait()   <--[len|status|id|reply]--   write reply
+ *
+ * Frames are length-prefixed, so tasks and replies can be pipelined: the
+ * parent may keep many tasks in flight per worker. Tasks go round-robin or
+ * to the worker with the fewest tasks in flight.
+ *
+ * A worker that dies (crash, kill -9) is noticed by EOF on its socket. It
+ * is reaped and replaced by a fresh one, and every task it still held is
+ * reported by wp_wait() as lost rather than silently dropped.
+ */
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define WP_MAX_MSG (64 * 1024) /* Largest task or reply payload */
+
+typedef enum { WP_ROUND_ROBIN = 0, WP_LEAST_LOADED = 1 } wp_policy_t;
+
+/*
+ * Runs in the worker: handle one task, write the reply into `reply` (room
+ * for WP_MAX_MSG bytes) and return its length, or -1 to report failure.
+ */
+typedef ssize_t (*wp_handler_t)(const void *task, size_t len, void *reply,
+                                void *arg);
+
+struct wp_worker; /* See worker_pool.c */
+
+struct wp_result; /* Finished, not yet collected */
+
+typedef struct {
+  struct wp_worker *workers;
+  int nworkers;
+  wp_policy_t policy;
+  wp_handler_t handler;
+  void *arg;
+  unsigned next;    /* Round-robin position */
+  uint64_t next_id; /* Task ids start at 1 */
+  struct wp_result *done_head, *done_tail;
+  unsigned long respawns;
+} wp_pool_t;
+
+/*
+ * Fork nworkers workers running handler(task, len, reply, arg).
+ * Returns 0 on success, -1 with errno set on failure.
+ */
+int wp_start(wp_pool_t *pool, int nworkers, wp_policy_t policy,
+             wp_handler_t handler, void *arg);
+
+/* Close every socket, let the workers exit and reap them */
+void wp_stop(wp_pool_t *pool);
+
+/*
+ * Queue a task. Returns its id (> 0), or -1 with errno set (EMSGSIZE).
+ * Blocks while the chosen worker's socket is full, collecting replies
+ * meanwhile so the two sides can never deadlock.
+ */
+int64_t wp_submit(wp_pool_t *pool, const void *task, size_t len);
+
+/*
+ * Collect one reply into buf. Returns its length and sets *id, or -1 with
+ * errno set and *id naming the task where there is one:
+ *   ECHILD     the worker died with the task; it has been replaced
+ *   EPROTO     the handler returned -1
+ *   EMSGSIZE   buflen too small, reply dropped
+ *   ETIMEDOUT  nothing arrived within timeout_ms (-1: wait forever)
+ *   ENOENT     no task is in flight
+ */
+ssize_t wp_wait(wp_pool_t *pool, uint64_t *id, void *buf, size_t buflen,
+                int timeout_ms);
+
+/* Tasks submitted and not yet collected */
+unsigned wp_inflight(const wp_pool_t *pool);
+
+#endif /* WORKER_POOL_H */
@@ -1,32 +1,127 @@
 /*
- * char_device.c - Simple character device
- * Creates /dev/mychardev that can be read/written
+ * char_device.c - Character device backed by an mmap-able ring buffer
+ * Creates /dev/mychardev: every write() appends one record, every read()
+ * returns the oldest records not read yet (cat-friendly: payloads only).
+ *
+ * Readers that want to go faster mmap the ring instead and consume the
+ * records in place: no read() call and no copy_to_user per record, only a
+ * poll() when the ring is empty. Layout and protocol: chardev_ring.h.
+ * Benchmark of both paths: ringbench.c.
  *
  * Build: make
- * Load: sudo insmod char_device.ko
+ * Load: sudo insmod char_device.ko [ring_pages=64]
  * Create device: sudo mknod /dev/mychardev c MAJOR 0
  * Test: echo "Hello" > /dev/mychardev
- *       cat /dev/mychardev
+ *       echo "World" > /dev/mychardev
+ *       cat /dev/mychardev        (blocks for more; Ctrl+C)
+ *       sudo ./ringbench
  * Unload: sudo rmmod char_device
+ *
+ * NOTE: this version has not been built with kbuild or loaded yet. Its
+ * ring logic was run in userspace against stand-ins for the kernel
+ * helpers: ringbench's three consumers, and a writer blocked in write()
+ * while an mmap consumer freed space and woke it with CHARDEV_IOC_WAKE.
+ * Until someone runs the steps above on a real kernel, treat it as
+ * untested on a live system, and its ringbench numbers as unmeasured.
  */
 
 #include <linux/cdev.h>
 #include <linux/fs.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/sched/signal.h>
 #include <linux/uaccess.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+
+#include "chardev_ring.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Your Name");
-MODULE_DESCRIPTION("Simple character device driver");
+MODULE_DESCRIPTION("Character device with an mmap-able ring buffer");
 
 #define DEVICE_NAME "mychardev"
-#define BUFFER_SIZE 1024
+
+static int ring_pages = 64; /* 256 KiB of records with 4 KiB pages */
+module_param(ring_pages, int, 0444);
+MODULE_PARM_DESC(ring_pages, "Data pages in the ring, a power of two");
 
 static int major_number;
-static char device_buffer[BUFFER_SIZE];
-static size_t buffer_len = 0;
+static void *ring_mem; /* Control page, then the data pages */
+static struct chardev_ring_ctrl *ctrl;
+static char *ring_data;
+static u64 data_size;
+static u32 max_record;
+/* The real head. ctrl->head is only a copy for mmap readers: the control
+ * page is writable from userspace, so nothing there is trusted. */
+static u64 head_pos;
+static u32 next_seq;
+
+static DEFINE_MUTEX(write_lock); /* One producer at a time */
+static DEFINE_MUTEX(read_lock);  /* One read() consumer at a time */
+static DECLARE_WAIT_QUEUE_HEAD(readq);  /* Waiting for records */
+static DECLARE_WAIT_QUEUE_HEAD(writeq); /* Waiting for space */
+
+static inline struct chardev_rec *rec_at(u64 pos) {
+  return (struct chardev_rec *)(ring_data + (pos & (data_size - 1)));
+}
+
+/*
+ * The tail has to live in the control page (mmap readers move it), so it
+ * is checked every time: a value outside [head - data_size, head] counts
+ * as "ring full" for the producer and as an error for read().
+ */
+static u64 used_bytes(u64 head, u64 tail) {
+  return head - tail <= data_size ? head - tail : data_size;
+}
+
+/* Bytes needed at head for a len-byte record, padding included; 0 if
+ * they are not free yet. poll() calls this without write_lock: tail is
+ * loaded first so the head read after it can never be behind it */
+static u64 room_for(u32 len, u64 *pad) {
+  u64 tail = smp_load_acquire(&ctrl->tail);
+  u64 head = READ_ONCE(head_pos);
+  u64 need = chardev_rec_size(len);
+  u64 to_end = data_size - (head & (data_size - 1));
+
+  *pad = need > to_end ? to_end : 0;
+  if (used_bytes(head, tail) + *pad + need > data_size)
+    return 0;
+  return *pad + need;
+}
+
+/* Publish the record written at head + pad; wakes readers */
+static void publish(u64 pad, u32 len) {
+  u64 head = head_pos;
+  struct chardev_rec *rec = rec_at(head + pad);
+
+  if (pad) {
+    struct chardev_rec *p = rec_at(head);
+    p->len = CHARDEV_REC_PAD;
+    p->seq = 0;
+  }
+  rec->len = len;
+  rec->seq = next_seq++;
+  /* Record first, then the head that makes it visible */
+  head += pad + chardev_rec_size(len);
+  smp_store_release(&head_pos, head);
+  smp_store_release(&ctrl->head, head);
+  wake_up_interruptible(&readq);
+}
+
+static int has_room(u32 len) {
+  u64 pad;
+  return room_for(len, &pad) != 0;
+}
+
+static int has_records(void) {
+  return smp_load_acquire(&head_pos) != READ_ONCE(ctrl->tail);
+}
 
 static int device_open(struct inode *inode, struct file *file) {
   printk(KERN_INFO "mychardev: Device opened\n");
@@ -38,35 +133,188 @@ static int device_release(struct inode *inode, struct file *file) {
   return 0;
 }
 
+/* Copy whole records' payloads out, as many as fit in count */
 static ssize_t device_read(struct file *file, char __user *user_buf,
                            size_t count, loff_t *offset) {
-  size_t to_read;
+  ssize_t done = 0;
+  u64 head, tail;
 
-  if (*offset >= buffer_len)
-    return 0;
+  if (mutex_lock_interruptible(&read_lock))
+    return -ERESTARTSYS;
 
-  to_read = min(count, buffer_len - (size_t)*offset);
+  while (!has_records()) {
+    mutex_unlock(&read_lock);
+    if (file->f_flags & O_NONBLOCK)
+      return -EAGAIN;
+    if (wait_event_interruptible(readq, has_records()))
+      return -ERESTARTSYS;
+    if (mutex_lock_interruptible(&read_lock))
+      return -ERESTARTSYS;
+  }
 
-  if (copy_to_user(user_buf, device_buffer + *offset, to_read))
-    return -EFAULT;
+  head = smp_load_acquire(&head_pos);
+  tail = READ_ONCE(ctrl->tail);
+  /* Someone scribbled on the tail: records start 8-byte aligned */
+  if (head - tail > data_size || (tail & 7)) {
+    done = -EIO;
+    goto out;
+  }
 
-  *offset += to_read;
-  printk(KERN_INFO "mychardev: Read %zu bytes\n", to_read);
+  while (tail != head) {
+    struct chardev_rec *rec = rec_at(tail);
+    u64 off = tail & (data_size - 1);
+    u32 len;
 
-  return to_read;
+    if (off + sizeof(*rec) > data_size) {
+      done = done ? done : -EIO;
+      break;
+    }
+    /*
+     * Load the length once. An mmap reader may move the tail past what we
+     * are walking, and the producer then reuses the space: every check and
+     * the copy below must agree on the same len, or the copy could run off
+     * the ring or past count.
+     */
+    len = READ_ONCE(rec->len);
+    if (len == CHARDEV_REC_PAD) {
+      tail += data_size - off;
+      continue;
+    }
+    if (off + chardev_rec_size(len) > data_size ||
+        tail + chardev_rec_size(len) > head) {
+      done = done ? done : -EIO; /* The tail is not on a record */
+      break;
+    }
+    if (len > count - done) {
+      if (done == 0)
+        done = -EMSGSIZE; /* Buffer smaller than the next record */
+      break;
+    }
+    if (copy_to_user(user_buf + done, rec + 1, len)) {
+      done = done ? done : -EFAULT;
+      break;
+    }
+    done += len;
+    tail += chardev_rec_size(len);
+  }
+  smp_store_release(&ctrl->tail, tail);
+  wake_up_interruptible(&writeq);
+out:
+  mutex_unlock(&read_lock);
+  return done;
 }
 
+/* Append the whole buffer as one record (no longer overwrites) */
 static ssize_t device_write(struct file *file, const char __user *user_buf,
                             size_t count, loff_t *offset) {
-  size_t to_write = min(count, (size_t)BUFFER_SIZE);
+  u64 pad;
+
+  if (count == 0)
+    return 0;
+  if (count > max_record)
+    return -EMSGSIZE;
+  if (mutex_lock_interruptible(&write_lock))
+    return -ERESTARTSYS;
 
-  if (copy_from_user(device_buffer, user_buf, to_write))
+  while (!room_for(count, &pad)) {
+    if (file->f_flags & O_NONBLOCK) {
+      mutex_unlock(&write_lock);
+      return -EAGAIN;
+    }
+    /* mmap readers free space without a syscall: ask for a wake-up,
+     * then look again in case they missed the flag */
+    WRITE_ONCE(ctrl->producer_waiting, 1);
+    smp_mb();
+    if (has_room(count))
+      break;
+    if (wait_event_interruptible(writeq, has_room(count))) {
+      mutex_unlock(&write_lock);
+      return -ERESTARTSYS;
+    }
+  }
+  WRITE_ONCE(ctrl->producer_waiting, 0);
+  room_for(count, &pad);
+
+  if (copy_from_user(rec_at(head_pos + pad) + 1, user_buf, count)) {
+    mutex_unlock(&write_lock); /* Nothing published, nothing to undo */
     return -EFAULT;
+  }
+  publish(pad, count);
+  mutex_unlock(&write_lock);
+  return count;
+}
+
+static long fill_records(struct chardev_fill __user *arg) {
+  struct chardev_fill f;
+  long n;
+
+  if (copy_from_user(&f, arg, sizeof(f)))
+    return -EFAULT;
+  if (f.size == 0 || f.size > max_record)
+    return -EINVAL;
+  if (mutex_lock_interruptible(&write_lock))
+    return -ERESTARTSYS;
+  for (n = 0; n < f.count; n++) {
+    u64 pad;
+    if (!room_for(f.size, &pad))
+      break;
+    memset(rec_at(head_pos + pad) + 1, next_seq & 0xff, f.size);
+    publish(pad, f.size);
+  }
+  mutex_unlock(&write_lock);
+  return n;
+}
+
+static long device_ioctl(struct file *file, unsigned int cmd,
+                         unsigned long arg) {
+  switch (cmd) {
+  case CHARDEV_IOC_FILL:
+    return fill_records((struct chardev_fill __user *)arg);
+  case CHARDEV_IOC_WAKE:
+    wake_up_interruptible(&writeq);
+    return 0;
+  default:
+    return -ENOTTY;
+  }
+}
 
-  buffer_len = to_write;
-  printk(KERN_INFO "mychardev: Wrote %zu bytes\n", to_write);
+static __poll_t device_poll(struct file *file, poll_table *wait) {
+  __poll_t mask = 0;
 
-  return to_write;
+  poll_wait(file, &readq, wait);
+  poll_wait(file, &writeq, wait);
+  if (has_records())
+    mask |= EPOLLIN | EPOLLRDNORM;
+  if (has_room(1))
+    mask |= EPOLLOUT | EPOLLWRNORM;
+  return mask;
+}
+
+/*
+ * Offset 0, one page: the control page, read-write.
+ * Offset PAGE_SIZE, data_size bytes: the records, read-only, so the
+ * lengths read() trusts can only ever come from this driver.
+ */
+static int device_mmap(struct file *file, struct vm_area_struct *vma) {
+  unsigned long len = vma->vm_end - vma->vm_start;
+
+  if (vma->vm_pgoff == 0) {
+    if (len != PAGE_SIZE)
+      return -EINVAL;
+  } else if (vma->vm_pgoff == 1) {
+    if (len != data_size)
+      return -EINVAL;
+    if (vma->vm_flags & VM_WRITE)
+      return -EPERM;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_clear(vma, VM_MAYWRITE);
+#else
+    vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+  } else {
+    return -EINVAL;
+  }
+  return remap_vmalloc_range(vma, ring_mem, vma->vm_pgoff);
 }
 
 static struct file_operations fops = {
@@ -75,18 +323,40 @@ static struct file_operations fops = {
     .release = device_release,
     .read = device_read,
     .write = device_write,
+    .poll = device_poll,
+    .unlocked_ioctl = device_ioctl,
+    .mmap = device_mmap,
 };
 
 static int __init chardev_init(void) {
+  if (ring_pages < 1 || (ring_pages & (ring_pages - 1))) {
+    printk(KERN_ALERT "mychardev: ring_pages must be a power of two\n");
+    return -EINVAL;
+  }
+  data_size = (u64)ring_pages * PAGE_SIZE;
+
+  /* Zeroed, and set up so remap_vmalloc_range() may map it */
+  ring_mem = vmalloc_user(PAGE_SIZE + data_size);
+  if (!ring_mem)
+    return -ENOMEM;
+  ctrl = ring_mem;
+  ring_data = (char *)ring_mem + PAGE_SIZE;
+  max_record = data_size / 4;
+  ctrl->data_size = data_size;
+  ctrl->max_record = max_record;
+  ctrl->magic = CHARDEV_RING_MAGIC;
+
   major_number = register_chrdev(0, DEVICE_NAME, &fops);
 
   if (major_number < 0) {
     printk(KERN_ALERT "mychardev: Failed to register\n");
+    vfree(ring_mem);
     return major_number;
   }
 
-  printk(KERN_INFO "mychardev: Registered with major number %d\n",
-         major_number);
+  printk(KERN_INFO "mychardev: Registered with major number %d, %llu KiB "
+                   "ring\n",
+         major_number, data_size / 1024);
   printk(KERN_INFO "Create device: mknod /dev/%s c %d 0\n", DEVICE_NAME,
          major_number);
 
@@ -94,7 +364,9 @@ static int __init chardev_init(void) {
 }
 
 static void __exit chardev_exit(void) {
+  /* No file can be open (or mapped) while the module is in use */
   unregister_chrdev(major_number, DEVICE_NAME);
+  vfree(ring_mem);
   printk(KERN_INFO "mychardev: Unregistered\n");
 }
 
@@ -0,0 +1,75 @@
+/*
+ * chardev_ring.h - Layout of the mychardev ring, shared by the driver
+ *                  (char_device.c) and userspace (ringbench.c)
+ *
+ * write() appends one record; readers take records in order, either with
+ * read() (one copy_to_user per record) or straight out of an mmap of the
+ * ring (no syscall, no copy):
+ *
+ *   mmap offset 0          control page, read-write:
+ *                            head  - bytes ever produced (driver writes)
+ *                            tail  - bytes ever consumed (reader writes)
+ *   mmap offset PAGE_SIZE  data pages, read-only: records
+ *
+ *   record: [ len | seq ][ payload, padded to 8 bytes ]
+ *
+ * head and tail only grow; position p lives at p % data_size. A record
+ * never wraps: when one does not fit before the end, the driver writes a
+ * padding record (len CHARDEV_REC_PAD) and starts again at offset 0.
+ *
+ * The driver publishes a record by storing head with release semantics
+ * after the record is written; a reader loads head with acquire, reads
+ * the records up to it in place, then stores tail (release) to give the
+ * space back. If ctrl->producer_waiting is set after that store (a full
+ * fence in between), a writer is asleep waiting for space and
+ * CHARDEV_IOC_WAKE wakes it.
+ *
+ * There is one tail, so one consumer at a time: read() callers take turns
+ * under a lock in the driver, but an mmap reader running alongside them
+ * would see records vanish from under it.
+ */
+
+#ifndef CHARDEV_RING_H
+#define CHARDEV_RING_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define CHARDEV_RING_MAGIC 0x52494e47 /* "RING" */
+#define CHARDEV_REC_PAD 0xffffffffu
+
+struct chardev_rec {
+  __u32 len; /* Payload bytes, or CHARDEV_REC_PAD */
+  __u32 seq; /* Counts records, for spotting gaps */
+};
+
+struct chardev_ring_ctrl {
+  __u32 magic;
+  __u32 data_size;  /* Bytes of record space, a power of two */
+  __u32 max_record; /* Largest payload one write() may carry */
+  __u32 pad0;
+  /* Producer side, on its own cache line */
+  __u64 head __attribute__((aligned(64)));
+  __u32 producer_waiting;
+  /* Consumer side */
+  __u64 tail __attribute__((aligned(64)));
+};
+
+static inline __u64 chardev_rec_size(__u32 len) {
+  return sizeof(struct chardev_rec) + (((__u64)len + 7) & ~(__u64)7);
+}
+
+/* CHARDEV_IOC_FILL: the driver appends up to count records of size bytes
+ * itself (payload bytes = seq & 0xff), stopping early when the ring is
+ * full. Returns how many it appended. Lets a benchmark time consumers
+ * without a userspace producer in the way. */
+struct chardev_fill {
+  __u32 count;
+  __u32 size;
+};
+
+#define CHARDEV_IOC_MAGIC 'k'
+#define CHARDEV_IOC_FILL _IOW(CHARDEV_IOC_MAGIC, 1, struct chardev_fill)
+#define CHARDEV_IOC_WAKE _IO(CHARDEV_IOC_MAGIC, 2) /* Space was freed */
+
+#endif /* CHARDEV_RING_H */
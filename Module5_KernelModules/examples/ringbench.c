@@ -0,0 +1,292 @@
+/*
+ * ringbench.c - read() vs mmap consumers of the mychardev ring
+ *
+ * The driver fills its ring with records itself (CHARDEV_IOC_FILL), then
+ * this program drains it three ways and times only the draining:
+ *
+ *   read/rec  one read() per record, the old char_device way
+ *   read/64K  read() into a 64 KiB buffer: many records per syscall, but
+ *             still one copy_to_user each
+ *   mmap      records read in place through the mapping; the only
+ *             syscalls left are the fills (and a poll() when empty)
+ *
+ * Every consumer sums every payload byte, so all three touch the same data.
+ *
+ * Compile: gcc -O2 -Wall -o ringbench ringbench.c   (or: make ringbench)
+ * Run: sudo ./ringbench [-n records] [-s 16,64,...] [-D /dev/mychardev]
+ *      sudo ./ringbench follow     # Print records as they are written
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chardev_ring.h"
+
+#define DEFAULT_DEVICE "/dev/mychardev"
+#define READ_BUF (64 * 1024)
+
+typedef struct {
+  int fd;
+  struct chardev_ring_ctrl *ctrl;
+  const unsigned char *data;
+  uint64_t size, mask;
+  long page;
+  uint32_t next_seq; /* mmap consumer: expected next */
+  int synced;
+  uint64_t bad;      /* Payload or sequence mismatches */
+  uint64_t syscalls; /* Made while draining */
+} ring_t;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int ring_open(ring_t *r, const char *path) {
+  memset(r, 0, sizeof(*r));
+  r->page = sysconf(_SC_PAGESIZE);
+  r->fd = open(path, O_RDWR | O_NONBLOCK);
+  if (r->fd == -1)
+    return -1;
+
+  /* Control page read-write, records read-only: see char_device.c */
+  r->ctrl = mmap(NULL, r->page, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+  if (r->ctrl == MAP_FAILED)
+    return -1;
+  if (r->ctrl->magic != CHARDEV_RING_MAGIC) {
+    errno = EINVAL;
+    return -1;
+  }
+  r->size = r->ctrl->data_size;
+  r->mask = r->size - 1;
+  r->data = mmap(NULL, r->size, PROT_READ, MAP_SHARED, r->fd, r->page);
+  if (r->data == MAP_FAILED)
+    return -1;
+  return 0;
+}
+
+static void ring_close(ring_t *r) {
+  munmap((void *)r->data, r->size);
+  munmap(r->ctrl, r->page);
+  close(r->fd);
+}
+
+static uint64_t sum_bytes(const unsigned char *p, size_t len) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < len; i++)
+    sum += p[i];
+  return sum;
+}
+
+/* Give consumed space back, and wake a writer if one is asleep */
+static void mmap_release(ring_t *r, uint64_t tail) {
+  __atomic_store_n(&r->ctrl->tail, tail, __ATOMIC_RELEASE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST); /* Store tail, then load flag */
+  if (__atomic_load_n(&r->ctrl->producer_waiting, __ATOMIC_RELAXED)) {
+    ioctl(r->fd, CHARDEV_IOC_WAKE);
+    r->syscalls++;
+  }
+}
+
+/*
+ * Consume every record published so far, in place. cb (if set) sees each
+ * payload; returns the number of records.
+ */
+static long mmap_drain(ring_t *r, uint64_t *sum,
+                       void (*cb)(const struct chardev_rec *, const void *)) {
+  uint64_t head = __atomic_load_n(&r->ctrl->head, __ATOMIC_ACQUIRE);
+  uint64_t tail = r->ctrl->tail; /* Only we move it */
+  long n = 0;
+
+  while (tail != head) {
+    const struct chardev_rec *rec =
+        (const void *)(r->data + (tail & r->mask));
+    if (rec->len == CHARDEV_REC_PAD) {
+      tail += r->size - (tail & r->mask);
+      continue;
+    }
+    const unsigned char *payload = (const unsigned char *)(rec + 1);
+    if (r->synced && rec->seq != r->next_seq)
+      r->bad++;
+    r->next_seq = rec->seq + 1;
+    r->synced = 1;
+    if (payload[0] != (rec->seq & 0xff) && !cb)
+      r->bad++;
+    if (sum)
+      *sum += sum_bytes(payload, rec->len);
+    if (cb)
+      cb(rec, payload);
+    tail += chardev_rec_size(rec->len);
+    n++;
+  }
+  mmap_release(r, tail);
+  return n;
+}
+
+/* Consume every record with read(); returns the number of records */
+static long read_drain(ring_t *r, char *buf, size_t bufsize, size_t recsize,
+                       uint64_t *sum) {
+  long n = 0;
+  for (;;) {
+    ssize_t got = read(r->fd, buf, bufsize);
+    r->syscalls++;
+    if (got <= 0)
+      break; /* EAGAIN: empty */
+    *sum += sum_bytes((const unsigned char *)buf, got);
+    n += got / recsize;
+  }
+  return n;
+}
+
+static long fill(ring_t *r, long count, uint32_t size) {
+  struct chardev_fill f = {.count = count, .size = size};
+  return ioctl(r->fd, CHARDEV_IOC_FILL, &f);
+}
+
+static int bench(ring_t *r, uint32_t size, long records) {
+  const char *names[] = {"read/rec", "read/64K", "mmap"};
+  char *buf = malloc(READ_BUF);
+  int failed = 0;
+
+  for (int mode = 0; mode < 3; mode++) {
+    uint64_t sum = 0;
+    double busy = 0;
+    long done = 0, got = 0;
+    r->syscalls = 0;
+    r->bad = 0;
+    r->synced = 0;
+
+    while (done < records) {
+      long n = fill(r, records - done, size);
+      if (n <= 0) {
+        perror("CHARDEV_IOC_FILL");
+        free(buf);
+        return 1;
+      }
+      double t0 = now_sec();
+      if (mode == 2)
+        got += mmap_drain(r, &sum, NULL);
+      else
+        got += read_drain(r, buf, mode == 0 ? size : READ_BUF, size, &sum);
+      busy += now_sec() - t0;
+      done += n;
+    }
+
+    int ok = got == records && r->bad == 0;
+    failed |= !ok;
+    printf("%-9s %7u %9.2f %9.1f %8.1f %10.3f  %s\n", names[mode], size,
+           records / busy / 1e6, (double)records * size / busy / 1e6,
+           busy * 1e9 / records, (double)r->syscalls / records,
+           ok ? "ok" : "MISMATCH");
+    fflush(stdout);
+  }
+  free(buf);
+  return failed;
+}
+
+static void print_record(const struct chardev_rec *rec, const void *p) {
+  printf("[%u] %.*s", rec->seq, (int)rec->len, (const char *)p);
+  if (rec->len == 0 || ((const char *)p)[rec->len - 1] != '\n')
+    printf("\n");
+}
+
+/* Like cat, but through the mapping: poll() only when the ring is empty */
+static int follow(ring_t *r) {
+  printf("Following the ring (%lu KiB); write to the device, Ctrl+C to "
+         "stop\n",
+         (unsigned long)(r->size / 1024));
+  fflush(stdout);
+  for (;;) {
+    if (mmap_drain(r, NULL, print_record) > 0) {
+      fflush(stdout);
+      continue;
+    }
+    struct pollfd pfd = {.fd = r->fd, .events = POLLIN};
+    if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+      perror("poll");
+      return 1;
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const char *device = DEFAULT_DEVICE;
+  long records = 2000000, sizes[16] = {16, 64, 512, 4096};
+  int nsizes = 4, opt;
+
+  while ((opt = getopt(argc, argv, "n:s:D:")) != -1) {
+    switch (opt) {
+    case 'n':
+      records = atol(optarg);
+      break;
+    case 's': {
+      nsizes = 0;
+      char *save = NULL;
+      for (char *tok = strtok_r(optarg, ",", &save); tok && nsizes < 16;
+           tok = strtok_r(NULL, ",", &save))
+        sizes[nsizes++] = atol(tok);
+      break;
+    }
+    case 'D':
+      device = optarg;
+      break;
+    default:
+      printf("Usage: %s [-n records] [-s sizes] [-D device] [follow]\n",
+             argv[0]);
+      return 1;
+    }
+  }
+
+  ring_t r;
+  if (ring_open(&r, device) == -1) {
+    perror(device);
+    printf("Load the module and create the device first (see "
+           "char_device.c)\n");
+    return 1;
+  }
+
+  if (optind < argc && strcmp(argv[optind], "follow") == 0)
+    return follow(&r);
+
+  /* Start from an empty ring: throw away whatever earlier writes left */
+  mmap_drain(&r, NULL, NULL);
+
+  printf("=== %ld records per run, %lu KiB ring, draining time only ===\n",
+         records, (unsigned long)(r.size / 1024));
+  printf("%-9s %7s %9s %9s %8s %10s\n", "consumer", "size", "Mrec/s",
+         "MB/s", "ns/rec", "syscall/rec");
+  int failed = 0;
+  for (int i = 0; i < nsizes; i++) {
+    if (sizes[i] < 1 || sizes[i] > r.ctrl->max_record) {
+      printf("Record size must be 1-%u\n", r.ctrl->max_record);
+      failed = 1;
+      continue;
+    }
+    failed |= bench(&r, sizes[i], records);
+  }
+  ring_close(&r);
+  return failed;
+}
+
+/*
+ * TRY THIS:
+ *
+ * sudo ./ringbench                  # The three consumers, 16 B to 4 KiB
+ * sudo ./ringbench -s 8 -n 10000000 # Tiny records: syscalls dominate
+ * sudo ./ringbench follow &         # Then: echo hi | sudo tee /dev/mychardev
+ *
+ * Load the module with ring_pages=1024 (4 MiB) and compare again: fewer
+ * fills per run, and the mmap consumer runs longer without a syscall.
+ */